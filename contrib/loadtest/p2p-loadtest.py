@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The CaritasCoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#
+# Open many fake peers to a local node and measure ping latency and the node's CPU use.
+#
+# Each peer completes the version handshake and then sends a ping at a fixed interval, timing
+# the pong. All peers run in a single thread on a selector, so the harness itself stays cheap
+# next to the node it measures.
+#
+
+import argparse
+import hashlib
+import os
+import random
+import selectors
+import socket
+import struct
+import sys
+import time
+
+NETWORKS = {
+    'main':    (bytes([0x16, 0x2f, 0xb3, 0xa4]), 16180),
+    'test':    (bytes([0x74, 0x2b, 0x33, 0xad]), 16170),
+    'regtest': (bytes([0x1d, 0x3f, 0xad, 0xc4]), 51476),
+}
+
+PROTOCOL_VERSION = 70926
+NODE_NETWORK = 1
+
+
+def sha256d(data):
+    return hashlib.sha256(hashlib.sha256(data).digest()).digest()
+
+
+def ser_string(s):
+    assert len(s) < 253
+    return bytes([len(s)]) + s
+
+
+def ser_addr(host, port):
+    ip = b'\x00' * 10 + b'\xff\xff' + socket.inet_aton(host)
+    return struct.pack('<Q', NODE_NETWORK) + ip + struct.pack('>H', port)
+
+
+def message(magic, command, payload):
+    return (magic + command.encode('ascii').ljust(12, b'\x00') +
+            struct.pack('<I', len(payload)) + sha256d(payload)[:4] + payload)
+
+
+def version_payload(host, port):
+    return (struct.pack('<iQq', PROTOCOL_VERSION, NODE_NETWORK, int(time.time())) +
+            ser_addr(host, port) + ser_addr('127.0.0.1', 0) +
+            struct.pack('<Q', random.getrandbits(64)) +
+            ser_string(b'/p2p-loadtest:0.1/') + struct.pack('<i', 0) + b'\x01')
+
+
+class Peer(object):
+    def __init__(self, harness, index):
+        self.harness = harness
+        self.index = index
+        self.sock = None
+        self.recvbuf = b''
+        self.sendbuf = b''
+        self.connected = False
+        self.ready = False
+        self.ping_nonce = None
+        self.ping_sent = 0.0
+        self.next_ping = 0.0
+
+    def connect(self):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.setblocking(False)
+        self.sock.connect_ex((self.harness.host, self.harness.port))
+        self.send('version', version_payload(self.harness.host, self.harness.port))
+        self.harness.sel.register(self.sock, selectors.EVENT_READ | selectors.EVENT_WRITE, self)
+
+    def close(self, reason):
+        if self.sock is None:
+            return
+        self.harness.log('peer %d closed: %s' % (self.index, reason))
+        self.harness.sel.unregister(self.sock)
+        self.sock.close()
+        self.sock = None
+        self.harness.disconnects += 1
+
+    def send(self, command, payload=b''):
+        self.sendbuf += message(self.harness.magic, command, payload)
+
+    def on_writable(self):
+        if not self.sendbuf:
+            return
+        try:
+            n = self.sock.send(self.sendbuf)
+        except (BlockingIOError, InterruptedError):
+            return
+        except OSError as e:
+            self.close(str(e))
+            return
+        self.sendbuf = self.sendbuf[n:]
+
+    def on_readable(self):
+        try:
+            data = self.sock.recv(65536)
+        except (BlockingIOError, InterruptedError):
+            return
+        except OSError as e:
+            self.close(str(e))
+            return
+        if not data:
+            self.close('connection closed by node')
+            return
+        self.recvbuf += data
+        while len(self.recvbuf) >= 24:
+            length = struct.unpack('<I', self.recvbuf[16:20])[0]
+            if len(self.recvbuf) < 24 + length:
+                break
+            command = self.recvbuf[4:16].rstrip(b'\x00').decode('ascii', 'replace')
+            payload = self.recvbuf[24:24 + length]
+            self.recvbuf = self.recvbuf[24 + length:]
+            self.on_message(command, payload)
+
+    def on_message(self, command, payload):
+        if command == 'version':
+            self.send('verack')
+        elif command == 'verack':
+            self.ready = True
+            self.next_ping = time.time() + random.uniform(0, self.harness.interval)
+            self.harness.handshakes += 1
+        elif command == 'ping':
+            self.send('pong', payload[:8])
+        elif command == 'pong' and self.ping_nonce is not None:
+            if struct.unpack('<Q', payload[:8])[0] == self.ping_nonce:
+                self.harness.latencies.append(time.time() - self.ping_sent)
+                self.ping_nonce = None
+
+    def tick(self, now):
+        if self.ready and self.ping_nonce is None and now >= self.next_ping:
+            self.ping_nonce = random.getrandbits(64)
+            self.ping_sent = now
+            self.next_ping = now + self.harness.interval
+            self.send('ping', struct.pack('<Q', self.ping_nonce))
+
+
+def cpu_seconds(pid):
+    """User plus system CPU time of a process, from /proc"""
+    with open('/proc/%d/stat' % pid) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / float(os.sysconf('SC_CLK_TCK'))
+
+
+def percentile(values, p):
+    if not values:
+        return float('nan')
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+
+class Harness(object):
+    def __init__(self, args):
+        self.magic, default_port = NETWORKS[args.network]
+        self.host = args.host
+        self.port = args.port or default_port
+        self.interval = args.interval
+        self.verbose = args.verbose
+        self.sel = selectors.DefaultSelector()
+        self.latencies = []
+        self.handshakes = 0
+        self.disconnects = 0
+
+    def log(self, msg):
+        if self.verbose:
+            print(msg, file=sys.stderr)
+
+    def run(self, npeers, duration, rampup, pid):
+        peers = [Peer(self, i) for i in range(npeers)]
+        start = time.time()
+        connect_at = [start + rampup * i / max(npeers, 1) for i in range(npeers)]
+        nconnected = 0
+        cpu_start = None
+        measure_start = None
+
+        while True:
+            now = time.time()
+            while nconnected < npeers and connect_at[nconnected] <= now:
+                peers[nconnected].connect()
+                nconnected += 1
+
+            # measure once all peers are connected
+            if measure_start is None and nconnected == npeers:
+                measure_start = now
+                self.latencies = []
+                if pid:
+                    cpu_start = cpu_seconds(pid)
+            if measure_start is not None and now - measure_start >= duration:
+                break
+
+            for peer in peers:
+                if peer.sock is not None:
+                    peer.tick(now)
+            for key, mask in self.sel.select(timeout=0.01):
+                peer = key.data
+                if mask & selectors.EVENT_READ:
+                    peer.on_readable()
+                if peer.sock is not None and mask & selectors.EVENT_WRITE:
+                    peer.on_writable()
+
+        elapsed = time.time() - measure_start
+        print('peers:       %d (%d handshakes, %d disconnects)' % (npeers, self.handshakes, self.disconnects))
+        print('pings:       %d in %.1fs' % (len(self.latencies), elapsed))
+        ms = [l * 1000.0 for l in self.latencies]
+        print('latency ms:  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f' % (
+            percentile(ms, 50), percentile(ms, 90), percentile(ms, 99), max(ms) if ms else float('nan')))
+        if pid:
+            cpu = cpu_seconds(pid) - cpu_start
+            print('node cpu:    %.2fs (%.1f%% of one core)' % (cpu, 100.0 * cpu / elapsed))
+
+        for peer in peers:
+            if peer.sock is not None:
+                self.sel.unregister(peer.sock)
+                peer.sock.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Open many fake peers to a local node and measure latency and CPU.')
+    parser.add_argument('--network', choices=sorted(NETWORKS.keys()), default='regtest')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=0, help='node p2p port (default: the network default)')
+    parser.add_argument('--peers', type=int, default=200, help='number of fake peers (default: 200)')
+    parser.add_argument('--duration', type=float, default=30.0, help='seconds to measure once all peers are connected (default: 30)')
+    parser.add_argument('--rampup', type=float, default=5.0, help='seconds over which the peers connect (default: 5)')
+    parser.add_argument('--interval', type=float, default=1.0, help='seconds between the pings of a peer (default: 1)')
+    parser.add_argument('--pid', type=int, default=0, help='pid of the node, to report its CPU use')
+    parser.add_argument('--verbose', action='store_true')
+    args = parser.parse_args()
+
+    Harness(args).run(args.peers, args.duration, args.rampup, args.pid)
+
+
+if __name__ == '__main__':
+    main()
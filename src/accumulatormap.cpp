@@ -72,6 +72,14 @@ CBigNum AccumulatorMap::GetValue(CoinDenomination denom)
     return mapAccumulators.at(denom)->getValue();
 }
 
+//Set the value of a specific accumulator
+void AccumulatorMap::SetValue(CoinDenomination denom, const CBigNum& bnValue)
+{
+    if (denom == CoinDenomination::ZQ_ERROR)
+        return;
+    mapAccumulators.at(denom)->setValue(bnValue);
+}
+
 //Calculate a 32bit checksum of each accumulator value. Concatenate checksums into uint256
 uint256 AccumulatorMap::GetCheckpoint()
 {
@@ -9,12 +9,16 @@
 #include "txdb.h"
 #include "init.h"
 #include "spork.h"
+#include "util.h"
 
 using namespace libzerocoin;
 
 std::map<uint32_t, CBigNum> mapAccumulatorValues;
 std::list<uint256> listAccCheckpointsNoDB;
 
+//! Recently connected blocks' mint journals, the rest are read back from the zerocoin database (protected by cs_main)
+std::map<int, CMintJournalEntry> mapMintJournal;
+
 uint32_t ParseChecksum(uint256 nChecksum, CoinDenomination denomination)
 {
     //shift to the beginning bit of this denomination and trim any remaining bits by returning 32 bits only
@@ -151,8 +155,215 @@ bool EraseCheckpoints(int nStartHeight, int nEndHeight)
     return true;
 }
 
+//! Number of mint journal entries kept in memory
+static const int MINT_JOURNAL_MEMORY_DEPTH = 100;
+//! Number of mint journal entries kept in the zerocoin database
+static const int MINT_JOURNAL_DB_DEPTH = 1000;
+
+bool WriteMintJournal(const CBlockIndex* pindex, const std::list<CZerocoinMint>& listMints)
+{
+    CMintJournalEntry entry(pindex->GetBlockHash());
+    for (const CZerocoinMint& mint : listMints)
+        entry.AddMint(mint.GetDenomination(), mint.GetValue());
+
+    mapMintJournal[pindex->nHeight] = entry;
+    mapMintJournal.erase(mapMintJournal.begin(), mapMintJournal.lower_bound(pindex->nHeight - MINT_JOURNAL_MEMORY_DEPTH));
+
+    zerocoinDB->EraseMintJournal(pindex->nHeight - MINT_JOURNAL_DB_DEPTH);
+    return zerocoinDB->WriteMintJournal(pindex->nHeight, entry);
+}
+
+bool EraseMintJournal(const CBlockIndex* pindex)
+{
+    mapMintJournal.erase(pindex->nHeight);
+    return zerocoinDB->EraseMintJournal(pindex->nHeight);
+}
+
+bool ReadMintJournal(const CBlockIndex* pindex, CMintJournalEntry& entry)
+{
+    auto it = mapMintJournal.find(pindex->nHeight);
+    if (it != mapMintJournal.end())
+        entry = it->second;
+    else if (!zerocoinDB->ReadMintJournal(pindex->nHeight, entry))
+        return false;
+
+    //the journal may still hold a block from a chain that was reorganized away
+    return entry.GetBlockHash() == pindex->GetBlockHash();
+}
+
+void CBlockPubcoinCache::Add(const CBlockIndex* pindex, bool fFilterInvalid, const std::list<PublicCoin>& listPubcoins)
+{
+    CEntry& entry = mapEntries[pindex->nHeight];
+    if (entry.hashBlock != pindex->GetBlockHash()) {
+        entry = CEntry();
+        entry.hashBlock = pindex->GetBlockHash();
+    }
+    if (fFilterInvalid) {
+        entry.listFiltered = listPubcoins;
+        entry.fHaveFiltered = true;
+    } else {
+        entry.listAll = listPubcoins;
+        entry.fHaveAll = true;
+    }
+}
+
+bool CBlockPubcoinCache::Get(const CBlockIndex* pindex, bool fFilterInvalid, std::list<PublicCoin>& listPubcoins) const
+{
+    std::map<int, CEntry>::const_iterator it = mapEntries.find(pindex->nHeight);
+    if (it == mapEntries.end() || it->second.hashBlock != pindex->GetBlockHash())
+        return false;
+    if (fFilterInvalid ? !it->second.fHaveFiltered : !it->second.fHaveAll)
+        return false;
+
+    const std::list<PublicCoin>& listCached = fFilterInvalid ? it->second.listFiltered : it->second.listAll;
+    listPubcoins.insert(listPubcoins.end(), listCached.begin(), listCached.end());
+    return true;
+}
+
+void CBlockPubcoinCache::Prune(int nHeight)
+{
+    mapEntries.erase(mapEntries.begin(), mapEntries.lower_bound(nHeight));
+}
+
+//Get the pubcoins of a block, from the cache or the mint journal if possible so that the block does not have to be read from disk
+bool GetBlockPubcoins(const CBlockIndex* pindex, bool fFilterInvalid, std::list<PublicCoin>& listPubcoins, const CBlockPubcoinCache* pcache)
+{
+    if (pcache && pcache->Get(pindex, fFilterInvalid, listPubcoins))
+        return true;
+
+    //journal entries are only written past the recalculation block, so they always hold the filtered list
+    CMintJournalEntry entry;
+    if (fFilterInvalid && pindex->nHeight > Params().Zerocoin_Block_RecalculateAccumulators() && ReadMintJournal(pindex, entry)) {
+        for (auto& mint : entry.GetMints())
+            listPubcoins.emplace_back(PublicCoin(Params().Zerocoin_Params(), mint.second, mint.first));
+        return true;
+    }
+
+    CBlock block;
+    if(!ReadBlockFromDisk(block, pindex)) {
+        LogPrint("zero","%s: failed to read block from disk\n", __func__);
+        return false;
+    }
+
+    return BlockToPubcoinList(block, listPubcoins, fFilterInvalid);
+}
+
+/**
+ * Accumulator values calculated by ThreadPrecomputeAccumulators() before the checkpoint block arrives.
+ * The checkpoint at height H accumulates the mints of blocks H-20 through H-11, which are all known
+ * once block H-10 is connected.
+ */
+struct CPrecomputedCheckpoint
+{
+    int nHeight;
+    uint256 nCheckpointBase; //! checkpoint of block H-10 that the accumulators start from
+    uint256 hashLastBlock; //! hash of block H-11, the last block accumulated
+    std::vector<CMintJournalEntry> vJournal;
+
+    bool fValid;
+    int nMintsFound;
+    std::map<CoinDenomination, CBigNum> mapValues;
+
+    CPrecomputedCheckpoint() : nHeight(-1), fValid(false), nMintsFound(0) {}
+};
+
+static boost::mutex csPrecompute;
+static boost::condition_variable condPrecompute;
+//! latest job posted while the thread was busy, it replaces any older one still waiting
+static CPrecomputedCheckpoint precomputePending;
+//! last finished job
+static CPrecomputedCheckpoint precomputed;
+
+void PrecomputeAccumulatorCheckpoint(const CBlockIndex* pindex)
+{
+    if (pindex->nHeight % 10 != 0)
+        return;
+
+    //only precompute where the journals hold the filtered mint lists
+    int nHeight = pindex->nHeight + 10;
+    if (nHeight - 20 <= Params().Zerocoin_Block_RecalculateAccumulators())
+        return;
+
+    CPrecomputedCheckpoint job;
+    job.nHeight = nHeight;
+    job.nCheckpointBase = pindex->nAccumulatorCheckpoint;
+    job.hashLastBlock = pindex->pprev->GetBlockHash();
+
+    const CBlockIndex* pindexJournal = pindex->pprev;
+    while (pindexJournal && pindexJournal->nHeight >= nHeight - 20) {
+        CMintJournalEntry entry;
+        if (!ReadMintJournal(pindexJournal, entry))
+            return;
+        job.vJournal.emplace_back(entry);
+        pindexJournal = pindexJournal->pprev;
+    }
+
+    boost::unique_lock<boost::mutex> lock(csPrecompute);
+    precomputePending = job;
+    condPrecompute.notify_all();
+}
+
+void ThreadPrecomputeAccumulators()
+{
+    RenameThread("caritas-accumulators");
+
+    while (true) {
+        CPrecomputedCheckpoint job;
+        {
+            boost::unique_lock<boost::mutex> lock(csPrecompute);
+            while (precomputePending.nHeight == -1)
+                condPrecompute.wait(lock);
+            job = precomputePending;
+            precomputePending = CPrecomputedCheckpoint();
+        }
+
+        AccumulatorMap mapAccumulators;
+        job.fValid = mapAccumulators.Load(job.nCheckpointBase);
+        if (!job.fValid && job.nCheckpointBase == 0) {
+            mapAccumulators.Reset();
+            job.fValid = true;
+        }
+
+        for (const CMintJournalEntry& entry : job.vJournal) {
+            for (auto& mint : entry.GetMints()) {
+                if (!job.fValid)
+                    break;
+                job.fValid = mapAccumulators.Accumulate(PublicCoin(Params().Zerocoin_Params(), mint.second, mint.first), true);
+                job.nMintsFound++;
+            }
+        }
+
+        for (auto& denom : zerocoinDenomList)
+            job.mapValues[denom] = mapAccumulators.GetValue(denom);
+
+        {
+            boost::unique_lock<boost::mutex> lock(csPrecompute);
+            job.vJournal.clear();
+            precomputed = job;
+        }
+        LogPrint("zero", "%s : precomputed accumulators for block %d\n", __func__, job.nHeight);
+    }
+}
+
+//Get the precomputed accumulators if they were calculated from the active chain. The caller holds cs_main,
+//so a calculation still in progress is not waited for; the accumulators are computed inline instead.
+static bool GetPrecomputedCheckpoint(int nHeight, AccumulatorMap& mapAccumulators, int& nMintsFound)
+{
+    uint256 hashLastBlock = chainActive[nHeight - 11]->GetBlockHash();
+    uint256 nCheckpointBase = chainActive[nHeight - 1]->nAccumulatorCheckpoint;
+
+    boost::unique_lock<boost::mutex> lock(csPrecompute);
+    if (precomputed.nHeight != nHeight || !precomputed.fValid || precomputed.hashLastBlock != hashLastBlock || precomputed.nCheckpointBase != nCheckpointBase)
+        return false;
+
+    for (auto& value : precomputed.mapValues)
+        mapAccumulators.SetValue(value.first, value.second);
+    nMintsFound = precomputed.nMintsFound;
+    return true;
+}
+
 //Get checkpoint value for a specific block height
-bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint)
+bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, const CBlockPubcoinCache* pcache)
 {
     if (nHeight < Params().Zerocoin_StartHeight()) {
         nCheckpoint = 0;
@@ -201,6 +412,10 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint)
         }
     }
 
+    //the mints may already have been accumulated in the background when block height - 10 was connected
+    if (nHeight != Params().Zerocoin_Block_RecalculateAccumulators() && GetPrecomputedCheckpoint(nHeight, mapAccumulators, nTotalMintsFound))
+        pindex = chainActive[nHeight - 10];
+
     while (pindex->nHeight < nHeight - 10) {
         // checking whether we should stop this process due to a shutdown request
         if (ShutdownRequested()) {
@@ -214,14 +429,8 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint)
         }
 
         //grab mints from this block
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex)) {
-            LogPrint("zero","%s: failed to read block from disk\n", __func__);
-            return false;
-        }
-
         std::list<PublicCoin> listPubcoins;
-        if (!BlockToPubcoinList(block, listPubcoins, fFilterInvalid)) {
+        if (!GetBlockPubcoins(pindex, fFilterInvalid, listPubcoins, pcache)) {
             LogPrint("zero","%s: failed to get zerocoin mintlist from block %n\n", __func__, pindex->nHeight);
             return false;
         }
@@ -258,18 +467,28 @@ bool InvalidCheckpointRange(int nHeight)
     return nHeight > Params().Zerocoin_Block_LastGoodCheckpoint() && nHeight < Params().Zerocoin_Block_RecalculateAccumulators();
 }
 
-bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError)
+bool IsZerocoinWitnessCurrent(const CZerocoinWitness& zerocoinWitness)
+{
+    if (zerocoinWitness.IsNull() || zerocoinWitness.nHeightAccEnd > chainActive.Height() + 1)
+        return false;
+
+    return chainActive[zerocoinWitness.nHeightAccEnd - 1]->GetBlockHash() == zerocoinWitness.hashAccEnd;
+}
+
+bool InitZerocoinWitness(CZerocoinWitness& zerocoinWitness, string& strError)
 {
     uint256 txid;
-    if (!zerocoinDB->ReadCoinMint(coin.getValue(), txid)) {
-        LogPrint("zero","%s failed to read mint from db\n", __func__);
+    if (!zerocoinDB->ReadCoinMint(zerocoinWitness.bnPubcoin, txid)) {
+        strError = "failed to read mint from db";
+        LogPrint("zero","%s %s\n", __func__, strError);
         return false;
     }
 
     CTransaction txMinted;
     uint256 hashBlock;
-    if (!GetTransaction(txid, txMinted, hashBlock)) {
-        LogPrint("zero","%s failed to read tx\n", __func__);
+    if (!GetTransaction(txid, txMinted, hashBlock) || !mapBlockIndex.count(hashBlock) || !chainActive.Contains(mapBlockIndex[hashBlock])) {
+        strError = "failed to read tx";
+        LogPrint("zero","%s %s\n", __func__, strError);
         return false;
     }
 
@@ -298,6 +517,12 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
         pindex = chainActive.Next(pindex);
     }
 
+    if (nChanges == 0) {
+        strError = "mint has not been added to an accumulator checkpoint yet";
+        LogPrint("zero","%s %s\n", __func__, strError);
+        return false;
+    }
+
     //the height to start accumulating coins to add to witness
     int nAccStartHeight = nHeightMintAdded - (nHeightMintAdded % 10);
 
@@ -311,14 +536,76 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
     }
 
     //Get the accumulator that is right before the cluster of blocks containing our mint was added to the accumulator
+    Accumulator accumulator(Params().Zerocoin_Params(), zerocoinWitness.denom);
     CBigNum bnAccValue = 0;
-    if (GetAccumulatorValueFromDB(nCheckpointBeforeMint, coin.getDenomination(), bnAccValue)) {
-        if (bnAccValue > 0) {
+    if (GetAccumulatorValueFromDB(nCheckpointBeforeMint, zerocoinWitness.denom, bnAccValue)) {
+        if (bnAccValue > 0)
             accumulator.setValue(bnAccValue);
-            witness.resetValue(accumulator, coin);
+    }
+
+    zerocoinWitness.nHeightMint = nHeightMintAdded;
+    zerocoinWitness.nHeightAccStart = nAccStartHeight;
+    zerocoinWitness.nHeightAccEnd = nAccStartHeight;
+    zerocoinWitness.hashAccEnd = chainActive[nAccStartHeight - 1]->GetBlockHash();
+    zerocoinWitness.bnWitness = accumulator.getValue();
+    zerocoinWitness.nMintsAdded = 0;
+    return true;
+}
+
+bool UpdateZerocoinWitness(CZerocoinWitness& zerocoinWitness, int nHeightEnd, string& strError)
+{
+    if (nHeightEnd > chainActive.Height() + 1 || !IsZerocoinWitnessCurrent(zerocoinWitness)) {
+        strError = "witness is not on the active chain";
+        LogPrint("zero","%s %s\n", __func__, strError);
+        return false;
+    }
+
+    Accumulator accWitness(Params().Zerocoin_Params(), zerocoinWitness.denom, zerocoinWitness.bnWitness);
+    int nMintsAdded = 0;
+    CBlockIndex* pindex = chainActive[zerocoinWitness.nHeightAccEnd];
+    while (pindex && pindex->nHeight < nHeightEnd) {
+        // if this block contains mints of the denomination that is being spent, then add them to the witness
+        if (pindex->MintedDenomination(zerocoinWitness.denom)) {
+            list<PublicCoin> listPubcoins;
+            if (!GetBlockPubcoins(pindex, true, listPubcoins)) {
+                strError = strprintf("failed to get zerocoin mintlist from block %d", pindex->nHeight);
+                LogPrintf("%s: %s\n", __func__, strError);
+                return false;
+            }
+
+            //add the mints to the witness
+            for (const PublicCoin pubcoin : listPubcoins) {
+                if (pubcoin.getDenomination() != zerocoinWitness.denom)
+                    continue;
+
+                if (pindex->nHeight == zerocoinWitness.nHeightMint && pubcoin.getValue() == zerocoinWitness.bnPubcoin)
+                    continue;
+
+                accWitness.increment(pubcoin.getValue());
+                ++nMintsAdded;
+            }
         }
+
+        pindex = chainActive.Next(pindex);
     }
 
+    zerocoinWitness.bnWitness = accWitness.getValue();
+    zerocoinWitness.nMintsAdded += nMintsAdded;
+    zerocoinWitness.nHeightAccEnd = nHeightEnd;
+    zerocoinWitness.hashAccEnd = chainActive[nHeightEnd - 1]->GetBlockHash();
+    return true;
+}
+
+bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError, CZerocoinWitness* pzerocoinWitness)
+{
+    //continue from the cached witness if it is still on the active chain
+    CZerocoinWitness zerocoinWitness(coin.getValue(), coin.getDenomination());
+    bool fCached = pzerocoinWitness && pzerocoinWitness->bnPubcoin == coin.getValue() && IsZerocoinWitnessCurrent(*pzerocoinWitness);
+    if (fCached)
+        zerocoinWitness = *pzerocoinWitness;
+    else if (!InitZerocoinWitness(zerocoinWitness, strError))
+        return false;
+
     //security level: this is an important prevention of tracing the coins via timing. Security level represents how many checkpoints
     //of accumulated coins are added *beyond* the checkpoint that the mint being spent was added too. If each spend added the exact same
     //amounts of checkpoints after the mint was accumulated, then you could know the range of blocks that the mint originated from.
@@ -331,61 +618,58 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
             nSecurityLevel = 99;
     }
 
-    //add the pubcoins (zerocoinmints that have been published to the chain) up to the next checksum starting from the block
-    pindex = chainActive[nAccStartHeight];
+    //find the block to stop adding the pubcoins (zerocoinmints that have been published to the chain) at
+    int nAccStartHeight = zerocoinWitness.nHeightAccStart;
+    CBlockIndex* pindex = chainActive[nAccStartHeight];
     int nChainHeight = chainActive.Height();
     int nHeightStop = nChainHeight % 10;
     nHeightStop = nChainHeight - nHeightStop - 20; // at least two checkpoints deep
     int nCheckpointsAdded = 0;
-    nMintsAdded = 0;
+    int nHeightAccEnd = 0;
     while (pindex->nHeight < nHeightStop + 1) {
         if (pindex->nHeight != nAccStartHeight && pindex->pprev->nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint)
             ++nCheckpointsAdded;
 
         //if a new checkpoint was generated on this block, and we have added the specified amount of checkpointed accumulators,
-        //then initialize the accumulator at this point and break
+        //then the witness is complete at this point
         if (!InvalidCheckpointRange(pindex->nHeight) && (pindex->nHeight >= nHeightStop || (nSecurityLevel != 100 && nCheckpointsAdded >= nSecurityLevel))) {
-            uint32_t nChecksum = ParseChecksum(chainActive[pindex->nHeight + 10]->nAccumulatorCheckpoint, coin.getDenomination());
-            CBigNum bnAccValue = 0;
-            if (!zerocoinDB->ReadAccumulatorValue(nChecksum, bnAccValue)) {
-                LogPrintf("%s : failed to find checksum in database for accumulator\n", __func__);
-                return false;
-            }
-            accumulator.setValue(bnAccValue);
+            nHeightAccEnd = pindex->nHeight;
             break;
         }
 
-        // if this block contains mints of the denomination that is being spent, then add them to the witness
-        if (pindex->MintedDenomination(coin.getDenomination())) {
-            //grab mints from this block
-            CBlock block;
-            if(!ReadBlockFromDisk(block, pindex)) {
-                LogPrintf("%s: failed to read block from disk while adding pubcoins to witness\n", __func__);
-                return false;
-            }
-
-            list<PublicCoin> listPubcoins;
-            if(!BlockToPubcoinList(block, listPubcoins, true)) {
-                LogPrintf("%s: failed to get zerocoin mintlist from block %n\n", __func__, pindex->nHeight);
-                return false;
-            }
+        pindex = chainActive[pindex->nHeight + 1];
+    }
 
-            //add the mints to the witness
-            for (const PublicCoin pubcoin : listPubcoins) {
-                if (pubcoin.getDenomination() != coin.getDenomination())
-                    continue;
+    if (!nHeightAccEnd) {
+        strError = _("Mint is not deep enough in the chain to create spend");
+        LogPrintf("%s : %s\n", __func__, strError);
+        return false;
+    }
 
-                if (pindex->nHeight == nHeightMintAdded && pubcoin.getValue() == coin.getValue())
-                    continue;
+    //a cached witness can not be rolled back to an earlier checkpoint
+    if (zerocoinWitness.nHeightAccEnd > nHeightAccEnd) {
+        zerocoinWitness = CZerocoinWitness(coin.getValue(), coin.getDenomination());
+        if (!InitZerocoinWitness(zerocoinWitness, strError))
+            return false;
+    }
 
-                witness.addRawValue(pubcoin.getValue());
-                ++nMintsAdded;
-            }
-        }
+    if (!UpdateZerocoinWitness(zerocoinWitness, nHeightAccEnd, strError))
+        return false;
 
-        pindex = chainActive[pindex->nHeight + 1];
+    uint32_t nChecksum = ParseChecksum(chainActive[nHeightAccEnd + 10]->nAccumulatorCheckpoint, coin.getDenomination());
+    CBigNum bnAccValue = 0;
+    if (!zerocoinDB->ReadAccumulatorValue(nChecksum, bnAccValue)) {
+        LogPrintf("%s : failed to find checksum in database for accumulator\n", __func__);
+        return false;
     }
+    accumulator.setValue(bnAccValue);
+    witness.resetValue(Accumulator(Params().Zerocoin_Params(), coin.getDenomination(), zerocoinWitness.bnWitness), coin);
+
+    //let the caller keep the furthest witness
+    if (pzerocoinWitness && (!fCached || zerocoinWitness.nHeightAccEnd >= pzerocoinWitness->nHeightAccEnd))
+        *pzerocoinWitness = zerocoinWitness;
 
+    nMintsAdded = zerocoinWitness.nMintsAdded;
     if (nMintsAdded < Params().Zerocoin_RequiredAccumulation()) {
         strError = _(strprintf("Less than %d mints added, unable to create spend", Params().Zerocoin_RequiredAccumulation()).c_str());
         LogPrintf("%s : %s\n", __func__, strError);
@@ -11,15 +11,51 @@
 #include "primitives/zerocoin.h"
 #include "uint256.h"
 
-bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError);
+#include <list>
+#include <map>
+
+class CBlockIndex;
+
+/** Pubcoins of recently read blocks, so that a reindex can calculate checkpoints without reading the blocks again */
+class CBlockPubcoinCache
+{
+private:
+    struct CEntry {
+        uint256 hashBlock;
+        bool fHaveAll;
+        bool fHaveFiltered;
+        std::list<libzerocoin::PublicCoin> listAll;
+        std::list<libzerocoin::PublicCoin> listFiltered;
+
+        CEntry() : fHaveAll(false), fHaveFiltered(false) {}
+    };
+    std::map<int, CEntry> mapEntries;
+
+public:
+    void Add(const CBlockIndex* pindex, bool fFilterInvalid, const std::list<libzerocoin::PublicCoin>& listPubcoins);
+    bool Get(const CBlockIndex* pindex, bool fFilterInvalid, std::list<libzerocoin::PublicCoin>& listPubcoins) const;
+    //! Forget the blocks below nHeight
+    void Prune(int nHeight);
+};
+
+bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError, CZerocoinWitness* pzerocoinWitness = NULL);
+bool InitZerocoinWitness(CZerocoinWitness& zerocoinWitness, std::string& strError);
+bool UpdateZerocoinWitness(CZerocoinWitness& zerocoinWitness, int nHeightEnd, std::string& strError);
+bool IsZerocoinWitnessCurrent(const CZerocoinWitness& zerocoinWitness);
 bool GetAccumulatorValueFromDB(uint256 nCheckpoint, libzerocoin::CoinDenomination denom, CBigNum& bnAccValue);
 bool GetAccumulatorValueFromChecksum(uint32_t nChecksum, bool fMemoryOnly, CBigNum& bnAccValue);
 void AddAccumulatorChecksum(const uint32_t nChecksum, const CBigNum &bnValue, bool fMemoryOnly);
-bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint);
+bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, const CBlockPubcoinCache* pcache = NULL);
 bool LoadAccumulatorValuesFromDB(const uint256 nCheckpoint);
 bool EraseAccumulatorValues(const uint256& nCheckpointErase, const uint256& nCheckpointPrevious);
 uint32_t ParseChecksum(uint256 nChecksum, libzerocoin::CoinDenomination denomination);
 uint32_t GetChecksum(const CBigNum &bnValue);
 bool InvalidCheckpointRange(int nHeight);
+bool WriteMintJournal(const CBlockIndex* pindex, const std::list<CZerocoinMint>& listMints);
+bool EraseMintJournal(const CBlockIndex* pindex);
+bool ReadMintJournal(const CBlockIndex* pindex, CMintJournalEntry& entry);
+bool GetBlockPubcoins(const CBlockIndex* pindex, bool fFilterInvalid, std::list<libzerocoin::PublicCoin>& listPubcoins, const CBlockPubcoinCache* pcache = NULL);
+void PrecomputeAccumulatorCheckpoint(const CBlockIndex* pindex);
+void ThreadPrecomputeAccumulators();
 
 #endif //CaritasCoin_ACCUMULATORS_H
@@ -9,6 +9,7 @@
 #include <map>
 #include <string.h>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include <boost/thread/mutex.hpp>
@@ -226,6 +227,8 @@ struct secure_allocator : public std::allocator<T> {
 
 //
 // Allocator that clears its contents before deletion.
+// Made with fZeroIn=false it leaves public data, like the messages
+// received from the network, as it is and saves wiping every buffer.
 //
 template <typename T>
 struct zero_after_free_allocator : public std::allocator<T> {
@@ -238,10 +241,11 @@ struct zero_after_free_allocator : public std::allocator<T> {
     typedef typename base::reference reference;
     typedef typename base::const_reference const_reference;
     typedef typename base::value_type value_type;
-    zero_after_free_allocator() throw() {}
-    zero_after_free_allocator(const zero_after_free_allocator& a) throw() : base(a) {}
+    bool fZero;
+    explicit zero_after_free_allocator(bool fZeroIn = true) throw() : fZero(fZeroIn) {}
+    zero_after_free_allocator(const zero_after_free_allocator& a) throw() : base(a), fZero(a.fZero) {}
     template <typename U>
-    zero_after_free_allocator(const zero_after_free_allocator<U>& a) throw() : base(a)
+    zero_after_free_allocator(const zero_after_free_allocator<U>& a) throw() : base(a), fZero(a.fZero)
     {
     }
     ~zero_after_free_allocator() throw() {}
@@ -250,14 +254,31 @@ struct zero_after_free_allocator : public std::allocator<T> {
         typedef zero_after_free_allocator<_Other> other;
     };
 
+    // the wipe policy moves with the buffer it was made for
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+
     void deallocate(T* p, std::size_t n)
     {
-        if (p != NULL)
+        if (p != NULL && fZero)
             OPENSSL_cleanse(p, sizeof(T) * n);
         std::allocator<T>::deallocate(p, n);
     }
 };
 
+template <typename T, typename U>
+bool operator==(const zero_after_free_allocator<T>& a, const zero_after_free_allocator<U>& b)
+{
+    return a.fZero == b.fZero;
+}
+
+template <typename T, typename U>
+bool operator!=(const zero_after_free_allocator<T>& a, const zero_after_free_allocator<U>& b)
+{
+    return a.fZero != b.fZero;
+}
+
 // This is exactly like std::string, but with a custom allocator.
 typedef std::basic_string<char, std::char_traits<char>, secure_allocator<char> > SecureString;
 
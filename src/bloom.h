@@ -8,6 +8,7 @@
 
 #include "serialize.h"
 
+#include <stdint.h>
 #include <vector>
 
 class COutPoint;
@@ -98,4 +99,49 @@ public:
     void UpdateEmptyFull();
 };
 
+/**
+ * RollingBloomFilter is a probabilistic "keep track of most recently inserted" set.
+ * Construct it with the number of items to keep track of, and a false-positive
+ * rate. Unlike CBloomFilter, by default nTweak is set to a cryptographically
+ * secure random value for you.
+ *
+ * contains(item) will always return true if item was one of the last N to 1.5*N
+ * insert()'ed ... but may also return true for items that were not inserted.
+ *
+ * Its memory is allocated once: about 11 bytes per tracked item for a false-positive
+ * rate of 0.000001 and 6 bytes for 0.001, where a set allocates a node of 50 or more
+ * bytes for every item.
+ */
+class CRollingBloomFilter
+{
+public:
+    // A random bloom filter calls GetRand() at creation time.
+    // Don't create global CRollingBloomFilter objects, as they may be
+    // constructed before the randomizer is properly initialized.
+    CRollingBloomFilter(unsigned int nElements, double nFPRate);
+
+    void insert(const std::vector<unsigned char>& vKey);
+    void insert(const uint256& hash);
+    bool contains(const std::vector<unsigned char>& vKey) const;
+    bool contains(const uint256& hash) const;
+
+    void reset();
+
+    //! Bytes of the filter data
+    size_t DynamicMemoryUsage() const { return data.capacity() * sizeof(uint64_t); }
+
+private:
+    int nEntriesPerGeneration;
+    int nEntriesThisGeneration;
+    int nGeneration;
+    /**
+     * Every bit position is 2 bits, one in each of the pair of words data[2*i] and data[2*i+1]:
+     * 00 is unset, 01, 10 and 11 are set in generation 1, 2 and 3. The filter keeps between
+     * 2 and 3 generations of nElements/2 entries, starting a new generation wipes the oldest.
+     */
+    std::vector<uint64_t> data;
+    unsigned int nTweak;
+    int nHashFuncs;
+};
+
 #endif // BITCOIN_BLOOM_H
@@ -0,0 +1,140 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cachefile.h"
+
+#include <algorithm>
+
+CCacheFileWriter::CCacheFileWriter(const boost::filesystem::path& pathIn, int nTypeIn, int nVersionIn) : path(pathIn),
+                                                                                                         pathTmp(pathIn.string() + ".new"),
+                                                                                                         file(fopen(pathTmp.string().c_str(), "wb"), nTypeIn, nVersionIn),
+                                                                                                         nType(nTypeIn),
+                                                                                                         nVersion(nVersionIn)
+{
+    vchChunk.reserve(CACHEFILE_CHUNK_SIZE);
+    if (file.IsNull())
+        return;
+
+    try {
+        file.write((const char*)CACHEFILE_MAGIC, sizeof(CACHEFILE_MAGIC));
+    } catch (std::exception& e) {
+        error("%s : I/O error - %s", __func__, e.what());
+        file.fclose();
+    }
+}
+
+CCacheFileWriter::~CCacheFileWriter()
+{
+    // not committed, leave the old file in place
+    if (!file.IsNull()) {
+        file.fclose();
+        boost::system::error_code ec;
+        boost::filesystem::remove(pathTmp, ec);
+    }
+}
+
+void CCacheFileWriter::WriteChunk()
+{
+    uint32_t nSize = vchChunk.size();
+    file << nSize;
+    if (nSize > 0)
+        file.write(&vchChunk[0], nSize);
+    file << Hash(vchChunk.begin(), vchChunk.end());
+    vchChunk.clear();
+}
+
+CCacheFileWriter& CCacheFileWriter::write(const char* pch, size_t nSize)
+{
+    if (file.IsNull())
+        throw std::ios_base::failure("CCacheFileWriter::write : file handle is NULL");
+
+    while (nSize > 0) {
+        size_t nCopy = std::min(nSize, (size_t)CACHEFILE_CHUNK_SIZE - vchChunk.size());
+        vchChunk.insert(vchChunk.end(), pch, pch + nCopy);
+        pch += nCopy;
+        nSize -= nCopy;
+        if (vchChunk.size() == CACHEFILE_CHUNK_SIZE)
+            WriteChunk();
+    }
+    return (*this);
+}
+
+bool CCacheFileWriter::Commit()
+{
+    if (file.IsNull())
+        return false;
+
+    try {
+        if (!vchChunk.empty())
+            WriteChunk();
+        // the empty chunk ends the file
+        WriteChunk();
+    } catch (std::exception& e) {
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+
+    FileCommit(file.Get());
+    file.fclose();
+
+    if (!RenameOver(pathTmp, path))
+        return error("%s : Failed to rename %s to %s", __func__, pathTmp.string(), path.string());
+    return true;
+}
+
+CCacheFileReader::CCacheFileReader(FILE* filenew, int nTypeIn, int nVersionIn) : file(filenew, nTypeIn, nVersionIn),
+                                                                                  nChunkPos(0),
+                                                                                  fEnd(false),
+                                                                                  fCorrupt(false),
+                                                                                  nType(nTypeIn),
+                                                                                  nVersion(nVersionIn)
+{
+}
+
+bool CCacheFileReader::ReadChunk()
+{
+    if (fEnd)
+        return false;
+
+    uint32_t nSize;
+    file >> nSize;
+    if (nSize > CACHEFILE_CHUNK_SIZE)
+        throw std::ios_base::failure("CCacheFileReader::ReadChunk : chunk size too large");
+
+    vchChunk.resize(nSize);
+    if (nSize > 0)
+        file.read(&vchChunk[0], nSize);
+    nChunkPos = 0;
+
+    uint256 hashIn;
+    file >> hashIn;
+    if (hashIn != Hash(vchChunk.begin(), vchChunk.end())) {
+        fCorrupt = true;
+        throw std::ios_base::failure("CCacheFileReader::ReadChunk : checksum mismatch");
+    }
+
+    fEnd = (nSize == 0);
+    return !fEnd;
+}
+
+CCacheFileReader& CCacheFileReader::read(char* pch, size_t nSize)
+{
+    while (nSize > 0) {
+        if (nChunkPos == vchChunk.size() && !ReadChunk())
+            throw std::ios_base::failure("CCacheFileReader::read : end of data reached");
+
+        size_t nCopy = std::min(nSize, vchChunk.size() - nChunkPos);
+        memcpy(pch, &vchChunk[nChunkPos], nCopy);
+        nChunkPos += nCopy;
+        pch += nCopy;
+        nSize -= nCopy;
+    }
+    return (*this);
+}
+
+bool CCacheFileReader::AtEnd()
+{
+    if (nChunkPos != vchChunk.size())
+        return false;
+    return !ReadChunk();
+}
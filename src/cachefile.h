@@ -0,0 +1,264 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef CARITASCOIN_CACHEFILE_H
+#define CARITASCOIN_CACHEFILE_H
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "hash.h"
+#include "streams.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+/**
+ * Chunked, checksummed format of the coralnode, payment and budget cache files.
+ *
+ * After CACHEFILE_MAGIC the file holds the serialized cache split into chunks of at most
+ * CACHEFILE_CHUNK_SIZE bytes, each written as its size, the data and Hash(data), and ended
+ * by an empty chunk. The first bytes of the data are the format version, the file specific
+ * magic message and the network magic, followed by the cache object itself.
+ *
+ * The object is streamed through a single chunk buffer, so neither writing nor reading holds
+ * a second copy of the whole file in memory, and every chunk is verified as it is consumed.
+ * Files written before this format start with the magic message instead; they are still read
+ * and get converted when the cache is written next.
+ */
+static const unsigned char CACHEFILE_MAGIC[8] = {0xff, 'c', 'a', 'c', 'h', 'e', 'd', 'b'};
+static const int CACHEFILE_VERSION = 1;
+static const unsigned int CACHEFILE_CHUNK_SIZE = 1 << 20;
+
+/** Writes a cache file to a temporary file that replaces the old one on Commit */
+class CCacheFileWriter
+{
+private:
+    // Disallow copies
+    CCacheFileWriter(const CCacheFileWriter&);
+    CCacheFileWriter& operator=(const CCacheFileWriter&);
+
+    boost::filesystem::path path;
+    boost::filesystem::path pathTmp;
+    CAutoFile file;
+    std::vector<char> vchChunk;
+    int nType;
+    int nVersion;
+
+    void WriteChunk();
+
+public:
+    CCacheFileWriter(const boost::filesystem::path& pathIn, int nTypeIn, int nVersionIn);
+    ~CCacheFileWriter();
+
+    bool IsNull() const { return file.IsNull(); }
+    int GetType() { return nType; }
+    int GetVersion() { return nVersion; }
+
+    CCacheFileWriter& write(const char* pch, size_t nSize);
+
+    template <typename T>
+    CCacheFileWriter& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+
+    /** Write the end of the file, flush it to disk and move it over the old file */
+    bool Commit();
+};
+
+/** Reads the chunks of a cache file, verifying each one when it is reached */
+class CCacheFileReader
+{
+private:
+    // Disallow copies
+    CCacheFileReader(const CCacheFileReader&);
+    CCacheFileReader& operator=(const CCacheFileReader&);
+
+    CAutoFile file;
+    std::vector<char> vchChunk;
+    size_t nChunkPos;
+    bool fEnd;
+    bool fCorrupt;
+    int nType;
+    int nVersion;
+
+    bool ReadChunk();
+
+public:
+    /** Takes ownership of a file positioned right after CACHEFILE_MAGIC */
+    CCacheFileReader(FILE* filenew, int nTypeIn, int nVersionIn);
+
+    int GetType() { return nType; }
+    int GetVersion() { return nVersion; }
+
+    /** Whether a chunk failed its checksum */
+    bool IsCorrupt() const { return fCorrupt; }
+
+    CCacheFileReader& read(char* pch, size_t nSize);
+
+    template <typename T>
+    CCacheFileReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+
+    /** Whether all data was consumed and the end of the file was reached */
+    bool AtEnd();
+};
+
+/** Write objToSave to pathFile in the chunked format */
+template <typename T>
+bool WriteCacheFile(const boost::filesystem::path& pathFile, const std::string& strMagicMessage, const T& objToSave)
+{
+    CCacheFileWriter fileout(pathFile, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s : Failed to open file %s", __func__, pathFile.string());
+
+    try {
+        fileout << CACHEFILE_VERSION;
+        fileout << strMagicMessage;                   // cache file specific magic message
+        fileout << FLATDATA(Params().MessageStart()); // network specific magic number
+        fileout << objToSave;
+    } catch (std::exception& e) {
+        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+    }
+
+    return fileout.Commit();
+}
+
+/** Read a cache file written before the chunked format: one blob followed by its hash */
+template <typename DB, typename T>
+typename DB::ReadResult ReadLegacyCacheFile(const boost::filesystem::path& pathFile, const std::string& strMagicMessage, T& objToLoad)
+{
+    FILE* file = fopen(pathFile.string().c_str(), "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        error("%s : Failed to open file %s", __func__, pathFile.string());
+        return DB::FileError;
+    }
+
+    // use file size to size memory buffer
+    int fileSize = boost::filesystem::file_size(pathFile);
+    int dataSize = fileSize - sizeof(uint256);
+    // Don't try to resize to a negative number if file is small
+    if (dataSize < 0)
+        dataSize = 0;
+    std::vector<unsigned char> vchData;
+    vchData.resize(dataSize);
+    uint256 hashIn;
+
+    // read data and checksum from file
+    try {
+        filein.read((char*)&vchData[0], dataSize);
+        filein >> hashIn;
+    } catch (std::exception& e) {
+        error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        return DB::HashReadError;
+    }
+    filein.fclose();
+
+    CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
+
+    // verify stored checksum matches input data
+    uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
+    if (hashIn != hashTmp) {
+        error("%s : Checksum mismatch, data corrupted", __func__);
+        return DB::IncorrectHash;
+    }
+
+    unsigned char pchMsgTmp[4];
+    std::string strMagicMessageTmp;
+    try {
+        ssObj >> strMagicMessageTmp;
+        if (strMagicMessage != strMagicMessageTmp) {
+            error("%s : Invalid cache magic message", __func__);
+            return DB::IncorrectMagicMessage;
+        }
+
+        ssObj >> FLATDATA(pchMsgTmp);
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
+            error("%s : Invalid network magic number", __func__);
+            return DB::IncorrectMagicNumber;
+        }
+
+        ssObj >> objToLoad;
+    } catch (std::exception& e) {
+        objToLoad.Clear();
+        error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        return DB::IncorrectFormat;
+    }
+
+    LogPrintf("%s : read %s in the old format, it will be converted when it is written next\n", __func__, pathFile.filename().string());
+    return DB::Ok;
+}
+
+/** Read objToLoad from pathFile, in the chunked or the old format */
+template <typename DB, typename T>
+typename DB::ReadResult ReadCacheFile(const boost::filesystem::path& pathFile, const std::string& strMagicMessage, T& objToLoad)
+{
+    FILE* file = fopen(pathFile.string().c_str(), "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        error("%s : Failed to open file %s", __func__, pathFile.string());
+        return DB::FileError;
+    }
+
+    unsigned char pchFileMagic[sizeof(CACHEFILE_MAGIC)];
+    try {
+        filein.read((char*)pchFileMagic, sizeof(pchFileMagic));
+    } catch (std::exception& e) {
+        error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        return DB::HashReadError;
+    }
+    if (memcmp(pchFileMagic, CACHEFILE_MAGIC, sizeof(CACHEFILE_MAGIC))) {
+        filein.fclose();
+        return ReadLegacyCacheFile<DB>(pathFile, strMagicMessage, objToLoad);
+    }
+
+    CCacheFileReader reader(filein.release(), SER_DISK, CLIENT_VERSION);
+    int nFormatVersion;
+    unsigned char pchMsgTmp[4];
+    std::string strMagicMessageTmp;
+    try {
+        reader >> nFormatVersion;
+        if (nFormatVersion > CACHEFILE_VERSION) {
+            error("%s : Unsupported cache file version %d", __func__, nFormatVersion);
+            return DB::IncorrectFormat;
+        }
+
+        reader >> strMagicMessageTmp;
+        if (strMagicMessage != strMagicMessageTmp) {
+            error("%s : Invalid cache magic message", __func__);
+            return DB::IncorrectMagicMessage;
+        }
+
+        reader >> FLATDATA(pchMsgTmp);
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
+            error("%s : Invalid network magic number", __func__);
+            return DB::IncorrectMagicNumber;
+        }
+
+        reader >> objToLoad;
+        if (!reader.AtEnd())
+            throw std::ios_base::failure("unexpected data at the end of the file");
+    } catch (std::exception& e) {
+        objToLoad.Clear();
+        if (reader.IsCorrupt()) {
+            error("%s : Checksum mismatch, data corrupted", __func__);
+            return DB::IncorrectHash;
+        }
+        error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        return DB::IncorrectFormat;
+    }
+
+    return DB::Ok;
+}
+
+#endif // CARITASCOIN_CACHEFILE_H
@@ -189,6 +189,7 @@ public:
         fMineBlocksOnDemand = false;
         fSkipProofOfWorkCheck = false;
         fTestnetToBeDeprecatedFieldRPC = false;
+        // PoS headers cost nothing to produce, keep headers-first off until header acceptance is bounded
         fHeadersFirstSyncingActive = false;
 
         nPoolMaxTransactions = 3;
@@ -286,6 +287,7 @@ public:
         fRequireStandard = false;
         fMineBlocksOnDemand = false;
         fTestnetToBeDeprecatedFieldRPC = true;
+        fHeadersFirstSyncingActive = true;
 
         nPoolMaxTransactions = 2;
         strSporkKey = "047cb1d068ef01a90200652ee3b350d660b7829d761417496716e41c9722d3b38bf099546a56f6e71c98b58e5616296172726377c6b2082c60c7bc4a1d54159c6b";
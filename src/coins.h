@@ -7,6 +7,8 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "core_memusage.h"
+#include "memusage.h"
 #include "script/standard.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -18,9 +20,128 @@
 #include <boost/foreach.hpp>
 #include <boost/unordered_map.hpp>
 
-/** 
+/**
+ * A UTXO entry.
+ *
+ * Serialized format:
+ * - VARINT(nHeight * 4 + fCoinStake * 2 + fCoinBase)
+ * - VARINT(nVersion)
+ * - the non-spent CTxOut (via CTxOutCompressor)
+ */
+class Coin
+{
+public:
+    //! unspent transaction output
+    CTxOut out;
+
+    //! whether the containing transaction was a coinbase
+    bool fCoinBase;
+    bool fCoinStake;
+
+    //! at which height the containing transaction was included in the active block chain
+    int nHeight;
+
+    //! version of the containing transaction
+    int nVersion;
+
+    //! construct a Coin from output n of a CTransaction, at a given height
+    Coin(const CTransaction& tx, unsigned int n, int nHeightIn) : out(tx.vout[n]), fCoinBase(tx.IsCoinBase()), fCoinStake(tx.IsCoinStake()), nHeight(nHeightIn), nVersion(tx.nVersion) {}
+
+    Coin(const CTxOut& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn, int nVersionIn) : out(outIn), fCoinBase(fCoinBaseIn), fCoinStake(fCoinStakeIn), nHeight(nHeightIn), nVersion(nVersionIn) {}
+
+    //! empty constructor
+    Coin() : fCoinBase(false), fCoinStake(false), nHeight(0), nVersion(0) {}
+
+    void Clear()
+    {
+        out.SetNull();
+        fCoinBase = false;
+        fCoinStake = false;
+        nHeight = 0;
+        nVersion = 0;
+    }
+
+    bool IsCoinBase() const
+    {
+        return fCoinBase;
+    }
+
+    bool IsCoinStake() const
+    {
+        return fCoinStake;
+    }
+
+    //! check whether the output has been spent (or never existed)
+    bool IsSpent() const
+    {
+        return out.IsNull();
+    }
+
+    //! check whether a regular input may spend the output, zerocoin mints are only redeemed by zerocoin spends
+    bool IsAvailable() const
+    {
+        return !IsSpent() && !out.scriptPubKey.IsZerocoinMint();
+    }
+
+    //! equality test
+    friend bool operator==(const Coin& a, const Coin& b)
+    {
+        // Spent coins are always equal.
+        if (a.IsSpent() && b.IsSpent())
+            return true;
+        return a.fCoinBase == b.fCoinBase &&
+               a.fCoinStake == b.fCoinStake &&
+               a.nHeight == b.nHeight &&
+               a.nVersion == b.nVersion &&
+               a.out == b.out;
+    }
+    friend bool operator!=(const Coin& a, const Coin& b)
+    {
+        return !(a == b);
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        unsigned int nCode = nHeight * 4 + (fCoinStake ? 2 : 0) + (fCoinBase ? 1 : 0);
+        return ::GetSerializeSize(VARINT(nCode), nType, nVersion) +
+               ::GetSerializeSize(VARINT(this->nVersion), nType, nVersion) +
+               ::GetSerializeSize(CTxOutCompressor(REF(out)), nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        assert(!IsSpent());
+        unsigned int nCode = nHeight * 4 + (fCoinStake ? 2 : 0) + (fCoinBase ? 1 : 0);
+        ::Serialize(s, VARINT(nCode), nType, nVersion);
+        ::Serialize(s, VARINT(this->nVersion), nType, nVersion);
+        ::Serialize(s, CTxOutCompressor(REF(out)), nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        unsigned int nCode = 0;
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        nHeight = nCode / 4;
+        fCoinStake = (nCode & 2) != 0;
+        fCoinBase = (nCode & 1) != 0;
+        ::Unserialize(s, VARINT(this->nVersion), nType, nVersion);
+        ::Unserialize(s, REF(CTxOutCompressor(REF(out))), nType, nVersion);
+    }
+
+    size_t DynamicMemoryUsage() const
+    {
+        return RecursiveDynamicUsage(out.scriptPubKey);
+    }
+};
 
-    ****Note - for CaritasCoin we added fCoinStake to the 2nd bit. Keep in mind when reading the following and adjust as needed.
+/**
+ * Legacy per-transaction record of the coin database. Versions before per-output
+ * records stored every transaction under 'c' + txid; it is only read to upgrade
+ * such databases (see CCoinsViewDB::Upgrade).
+ *
+ *    ****Note - for CaritasCoin we added fCoinStake to the 2nd bit. Keep in mind when reading the following and adjust as needed.
  * Pruned version of CTransaction: only retains metadata and unspent transaction outputs
  *
  * Serialized format:
@@ -104,15 +225,6 @@ public:
         FromTx(tx, nHeightIn);
     }
 
-    void Clear()
-    {
-        fCoinBase = false;
-        fCoinStake = false;
-        std::vector<CTxOut>().swap(vout);
-        nHeight = 0;
-        nVersion = 0;
-    }
-
     //! empty constructor
     CCoins() : fCoinBase(false), fCoinStake(false), vout(0), nHeight(0), nVersion(0) {}
 
@@ -134,32 +246,6 @@ public:
         Cleanup();
     }
 
-    void swap(CCoins& to)
-    {
-        std::swap(to.fCoinBase, fCoinBase);
-        std::swap(to.fCoinStake, fCoinStake);
-        to.vout.swap(vout);
-        std::swap(to.nHeight, nHeight);
-        std::swap(to.nVersion, nVersion);
-    }
-
-    //! equality test
-    friend bool operator==(const CCoins& a, const CCoins& b)
-    {
-        // Empty CCoins objects are always equal.
-        if (a.IsPruned() && b.IsPruned())
-            return true;
-        return a.fCoinBase == b.fCoinBase &&
-               a.fCoinStake == b.fCoinStake &&
-               a.nHeight == b.nHeight &&
-               a.nVersion == b.nVersion &&
-               a.vout == b.vout;
-    }
-    friend bool operator!=(const CCoins& a, const CCoins& b)
-    {
-        return !(a == b);
-    }
-
     void CalcMaskSize(unsigned int& nBytes, unsigned int& nNonzeroBytes) const;
 
     bool IsCoinBase() const
@@ -262,18 +348,6 @@ public:
         Cleanup();
     }
 
-    //! mark an outpoint spent, and construct undo information
-    bool Spend(const COutPoint& out, CTxInUndo& undo);
-
-    //! mark a vout spent
-    bool Spend(int nPos);
-
-    //! check whether a particular output is still available
-    bool IsAvailable(unsigned int nPos) const
-    {
-        return (nPos < vout.size() && !vout[nPos].IsNull() && !vout[nPos].scriptPubKey.IsZerocoinMint());
-    }
-
     //! check whether the entire CCoins is spent
     //! note that only !IsPruned() CCoins can be serialized
     bool IsPruned() const
@@ -298,25 +372,30 @@ public:
      * unordered_map will behave unpredictably if the custom hasher returns a
      * uint64_t, resulting in failures when syncing the chain (#4634).
      */
-    size_t operator()(const uint256& key) const
+    size_t operator()(const COutPoint& key) const
     {
-        return key.GetHash(salt);
+        return key.hash.GetHash(salt) ^ key.n;
     }
 };
 
 struct CCoinsCacheEntry {
-    CCoins coins; // The actual cached data.
+    Coin coin; // The actual cached data.
     unsigned char flags;
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
-        FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
+        FRESH = (1 << 1), // The parent view does not have this entry (or it is spent).
+        /* Note that FRESH is a performance optimization with which we can
+         * erase coins that are spent if we know we do not need to flush the
+         * changes to the parent cache. It is always safe to not mark FRESH
+         * if that condition is not guaranteed.
+         */
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsCacheEntry() : coin(), flags(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+typedef boost::unordered_map<COutPoint, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
 
 struct CCoinsStats {
     int nHeight;
@@ -335,17 +414,17 @@ struct CCoinsStats {
 class CCoinsView
 {
 public:
-    //! Retrieve the CCoins (unspent transaction outputs) for a given txid
-    virtual bool GetCoins(const uint256& txid, CCoins& coins) const;
+    //! Retrieve the Coin (unspent transaction output) for a given outpoint.
+    //! Returns true only when an unspent coin was found, which is returned in coin.
+    virtual bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
 
-    //! Just check whether we have data for a given txid.
-    //! This may (but cannot always) return true for fully spent transactions
-    virtual bool HaveCoins(const uint256& txid) const;
+    //! Just check whether a given outpoint is unspent.
+    virtual bool HaveCoin(const COutPoint& outpoint) const;
 
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
-    //! Do a bulk modification (multiple CCoins changes + BestBlock change).
+    //! Do a bulk modification (multiple Coin changes + BestBlock change).
     //! The passed mapCoins can be modified.
     virtual bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
 
@@ -365,8 +444,8 @@ protected:
 
 public:
     CCoinsViewBacked(CCoinsView* viewIn);
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView& viewIn);
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
@@ -388,32 +467,10 @@ enum {
 static const unsigned int STANDARD_LOCKTIME_VERIFY_FLAGS = LOCKTIME_VERIFY_SEQUENCE |
                                                            LOCKTIME_MEDIAN_TIME_PAST;
 
-/** 
- * A reference to a mutable cache entry. Encapsulating it allows us to run
- *  cleanup code after the modification is finished, and keeping track of
- *  concurrent modifications. 
- */
-class CCoinsModifier
-{
-private:
-    CCoinsViewCache& cache;
-    CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
-
-public:
-    CCoins* operator->() { return &it->second.coins; }
-    CCoins& operator*() { return it->second.coins; }
-    ~CCoinsModifier();
-    friend class CCoinsViewCache;
-};
-
-/** CCoinsView that adds a memory cache for transactions to another CCoinsView */
+/** CCoinsView that adds a memory cache for unspent outputs to another CCoinsView */
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
-    /* Whether this cache has an active modifier. */
-    bool hasModifier;
-
     /**
      * Make mutable so that we can "fill the cache" even from Get-methods
      * declared as "const".  
@@ -421,30 +478,43 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner Coin objects. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView* baseIn);
-    ~CCoinsViewCache();
 
     // Standard CCoinsView methods
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256& hashBlock);
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
 
     /**
-     * Return a pointer to CCoins in the cache, or NULL if not found. This is
-     * more efficient than GetCoins. Modifications to other cache entries are
-     * allowed while accessing the returned pointer.
+     * Check whether the given outpoint is unspent and already loaded in this
+     * cache, without calling into the backing view.
+     */
+    bool HaveCoinInCache(const COutPoint& outpoint) const;
+
+    /**
+     * Return a reference to the Coin in the cache, or a spent one if not found.
+     * This is more efficient than GetCoin. Modifications to other cache entries
+     * are allowed while accessing the returned reference.
      */
-    const CCoins* AccessCoins(const uint256& txid) const;
+    const Coin& AccessCoin(const COutPoint& outpoint) const;
 
     /**
-     * Return a modifiable reference to a CCoins. If no entry with the given
-     * txid exists, a new one is created. Simultaneous modifications are not
-     * allowed.
+     * Add a coin. Set fPossibleOverwrite if an unspent version may already
+     * exist in this cache or its backing view.
      */
-    CCoinsModifier ModifyCoins(const uint256& txid);
+    void AddCoin(const COutPoint& outpoint, const Coin& coin, bool fPossibleOverwrite);
+
+    /**
+     * Spend a coin, moving its data to moveto when given. Returns false if
+     * neither this cache nor its backing view know the outpoint.
+     */
+    bool SpendCoin(const COutPoint& outpoint, Coin* moveto = NULL);
 
     /**
      * Push the modifications applied to this cache to its base.
@@ -453,9 +523,12 @@ public:
      */
     bool Flush();
 
-    //! Calculate the size of the cache (in number of transactions)
+    //! Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+
     /** 
      * Amount of caritas coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -474,11 +547,15 @@ public:
 
     const CTxOut& GetOutputFor(const CTxIn& input) const;
 
-    friend class CCoinsModifier;
-
 private:
-    CCoinsMap::iterator FetchCoins(const uint256& txid);
-    CCoinsMap::const_iterator FetchCoins(const uint256& txid) const;
+    CCoinsMap::iterator FetchCoin(const COutPoint& outpoint) const;
 };
 
+//! Add the spendable outputs of a transaction to a cache
+void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight);
+
+//! Find any unspent output of a transaction; a spent Coin if there is none. This looks
+//! up every possible output index, use it only where the txid is all there is to go on.
+const Coin& AccessByTxid(const CCoinsViewCache& cache, const uint256& txid);
+
 #endif // BITCOIN_COINS_H
@@ -0,0 +1,113 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "collateralwatch.h"
+
+#include "main.h"
+#include "txmempool.h"
+
+#include <boost/foreach.hpp>
+
+void CCollateralWatch::Add(const COutPoint& outpoint)
+{
+    LOCK(cs);
+    mapWatched[outpoint];
+}
+
+void CCollateralWatch::Reset(const std::vector<COutPoint>& vOutpoints)
+{
+    LOCK(cs);
+    std::map<COutPoint, CCollateralState> mapNew;
+    BOOST_FOREACH (const COutPoint& outpoint, vOutpoints) {
+        std::map<COutPoint, CCollateralState>::const_iterator it = mapWatched.find(outpoint);
+        mapNew[outpoint] = (it != mapWatched.end()) ? it->second : CCollateralState();
+    }
+    mapWatched.swap(mapNew);
+}
+
+void CCollateralWatch::SetVerified(const COutPoint& outpoint)
+{
+    LOCK(cs);
+    std::map<COutPoint, CCollateralState>::iterator it = mapWatched.find(outpoint);
+    if (it != mapWatched.end())
+        it->second.fVerified = true;
+}
+
+bool CCollateralWatch::GetStatus(const COutPoint& outpoint, bool& fSpent)
+{
+    uint256 hashMempoolSpend;
+    {
+        LOCK(cs);
+        std::map<COutPoint, CCollateralState>::const_iterator it = mapWatched.find(outpoint);
+        if (it == mapWatched.end() || !it->second.fVerified)
+            return false;
+
+        if (!it->second.fMempoolSpend) {
+            fSpent = it->second.hashSpendingTx != 0;
+            return true;
+        }
+        hashMempoolSpend = it->second.hashSpendingTx;
+    }
+
+    if (mempool.exists(hashMempoolSpend)) {
+        fSpent = true;
+        return true;
+    }
+
+    // The spend was evicted or expired without a notification. Any other spend would have been
+    // seen since the collateral was verified, so it is unspent again unless a block just mined it.
+    LOCK(cs);
+    std::map<COutPoint, CCollateralState>::iterator it = mapWatched.find(outpoint);
+    if (it == mapWatched.end() || !it->second.fVerified)
+        return false;
+
+    if (it->second.fMempoolSpend && it->second.hashSpendingTx == hashMempoolSpend) {
+        LogPrint("coralnode", "CCollateralWatch::GetStatus - spend of collateral %s by %s left the mempool\n", outpoint.ToStringShort(), hashMempoolSpend.ToString());
+        it->second.hashSpendingTx = 0;
+        it->second.fMempoolSpend = false;
+    }
+    fSpent = it->second.hashSpendingTx != 0;
+    return true;
+}
+
+void CCollateralWatch::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    if (tx.IsCoinBase() || tx.IsZerocoinSpend())
+        return;
+
+    {
+        LOCK(cs);
+        bool fWatched = false;
+        BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            if (mapWatched.count(txin.prevout)) {
+                fWatched = true;
+                break;
+            }
+        }
+        if (!fWatched)
+            return;
+    }
+
+    // Without a block the transaction either entered the mempool, or it left a disconnected
+    // block or the mempool; the mempool tells which. Asked outside cs to keep the watch a leaf lock.
+    const uint256 hashTx = tx.GetHash();
+    bool fSpent = pblock != NULL || mempool.exists(hashTx);
+
+    LOCK(cs);
+    BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+        std::map<COutPoint, CCollateralState>::iterator it = mapWatched.find(txin.prevout);
+        if (it == mapWatched.end())
+            continue;
+
+        if (fSpent) {
+            LogPrint("coralnode", "CCollateralWatch::SyncTransaction - collateral %s spent by %s\n", txin.prevout.ToStringShort(), hashTx.ToString());
+            it->second.hashSpendingTx = hashTx;
+            it->second.fMempoolSpend = pblock == NULL;
+        } else if (it->second.hashSpendingTx == hashTx) {
+            LogPrint("coralnode", "CCollateralWatch::SyncTransaction - spend of collateral %s by %s was dropped\n", txin.prevout.ToStringShort(), hashTx.ToString());
+            it->second.hashSpendingTx = 0;
+            it->second.fMempoolSpend = false;
+        }
+    }
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef CARITASCOIN_COLLATERALWATCH_H
+#define CARITASCOIN_COLLATERALWATCH_H
+
+#include "primitives/transaction.h"
+#include "sync.h"
+#include "uint256.h"
+#include "validationinterface.h"
+
+#include <map>
+#include <vector>
+
+/**
+ * Tracks whether the collateral outputs of a node list are spent, from the transactions
+ * that enter the mempool or get connected or disconnected, instead of probing every
+ * collateral against the mempool and the UTXO set on each check.
+ *
+ * A collateral is only reported once it was verified unspent by a probe, since spends
+ * made before it was watched (e.g. while the node was offline) are not seen here.
+ * Mempool spends can leave the mempool without a notification (expiry, trimming), so
+ * a mempool spend is dropped once its spending transaction is no longer there.
+ * The watch never takes locks other than its own, so it can be notified under cs_main.
+ */
+class CCollateralWatch : public CValidationInterface
+{
+public:
+    /** Start watching an outpoint; it stays unverified until SetVerified */
+    void Add(const COutPoint& outpoint);
+
+    /** Watch exactly these outpoints, keeping what is known about the ones already watched */
+    void Reset(const std::vector<COutPoint>& vOutpoints);
+
+    /** Record that a probe found the outpoint unspent */
+    void SetVerified(const COutPoint& outpoint);
+
+    /** Whether the outpoint is watched and verified; if so fSpent tells if it is spent */
+    bool GetStatus(const COutPoint& outpoint, bool& fSpent);
+
+protected:
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+
+private:
+    struct CCollateralState {
+        bool fVerified;
+        uint256 hashSpendingTx; // 0 while unspent
+        bool fMempoolSpend;     // hashSpendingTx was only seen in the mempool
+
+        CCollateralState() : fVerified(false), hashSpendingTx(0), fMempoolSpend(false) {}
+    };
+
+    mutable CCriticalSection cs;
+    std::map<COutPoint, CCollateralState> mapWatched;
+};
+
+#endif // CARITASCOIN_COLLATERALWATCH_H
@@ -5,6 +5,7 @@
 
 #include "coralnode-payments.h"
 #include "addrman.h"
+#include "cachefile.h"
 #include "coralnode-budget.h"
 #include "coralnode-sync.h"
 #include "coralnodeman.h"
@@ -42,27 +43,8 @@ bool CCoralnodePaymentDB::Write(const CCoralnodePayments& objToSave)
 {
     int64_t nStart = GetTimeMillis();
 
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-    ssObj << strMagicMessage;                   // coralnode cache file specific magic message
-    ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssObj << objToSave;
-    uint256 hash = Hash(ssObj.begin(), ssObj.end());
-    ssObj << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathDB.string());
-
-    // Write and commit header, data
-    try {
-        fileout << ssObj;
-    } catch (std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
-    }
-    fileout.fclose();
+    if (!WriteCacheFile(pathDB, strMagicMessage, objToSave))
+        return false;
 
     LogPrint("coralnode","Written info to mnpayments.dat  %dms\n", GetTimeMillis() - nStart);
 
@@ -72,72 +54,10 @@ bool CCoralnodePaymentDB::Write(const CCoralnodePayments& objToSave)
 CCoralnodePaymentDB::ReadResult CCoralnodePaymentDB::Read(CCoralnodePayments& objToLoad, bool fDryRun)
 {
     int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathDB.string());
-        return FileError;
-    }
-
-    // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathDB);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
-
-    CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
-
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
-
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
-    try {
-        // de-serialize file header (coralnode cache file specific magic message) and ..
-        ssObj >> strMagicMessageTmp;
-
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid coralnode payement cache magic message", __func__);
-            return IncorrectMagicMessage;
-        }
-
-
-        // de-serialize file header (network specific magic number) and ..
-        ssObj >> FLATDATA(pchMsgTmp);
-
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
-        }
 
-        // de-serialize data into CCoralnodePayments object
-        ssObj >> objToLoad;
-    } catch (std::exception& e) {
-        objToLoad.Clear();
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return IncorrectFormat;
-    }
+    ReadResult readResult = ReadCacheFile<CCoralnodePaymentDB>(pathDB, strMagicMessage, objToLoad);
+    if (readResult != Ok)
+        return readResult;
 
     LogPrint("coralnode","Loaded info from mnpayments.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrint("coralnode","  %s\n", objToLoad.ToString());
@@ -156,22 +76,7 @@ void DumpCoralnodePayments()
     int64_t nStart = GetTimeMillis();
 
     CCoralnodePaymentDB paymentdb;
-    CCoralnodePayments tempPayments;
-
-    LogPrint("coralnode","Verifying mnpayments.dat format...\n");
-    CCoralnodePaymentDB::ReadResult readResult = paymentdb.Read(tempPayments, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CCoralnodePaymentDB::FileError)
-        LogPrint("coralnode","Missing budgets file - mnpayments.dat, will try to recreate\n");
-    else if (readResult != CCoralnodePaymentDB::Ok) {
-        LogPrint("coralnode","Error reading mnpayments.dat: ");
-        if (readResult == CCoralnodePaymentDB::IncorrectFormat)
-            LogPrint("coralnode","magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint("coralnode","file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
+
     LogPrint("coralnode","Writting info to mnpayments.dat...\n");
     paymentdb.Write(coralnodePayments);
 
@@ -703,10 +608,59 @@ bool CCoralnodePayments::AddWinningCoralnode(CCoralnodePaymentWinner& winnerIn)
     }
 
     mapCoralnodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+    if (mapCoralnodeBlocks[winnerIn.nBlockHeight].HasPayeeWithVotes(winnerIn.payee, MNPAYMENTS_PAID_VOTES_REQUIRED))
+        AddPayeeHeight(winnerIn.payee, winnerIn.nBlockHeight);
 
     return true;
 }
 
+void CCoralnodePayments::AddPayeeHeight(const CScript& payee, int nBlockHeight)
+{
+    LOCK(cs_mapPayeeHeights);
+    mapPayeeHeights[payee].insert(nBlockHeight);
+}
+
+void CCoralnodePayments::RemovePayeeHeights(CCoralnodeBlockPayees& blockPayees)
+{
+    LOCK2(cs_vecPayments, cs_mapPayeeHeights);
+    BOOST_FOREACH (CCoralnodePayee& payee, blockPayees.vecPayments) {
+        std::map<CScript, std::set<int> >::iterator it = mapPayeeHeights.find(payee.scriptPubKey);
+        if (it == mapPayeeHeights.end()) continue;
+        it->second.erase(blockPayees.nBlockHeight);
+        if (it->second.empty())
+            mapPayeeHeights.erase(it);
+    }
+}
+
+void CCoralnodePayments::RebuildPayeeHeights()
+{
+    LOCK2(cs_vecPayments, cs_mapPayeeHeights);
+    mapPayeeHeights.clear();
+    for (std::map<int, CCoralnodeBlockPayees>::iterator it = mapCoralnodeBlocks.begin(); it != mapCoralnodeBlocks.end(); ++it) {
+        BOOST_FOREACH (CCoralnodePayee& payee, it->second.vecPayments) {
+            if (payee.nVotes >= MNPAYMENTS_PAID_VOTES_REQUIRED)
+                mapPayeeHeights[payee.scriptPubKey].insert(it->first);
+        }
+    }
+}
+
+bool CCoralnodePayments::GetLastPayeeHeight(const CScript& payee, int nHeightMin, int nHeightMax, int& nHeightRet) const
+{
+    LOCK(cs_mapPayeeHeights);
+
+    std::map<CScript, std::set<int> >::const_iterator it = mapPayeeHeights.find(payee);
+    if (it == mapPayeeHeights.end()) return false;
+
+    // the first height above the range, then step back into it
+    std::set<int>::const_iterator itHeight = it->second.upper_bound(nHeightMax);
+    if (itHeight == it->second.begin()) return false;
+    --itHeight;
+    if (*itHeight < nHeightMin) return false;
+
+    nHeightRet = *itHeight;
+    return true;
+}
+
 bool CCoralnodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
 {
     LOCK(cs_vecPayments);
@@ -834,7 +788,11 @@ void CCoralnodePayments::CleanPaymentList()
             LogPrint("mnpayments", "CCoralnodePayments::CleanPaymentList - Removing old Coralnode payment - block %d\n", winner.nBlockHeight);
             coralnodeSync.mapSeenSyncMNW.erase((*it).first);
             mapCoralnodePayeeVotes.erase(it++);
-            mapCoralnodeBlocks.erase(winner.nBlockHeight);
+            std::map<int, CCoralnodeBlockPayees>::iterator itBlock = mapCoralnodeBlocks.find(winner.nBlockHeight);
+            if (itBlock != mapCoralnodeBlocks.end()) {
+                RemovePayeeHeights(itBlock->second);
+                mapCoralnodeBlocks.erase(itBlock);
+            }
         } else {
             ++it;
         }
@@ -25,6 +25,7 @@ extern CCoralnodePayments coralnodePayments;
 
 #define MNPAYMENTS_SIGNATURES_REQUIRED 6
 #define MNPAYMENTS_SIGNATURES_TOTAL 10
+#define MNPAYMENTS_PAID_VOTES_REQUIRED 2
 
 void ProcessMessageCoralnodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 bool IsBlockPayeeValid(const CBlock& block, int nBlockHeight);
@@ -236,6 +237,15 @@ private:
     int nSyncedFromPeer;
     int nLastBlockHeight;
 
+    // heights at which a payee has at least MNPAYMENTS_PAID_VOTES_REQUIRED votes, kept in step
+    // with mapCoralnodeBlocks so the last payment of a coralnode is found without walking the chain
+    mutable CCriticalSection cs_mapPayeeHeights;
+    std::map<CScript, std::set<int> > mapPayeeHeights;
+
+    void AddPayeeHeight(const CScript& payee, int nBlockHeight);
+    void RemovePayeeHeights(CCoralnodeBlockPayees& blockPayees);
+    void RebuildPayeeHeights();
+
 public:
     std::map<uint256, CCoralnodePaymentWinner> mapCoralnodePayeeVotes;
     std::map<int, CCoralnodeBlockPayees> mapCoralnodeBlocks;
@@ -252,6 +262,7 @@ public:
         LOCK2(cs_mapCoralnodeBlocks, cs_mapCoralnodePayeeVotes);
         mapCoralnodeBlocks.clear();
         mapCoralnodePayeeVotes.clear();
+        RebuildPayeeHeights();
     }
 
     bool AddWinningCoralnode(CCoralnodePaymentWinner& winner);
@@ -261,6 +272,9 @@ public:
     void CleanPaymentList();
     int LastPayment(CCoralnode& mn);
 
+    /// The highest height in [nHeightMin, nHeightMax] at which payee was voted in with enough votes
+    bool GetLastPayeeHeight(const CScript& payee, int nHeightMin, int nHeightMax, int& nHeightRet) const;
+
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
     bool IsScheduled(CCoralnode& mn, int nNotBlockHeight);
@@ -295,6 +309,9 @@ public:
     {
         READWRITE(mapCoralnodePayeeVotes);
         READWRITE(mapCoralnodeBlocks);
+
+        if (ser_action.ForRead())
+            RebuildPayeeHeights();
     }
 };
 
@@ -138,8 +138,12 @@ CCoralnode::CCoralnode(const CCoralnodeBroadcast& mnb)
 bool CCoralnode::UpdateFromNewBroadcast(CCoralnodeBroadcast& mnb)
 {
     if (mnb.sigTime > sigTime) {
+        CPubKey pubKeyCoralnodeOld = pubKeyCoralnode;
+        CPubKey pubKeyCollateralAddressOld = pubKeyCollateralAddress;
         pubKeyCoralnode = mnb.pubKeyCoralnode;
         pubKeyCollateralAddress = mnb.pubKeyCollateralAddress;
+        if (pubKeyCoralnode != pubKeyCoralnodeOld || pubKeyCollateralAddress != pubKeyCollateralAddressOld)
+            mnodeman.UpdateKeyIndexes(*this, pubKeyCollateralAddressOld, pubKeyCoralnodeOld);
         sigTime = mnb.sigTime;
         sig = mnb.sig;
         protocolVersion = mnb.protocolVersion;
@@ -165,7 +169,6 @@ uint256 CCoralnode::CalculateScore(int mod, int64_t nBlockHeight)
     if (chainActive.Tip() == NULL) return 0;
 
     uint256 hash = 0;
-    uint256 aux = vin.prevout.hash + vin.prevout.n;
 
     if (!GetBlockHash(hash, nBlockHeight)) {
         LogPrint("coralnode","CalculateScore ERROR - nHeight %d - Returned 0\n", nBlockHeight);
@@ -174,10 +177,16 @@ uint256 CCoralnode::CalculateScore(int mod, int64_t nBlockHeight)
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     ss << hash;
-    uint256 hash2 = ss.GetHash();
+    uint256 hash2 = CHashWriter(ss).GetHash();
+
+    return CalculateScore(ss, hash2);
+}
 
-    CHashWriter ss2(SER_GETHASH, PROTOCOL_VERSION);
-    ss2 << hash;
+uint256 CCoralnode::CalculateScore(const CHashWriter& ssBlock, const uint256& hash2) const
+{
+    uint256 aux = vin.prevout.hash + vin.prevout.n;
+
+    CHashWriter ss2(ssBlock);
     ss2 << aux;
     uint256 hash3 = ss2.GetHash();
 
@@ -193,9 +202,21 @@ void CCoralnode::Check(bool forceCheck)
     if (!forceCheck && (GetTime() - lastTimeChecked < CORALNODE_CHECK_SECONDS)) return;
     lastTimeChecked = GetTime();
 
+    int prevState = activeState;
+    UpdateActiveState();
+
+    // the rankings of active coralnodes cached by the manager depend on this
+    if (activeState != prevState && !unitTest)
+        mnodeman.NotifyStateChange();
+}
 
-    //once spent, stop doing the checks
-    if (activeState == CORALNODE_VIN_SPENT) return;
+void CCoralnode::UpdateActiveState()
+{
+    bool fCollateralSpent = false;
+    bool fCollateralWatched = !unitTest && mnodeman.collateralWatch.GetStatus(vin.prevout, fCollateralSpent);
+
+    //once spent, stop doing the checks, unless the watch saw the spend disconnected or dropped from the mempool
+    if (activeState == CORALNODE_VIN_SPENT && !(fCollateralWatched && !fCollateralSpent)) return;
 
 
     if (!IsPingedWithin(CORALNODE_REMOVAL_SECONDS)) {
@@ -208,7 +229,13 @@ void CCoralnode::Check(bool forceCheck)
         return;
     }
 
-    if (!unitTest) {
+    if (fCollateralWatched) {
+        // spends of the collateral are pushed to the watch by validation
+        if (fCollateralSpent) {
+            activeState = CORALNODE_VIN_SPENT;
+            return;
+        }
+    } else if (!unitTest) {
         CValidationState state;
         CMutableTransaction tx = CMutableTransaction();
         CTxOut vout = CTxOut(0.1 * COIN, obfuScationPool.collateralPubKey);
@@ -224,17 +251,17 @@ void CCoralnode::Check(bool forceCheck)
                 return;
             }
         }
+
+        // from now on the watch knows about spends of a listed collateral
+        mnodeman.collateralWatch.SetVerified(vin.prevout);
     }
 
     activeState = CORALNODE_ENABLED; // OK
 }
 
-int64_t CCoralnode::SecondsSincePayment()
+int64_t CCoralnode::SecondsSincePayment(int nCountEnabled)
 {
-    CScript pubkeyScript;
-    pubkeyScript = GetScriptForDestination(pubKeyCollateralAddress.GetID());
-
-    int64_t sec = (GetAdjustedTime() - GetLastPaid());
+    int64_t sec = (GetAdjustedTime() - GetLastPaid(nCountEnabled));
     int64_t month = 60 * 60 * 24 * 30;
     if (sec < month) return sec; //if it's less than 30 days, give seconds
 
@@ -247,7 +274,7 @@ int64_t CCoralnode::SecondsSincePayment()
     return month + hash.GetCompact(false);
 }
 
-int64_t CCoralnode::GetLastPaid()
+int64_t CCoralnode::GetLastPaid(int nCountEnabled)
 {
     CBlockIndex* pindexPrev = chainActive.Tip();
     if (pindexPrev == NULL) return false;
@@ -263,36 +290,21 @@ int64_t CCoralnode::GetLastPaid()
     // use a deterministic offset to break a tie -- 2.5 minutes
     int64_t nOffset = hash.GetCompact(false) % 150;
 
-    if (chainActive.Tip() == NULL) return false;
-
-    const CBlockIndex* BlockReading = chainActive.Tip();
-
-    int nMnCount = mnodeman.CountEnabled() * 1.25;
-    int n = 0;
-    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
-        if (n >= nMnCount) {
-            return 0;
-        }
-        n++;
-
-        if (coralnodePayments.mapCoralnodeBlocks.count(BlockReading->nHeight)) {
-            /*
-                Search for this payee, with at least 2 votes. This will aid in consensus allowing the network
-                to converge on the same payees quickly, then keep the same schedule.
-            */
-            if (coralnodePayments.mapCoralnodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(mnpayee, 2)) {
-                return BlockReading->nTime + nOffset;
-            }
-        }
+    /*
+        Search the last nMnCount blocks for this payee, with at least 2 votes. This will aid in consensus allowing
+        the network to converge on the same payees quickly, then keep the same schedule.
+    */
+    if (nCountEnabled < 0) nCountEnabled = mnodeman.CountEnabled();
+    int nMnCount = nCountEnabled * 1.25;
+    int nHeightPaid;
+    if (!coralnodePayments.GetLastPayeeHeight(mnpayee, std::max(1, pindexPrev->nHeight - nMnCount + 1), pindexPrev->nHeight, nHeightPaid))
+        return 0;
 
-        if (BlockReading->pprev == NULL) {
-            assert(BlockReading);
-            break;
-        }
-        BlockReading = BlockReading->pprev;
-    }
+    // the time comes from the active chain, so the result follows reorgs
+    const CBlockIndex* pindexPaid = chainActive[nHeightPaid];
+    if (pindexPaid == NULL) return 0;
 
-    return 0;
+    return pindexPaid->nTime + nOffset;
 }
 
 std::string CCoralnode::GetStatus()
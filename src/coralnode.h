@@ -194,6 +194,8 @@ public:
     }
 
     uint256 CalculateScore(int mod = 1, int64_t nBlockHeight = 0);
+    /// Score against a block, with the block hash already written to ssBlock and hash2 = Hash(block hash)
+    uint256 CalculateScore(const CHashWriter& ssBlock, const uint256& hash2) const;
 
     ADD_SERIALIZE_METHODS;
 
@@ -220,7 +222,8 @@ public:
         READWRITE(nLastScanningErrorBlockHeight);
     }
 
-    int64_t SecondsSincePayment();
+    /// nCountEnabled is the number of enabled coralnodes, -1 to count them
+    int64_t SecondsSincePayment(int nCountEnabled = -1);
 
     bool UpdateFromNewBroadcast(CCoralnodeBroadcast& mnb);
 
@@ -232,6 +235,7 @@ public:
     }
 
     void Check(bool forceCheck = false);
+    void UpdateActiveState();
 
     bool IsBroadcastedWithin(int seconds)
     {
@@ -283,7 +287,7 @@ public:
         return strStatus;
     }
 
-    int64_t GetLastPaid();
+    int64_t GetLastPaid(int nCountEnabled = -1);
     bool IsValidNetAddr();
 };
 
@@ -5,6 +5,7 @@
 
 #include "activecoralnode.h"
 #include "addrman.h"
+#include "cachefile.h"
 #include "coralnode.h"
 #include "coralnodeman.h"
 #include "main.h"
@@ -35,6 +36,14 @@ struct CompareScoreTxIn {
     }
 };
 
+struct CompareScorePosition {
+    bool operator()(const pair<int64_t, size_t>& t1,
+        const pair<int64_t, size_t>& t2) const
+    {
+        return t1.first < t2.first;
+    }
+};
+
 struct CompareScoreMN {
     bool operator()(const pair<int64_t, CCoralnode>& t1,
         const pair<int64_t, CCoralnode>& t2) const
@@ -57,28 +66,8 @@ bool CCoralnodeDB::Write(const CCoralnodeMan& mnodemanToSave)
 {
     int64_t nStart = GetTimeMillis();
 
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssCoralnodes(SER_DISK, CLIENT_VERSION);
-    ssCoralnodes << strMagicMessage;                   // coralnode cache file specific magic message
-    ssCoralnodes << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssCoralnodes << mnodemanToSave;
-    uint256 hash = Hash(ssCoralnodes.begin(), ssCoralnodes.end());
-    ssCoralnodes << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathMN.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathMN.string());
-
-    // Write and commit header, data
-    try {
-        fileout << ssCoralnodes;
-    } catch (std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
-    }
-    //    FileCommit(fileout);
-    fileout.fclose();
+    if (!WriteCacheFile(pathMN, strMagicMessage, mnodemanToSave))
+        return false;
 
     LogPrint("coralnode", "Written info to mncache.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrint("coralnode", "  %s\n", mnodemanToSave.ToString());
@@ -89,71 +78,10 @@ bool CCoralnodeDB::Write(const CCoralnodeMan& mnodemanToSave)
 CCoralnodeDB::ReadResult CCoralnodeDB::Read(CCoralnodeMan& mnodemanToLoad, bool fDryRun)
 {
     int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fopen(pathMN.string().c_str(), "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathMN.string());
-        return FileError;
-    }
 
-    // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathMN);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
-
-    CDataStream ssCoralnodes(vchData, SER_DISK, CLIENT_VERSION);
-
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssCoralnodes.begin(), ssCoralnodes.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
-
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
-    try {
-        // de-serialize file header (coralnode cache file specific magic message) and ..
-
-        ssCoralnodes >> strMagicMessageTmp;
-
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid coralnode cache magic message", __func__);
-            return IncorrectMagicMessage;
-        }
-
-        // de-serialize file header (network specific magic number) and ..
-        ssCoralnodes >> FLATDATA(pchMsgTmp);
-
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
-        }
-        // de-serialize data into CCoralnodeMan object
-        ssCoralnodes >> mnodemanToLoad;
-    } catch (std::exception& e) {
-        mnodemanToLoad.Clear();
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return IncorrectFormat;
-    }
+    ReadResult readResult = ReadCacheFile<CCoralnodeDB>(pathMN, strMagicMessage, mnodemanToLoad);
+    if (readResult != Ok)
+        return readResult;
 
     LogPrint("coralnode", "Loaded info from mncache.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrint("coralnode", "  %s\n", mnodemanToLoad.ToString());
@@ -172,22 +100,7 @@ void DumpCoralnodes()
     int64_t nStart = GetTimeMillis();
 
     CCoralnodeDB mndb;
-    CCoralnodeMan tempMnodeman;
-
-    LogPrint("coralnode", "Verifying mncache.dat format...\n");
-    CCoralnodeDB::ReadResult readResult = mndb.Read(tempMnodeman, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CCoralnodeDB::FileError)
-        LogPrint("coralnode", "Missing coralnode cache file - mncache.dat, will try to recreate\n");
-    else if (readResult != CCoralnodeDB::Ok) {
-        LogPrint("coralnode", "Error reading mncache.dat: ");
-        if (readResult == CCoralnodeDB::IncorrectFormat)
-            LogPrint("coralnode", "magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint("coralnode", "file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
+
     LogPrint("coralnode", "Writting info to mncache.dat...\n");
     mndb.Write(mnodeman);
 
@@ -197,6 +110,68 @@ void DumpCoralnodes()
 CCoralnodeMan::CCoralnodeMan()
 {
     nDsqCount = 0;
+    nStateChanges = 0;
+}
+
+static void IndexInsert(std::vector<size_t>& vPos, size_t nPos)
+{
+    vPos.insert(std::lower_bound(vPos.begin(), vPos.end(), nPos), nPos);
+}
+
+template <typename Map, typename Key>
+static void IndexErase(Map& mapIndex, const Key& key, size_t nPos)
+{
+    typename Map::iterator it = mapIndex.find(key);
+    if (it == mapIndex.end())
+        return;
+    std::vector<size_t>& vPos = it->second;
+    vPos.erase(std::remove(vPos.begin(), vPos.end(), nPos), vPos.end());
+    if (vPos.empty())
+        mapIndex.erase(it);
+}
+
+void CCoralnodeMan::AddToIndexes(size_t nPos)
+{
+    const CCoralnode& mn = vCoralnodes[nPos];
+    IndexInsert(mapIndexByVin[mn.vin.prevout], nPos);
+    IndexInsert(mapIndexByPayee[mn.pubKeyCollateralAddress.GetID()], nPos);
+    IndexInsert(mapIndexByPubKey[mn.pubKeyCoralnode.GetID()], nPos);
+    collateralWatch.Add(mn.vin.prevout);
+}
+
+void CCoralnodeMan::RebuildIndexes()
+{
+    LOCK(cs);
+    ClearScoreCache();
+    mapIndexByVin.clear();
+    mapIndexByPayee.clear();
+    mapIndexByPubKey.clear();
+    for (size_t nPos = 0; nPos < vCoralnodes.size(); nPos++)
+        AddToIndexes(nPos);
+
+    std::vector<COutPoint> vCollaterals;
+    BOOST_FOREACH (const CCoralnode& mn, vCoralnodes)
+        vCollaterals.push_back(mn.vin.prevout);
+    collateralWatch.Reset(vCollaterals);
+}
+
+void CCoralnodeMan::UpdateKeyIndexes(const CCoralnode& mn, const CPubKey& pubKeyCollateralAddressOld, const CPubKey& pubKeyCoralnodeOld)
+{
+    LOCK(cs);
+
+    // only entries of the list are indexed
+    if (vCoralnodes.empty() || &mn < &vCoralnodes.front() || &mn > &vCoralnodes.back())
+        return;
+    size_t nPos = &mn - &vCoralnodes.front();
+
+    if (mn.pubKeyCollateralAddress != pubKeyCollateralAddressOld) {
+        IndexErase(mapIndexByPayee, pubKeyCollateralAddressOld.GetID(), nPos);
+        IndexInsert(mapIndexByPayee[mn.pubKeyCollateralAddress.GetID()], nPos);
+    }
+    if (mn.pubKeyCoralnode != pubKeyCoralnodeOld) {
+        IndexErase(mapIndexByPubKey, pubKeyCoralnodeOld.GetID(), nPos);
+        IndexInsert(mapIndexByPubKey[mn.pubKeyCoralnode.GetID()], nPos);
+    }
 }
 
 bool CCoralnodeMan::Add(CCoralnode& mn)
@@ -210,6 +185,8 @@ bool CCoralnodeMan::Add(CCoralnode& mn)
     if (pmn == NULL) {
         LogPrint("coralnode", "CCoralnodeMan: Adding new Coralnode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
         vCoralnodes.push_back(mn);
+        AddToIndexes(vCoralnodes.size() - 1);
+        ClearScoreCache();
         return true;
     }
 
@@ -248,6 +225,7 @@ void CCoralnodeMan::CheckAndRemove(bool forceExpiredRemoval)
     LOCK(cs);
 
     //remove inactive and outdated
+    size_t nSizeBefore = vCoralnodes.size();
     vector<CCoralnode>::iterator it = vCoralnodes.begin();
     while (it != vCoralnodes.end()) {
         if ((*it).activeState == CCoralnode::CORALNODE_REMOVE ||
@@ -285,6 +263,10 @@ void CCoralnodeMan::CheckAndRemove(bool forceExpiredRemoval)
         }
     }
 
+    // positions behind a removed entry have shifted
+    if (vCoralnodes.size() != nSizeBefore)
+        RebuildIndexes();
+
     // check who's asked for the Coralnode list
     map<CNetAddr, int64_t>::iterator it1 = mAskedUsForCoralnodeList.begin();
     while (it1 != mAskedUsForCoralnodeList.end()) {
@@ -341,6 +323,11 @@ void CCoralnodeMan::Clear()
 {
     LOCK(cs);
     vCoralnodes.clear();
+    mapIndexByVin.clear();
+    mapIndexByPayee.clear();
+    mapIndexByPubKey.clear();
+    collateralWatch.Reset(std::vector<COutPoint>());
+    ClearScoreCache();
     mAskedUsForCoralnodeList.clear();
     mWeAskedForCoralnodeList.clear();
     mWeAskedForCoralnodeListEntry.clear();
@@ -439,11 +426,21 @@ void CCoralnodeMan::DsegUpdate(CNode* pnode)
 CCoralnode* CCoralnodeMan::Find(const CScript& payee)
 {
     LOCK(cs);
-    CScript payee2;
 
-    BOOST_FOREACH (CCoralnode& mn, vCoralnodes) {
-        payee2 = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
-        if (payee2 == payee)
+    // coralnodes are paid to the key id of their collateral address
+    CTxDestination dest;
+    if (!ExtractDestination(payee, dest))
+        return NULL;
+    const CKeyID* keyID = boost::get<CKeyID>(&dest);
+    if (!keyID)
+        return NULL;
+
+    boost::unordered_map<CKeyID, CoralnodePositions, CCoralnodeIndexHasher>::const_iterator it = mapIndexByPayee.find(*keyID);
+    if (it == mapIndexByPayee.end())
+        return NULL;
+    BOOST_FOREACH (size_t nPos, it->second) {
+        CCoralnode& mn = vCoralnodes[nPos];
+        if (GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()) == payee)
             return &mn;
     }
     return NULL;
@@ -453,11 +450,10 @@ CCoralnode* CCoralnodeMan::Find(const CTxIn& vin)
 {
     LOCK(cs);
 
-    BOOST_FOREACH (CCoralnode& mn, vCoralnodes) {
-        if (mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    boost::unordered_map<COutPoint, CoralnodePositions, CCoralnodeIndexHasher>::const_iterator it = mapIndexByVin.find(vin.prevout);
+    if (it == mapIndexByVin.end())
+        return NULL;
+    return &vCoralnodes[it->second.front()];
 }
 
 
@@ -465,7 +461,11 @@ CCoralnode* CCoralnodeMan::Find(const CPubKey& pubKeyCoralnode)
 {
     LOCK(cs);
 
-    BOOST_FOREACH (CCoralnode& mn, vCoralnodes) {
+    boost::unordered_map<CKeyID, CoralnodePositions, CCoralnodeIndexHasher>::const_iterator it = mapIndexByPubKey.find(pubKeyCoralnode.GetID());
+    if (it == mapIndexByPubKey.end())
+        return NULL;
+    BOOST_FOREACH (size_t nPos, it->second) {
+        CCoralnode& mn = vCoralnodes[nPos];
         if (mn.pubKeyCoralnode == pubKeyCoralnode)
             return &mn;
     }
@@ -503,7 +503,7 @@ CCoralnode* CCoralnodeMan::GetNextCoralnodeInQueueForPayment(int nBlockHeight, b
         //make sure it has as many confirmations as there are coralnodes
         if (mn.GetCoralnodeInputAge() < nMnCount) continue;
 
-        vecCoralnodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(), mn.vin));
+        vecCoralnodeLastPaid.push_back(make_pair(mn.SecondsSincePayment(nMnCount), mn.vin));
     }
 
     nCount = (int)vecCoralnodeLastPaid.size();
@@ -518,6 +518,9 @@ CCoralnode* CCoralnodeMan::GetNextCoralnodeInQueueForPayment(int nBlockHeight, b
     //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
     //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
     //  -- (chance per block * chances before IsScheduled will fire)
+    const std::vector<uint256>* pvScores = GetScores(nBlockHeight - 100);
+    if (!pvScores) return NULL;
+
     int nTenthNetwork = CountEnabled() / 10;
     int nCountTenth = 0;
     uint256 nHigh = 0;
@@ -525,7 +528,7 @@ CCoralnode* CCoralnodeMan::GetNextCoralnodeInQueueForPayment(int nBlockHeight, b
         CCoralnode* pmn = Find(s.second);
         if (!pmn) break;
 
-        uint256 n = pmn->CalculateScore(1, nBlockHeight - 100);
+        uint256 n = (*pvScores)[pmn - &vCoralnodes[0]];
         if (n > nHigh) {
             nHigh = n;
             pBestCoralnode = pmn;
@@ -568,19 +571,127 @@ CCoralnode* CCoralnodeMan::FindRandomNotInVec(std::vector<CTxIn>& vecToExclude,
     return NULL;
 }
 
+void CCoralnodeMan::ClearScoreCache()
+{
+    LOCK(cs);
+    mapScoreCache.clear();
+    mapRankingCache.clear();
+}
+
+void CCoralnodeMan::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    ClearScoreCache();
+}
+
+const std::vector<uint256>* CCoralnodeMan::GetScores(int64_t nBlockHeight)
+{
+    LOCK(cs);
+
+    //make sure we know about this block
+    uint256 hash = 0;
+    if (!GetBlockHash(hash, nBlockHeight)) return NULL;
+
+    std::map<int64_t, CoralnodeScores>::iterator it = mapScoreCache.find(nBlockHeight);
+    if (it != mapScoreCache.end() && it->second.hashBlock == hash)
+        return &it->second.vScores;
+
+    if (mapScoreCache.size() >= CORALNODES_SCORE_CACHE_HEIGHTS) {
+        mapScoreCache.clear();
+        mapRankingCache.clear();
+    } else if (it != mapScoreCache.end()) {
+        // the block at this height changed, the rankings built from its old scores are stale
+        std::map<CoralnodeRankingKey, CoralnodeRanking>::iterator itRanking = mapRankingCache.begin();
+        while (itRanking != mapRankingCache.end()) {
+            if (itRanking->first.nBlockHeight == nBlockHeight)
+                mapRankingCache.erase(itRanking++);
+            else
+                ++itRanking;
+        }
+    }
+
+    // the block part of the score is the same for every entry
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << hash;
+    uint256 hash2 = CHashWriter(ss).GetHash();
+
+    CoralnodeScores& scores = mapScoreCache[nBlockHeight];
+    scores.hashBlock = hash;
+    scores.vScores.clear();
+    scores.vScores.reserve(vCoralnodes.size());
+    BOOST_FOREACH (const CCoralnode& mn, vCoralnodes)
+        scores.vScores.push_back(mn.CalculateScore(ss, hash2));
+
+    return &scores.vScores;
+}
+
+const CCoralnodeMan::CoralnodeRanking* CCoralnodeMan::GetRanking(int64_t nBlockHeight, int minProtocol, bool fOnlyActive, bool fMinimumAge)
+{
+    LOCK(cs);
+
+    const std::vector<uint256>* pvScores = GetScores(nBlockHeight);
+    if (!pvScores) return NULL;
+
+    // entries due for a check may change state, which invalidates the rankings of active entries
+    if (fOnlyActive) {
+        BOOST_FOREACH (CCoralnode& mn, vCoralnodes)
+            mn.Check();
+    }
+
+    CoralnodeRankingKey key = {nBlockHeight, minProtocol, fOnlyActive, fMinimumAge};
+    std::map<CoralnodeRankingKey, CoralnodeRanking>::iterator it = mapRankingCache.find(key);
+    if (it != mapRankingCache.end() && it->second.nStateChanges == nStateChanges &&
+        GetTime() - it->second.nTimeCreated < CORALNODE_CHECK_SECONDS)
+        return &it->second;
+
+    unsigned int nStateChangesBefore = nStateChanges;
+    std::vector<pair<int64_t, size_t> > vecCoralnodeScores;
+    for (size_t nPos = 0; nPos < vCoralnodes.size(); nPos++) {
+        CCoralnode& mn = vCoralnodes[nPos];
+        if (mn.protocolVersion < minProtocol) continue; // Skip obsolete versions
+
+        if (fMinimumAge && GetAdjustedTime() - mn.sigTime < MN_WINNER_MINIMUM_AGE)
+            continue; // Skip coralnodes younger than (default) 1 hour
+
+        if (fOnlyActive) {
+            mn.Check();
+            if (!mn.IsEnabled()) continue;
+        }
+
+        vecCoralnodeScores.push_back(make_pair((*pvScores)[nPos].GetCompact(false), nPos));
+    }
+
+    sort(vecCoralnodeScores.rbegin(), vecCoralnodeScores.rend(), CompareScorePosition());
+
+    CoralnodeRanking& ranking = mapRankingCache[key];
+    ranking.nTimeCreated = GetTime();
+    ranking.nStateChanges = nStateChangesBefore;
+    ranking.vPositions.clear();
+    ranking.mapRanks.clear();
+    BOOST_FOREACH (PAIRTYPE(int64_t, size_t) & s, vecCoralnodeScores) {
+        ranking.vPositions.push_back(s.second);
+        ranking.mapRanks.insert(make_pair(vCoralnodes[s.second].vin.prevout, (int)ranking.vPositions.size()));
+    }
+
+    return &ranking;
+}
+
 CCoralnode* CCoralnodeMan::GetCurrentCoralNode(int mod, int64_t nBlockHeight, int minProtocol)
 {
+    LOCK(cs);
+
     int64_t score = 0;
     CCoralnode* winner = NULL;
 
+    const std::vector<uint256>* pvScores = GetScores(nBlockHeight);
+    if (!pvScores) return NULL;
+
     // scan for winner
-    BOOST_FOREACH (CCoralnode& mn, vCoralnodes) {
+    for (size_t nPos = 0; nPos < vCoralnodes.size(); nPos++) {
+        CCoralnode& mn = vCoralnodes[nPos];
         mn.Check();
         if (mn.protocolVersion < minProtocol || !mn.IsEnabled()) continue;
 
-        // calculate the score for each Coralnode
-        uint256 n = mn.CalculateScore(mod, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+        int64_t n2 = (*pvScores)[nPos].GetCompact(false);
 
         // determine the winner
         if (n2 > score) {
@@ -594,62 +705,30 @@ CCoralnode* CCoralnodeMan::GetCurrentCoralNode(int mod, int64_t nBlockHeight, in
 
 int CCoralnodeMan::GetCoralnodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecCoralnodeScores;
-    int64_t nCoralnode_Min_Age = MN_WINNER_MINIMUM_AGE;
-    int64_t nCoralnode_Age = 0;
-
-    //make sure we know about this block
-    uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return -1;
-
-    // scan for winner
-    BOOST_FOREACH (CCoralnode& mn, vCoralnodes) {
-        if (mn.protocolVersion < minProtocol) {
-            LogPrint("coralnode", "Skipping Coralnode with obsolete version %d\n", mn.protocolVersion);
-            continue; // Skip obsolete versions
-        }
-
-        if (IsSporkActive(SPORK_8_CORALNODE_PAYMENT_ENFORCEMENT)) {
-            nCoralnode_Age = GetAdjustedTime() - mn.sigTime;
-            if ((nCoralnode_Age) < nCoralnode_Min_Age) {
-                if (fDebug) LogPrint("coralnode", "Skipping just activated Coralnode. Age: %ld\n", nCoralnode_Age);
-                continue; // Skip coralnodes younger than (default) 1 hour
-            }
-        }
-        if (fOnlyActive) {
-            mn.Check();
-            if (!mn.IsEnabled()) continue;
-        }
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecCoralnodeScores.push_back(make_pair(n2, mn.vin));
-    }
+    LOCK(cs);
 
-    sort(vecCoralnodeScores.rbegin(), vecCoralnodeScores.rend(), CompareScoreTxIn());
+    const CoralnodeRanking* pranking = GetRanking(nBlockHeight, minProtocol, fOnlyActive, IsSporkActive(SPORK_8_CORALNODE_PAYMENT_ENFORCEMENT));
+    if (!pranking) return -1;
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecCoralnodeScores) {
-        rank++;
-        if (s.second.prevout == vin.prevout) {
-            return rank;
-        }
-    }
+    boost::unordered_map<COutPoint, int, CCoralnodeIndexHasher>::const_iterator it = pranking->mapRanks.find(vin.prevout);
+    if (it == pranking->mapRanks.end()) return -1;
 
-    return -1;
+    return it->second;
 }
 
 std::vector<pair<int, CCoralnode> > CCoralnodeMan::GetCoralnodeRanks(int64_t nBlockHeight, int minProtocol)
 {
+    LOCK(cs);
+
     std::vector<pair<int64_t, CCoralnode> > vecCoralnodeScores;
     std::vector<pair<int, CCoralnode> > vecCoralnodeRanks;
 
-    //make sure we know about this block
-    uint256 hash = 0;
-    if (!GetBlockHash(hash, nBlockHeight)) return vecCoralnodeRanks;
+    const std::vector<uint256>* pvScores = GetScores(nBlockHeight);
+    if (!pvScores) return vecCoralnodeRanks;
 
     // scan for winner
-    BOOST_FOREACH (CCoralnode& mn, vCoralnodes) {
+    for (size_t nPos = 0; nPos < vCoralnodes.size(); nPos++) {
+        CCoralnode& mn = vCoralnodes[nPos];
         mn.Check();
 
         if (mn.protocolVersion < minProtocol) continue;
@@ -659,8 +738,7 @@ std::vector<pair<int, CCoralnode> > CCoralnodeMan::GetCoralnodeRanks(int64_t nBl
             continue;
         }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+        int64_t n2 = (*pvScores)[nPos].GetCompact(false);
 
         vecCoralnodeScores.push_back(make_pair(n2, mn));
     }
@@ -678,33 +756,12 @@ std::vector<pair<int, CCoralnode> > CCoralnodeMan::GetCoralnodeRanks(int64_t nBl
 
 CCoralnode* CCoralnodeMan::GetCoralnodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn> > vecCoralnodeScores;
-
-    // scan for winner
-    BOOST_FOREACH (CCoralnode& mn, vCoralnodes) {
-        if (mn.protocolVersion < minProtocol) continue;
-        if (fOnlyActive) {
-            mn.Check();
-            if (!mn.IsEnabled()) continue;
-        }
-
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecCoralnodeScores.push_back(make_pair(n2, mn.vin));
-    }
+    LOCK(cs);
 
-    sort(vecCoralnodeScores.rbegin(), vecCoralnodeScores.rend(), CompareScoreTxIn());
+    const CoralnodeRanking* pranking = GetRanking(nBlockHeight, minProtocol, fOnlyActive, false);
+    if (!pranking || nRank < 1 || nRank > (int)pranking->vPositions.size()) return NULL;
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CTxIn) & s, vecCoralnodeScores) {
-        rank++;
-        if (rank == nRank) {
-            return Find(s.second);
-        }
-    }
-
-    return NULL;
+    return &vCoralnodes[pranking->vPositions[nRank - 1]];
 }
 
 void CCoralnodeMan::ProcessCoralnodeConnections()
@@ -723,6 +780,42 @@ void CCoralnodeMan::ProcessCoralnodeConnections()
     }
 }
 
+bool CCoralnodeMan::HaveSeenBroadcast(const uint256& hash) const
+{
+    TRY_LOCK(cs_process_message, lockProcess);
+    return lockProcess && mapSeenCoralnodeBroadcast.count(hash);
+}
+
+bool CCoralnodeMan::HaveSeenPing(const uint256& hash) const
+{
+    TRY_LOCK(cs_process_message, lockProcess);
+    return lockProcess && mapSeenCoralnodePing.count(hash);
+}
+
+bool CCoralnodeMan::GetSeenBroadcast(const uint256& hash, CCoralnodeBroadcast& fnb, bool& fFound) const
+{
+    TRY_LOCK(cs_process_message, lockProcess);
+    if (!lockProcess)
+        return false;
+    std::map<uint256, CCoralnodeBroadcast>::const_iterator it = mapSeenCoralnodeBroadcast.find(hash);
+    fFound = it != mapSeenCoralnodeBroadcast.end();
+    if (fFound)
+        fnb = it->second;
+    return true;
+}
+
+bool CCoralnodeMan::GetSeenPing(const uint256& hash, CCoralnodePing& fnp, bool& fFound) const
+{
+    TRY_LOCK(cs_process_message, lockProcess);
+    if (!lockProcess)
+        return false;
+    std::map<uint256, CCoralnodePing>::const_iterator it = mapSeenCoralnodePing.find(hash);
+    fFound = it != mapSeenCoralnodePing.end();
+    if (fFound)
+        fnp = it->second;
+    return true;
+}
+
 void CCoralnodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 {
     if (fLiteMode) return; //disable all Obfuscation/Coralnode related functionality
@@ -1163,6 +1256,7 @@ void CCoralnodeMan::Remove(CTxIn vin)
         if ((*it).vin == vin) {
             LogPrint("coralnode", "CCoralnodeMan: Removing Coralnode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
             vCoralnodes.erase(it);
+            RebuildIndexes();
             break;
         }
         ++it;
@@ -7,15 +7,21 @@
 #define CORALNODEMAN_H
 
 #include "base58.h"
+#include "collateralwatch.h"
 #include "key.h"
 #include "main.h"
 #include "coralnode.h"
 #include "net.h"
 #include "sync.h"
 #include "util.h"
+#include "validationinterface.h"
+
+#include <atomic>
+#include <boost/unordered_map.hpp>
 
 #define CORALNODES_DUMP_SECONDS (15 * 60)
 #define CORALNODES_DSEG_SECONDS (3 * 60 * 60)
+#define CORALNODES_SCORE_CACHE_HEIGHTS 64
 
 using namespace std;
 
@@ -48,9 +54,17 @@ public:
     ReadResult Read(CCoralnodeMan& mnodemanToLoad, bool fDryRun = false);
 };
 
-class CCoralnodeMan
+/** Hasher for the lookup indexes of CCoralnodeMan */
+struct CCoralnodeIndexHasher {
+    size_t operator()(const COutPoint& prevout) const { return prevout.hash.GetLow64() ^ prevout.n; }
+    size_t operator()(const CKeyID& keyID) const { return keyID.GetLow64(); }
+};
+
+class CCoralnodeMan : public CValidationInterface
 {
 private:
+    typedef std::vector<size_t> CoralnodePositions;
+
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
@@ -66,6 +80,56 @@ private:
     // which Coralnodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForCoralnodeListEntry;
 
+    // positions in vCoralnodes by collateral outpoint, payee (collateral key id) and coralnode key id,
+    // in vector order so that a lookup finds the same entry as a scan of the vector
+    boost::unordered_map<COutPoint, CoralnodePositions, CCoralnodeIndexHasher> mapIndexByVin;
+    boost::unordered_map<CKeyID, CoralnodePositions, CCoralnodeIndexHasher> mapIndexByPayee;
+    boost::unordered_map<CKeyID, CoralnodePositions, CCoralnodeIndexHasher> mapIndexByPubKey;
+
+    void AddToIndexes(size_t nPos);
+    void RebuildIndexes();
+
+    /** Scores of all entries against the block of one height, in vCoralnodes order */
+    struct CoralnodeScores {
+        uint256 hashBlock;
+        std::vector<uint256> vScores;
+    };
+
+    /** Entries passing the rank filters, best score first */
+    struct CoralnodeRanking {
+        int64_t nTimeCreated;
+        unsigned int nStateChanges;
+        std::vector<size_t> vPositions;
+        boost::unordered_map<COutPoint, int, CCoralnodeIndexHasher> mapRanks;
+    };
+
+    struct CoralnodeRankingKey {
+        int64_t nBlockHeight;
+        int minProtocol;
+        bool fOnlyActive;
+        bool fMinimumAge;
+
+        bool operator<(const CoralnodeRankingKey& other) const
+        {
+            if (nBlockHeight != other.nBlockHeight) return nBlockHeight < other.nBlockHeight;
+            if (minProtocol != other.minProtocol) return minProtocol < other.minProtocol;
+            if (fOnlyActive != other.fOnlyActive) return fOnlyActive < other.fOnlyActive;
+            return fMinimumAge < other.fMinimumAge;
+        }
+    };
+
+    // scores and rankings by height, valid until the tip or the list changes; rankings also
+    // depend on the state of the entries, they are dropped when an entry changes state and
+    // recomputed every CORALNODE_CHECK_SECONDS for the time based filters
+    std::map<int64_t, CoralnodeScores> mapScoreCache;
+    std::map<CoralnodeRankingKey, CoralnodeRanking> mapRankingCache;
+    // bumped whenever an entry changes state; entries are checked without cs held
+    std::atomic<unsigned int> nStateChanges;
+
+    const std::vector<uint256>* GetScores(int64_t nBlockHeight);
+    const CoralnodeRanking* GetRanking(int64_t nBlockHeight, int minProtocol, bool fOnlyActive, bool fMinimumAge);
+    void ClearScoreCache();
+
 public:
     // Keep track of all broadcasts I've seen
     map<uint256, CCoralnodeBroadcast> mapSeenCoralnodeBroadcast;
@@ -75,6 +139,9 @@ public:
     // keep track of dsq count to prevent coralnodes from gaming obfuscation queue
     int64_t nDsqCount;
 
+    // spends of the collateral of the listed coralnodes
+    CCollateralWatch collateralWatch;
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -89,6 +156,9 @@ public:
 
         READWRITE(mapSeenCoralnodeBroadcast);
         READWRITE(mapSeenCoralnodePing);
+
+        if (ser_action.ForRead())
+            RebuildIndexes();
     }
 
     CCoralnodeMan();
@@ -103,6 +173,9 @@ public:
     /// Check all Coralnodes
     void Check();
 
+    /// Called by an entry whose state changed, invalidates the cached rankings
+    void NotifyStateChange() { nStateChanges++; }
+
     /// Check all Coralnodes and remove inactive
     void CheckAndRemove(bool forceExpiredRemoval = false);
 
@@ -143,6 +216,15 @@ public:
 
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 
+    /// Whether a broadcast or ping was seen. Callers may hold cs_main, which ProcessMessage takes under
+    /// cs_process_message, so they get false while a message is being processed
+    bool HaveSeenBroadcast(const uint256& hash) const;
+    bool HaveSeenPing(const uint256& hash) const;
+    /// Copy a seen broadcast or ping for getdata into fnb/fnp and set fFound. Return false without
+    /// waiting while a message is being processed, for the same reason
+    bool GetSeenBroadcast(const uint256& hash, CCoralnodeBroadcast& fnb, bool& fFound) const;
+    bool GetSeenPing(const uint256& hash, CCoralnodePing& fnp, bool& fFound) const;
+
     /// Return the number of (unique) Coralnodes
     int size() { return vCoralnodes.size(); }
 
@@ -153,8 +235,14 @@ public:
 
     void Remove(CTxIn vin);
 
+    /// Update the lookup indexes after the keys of an entry were changed by a new broadcast
+    void UpdateKeyIndexes(const CCoralnode& mn, const CPubKey& pubKeyCollateralAddressOld, const CPubKey& pubKeyCoralnodeOld);
+
     /// Update coralnode list and maps using provided CCoralnodeBroadcast
     void UpdateCoralnodeList(CCoralnodeBroadcast mnb);
+
+    /// Drop the cached scores and ranks after the chain tip changed, called through CValidationInterface
+    void UpdatedBlockTip(const CBlockIndex* pindex);
 };
 
 #endif
@@ -7,6 +7,7 @@
 #include <boost/assign/list_of.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include "crypto/common.h"
 #include "db.h"
 #include "kernel.h"
 #include "script/interpreter.h"
@@ -33,6 +34,17 @@ unsigned int getIntervalVersion(bool fTestNet)
 static std::map<int, unsigned int> mapStakeModifierCheckpoints =
     boost::assign::map_list_of(0, 0xfd11f4e7u);
 
+// Kernel stake modifiers already looked up, by source block. An entry stays valid for as
+// long as the block where the lookup stopped is on the active chain.
+struct CStakeModifierCacheEntry {
+    uint64_t nStakeModifier;
+    int nStakeModifierHeight;
+    int64_t nStakeModifierTime;
+    const CBlockIndex* pindexEnd;
+};
+static CCriticalSection cs_stakeModifierCache;
+static std::map<uint256, CStakeModifierCacheEntry> mapStakeModifierCache;
+
 // Get time weight
 int64_t GetWeight(int64_t nIntervalBeginning, int64_t nIntervalEnd)
 {
@@ -248,6 +260,21 @@ bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int
     if (!mapBlockIndex.count(hashBlockFrom))
         return error("GetKernelStakeModifier() : block not indexed");
     const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
+
+    {
+        LOCK(cs_stakeModifierCache);
+        std::map<uint256, CStakeModifierCacheEntry>::const_iterator it = mapStakeModifierCache.find(hashBlockFrom);
+        if (it != mapStakeModifierCache.end()) {
+            const CStakeModifierCacheEntry& entry = it->second;
+            if (entry.pindexEnd == pindexFrom || chainActive.Contains(entry.pindexEnd)) {
+                nStakeModifier = entry.nStakeModifier;
+                nStakeModifierHeight = entry.nStakeModifierHeight;
+                nStakeModifierTime = entry.nStakeModifierTime;
+                return true;
+            }
+        }
+    }
+
     nStakeModifierHeight = pindexFrom->nHeight;
     nStakeModifierTime = pindexFrom->GetBlockTime();
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
@@ -269,9 +296,42 @@ bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int
         }
     }
     nStakeModifier = pindex->nStakeModifier;
+
+    LOCK(cs_stakeModifierCache);
+    if (mapStakeModifierCache.size() >= MAX_STAKE_MODIFIER_CACHE_SIZE)
+        mapStakeModifierCache.clear();
+    CStakeModifierCacheEntry& entry = mapStakeModifierCache[hashBlockFrom];
+    entry.nStakeModifier = nStakeModifier;
+    entry.nStakeModifierHeight = nStakeModifierHeight;
+    entry.nStakeModifierTime = nStakeModifierTime;
+    entry.pindexEnd = pindex;
     return true;
 }
 
+CStakeKernel::CStakeKernel(uint64_t nStakeModifier, unsigned int nTimeBlockFrom, const COutPoint& prevout)
+{
+    // Serialized as in stakeHash(): modifier, source block time, prevout index and prevout hash
+    unsigned char buf[8 + 4 + 4];
+    WriteLE64(buf, nStakeModifier);
+    WriteLE32(buf + 8, nTimeBlockFrom);
+    WriteLE32(buf + 12, prevout.n);
+    sha.Write(buf, sizeof(buf));
+    sha.Write(prevout.hash.begin(), prevout.hash.size());
+}
+
+uint256 CStakeKernel::GetHash(unsigned int nTimeTx) const
+{
+    unsigned char buf[CSHA256::OUTPUT_SIZE];
+    WriteLE32(buf, nTimeTx);
+
+    CSHA256 shaTry(sha);
+    shaTry.Write(buf, 4).Finalize(buf);
+
+    uint256 hash;
+    CSHA256().Write(buf, sizeof(buf)).Finalize(hash.begin());
+    return hash;
+}
+
 uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom)
 {
     //CARITAS will hash in the transaction hash and the index number in order to make sure each hash is unique
@@ -289,8 +349,40 @@ bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTarget
     return (uint256(hashProofOfStake) < bnCoinDayWeight * bnTargetPerCoinDay);
 }
 
+//the target is the same for every nTimeTx, see stakeTargetHit()
+uint256 GetStakeKernelTarget(unsigned int nBits, int64_t nValueIn)
+{
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+    return (uint256(nValueIn) / 100) * bnTargetPerCoinDay;
+}
+
+bool SearchStakeKernel(const CStakeKernel& kernel, const uint256& bnTarget, unsigned int& nTimeTx, unsigned int nHashDrift, int nHeightStart,
+                       uint256& hashProofOfStake, uint64_t& nHashes, const std::atomic<bool>* pfInterrupt)
+{
+    for (unsigned int i = 0; i < nHashDrift; i++) //iterate the hashing
+    {
+        //new block came in or the search was called off, move on
+        if (chainActive.Height() != nHeightStart || (pfInterrupt && *pfInterrupt))
+            return false;
+
+        //hash this iteration
+        unsigned int nTryTime = nTimeTx + nHashDrift - i;
+        hashProofOfStake = kernel.GetHash(nTryTime);
+        nHashes++;
+
+        // if stake hash does not meet the target then continue to next iteration
+        if (!(hashProofOfStake < bnTarget))
+            continue;
+
+        nTimeTx = nTryTime;
+        return true;
+    }
+    return false;
+}
+
 //instead of looping outside and reinitializing variables many times, we will give a nTimeTx and also search interval so that we can do all the hashing here
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
+bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, const CTransaction& txPrev, const COutPoint& prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
 {
     //assign new variables to make it easier to read
     int64_t nValueIn = txPrev.vout[prevout.n].nValue;
@@ -303,62 +395,42 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
         return error("CheckStakeKernelHash() : min age violation - nTimeBlockFrom=%d nStakeMinAge=%d nTimeTx=%d", nTimeBlockFrom, nStakeMinAge, nTimeTx);
 
     //grab difficulty
-    uint256 bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
+    uint256 bnTarget = GetStakeKernelTarget(nBits, nValueIn);
 
     //grab stake modifier
+    uint256 hashBlockFrom = blockFrom.GetHash();
     uint64_t nStakeModifier = 0;
     int nStakeModifierHeight = 0;
     int64_t nStakeModifierTime = 0;
-    if (!GetKernelStakeModifier(blockFrom.GetHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake)) {
+    if (!GetKernelStakeModifier(hashBlockFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake)) {
         LogPrintf("CheckStakeKernelHash(): failed to get kernel stake modifier \n");
         return false;
     }
 
-    //create data stream once instead of repeating it in the loop
-    CDataStream ss(SER_GETHASH, 0);
-    ss << nStakeModifier;
+    //hash the part of the kernel that does not depend on the time once instead of repeating it in the loop
+    const CStakeKernel kernel(nStakeModifier, nTimeBlockFrom, prevout);
 
     //if wallet is simply checking to make sure a hash is valid
     if (fCheck) {
-        hashProofOfStake = stakeHash(nTimeTx, ss, prevout.n, prevout.hash, nTimeBlockFrom);
-        return stakeTargetHit(hashProofOfStake, nValueIn, bnTargetPerCoinDay);
+        hashProofOfStake = kernel.GetHash(nTimeTx);
+        return hashProofOfStake < bnTarget;
     }
 
-    bool fSuccess = false;
-    unsigned int nTryTime = 0;
-    unsigned int i;
-    int nHeightStart = chainActive.Height();
-    for (i = 0; i < (nHashDrift); i++) //iterate the hashing
-    {
-        //new block came in, move on
-        if (chainActive.Height() != nHeightStart)
-            break;
-
-        //hash this iteration
-        nTryTime = nTimeTx + nHashDrift - i;
-        hashProofOfStake = stakeHash(nTryTime, ss, prevout.n, prevout.hash, nTimeBlockFrom);
-
-        // if stake hash does not meet the target then continue to next iteration
-        if (!stakeTargetHit(hashProofOfStake, nValueIn, bnTargetPerCoinDay))
-            continue;
-
-        fSuccess = true; // if we make it this far then we have successfully created a stake hash
-        nTimeTx = nTryTime;
-
+    uint64_t nHashes = 0;
+    bool fSuccess = SearchStakeKernel(kernel, bnTarget, nTimeTx, nHashDrift, chainActive.Height(), hashProofOfStake, nHashes);
+    if (fSuccess) {
         if (fDebug || fPrintProofOfStake) {
             LogPrintf("CheckStakeKernelHash() : using modifier %s at height=%d timestamp=%s for block from height=%d timestamp=%s\n",
                 boost::lexical_cast<std::string>(nStakeModifier).c_str(), nStakeModifierHeight,
                 DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nStakeModifierTime).c_str(),
-                mapBlockIndex[blockFrom.GetHash()]->nHeight,
+                mapBlockIndex[hashBlockFrom]->nHeight,
                 DateTimeStrFormat("%Y-%m-%d %H:%M:%S", blockFrom.GetBlockTime()).c_str());
             LogPrintf("CheckStakeKernelHash() : pass protocol=%s modifier=%s nTimeBlockFrom=%u prevoutHash=%s nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n",
                 "0.3",
                 boost::lexical_cast<std::string>(nStakeModifier).c_str(),
-                nTimeBlockFrom, prevout.hash.ToString().c_str(), nTimeBlockFrom, prevout.n, nTryTime,
+                nTimeBlockFrom, prevout.hash.ToString().c_str(), nTimeBlockFrom, prevout.n, nTimeTx,
                 hashProofOfStake.ToString().c_str());
         }
-        break;
     }
 
     mapHashedBlocks.clear();
@@ -5,8 +5,11 @@
 #ifndef BITCOIN_KERNEL_H
 #define BITCOIN_KERNEL_H
 
+#include "crypto/sha256.h"
 #include "main.h"
 
+#include <atomic>
+
 
 // MODIFIER_INTERVAL: time to elapse before new modifier is computed
 static const unsigned int MODIFIER_INTERVAL = 60;
@@ -21,11 +24,41 @@ static const int MODIFIER_INTERVAL_RATIO = 3;
 // Compute the hash modifier for proof-of-stake
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 
+// Maximum number of source blocks whose kernel stake modifier is remembered
+static const unsigned int MAX_STAKE_MODIFIER_CACHE_SIZE = 20000;
+
+// Get the stake modifier used to hash a kernel whose input comes from hashBlockFrom
+bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake);
+
+/**
+ * Kernel hash of one stake input, the same hash as stakeHash().
+ * Everything hashed before nTimeTx is fixed for the input, so it is written into the
+ * SHA256 state once and each try only hashes the final nTimeTx word, without allocating.
+ */
+class CStakeKernel
+{
+private:
+    CSHA256 sha;
+
+public:
+    CStakeKernel() {}
+    CStakeKernel(uint64_t nStakeModifier, unsigned int nTimeBlockFrom, const COutPoint& prevout);
+
+    uint256 GetHash(unsigned int nTimeTx) const;
+};
+
 // Check whether stake kernel meets hash target
 // Sets hashProofOfStake on success return
 uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom);
 bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay);
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+uint256 GetStakeKernelTarget(unsigned int nBits, int64_t nValueIn);
+
+// Hash the drift window of one stake input, latest time first, until a kernel meets the target.
+// Gives up when the chain tip moves away from nHeightStart or *pfInterrupt is set.
+// Sets nTimeTx and hashProofOfStake on success return, counts the hashes done in nHashes
+bool SearchStakeKernel(const CStakeKernel& kernel, const uint256& bnTarget, unsigned int& nTimeTx, unsigned int nHashDrift, int nHeightStart,
+                       uint256& hashProofOfStake, uint64_t& nHashes, const std::atomic<bool>* pfInterrupt = NULL);
+bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, const CTransaction& txPrev, const COutPoint& prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
 
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
@@ -12,6 +12,7 @@
 // Copyright (c) 2017 The VITAE developers
 // Copyright (c) 2017 The PIVX developers
 #include "AccumulatorProofOfKnowledge.h"
+#include "GroupExponentiation.h"
 #include "hash.h"
 
 namespace libzerocoin {
@@ -37,9 +38,12 @@ AccumulatorProofOfKnowledge::AccumulatorProofOfKnowledge(const AccumulatorAndPro
 	CBigNum r_2 = CBigNum::randBignum(params->accumulatorModulus/4);
 	CBigNum r_3 = CBigNum::randBignum(params->accumulatorModulus/4);
 
-	this->C_e = g_n.pow_mod(e, params->accumulatorModulus) * h_n.pow_mod(r_1, params->accumulatorModulus);
-	this->C_u = witness.getValue() * h_n.pow_mod(r_2, params->accumulatorModulus);
-	this->C_r = g_n.pow_mod(r_2, params->accumulatorModulus) * h_n.pow_mod(r_3, params->accumulatorModulus);
+	const GroupExponentiation& qrnGroup = getGroupExponentiation(params->accumulatorModulus, g_n, h_n);
+	const GroupExponentiation& pokGroup = getGroupExponentiation(params->accumulatorPoKCommitmentGroup);
+
+	this->C_e = qrnGroup.pow_g(e) * qrnGroup.pow_h(r_1);
+	this->C_u = witness.getValue() * qrnGroup.pow_h(r_2);
+	this->C_r = qrnGroup.pow_g(r_2) * qrnGroup.pow_h(r_3);
 
 	CBigNum r_alpha = CBigNum::randBignum(params->maxCoinValue * CBigNum(2).pow(params->k_prime + params->k_dprime));
 	if(!(CBigNum::randBignum(CBigNum(3)) % 2)) {
@@ -74,14 +78,15 @@ AccumulatorProofOfKnowledge::AccumulatorProofOfKnowledge(const AccumulatorAndPro
 		r_delta = 0-r_delta;
 	}
 
-	this->st_1 = (sg.pow_mod(r_alpha, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(r_phi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	this->st_2 = (((commitmentToCoin.getCommitmentValue() * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(r_gamma, params->accumulatorPoKCommitmentGroup.modulus)) * sh.pow_mod(r_psi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	this->st_3 = ((sg * commitmentToCoin.getCommitmentValue()).pow_mod(r_sigma, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(r_xi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
+	this->st_1 = pokGroup.pow_gh(r_alpha, r_phi);
+	this->st_2 = pokGroup.pow_mul(commitmentToCoin.getCommitmentValue() * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus), r_gamma, CBigNum(0), r_psi);
+	this->st_3 = pokGroup.pow_mul(sg * commitmentToCoin.getCommitmentValue(), r_sigma, CBigNum(0), r_xi);
 
-	this->t_1 = (h_n.pow_mod(r_zeta, params->accumulatorModulus) * g_n.pow_mod(r_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
-	this->t_2 = (h_n.pow_mod(r_eta, params->accumulatorModulus) * g_n.pow_mod(r_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
-	this->t_3 = (C_u.pow_mod(r_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(r_beta, params->accumulatorModulus))) % params->accumulatorModulus;
-	this->t_4 = (C_r.pow_mod(r_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(r_delta, params->accumulatorModulus)) * ((g_n.inverse(params->accumulatorModulus)).pow_mod(r_beta, params->accumulatorModulus))) % params->accumulatorModulus;
+	// (h_n^-1)^x is computed as h_n^-x
+	this->t_1 = qrnGroup.pow_gh(r_epsilon, r_zeta);
+	this->t_2 = qrnGroup.pow_gh(r_alpha, r_eta);
+	this->t_3 = qrnGroup.pow_mul(C_u, r_alpha, CBigNum(0), 0 - r_beta);
+	this->t_4 = qrnGroup.pow_mul(C_r, r_alpha, 0 - r_beta, 0 - r_delta);
 
 	CHashWriter hasher(0,0);
 	hasher << *params << sg << sh << g_n << h_n << commitmentToCoin.getCommitmentValue() << C_e << C_u << C_r << st_1 << st_2 << st_3 << t_1 << t_2 << t_3 << t_4;
@@ -117,14 +122,18 @@ bool AccumulatorProofOfKnowledge:: Verify(const Accumulator& a, const CBigNum& v
 
 	CBigNum c = CBigNum(hasher.GetHash()); //this hash should be of length k_prime bits
 
-	CBigNum st_1_prime = (valueOfCommitmentToCoin.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * sg.pow_mod(s_alpha, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_phi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_2_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * ((valueOfCommitmentToCoin * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(s_gamma, params->accumulatorPoKCommitmentGroup.modulus)) * sh.pow_mod(s_psi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_3_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * (sg * valueOfCommitmentToCoin).pow_mod(s_sigma, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_xi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
+	const GroupExponentiation& qrnGroup = getGroupExponentiation(params->accumulatorModulus, g_n, h_n);
+	const GroupExponentiation& pokGroup = getGroupExponentiation(params->accumulatorPoKCommitmentGroup);
+
+	CBigNum st_1_prime = pokGroup.pow_mul(valueOfCommitmentToCoin, c, s_alpha, s_phi);
+	CBigNum st_2_prime = pokGroup.pow_mul(valueOfCommitmentToCoin * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus), s_gamma, c, s_psi);
+	CBigNum st_3_prime = pokGroup.pow_mul(sg * valueOfCommitmentToCoin, s_sigma, c, s_xi);
 
-	CBigNum t_1_prime = (C_r.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_zeta, params->accumulatorModulus) * g_n.pow_mod(s_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_2_prime = (C_e.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_eta, params->accumulatorModulus) * g_n.pow_mod(s_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_3_prime = ((a.getValue()).pow_mod(c, params->accumulatorModulus) * C_u.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
-	CBigNum t_4_prime = (C_r.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_delta, params->accumulatorModulus)) * ((g_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
+	// (h_n^-1)^x and (g_n^-1)^x are computed as h_n^-x and g_n^-x
+	CBigNum t_1_prime = qrnGroup.pow_mul(C_r, c, s_epsilon, s_zeta);
+	CBigNum t_2_prime = qrnGroup.pow_mul(C_e, c, s_alpha, s_eta);
+	CBigNum t_3_prime = qrnGroup.pow2_mul(a.getValue(), c, C_u, s_alpha, CBigNum(0), 0 - s_beta);
+	CBigNum t_4_prime = qrnGroup.pow_mul(C_r, s_alpha, 0 - s_beta, 0 - s_delta);
 
 	bool result = false;
 
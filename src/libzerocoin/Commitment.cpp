@@ -13,6 +13,7 @@
 
 #include <stdlib.h>
 #include "Commitment.h"
+#include "GroupExponentiation.h"
 #include "hash.h"
 
 namespace libzerocoin {
@@ -21,8 +22,7 @@ namespace libzerocoin {
 Commitment::Commitment::Commitment(const IntegerGroupParams* p,
                                    const CBigNum& value): params(p), contents(value) {
 	this->randomness = CBigNum::randBignum(params->groupOrder);
-	this->commitmentValue = (params->g.pow_mod(this->contents, params->modulus).mul_mod(
-	                         params->h.pow_mod(this->randomness, params->modulus), params->modulus));
+	this->commitmentValue = getGroupExponentiation(*params).pow_gh(this->contents, this->randomness);
 }
 
 const CBigNum& Commitment::getCommitmentValue() const {
@@ -73,8 +73,8 @@ CommitmentProofOfKnowledge::CommitmentProofOfKnowledge(const IntegerGroupParams*
 	// T2 = g2^r1 * h2^r3 mod p2
 	//
 	// Where (g1, h1, p1) are from "aParams" and (g2, h2, p2) are from "bParams".
-	CBigNum T1 = this->ap->g.pow_mod(r1, this->ap->modulus).mul_mod((this->ap->h.pow_mod(r2, this->ap->modulus)), this->ap->modulus);
-	CBigNum T2 = this->bp->g.pow_mod(r1, this->bp->modulus).mul_mod((this->bp->h.pow_mod(r3, this->bp->modulus)), this->bp->modulus);
+	CBigNum T1 = getGroupExponentiation(*this->ap).pow_gh(r1, r2);
+	CBigNum T2 = getGroupExponentiation(*this->bp).pow_gh(r1, r3);
 
 	// Now hash commitment "A" with commitment "B" as well as the
 	// parameters and the two ephemeral commitments "T1, T2" we just generated
@@ -119,14 +119,10 @@ bool CommitmentProofOfKnowledge::Verify(const CBigNum& A, const CBigNum& B) cons
 	}
 
 	// Compute T1 = g1^S1 * h1^S2 * inverse(A^{challenge}) mod p1
-	CBigNum T1 = A.pow_mod(this->challenge, ap->modulus).inverse(ap->modulus).mul_mod(
-	                (ap->g.pow_mod(S1, ap->modulus).mul_mod(ap->h.pow_mod(S2, ap->modulus), ap->modulus)),
-	                ap->modulus);
+	CBigNum T1 = getGroupExponentiation(*ap).pow_mul(A, 0 - this->challenge, S1, S2);
 
 	// Compute T2 = g2^S1 * h2^S3 * inverse(B^{challenge}) mod p2
-	CBigNum T2 = B.pow_mod(this->challenge, bp->modulus).inverse(bp->modulus).mul_mod(
-	                (bp->g.pow_mod(S1, bp->modulus).mul_mod(bp->h.pow_mod(S3, bp->modulus), bp->modulus)),
-	                bp->modulus);
+	CBigNum T2 = getGroupExponentiation(*bp).pow_mul(B, 0 - this->challenge, S1, S3);
 
 	// Hash T1 and T2 along with all of the public parameters
 	CBigNum computedChallenge = calculateChallenge(A, B, T1, T2);
@@ -0,0 +1,210 @@
+/**
+ * @file       GroupExponentiation.cpp
+ *
+ * @brief      Montgomery and fixed-base exponentiation for the Zerocoin library.
+ *
+ * @copyright  Copyright 2018 The CaritasCoin developers
+ * @license    This project is released under the MIT license.
+ **/
+
+#include <map>
+#include "GroupExponentiation.h"
+#include "hash.h"
+
+namespace libzerocoin {
+
+//MontgomeryContext class
+MontgomeryContext::MontgomeryContext(const CBigNum& modulus): modulus(modulus) {
+	if (!BN_is_odd(&this->modulus)) {
+		throw std::runtime_error("MontgomeryContext: modulus must be odd");
+	}
+
+	CAutoBN_CTX pctx;
+	this->mont = BN_MONT_CTX_new();
+	if (this->mont == NULL || !BN_MONT_CTX_set(this->mont, &this->modulus, pctx)) {
+		BN_MONT_CTX_free(this->mont);
+		throw bignum_error("MontgomeryContext : BN_MONT_CTX_set failed");
+	}
+	this->montOne = toMontgomery(CBigNum(1));
+}
+
+MontgomeryContext::~MontgomeryContext() {
+	BN_MONT_CTX_free(this->mont);
+}
+
+CBigNum MontgomeryContext::toMontgomery(const CBigNum& a) const {
+	CAutoBN_CTX pctx;
+	CBigNum reduced;
+	CBigNum ret;
+	if (!BN_nnmod(&reduced, &a, &this->modulus, pctx) || !BN_to_montgomery(&ret, &reduced, this->mont, pctx))
+		throw bignum_error("MontgomeryContext::toMontgomery : BN_to_montgomery failed");
+	return ret;
+}
+
+CBigNum MontgomeryContext::fromMontgomery(const CBigNum& a) const {
+	CAutoBN_CTX pctx;
+	CBigNum ret;
+	if (!BN_from_montgomery(&ret, &a, this->mont, pctx))
+		throw bignum_error("MontgomeryContext::fromMontgomery : BN_from_montgomery failed");
+	return ret;
+}
+
+CBigNum MontgomeryContext::mul(const CBigNum& a, const CBigNum& b) const {
+	CAutoBN_CTX pctx;
+	CBigNum ret;
+	if (!BN_mod_mul_montgomery(&ret, &a, &b, this->mont, pctx))
+		throw bignum_error("MontgomeryContext::mul : BN_mod_mul_montgomery failed");
+	return ret;
+}
+
+CBigNum MontgomeryContext::pow(const CBigNum& base, const CBigNum& e) const {
+	CAutoBN_CTX pctx;
+	CBigNum ret;
+	if (e < 0) {
+		// g^-x = (g^-1)^x
+		CBigNum inv = base.inverse(this->modulus);
+		CBigNum posE = e * -1;
+		if (!BN_mod_exp_mont(&ret, &inv, &posE, &this->modulus, pctx, this->mont))
+			throw bignum_error("MontgomeryContext::pow : BN_mod_exp_mont failed on negative exponent");
+	} else if (!BN_mod_exp_mont(&ret, &base, &e, &this->modulus, pctx, this->mont)) {
+		throw bignum_error("MontgomeryContext::pow : BN_mod_exp_mont failed");
+	}
+	return ret;
+}
+
+CBigNum MontgomeryContext::pow2(const CBigNum& base1, const CBigNum& e1, const CBigNum& base2, const CBigNum& e2) const {
+	CBigNum b1 = e1 < 0 ? base1.inverse(this->modulus) : base1 % this->modulus;
+	CBigNum b2 = e2 < 0 ? base2.inverse(this->modulus) : base2 % this->modulus;
+	CBigNum x1 = e1 < 0 ? e1 * -1 : e1;
+	CBigNum x2 = e2 < 0 ? e2 * -1 : e2;
+
+	CAutoBN_CTX pctx;
+	CBigNum ret;
+	if (!BN_mod_exp2_mont(&ret, &b1, &x1, &b2, &x2, &this->modulus, pctx, this->mont))
+		throw bignum_error("MontgomeryContext::pow2 : BN_mod_exp2_mont failed");
+	return ret;
+}
+
+//FixedBaseExponent class
+FixedBaseExponent::FixedBaseExponent(const MontgomeryContext& mont, const CBigNum& base, unsigned int nMaxBits): mont(mont) {
+	const unsigned int nDigits = (1 << WINDOW) - 1;
+	this->nRows = (nMaxBits + WINDOW - 1) / WINDOW;
+	this->table.resize(this->nRows * nDigits);
+
+	// row i holds base^(d * 2^(WINDOW * i)) for the digits d = 1 ... 2^WINDOW - 1
+	CBigNum rowBase = mont.toMontgomery(base);
+	for (unsigned int i = 0; i < this->nRows; i++) {
+		CBigNum* row = &this->table[i * nDigits];
+		row[0] = rowBase;
+		for (unsigned int d = 1; d < nDigits; d++)
+			row[d] = mont.mul(row[d - 1], rowBase);
+		rowBase = mont.mul(row[nDigits - 1], rowBase);
+	}
+}
+
+bool FixedBaseExponent::covers(const CBigNum& e) const {
+	return !(e < 0) && (unsigned int)BN_num_bits(&e) <= this->nRows * WINDOW;
+}
+
+void FixedBaseExponent::mulPow(CBigNum& accumulated, const CBigNum& e) const {
+	const unsigned int nDigits = (1 << WINDOW) - 1;
+	const unsigned int nBits = BN_num_bits(&e);
+	for (unsigned int i = 0; i * WINDOW < nBits; i++) {
+		unsigned int digit = 0;
+		for (unsigned int j = 0; j < WINDOW; j++) {
+			if (BN_is_bit_set(&e, i * WINDOW + j))
+				digit |= 1 << j;
+		}
+		if (digit)
+			accumulated = this->mont.mul(accumulated, this->table[i * nDigits + digit - 1]);
+	}
+}
+
+//GroupExponentiation class
+GroupExponentiation::GroupExponentiation(const CBigNum& modulus, const CBigNum& g, const CBigNum& h): mont(modulus) {
+	this->bases[BASE_G] = g;
+	this->bases[BASE_H] = h;
+	this->bases[BASE_G_INV] = g.inverse(modulus);
+	this->bases[BASE_H_INV] = h.inverse(modulus);
+
+	// Tables cover exponents up to the size of the modulus, which keeps the
+	// accumulator group tables at a few MB each. The occasional larger
+	// exponent falls back to a sliding window exponentiation.
+	this->nTableBits = modulus.bitSize();
+}
+
+const FixedBaseExponent& GroupExponentiation::getTable(int nBase) const {
+	std::call_once(this->tablesBuilt[nBase], [this, nBase]() {
+		this->tables[nBase].reset(new FixedBaseExponent(this->mont, this->bases[nBase], this->nTableBits));
+	});
+	return *this->tables[nBase];
+}
+
+void GroupExponentiation::mulFixed(CBigNum& accumulated, int nBase, const CBigNum& e) const {
+	if (e == 0)
+		return;
+
+	// g^-x = (g^-1)^x
+	CBigNum x = e;
+	if (e < 0) {
+		x = e * -1;
+		nBase = (nBase == BASE_G) ? BASE_G_INV : BASE_H_INV;
+	}
+
+	const FixedBaseExponent& table = getTable(nBase);
+	if (table.covers(x))
+		table.mulPow(accumulated, x);
+	else
+		accumulated = this->mont.mul(accumulated, this->mont.toMontgomery(this->mont.pow(this->bases[nBase], x)));
+}
+
+CBigNum GroupExponentiation::pow_g(const CBigNum& e) const {
+	return pow_gh(e, CBigNum(0));
+}
+
+CBigNum GroupExponentiation::pow_h(const CBigNum& e) const {
+	return pow_gh(CBigNum(0), e);
+}
+
+CBigNum GroupExponentiation::pow_gh(const CBigNum& eg, const CBigNum& eh) const {
+	CBigNum accumulated = this->mont.one();
+	mulFixed(accumulated, BASE_G, eg);
+	mulFixed(accumulated, BASE_H, eh);
+	return this->mont.fromMontgomery(accumulated);
+}
+
+CBigNum GroupExponentiation::pow_mul(const CBigNum& base, const CBigNum& e, const CBigNum& eg, const CBigNum& eh) const {
+	CBigNum accumulated = this->mont.toMontgomery(this->mont.pow(base, e));
+	mulFixed(accumulated, BASE_G, eg);
+	mulFixed(accumulated, BASE_H, eh);
+	return this->mont.fromMontgomery(accumulated);
+}
+
+CBigNum GroupExponentiation::pow2_mul(const CBigNum& base1, const CBigNum& e1, const CBigNum& base2, const CBigNum& e2,
+                                      const CBigNum& eg, const CBigNum& eh) const {
+	CBigNum accumulated = this->mont.toMontgomery(this->mont.pow2(base1, e1, base2, e2));
+	mulFixed(accumulated, BASE_G, eg);
+	mulFixed(accumulated, BASE_H, eh);
+	return this->mont.fromMontgomery(accumulated);
+}
+
+const GroupExponentiation& getGroupExponentiation(const CBigNum& modulus, const CBigNum& g, const CBigNum& h) {
+	static std::mutex csGroups;
+	static std::map<uint256, std::unique_ptr<GroupExponentiation> > mapGroups;
+
+	CHashWriter hasher(0,0);
+	hasher << modulus << g << h;
+	uint256 hashGroup = hasher.GetHash();
+
+	std::lock_guard<std::mutex> lock(csGroups);
+	std::unique_ptr<GroupExponentiation>& group = mapGroups[hashGroup];
+	if (!group)
+		group.reset(new GroupExponentiation(modulus, g, h));
+	return *group;
+}
+
+const GroupExponentiation& getGroupExponentiation(const IntegerGroupParams& group) {
+	return getGroupExponentiation(group.modulus, group.g, group.h);
+}
+
+} /* namespace libzerocoin */
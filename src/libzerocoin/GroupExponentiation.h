@@ -0,0 +1,125 @@
+/**
+ * @file       GroupExponentiation.h
+ *
+ * @brief      Montgomery and fixed-base exponentiation for the Zerocoin library.
+ *
+ * @copyright  Copyright 2018 The CaritasCoin developers
+ * @license    This project is released under the MIT license.
+ **/
+
+#ifndef GROUPEXPONENTIATION_H_
+#define GROUPEXPONENTIATION_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Params.h"
+
+namespace libzerocoin {
+
+/**
+ * Montgomery arithmetic modulo a fixed odd modulus.
+ * The context is read-only once it is set up, so a single instance
+ * can be shared by every thread exponentiating in the group.
+ */
+class MontgomeryContext {
+public:
+	explicit MontgomeryContext(const CBigNum& modulus);
+	~MontgomeryContext();
+
+	const CBigNum& getModulus() const { return modulus; }
+	const CBigNum& one() const { return montOne; }
+
+	CBigNum toMontgomery(const CBigNum& a) const;
+	CBigNum fromMontgomery(const CBigNum& a) const;
+
+	/** Multiply two values in Montgomery form */
+	CBigNum mul(const CBigNum& a, const CBigNum& b) const;
+
+	/** base^e mod modulus, negative exponents use the inverse of the base */
+	CBigNum pow(const CBigNum& base, const CBigNum& e) const;
+
+	/** base1^e1 * base2^e2 mod modulus in a single pass */
+	CBigNum pow2(const CBigNum& base1, const CBigNum& e1, const CBigNum& base2, const CBigNum& e2) const;
+
+private:
+	MontgomeryContext(const MontgomeryContext&);
+	MontgomeryContext& operator=(const MontgomeryContext&);
+
+	CBigNum modulus;
+	CBigNum montOne;
+	BN_MONT_CTX* mont;
+};
+
+/**
+ * Precomputed powers base^(d * 2^(WINDOW * i)) of a fixed base, in Montgomery form.
+ * An exponentiation then costs one multiplication per nonzero window of the
+ * exponent and no squarings.
+ */
+class FixedBaseExponent {
+public:
+	static const unsigned int WINDOW = 4;
+
+	FixedBaseExponent(const MontgomeryContext& mont, const CBigNum& base, unsigned int nMaxBits);
+
+	/** Whether the table is large enough for this (non-negative) exponent */
+	bool covers(const CBigNum& e) const;
+
+	/** Multiply base^e into accumulated, which is in Montgomery form */
+	void mulPow(CBigNum& accumulated, const CBigNum& e) const;
+
+private:
+	const MontgomeryContext& mont;
+	unsigned int nRows;
+	std::vector<CBigNum> table;
+};
+
+/**
+ * Exponentiation engine for a group with two fixed generators g and h.
+ * Holds the Montgomery context of the modulus and builds fixed-base tables
+ * for g, h and their inverses on first use.
+ */
+class GroupExponentiation {
+public:
+	GroupExponentiation(const CBigNum& modulus, const CBigNum& g, const CBigNum& h);
+
+	const CBigNum& getModulus() const { return mont.getModulus(); }
+	const MontgomeryContext& getMontgomery() const { return mont; }
+
+	CBigNum pow_g(const CBigNum& e) const;
+	CBigNum pow_h(const CBigNum& e) const;
+
+	/** g^eg * h^eh mod modulus */
+	CBigNum pow_gh(const CBigNum& eg, const CBigNum& eh) const;
+
+	/** base^e * g^eg * h^eh mod modulus */
+	CBigNum pow_mul(const CBigNum& base, const CBigNum& e, const CBigNum& eg, const CBigNum& eh) const;
+
+	/** base1^e1 * base2^e2 * g^eg * h^eh mod modulus */
+	CBigNum pow2_mul(const CBigNum& base1, const CBigNum& e1, const CBigNum& base2, const CBigNum& e2,
+	                 const CBigNum& eg, const CBigNum& eh) const;
+
+	/** base^e mod modulus for a base that is not one of the generators */
+	CBigNum pow(const CBigNum& base, const CBigNum& e) const { return mont.pow(base, e); }
+
+private:
+	enum { BASE_G = 0, BASE_H, BASE_G_INV, BASE_H_INV, BASE_COUNT };
+
+	const FixedBaseExponent& getTable(int nBase) const;
+	void mulFixed(CBigNum& accumulated, int nBase, const CBigNum& e) const;
+
+	MontgomeryContext mont;
+	CBigNum bases[BASE_COUNT];
+	unsigned int nTableBits;
+	mutable std::unique_ptr<FixedBaseExponent> tables[BASE_COUNT];
+	mutable std::once_flag tablesBuilt[BASE_COUNT];
+};
+
+/**
+ * The shared exponentiation engine of a group, created the first time the group is used.
+ */
+const GroupExponentiation& getGroupExponentiation(const CBigNum& modulus, const CBigNum& g, const CBigNum& h);
+const GroupExponentiation& getGroupExponentiation(const IntegerGroupParams& group);
+
+} /* namespace libzerocoin */
+#endif /* GROUPEXPONENTIATION_H_ */
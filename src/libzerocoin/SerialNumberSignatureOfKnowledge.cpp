@@ -13,6 +13,7 @@
 // Copyright (c) 2017 The PIVX developers
 #include <streams.h>
 #include "SerialNumberSignatureOfKnowledge.h"
+#include "GroupExponentiation.h"
 
 namespace libzerocoin {
 
@@ -92,6 +93,7 @@ SerialNumberSignatureOfKnowledge::SerialNumberSignatureOfKnowledge(const
 	this->hash = hasher.GetHash();
 	unsigned char *hashbytes =  (unsigned char*) &hash;
 
+	const GroupExponentiation& coinGroup = getGroupExponentiation(params->serialNumberSoKCommitmentGroup.groupOrder, a, b);
 	for(uint32_t i = 0; i < params->zkp_iterations; i++) {
 		int bit = i % 8;
 		int byte = i / 8;
@@ -103,7 +105,7 @@ SerialNumberSignatureOfKnowledge::SerialNumberSignatureOfKnowledge(const
 		} else {
 			s_notprime[i]       = r[i] - coin.getRandomness();
 			sprime[i]           = v_expanded[i] - (commitmentToCoin.getRandomness() *
-			                              b.pow_mod(r[i] - coin.getRandomness(), params->serialNumberSoKCommitmentGroup.groupOrder));
+			                              coinGroup.pow_h(r[i] - coin.getRandomness()));
 		}
 	}
 }
@@ -111,45 +113,51 @@ SerialNumberSignatureOfKnowledge::SerialNumberSignatureOfKnowledge(const
 inline CBigNum SerialNumberSignatureOfKnowledge::challengeCalculation(const CBigNum& a_exp,const CBigNum& b_exp,
         const CBigNum& h_exp) const {
 
-	CBigNum a = params->coinCommitmentGroup.g;
-	CBigNum b = params->coinCommitmentGroup.h;
-	CBigNum g = params->serialNumberSoKCommitmentGroup.g;
-	CBigNum h = params->serialNumberSoKCommitmentGroup.h;
+	const GroupExponentiation& coinGroup = getGroupExponentiation(params->serialNumberSoKCommitmentGroup.groupOrder,
+	                                                              params->coinCommitmentGroup.g, params->coinCommitmentGroup.h);
+	const GroupExponentiation& sokGroup = getGroupExponentiation(params->serialNumberSoKCommitmentGroup);
 
-	CBigNum exponent = (a.pow_mod(a_exp, params->serialNumberSoKCommitmentGroup.groupOrder)
-	                   * b.pow_mod(b_exp, params->serialNumberSoKCommitmentGroup.groupOrder)) % params->serialNumberSoKCommitmentGroup.groupOrder;
-
-	return (g.pow_mod(exponent, params->serialNumberSoKCommitmentGroup.modulus) * h.pow_mod(h_exp, params->serialNumberSoKCommitmentGroup.modulus)) % params->serialNumberSoKCommitmentGroup.modulus;
+	// a^{a_exp} b^{b_exp} mod q, then g^{exponent} h^{h_exp} mod p
+	CBigNum exponent = coinGroup.pow_gh(a_exp, b_exp);
+	return sokGroup.pow_gh(exponent, h_exp);
 }
 
 bool SerialNumberSignatureOfKnowledge::Verify(const CBigNum& coinSerialNumber, const CBigNum& valueOfCommitmentToCoin,
         const uint256 msghash) const {
-	CBigNum a = params->coinCommitmentGroup.g;
-	CBigNum b = params->coinCommitmentGroup.h;
-	CBigNum g = params->serialNumberSoKCommitmentGroup.g;
-	CBigNum h = params->serialNumberSoKCommitmentGroup.h;
+	if (s_notprime.size() < params->zkp_iterations || sprime.size() < params->zkp_iterations)
+		return false;
+
+	const CBigNum& q = params->serialNumberSoKCommitmentGroup.groupOrder;
+	const GroupExponentiation& coinGroup = getGroupExponentiation(q, params->coinCommitmentGroup.g, params->coinCommitmentGroup.h);
+	const GroupExponentiation& sokGroup = getGroupExponentiation(params->serialNumberSoKCommitmentGroup);
+	const MontgomeryContext& mont = sokGroup.getMontgomery();
+
 	CHashWriter hasher(0,0);
 	hasher << *params << valueOfCommitmentToCoin << coinSerialNumber << msghash;
 
-	vector<CBigNum> tprime(params->zkp_iterations);
-	unsigned char *hashbytes = (unsigned char*) &this->hash;
+	// a^serial is the same in every round with a set challenge bit
+	CBigNum aSerial = coinGroup.pow_g(coinSerialNumber);
 
+	// The rounds with a clear challenge bit all raise the commitment to the coin to
+	// an exponent below q, so they share one fixed-base table for it
+	FixedBaseExponent commitmentTable(mont, valueOfCommitmentToCoin, q.bitSize());
+
+	unsigned char *hashbytes = (unsigned char*) &this->hash;
 	for(uint32_t i = 0; i < params->zkp_iterations; i++) {
 		int bit = i % 8;
 		int byte = i / 8;
 		bool challenge_bit = ((hashbytes[byte] >> bit) & 0x01);
+		CBigNum bExp = coinGroup.pow_h(s_notprime[i]);
 		if(challenge_bit) {
-			tprime[i] = challengeCalculation(coinSerialNumber, s_notprime[i], SeedTo1024(sprime[i].getuint256()));
+			CBigNum exponent = aSerial.mul_mod(bExp, q);
+			hasher << sokGroup.pow_gh(exponent, SeedTo1024(sprime[i].getuint256()));
 		} else {
-			CBigNum exp = b.pow_mod(s_notprime[i], params->serialNumberSoKCommitmentGroup.groupOrder);
-			tprime[i] = ((valueOfCommitmentToCoin.pow_mod(exp, params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus) *
-			             (h.pow_mod(sprime[i], params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus)) %
-			            params->serialNumberSoKCommitmentGroup.modulus;
+			CBigNum accumulated = mont.one();
+			commitmentTable.mulPow(accumulated, bExp);
+			CBigNum tprime = mont.fromMontgomery(accumulated);
+			hasher << tprime.mul_mod(sokGroup.pow_h(sprime[i]), params->serialNumberSoKCommitmentGroup.modulus);
 		}
 	}
-	for(uint32_t i = 0; i < params->zkp_iterations; i++) {
-		hasher << tprime[i];
-	}
 	return hasher.GetHash() == hash;
 }
 
@@ -20,6 +20,7 @@
 #include "init.h"
 #include "kernel.h"
 #include "merkleblock.h"
+#include "messageworker.h"
 #include "net.h"
 #include "obfuscation.h"
 #include "pow.h"
@@ -31,6 +32,7 @@
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "zerocoinspendcache.h"
 
 #include "activemasternode.h"
 #include "masternode-pos.h"
@@ -40,6 +42,7 @@
 #include "libzerocoin/Denominations.h"
 #include "primitives/zerocoin.h"
 
+#include <deque>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -82,7 +85,7 @@ bool fTxIndex = true;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fVerifyingBlocks = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 
 unsigned int nStakeMinAge = 60 * 60;
@@ -178,6 +181,10 @@ uint32_t nBlockSequenceId = 1;
      */
 map<uint256, NodeId> mapBlockSource;
 
+/** Misbehavior reported while cs_main could not be taken, added to the scores by SendMessages. */
+std::map<NodeId, int> mapMisbehaviorPending;
+CCriticalSection cs_mapMisbehaviorPending;
+
 /** Blocks that are in flight, and that are in the queue to be downloaded. Protected by cs_main. */
 struct QueuedBlock {
     uint256 hash;
@@ -191,6 +198,18 @@ map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 /** Number of blocks in flight with validated headers. */
 int nQueuedValidatedHeaders = 0;
 
+/** Blocks downloaded ahead of their parent, waiting for it to be connected. Protected by cs_main. */
+struct PendingBlock {
+    CBlock block;
+    NodeId nodeid;
+    unsigned int nSize;
+    int64_t nTime;
+};
+map<uint256, PendingBlock> mapPendingBlocks;
+multimap<uint256, uint256> mapPendingBlocksByPrev;
+size_t nPendingBlocksSize = 0;
+int64_t nNextPendingBlocksExpiry = 0;
+
 /** Number of preferable block download peers. */
 int nPreferredDownload = 0;
 
@@ -211,6 +230,8 @@ set<int> setDirtyFileInfo;
 namespace
 {
 struct CMainSignals {
+    /** Notifies listeners of updated block chain tip */
+    boost::signals2::signal<void(const CBlockIndex*)> UpdatedBlockTip;
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void(const CTransaction&, const CBlock*)> SyncTransaction;
     /** Notifies listeners of an erased transaction (currently disabled, requires transaction replacement). */
@@ -231,6 +252,7 @@ struct CMainSignals {
 
 void RegisterValidationInterface(CValidationInterface* pwalletIn)
 {
+    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
     g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
     // XX42 g_signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
     g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
@@ -249,6 +271,7 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn)
     g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     // XX42    g_signals.EraseTransaction.disconnect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
     g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
+    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
 }
 
 void UnregisterAllValidationInterfaces()
@@ -260,6 +283,7 @@ void UnregisterAllValidationInterfaces()
     g_signals.UpdatedTransaction.disconnect_all_slots();
     // XX42    g_signals.EraseTransaction.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
+    g_signals.UpdatedBlockTip.disconnect_all_slots();
 }
 
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock)
@@ -307,12 +331,16 @@ struct CNodeState {
     CBlockIndex* pindexLastCommonBlock;
     //! Whether we've started headers synchronization with this peer.
     bool fSyncStarted;
+    //! Whether this peer answers getheaders with headers, rather than with block invs.
+    bool fHeadersFirst;
     //! Since when we're stalling block download progress (in microseconds), or 0.
     int64_t nStallingSince;
     list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Total size of the blocks from this peer waiting for their parent.
+    size_t nPendingBlocksSize;
 
     CNodeState()
     {
@@ -323,9 +351,11 @@ struct CNodeState {
         hashLastUnknownBlock = uint256(0);
         pindexLastCommonBlock = NULL;
         fSyncStarted = false;
+        fHeadersFirst = false;
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
+        nPendingBlocksSize = 0;
     }
 };
 
@@ -371,10 +401,76 @@ void InitializeNode(NodeId nodeid, const CNode* pnode)
     state.address = pnode->addr;
 }
 
+// Requires cs_main.
+void ErasePendingBlock(map<uint256, PendingBlock>::iterator it)
+{
+    const PendingBlock& pending = it->second;
+    std::pair<multimap<uint256, uint256>::iterator, multimap<uint256, uint256>::iterator> range = mapPendingBlocksByPrev.equal_range(pending.block.hashPrevBlock);
+    for (multimap<uint256, uint256>::iterator itPrev = range.first; itPrev != range.second; ++itPrev) {
+        if (itPrev->second == it->first) {
+            mapPendingBlocksByPrev.erase(itPrev);
+            break;
+        }
+    }
+    CNodeState* state = State(pending.nodeid);
+    if (state)
+        state->nPendingBlocksSize -= pending.nSize;
+    nPendingBlocksSize -= pending.nSize;
+    mapPendingBlocks.erase(it);
+}
+
+// Requires cs_main.
+void ErasePendingBlocksFor(NodeId nodeid)
+{
+    int nErased = 0;
+    map<uint256, PendingBlock>::iterator it = mapPendingBlocks.begin();
+    while (it != mapPendingBlocks.end()) {
+        map<uint256, PendingBlock>::iterator itErase = it++;
+        if (itErase->second.nodeid == nodeid) {
+            ErasePendingBlock(itErase);
+            ++nErased;
+        }
+    }
+    if (nErased > 0)
+        LogPrint("net", "Erased %d blocks ahead of their parent from peer=%d\n", nErased, nodeid);
+}
+
+/**
+ * Drop the blocks that have waited for their parent for longer than PENDING_BLOCK_TIMEOUT. A block that is
+ * not on our best header chain is part of a fork whose blocks never connect, its peer is penalised for it.
+ * Requires cs_main.
+ */
+void ExpirePendingBlocks(int64_t nNow)
+{
+    if (nNow < nNextPendingBlocksExpiry)
+        return;
+    nNextPendingBlocksExpiry = nNow + 60;
+
+    map<uint256, PendingBlock>::iterator it = mapPendingBlocks.begin();
+    while (it != mapPendingBlocks.end()) {
+        map<uint256, PendingBlock>::iterator itErase = it++;
+        if (itErase->second.nTime > nNow - PENDING_BLOCK_TIMEOUT)
+            continue;
+
+        NodeId nodeid = itErase->second.nodeid;
+        BlockMap::iterator mi = mapBlockIndex.find(itErase->first);
+        bool fBestHeaderChain = mi != mapBlockIndex.end() && pindexBestHeader &&
+                                pindexBestHeader->GetAncestor(mi->second->nHeight) == mi->second;
+        LogPrint("net", "%s : block %s from peer=%d did not connect in time, dropping it\n", __func__, itErase->first.ToString(), nodeid);
+        ErasePendingBlock(itErase);
+        if (!fBestHeaderChain)
+            Misbehaving(nodeid, 20);
+    }
+}
+
 void FinalizeNode(NodeId nodeid)
 {
     LOCK(cs_main);
     CNodeState* state = State(nodeid);
+    {
+        LOCK(cs_mapMisbehaviorPending);
+        mapMisbehaviorPending.erase(nodeid);
+    }
 
     if (state->fSyncStarted)
         nSyncStarted--;
@@ -385,6 +481,7 @@ void FinalizeNode(NodeId nodeid)
 
     BOOST_FOREACH (const QueuedBlock& entry, state->vBlocksInFlight)
         mapBlocksInFlight.erase(entry.hash);
+    ErasePendingBlocksFor(nodeid);
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
 
@@ -538,8 +635,16 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             if (pindex->nStatus & BLOCK_HAVE_DATA) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
+            } else if (mapPendingBlocks.count(pindex->GetBlockHash())) {
+                // Downloaded, and waiting for its parent.
+                continue;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
+                if ((nPendingBlocksSize >= MAX_PENDING_BLOCKS_SIZE || state->nPendingBlocksSize >= MAX_PENDING_BLOCKS_SIZE_PER_PEER) &&
+                    !(pindex->pprev->nStatus & BLOCK_HAVE_DATA)) {
+                    // No room to keep more blocks that arrive ahead of their parent.
+                    return;
+                }
                 if (pindex->nHeight > nWindowEnd) {
                     // We reached the end of the window.
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
@@ -587,6 +692,43 @@ void RegisterNodeSignals(CNodeSignals& nodeSignals)
     nodeSignals.FinalizeNode.connect(&FinalizeNode);
 }
 
+/** Threads processing the messages of the coralnode and obfuscation subsystems, outside the message handler */
+static CMessageWorker workerCoralnodes("coralnodes", boost::bind(&CCoralnodeMan::ProcessMessage, &mnodeman, _1, _2, _3));
+static CMessageWorker workerPayments("cnpayments", boost::bind(&CCoralnodePayments::ProcessMessageCoralnodePayments, &coralnodePayments, _1, _2, _3));
+static CMessageWorker workerBudget("budget", boost::bind(&CBudgetManager::ProcessMessage, &budget, _1, _2, _3));
+static CMessageWorker workerObfuscation("obfuscation", boost::bind(&CObfuscationPool::ProcessMessageObfuscation, &obfuScationPool, _1, _2, _3));
+
+/** Worker of each command processed on a worker thread, filled when the threads are started */
+static std::map<std::string, CMessageWorker*> mapMessageWorkers;
+
+void StartMessageWorkers(boost::thread_group& threadGroup)
+{
+    const char* pszCoralnodes[] = {"fnb", "fnp", "obseg", "obsee", "obseep"};
+    const char* pszPayments[] = {"fnget", "fnw"};
+    const char* pszBudget[] = {"fnvs", "fprop", "fvote", "fbs", "fbvote"};
+    const char* pszObfuscation[] = {"dsa", "dsq", "dsi", "dssu", "dss", "dsf", "dsc"};
+
+    BOOST_FOREACH (const char* pszCommand, pszCoralnodes)
+        mapMessageWorkers[pszCommand] = &workerCoralnodes;
+    BOOST_FOREACH (const char* pszCommand, pszPayments)
+        mapMessageWorkers[pszCommand] = &workerPayments;
+    BOOST_FOREACH (const char* pszCommand, pszBudget)
+        mapMessageWorkers[pszCommand] = &workerBudget;
+    BOOST_FOREACH (const char* pszCommand, pszObfuscation)
+        mapMessageWorkers[pszCommand] = &workerObfuscation;
+
+    CMessageWorker* workers[] = {&workerCoralnodes, &workerPayments, &workerBudget, &workerObfuscation};
+    BOOST_FOREACH (CMessageWorker* pworker, workers)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, pworker->GetName().c_str(), boost::function<void()>(boost::bind(&CMessageWorker::Run, pworker))));
+}
+
+/** The worker processing a command, NULL for the commands processed by the message handler thread */
+static CMessageWorker* GetMessageWorker(const std::string& strCommand)
+{
+    std::map<std::string, CMessageWorker*>::const_iterator it = mapMessageWorkers.find(strCommand);
+    return it == mapMessageWorkers.end() ? NULL : it->second;
+}
+
 void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.GetHeight.disconnect(&GetHeight);
@@ -901,11 +1043,11 @@ int GetInputAge(CTxIn& vin)
         CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
-        const CCoins* coins = view.AccessCoins(vin.prevout.hash);
+        const Coin& coin = view.AccessCoin(vin.prevout);
 
-        if (coins) {
-            if (coins->nHeight < 0) return 0;
-            return (chainActive.Tip()->nHeight + 1) - coins->nHeight;
+        if (!coin.IsSpent()) {
+            if (coin.nHeight < 0) return 0;
+            return (chainActive.Tip()->nHeight + 1) - coin.nHeight;
         } else
             return -1;
     }
@@ -1386,7 +1528,6 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
 
     bool fValidated = false;
     set<CBigNum> serials;
-    list<CoinSpend> vSpends;
     CAmount nTotalRedeemed = 0;
     for (const CTxIn& txin : tx.vin) {
         //only check txin that is a zcspend
@@ -1394,7 +1535,6 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
             continue;
 
         CoinSpend newSpend = TxInToZerocoinSpend(txin);
-        vSpends.push_back(newSpend);
 
         //check that the denomination is valid
         if (newSpend.getDenomination() == ZQ_ERROR)
@@ -1417,8 +1557,8 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
 
             Accumulator accumulator(Params().Zerocoin_Params(), newSpend.getDenomination(), bnAccumulatorValue);
 
-            //Check that the coin is on the accumulator
-            if (!newSpend.Verify(accumulator))
+            //Check that the coin is on the accumulator, remember the result for when the spend is seen in a block
+            if (!VerifyCoinSpendCached(newSpend, accumulator, true))
                 return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
         }
 
@@ -1436,23 +1576,35 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
         return state.DoS(100, error("Transaction spend more than was redeemed in zerocoins"));
     }
 
-    // Send signal to wallet if this is ours
-    if (pwalletMain) {
-        CWalletDB walletdb(pwalletMain->strWalletFile);
-        list<CBigNum> listMySerials = walletdb.ListMintedCoinsSerial();
-        for (const auto& newSpend : vSpends) {
-            list<CBigNum>::iterator it = find(listMySerials.begin(), listMySerials.end(), newSpend.getCoinSerialNumber());
-            if (it != listMySerials.end()) {
-                LogPrintf("%s: %s detected spent zerocoin mint in transaction %s \n", __func__, it->GetHex(), tx.GetHash().GetHex());
-                pwalletMain->NotifyZerocoinChanged(pwalletMain, it->GetHex(), "Used", CT_UPDATED);
-            }
+    return fValidated;
+}
+
+bool CheckZerocoinSpendProofs(const CTransaction& tx, CValidationState& state, bool fJustCheck, std::vector<CZerocoinSpendCheck>* pvChecks)
+{
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        const CTxIn& txin = tx.vin[i];
+        if (!txin.scriptSig.IsZerocoinSpend())
+            continue;
+
+        //see if we have record of the accumulator used in the spend tx
+        CoinSpend spend = TxInToZerocoinSpend(txin);
+        CBigNum bnAccumulatorValue = 0;
+        if (!zerocoinDB->ReadAccumulatorValue(spend.getAccumulatorChecksum(), bnAccumulatorValue))
+            return state.DoS(100, error("Zerocoinspend could not find accumulator associated with checksum"));
+
+        CZerocoinSpendCheck check(tx, i, bnAccumulatorValue, fJustCheck);
+        if (pvChecks) {
+            pvChecks->push_back(CZerocoinSpendCheck());
+            check.swap(pvChecks->back());
+        } else if (!check()) {
+            return state.DoS(100, error("CheckZerocoinSpendProofs(): zerocoin spend did not verify"));
         }
     }
 
-    return fValidated;
+    return true;
 }
 
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state)
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state, bool fVerifyZerocoinProofs)
 {
     // Basic checks that don't depend on any context
     if (tx.vin.empty())
@@ -1507,7 +1659,7 @@ bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fReject
             }
 
             // Do not require signature verification if this is initial sync and a block over 24 hours old
-            bool fVerifySignature = !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60 * 60 * 24));
+            bool fVerifySignature = fVerifyZerocoinProofs && !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60 * 60 * 24));
             if (!CheckZerocoinSpend(tx, fVerifySignature, state))
                 return state.DoS(100, error("CheckTransaction() : invalid zerocoin spend"));
         }
@@ -1602,7 +1754,16 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+static void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
+
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee, bool ignoreFees)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1698,14 +1859,16 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
             view.SetBackend(viewMemPool);
 
             // do we already have it?
-            if (view.HaveCoins(hash))
-                return false;
+            for (unsigned int i = 0; i < tx.vout.size(); i++) {
+                if (view.HaveCoin(COutPoint(hash, i)))
+                    return false;
+            }
 
             // do all inputs exist?
             // Note that this does not check for the presence of actual outputs (see the next check for that),
             // only helps filling in pfMissingInputs (to determine missing vs spent).
             for (const CTxIn txin : tx.vin) {
-                if (!view.HaveCoins(txin.prevout.hash)) {
+                if (!view.HaveCoin(txin.prevout)) {
                     if (pfMissingInputs)
                         *pfMissingInputs = true;
                     return false;
@@ -1762,9 +1925,9 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
         double dPriority = 0;
         if (!tx.IsZerocoinSpend())
-            view.GetPriority(tx, chainActive.Height());
+            dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height());
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1777,6 +1940,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                 return state.DoS(0, error("AcceptToMemoryPool : not enough fees %s, %d < %d", hash.ToString(), nFees, txMinFee),
                     REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+            // Once the pool was full, only transactions paying more than those evicted get in
+            CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+            if (mempoolRejectFee > 0 && nFees < mempoolRejectFee && !tx.IsZerocoinSpend())
+                return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d", hash.ToString(), nFees, mempoolRejectFee),
+                    REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
             // Require that free transactions have sufficient priority to be mined in the next block.
             if (tx.IsZerocoinMint()) {
                 if (nFees < Params().Zerocoin_MintFee() * tx.GetZerocoinMintCount())
@@ -1820,6 +1989,20 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                 hash.ToString(),
                 nFees, ::minRelayTxFee.GetFee(nSize) * 20000);
 
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+        std::string errString;
+        {
+            LOCK(pool.cs);
+            if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+                return state.DoS(0, error("AcceptToMemoryPool : %s %s", hash.ToString(), errString),
+                    REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true)) {
@@ -1839,8 +2022,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
             return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
 
-        // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        // Store transaction in memory, cs_main keeps the ancestors in the pool until then
+        pool.addUnchecked(hash, entry, setAncestors);
+
+        // trim the pool and check whether the transaction was trimmed itself
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -1848,6 +2036,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
     return true;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fRejectInsaneFee, ignoreFees);
+}
+
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool isDSTX)
 {
     AssertLockHeld(cs_main);
@@ -1912,14 +2105,16 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
             view.SetBackend(viewMemPool);
 
             // do we already have it?
-            if (view.HaveCoins(hash))
-                return false;
+            for (unsigned int i = 0; i < tx.vout.size(); i++) {
+                if (view.HaveCoin(COutPoint(hash, i)))
+                    return false;
+            }
 
             // do all inputs exist?
             // Note that this does not check for the presence of actual outputs (see the next check for that),
             // only helps filling in pfMissingInputs (to determine missing vs spent).
             for (const CTxIn txin : tx.vin) {
-                if (!view.HaveCoins(txin.prevout.hash)) {
+                if (!view.HaveCoin(txin.prevout)) {
                     if (pfMissingInputs)
                         *pfMissingInputs = true;
                     return false;
@@ -2112,14 +2307,16 @@ bool AcceptableFundamentalTxn(CTxMemPool& pool, CValidationState& state, const C
             view.SetBackend(viewMemPool);
 
             // do we already have it?
-            if (view.HaveCoins(hash))
-                return false;
+            for (unsigned int i = 0; i < tx.vout.size(); i++) {
+                if (view.HaveCoin(COutPoint(hash, i)))
+                    return false;
+            }
 
             // do all inputs exist?
             // Note that this does not check for the presence of actual outputs (see the next check for that),
             // only helps filling in pfMissingInputs (to determine missing vs spent).
             for (const CTxIn txin : tx.vin) {
-                if (!view.HaveCoins(txin.prevout.hash)) {
+                if (!view.HaveCoin(txin.prevout)) {
                     //if (pfMissingInputs)
                      //   *pfMissingInputs = true;
                     return false;
@@ -2193,6 +2390,30 @@ bool AcceptableFundamentalTxn(CTxMemPool& pool, CValidationState& state, const C
     return true;
 }
 
+/** Read a transaction from its block on disk through the transaction index, without cs_main */
+bool ReadTransactionFromIndex(const uint256& hash, CTransaction& txOut, uint256& hashBlock)
+{
+    CDiskTxPos postx;
+    if (!pblocktree->ReadTxIndex(hash, postx))
+        return false;
+
+    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return error("%s: OpenBlockFile failed", __func__);
+    CBlockHeader header;
+    try {
+        file >> header;
+        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+        file >> txOut;
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    hashBlock = header.GetHash();
+    if (txOut.GetHash() != hash)
+        return error("%s : txid mismatch", __func__);
+    return true;
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock, bool fAllowSlow)
 {
@@ -2206,36 +2427,16 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
         }
 
         if (fTxIndex) {
-            CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
-                CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (std::exception& e) {
-                    return error("%s : Deserialize or I/O error - %s", __func__, e.what());
-                }
-                hashBlock = header.GetHash();
-                if (txOut.GetHash() != hash)
-                    return error("%s : txid mismatch", __func__);
-                return true;
-            }
-
-            // transaction not found in the index, nothing more can be done
-            return false;
+            // if the transaction is not found in the index, nothing more can be done
+            return ReadTransactionFromIndex(hash, txOut, hashBlock);
         }
 
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
             int nHeight = -1;
             {
-                CCoinsViewCache& view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
+                const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+                if (!coin.IsSpent())
+                    nHeight = coin.nHeight;
             }
             if (nHeight > 0)
                 pindexSlow = chainActive[nHeight];
@@ -2561,12 +2762,20 @@ void CheckForkWarningConditionsOnNewFork(CBlockIndex* pindexNewForkTip)
     CheckForkWarningConditions();
 }
 
-// Requires cs_main.
 void Misbehaving(NodeId pnode, int howmuch)
 {
     if (howmuch == 0)
         return;
 
+    // The message workers report misbehavior while holding the lock of their subsystem,
+    // under which they must not wait for cs_main. SendMessages adds it to the score then.
+    TRY_LOCK(cs_main, lockMain);
+    if (!lockMain) {
+        LOCK(cs_mapMisbehaviorPending);
+        mapMisbehaviorPending[pnode] += howmuch;
+        return;
+    }
+
     CNodeState* state = State(pnode);
     if (state == NULL)
         return;
@@ -2620,14 +2829,15 @@ void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCach
     if (!tx.IsCoinBase() && !tx.IsZerocoinSpend()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-            txundo.vprevout.push_back(CTxInUndo());
-            bool ret = inputs.ModifyCoins(txin.prevout.hash)->Spend(txin.prevout, txundo.vprevout.back());
+            Coin coin;
+            bool ret = inputs.SpendCoin(txin.prevout, &coin);
             assert(ret);
+            txundo.vprevout.push_back(CTxInUndo(coin.out, coin.fCoinBase, coin.fCoinStake, coin.nHeight, coin.nVersion));
         }
     }
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 bool CScriptCheck::operator()()
@@ -2639,6 +2849,19 @@ bool CScriptCheck::operator()()
     return true;
 }
 
+bool CZerocoinSpendCheck::operator()()
+{
+    try {
+        CoinSpend spend = TxInToZerocoinSpend(ptxTo->vin[nIn]);
+        Accumulator accumulator(Params().Zerocoin_Params(), spend.getDenomination(), bnAccumulatorValue);
+        if (!VerifyCoinSpendCached(spend, accumulator, false, !fJustCheck))
+            return ::error("CZerocoinSpendCheck(): %s:%d zerocoin spend did not verify", ptxTo->GetHash().ToString(), nIn);
+    } catch (std::exception& e) {
+        return ::error("CZerocoinSpendCheck(): %s:%d %s", ptxTo->GetHash().ToString(), nIn, e.what());
+    }
+    return true;
+}
+
 CBitcoinAddress addressExp1("DQZzqnSR6PXxagep1byLiRg9ZurCZ5KieQ");
 CBitcoinAddress addressExp2("DTQYdnNqKuEHXyNeeYhPQGGGdqHbXYwjpj");
 
@@ -2795,12 +3018,12 @@ CAmount GetInvalidUTXOValue()
         const COutPoint out = it.first;
         bool fSpent = false;
         CCoinsViewCache cache(pcoinsTip);
-        const CCoins* coins = cache.AccessCoins(out.hash);
-        if (!coins || !coins->IsAvailable(out.n))
+        const Coin& coin = cache.AccessCoin(out);
+        if (!coin.IsAvailable())
             fSpent = true;
 
         if (!fSpent)
-            nValue += coins->vout[out.n].nValue;
+            nValue += coin.out.nValue;
     }
 
     return nValue;
@@ -2825,20 +3048,20 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
         CAmount nFees = 0;
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             const COutPoint& prevout = tx.vin[i].prevout;
-            const CCoins* coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase() || coins->IsCoinStake()) {
-                if (nSpendHeight - coins->nHeight < Params().COINBASE_MATURITY())
+            if (coin.IsCoinBase() || coin.IsCoinStake()) {
+                if (nSpendHeight - coin.nHeight < Params().COINBASE_MATURITY())
                     return state.Invalid(
-                        error("CheckInputs() : tried to spend coinbase at depth %d, coinstake=%d", nSpendHeight - coins->nHeight, coins->IsCoinStake()),
+                        error("CheckInputs() : tried to spend coinbase at depth %d, coinstake=%d", nSpendHeight - coin.nHeight, coin.IsCoinStake()),
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, error("CheckInputs() : txin values out of range"),
                     REJECT_INVALID, "bad-txns-inputvalues-outofrange");
         }
@@ -2871,11 +3094,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint& prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2887,7 +3110,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i,
+                        CScriptCheck check(coin.out, tx, i,
                             flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -2967,25 +3190,15 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         uint256 hash = tx.GetHash();
 
         // Check that all outputs are available and match the outputs in the block itself
-        // exactly. Note that transactions with only provably unspendable outputs won't
-        // have outputs available even in the block itself, so we handle that case
-        // specially with outsEmpty.
-        {
-            CCoins outsEmpty;
-            CCoinsModifier outs = view.ModifyCoins(hash);
-            outs->ClearUnspendable();
-
-            CCoins outsBlock(tx, pindex->nHeight);
-            // The CCoins serialization does not serialize negative numbers.
-            // No network rules currently depend on the version here, so an inconsistency is harmless
-            // but it must be corrected before txout nversion ever influences a network rule.
-            if (outsBlock.nVersion < 0)
-                outs->nVersion = outsBlock.nVersion;
-            if (*outs != outsBlock)
+        // exactly, and remove them. Provably unspendable outputs never made it into the
+        // coin set.
+        for (unsigned int o = 0; o < tx.vout.size(); o++) {
+            if (tx.vout[o].IsNull() || tx.vout[o].scriptPubKey.IsUnspendable())
+                continue;
+            Coin coin;
+            bool fSpent = view.SpendCoin(COutPoint(hash, o), &coin);
+            if (!fSpent || coin.out != tx.vout[o] || coin.nHeight != pindex->nHeight || coin.fCoinBase != tx.IsCoinBase())
                 fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
-
-            // remove outputs
-            outs->Clear();
         }
 
         // restore inputs
@@ -2996,24 +3209,22 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint& out = tx.vin[j].prevout;
                 const CTxInUndo& undo = txundo.vprevout[j];
-                CCoinsModifier coins = view.ModifyCoins(out.hash);
-                if (undo.nHeight != 0) {
-                    // undo data contains height: this is the last output of the prevout tx being spent
-                    if (!coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data overwriting existing transaction");
-                    coins->Clear();
-                    coins->fCoinBase = undo.fCoinBase;
-                    coins->nHeight = undo.nHeight;
-                    coins->nVersion = undo.nVersion;
-                } else {
-                    if (coins->IsPruned())
+                Coin coin(undo.txout, undo.nHeight, undo.fCoinBase, undo.fCoinStake, undo.nVersion);
+                if (undo.nHeight == 0) {
+                    // Undo data written by older versions only has the metadata for the last
+                    // spent output of a transaction; another output of it is still unspent.
+                    const Coin& alternate = AccessByTxid(view, out.hash);
+                    if (alternate.IsSpent())
                         fClean = fClean && error("DisconnectBlock() : undo data adding output to missing transaction");
+                    coin.fCoinBase = alternate.fCoinBase;
+                    coin.fCoinStake = alternate.fCoinStake;
+                    coin.nHeight = alternate.nHeight;
+                    coin.nVersion = alternate.nVersion;
                 }
-                if (coins->IsAvailable(out.n))
+                bool fOverwrite = view.HaveCoin(out);
+                if (fOverwrite)
                     fClean = fClean && error("DisconnectBlock() : undo data overwriting existing output");
-                if (coins->vout.size() < out.n + 1)
-                    coins->vout.resize(out.n + 1);
-                coins->vout[out.n] = undo.txout;
+                view.AddCoin(out, coin, fOverwrite);
                 // erase the spent input
                 mapStakeSpent.erase(out);
             }
@@ -3030,6 +3241,8 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             if (!EraseAccumulatorValues(nCheckpoint, pindex->pprev->nAccumulatorCheckpoint))
                 return error("DisconnectBlock(): failed to erase checkpoint");
         }
+
+        EraseMintJournal(pindex);
     }
 
     if (pfClean) {
@@ -3065,7 +3278,7 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CBlockCheck> scriptcheckqueue(128);
 
 void ThreadScriptCheck()
 {
@@ -3073,168 +3286,278 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
-void RecalculateZCRTSMinted()
-{
-    CBlockIndex* pindex = chainActive[Params().Zerocoin_StartHeight()];
-    int nHeightEnd = chainActive.Height();
-    while (true) {
-        if (pindex->nHeight % 1000 == 0)
-            LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
-
-        //overwrite possibly wrong vMintsInBlock data
-        CBlock block;
-        assert(ReadBlockFromDisk(block, pindex));
-
-        std::list<CZerocoinMint> listMints;
-        BlockToZerocoinMintList(block, listMints, true);
-
-        vector<libzerocoin::CoinDenomination> vDenomsBefore = pindex->vMintDenominationsInBlock;
-        pindex->vMintDenominationsInBlock.clear();
-        for (auto mint : listMints)
-            pindex->vMintDenominationsInBlock.emplace_back(mint.GetDenomination());
-
-        if (pindex->nHeight < nHeightEnd)
-            pindex = chainActive.Next(pindex);
-        else
-            break;
-    }
-}
+//! Threads reading blocks ahead of the ordered stage of ReindexZerocoin()
+static const int MAX_ZEROCOIN_REINDEX_THREADS = 8;
+//! Blocks that may be read ahead of the ordered stage of ReindexZerocoin()
+static const size_t MAX_ZEROCOIN_REINDEX_READ_AHEAD = 1000;
+
+/** Zerocoin and money supply data of one block, extracted by the read-ahead threads of ReindexZerocoin() */
+struct CZerocoinReindexBlock {
+    CBlockIndex* pindex;
+    bool fOk;
+    std::list<libzerocoin::CoinDenomination> listDenomsMinted;
+    std::list<libzerocoin::CoinDenomination> listDenomsSpent;
+    bool fHavePubcoins;
+    bool fHavePubcoinsFiltered;
+    std::list<PublicCoin> listPubcoins;
+    std::list<PublicCoin> listPubcoinsFiltered;
+    CAmount nValueIn; //! value of the inputs the read-ahead thread could look up
+    CAmount nValueOut;
+    std::vector<COutPoint> vPrevoutsLeft; //! inputs left for the ordered stage to look up
+
+    CZerocoinReindexBlock() : pindex(NULL), fOk(false), fHavePubcoins(false), fHavePubcoinsFiltered(false), nValueIn(0), nValueOut(0) {}
+};
 
-void RecalculateZCRTSSpent()
+/** Read the block of data.pindex and extract what the stages in nFlags need. Runs without cs_main. */
+static bool ExtractZerocoinReindexBlock(CZerocoinReindexBlock& data, unsigned int nFlags, int nSupplyHeightStart)
 {
-    CBlockIndex* pindex = chainActive[Params().Zerocoin_StartHeight()];
-    while (true) {
-        if (pindex->nHeight % 1000 == 0)
-            LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
-
-        //Rewrite zCRTS supply
-        CBlock block;
-        assert(ReadBlockFromDisk(block, pindex));
-
-        list<libzerocoin::CoinDenomination> listDenomsSpent = ZerocoinSpendListFromBlock(block, true);
-
-        //Reset the supply to previous block
-        pindex->mapZerocoinSupply = pindex->pprev->mapZerocoinSupply;
+    const CBlockIndex* pindex = data.pindex;
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return false;
 
-        //Add mints to zCRTS supply
-        for (auto denom : libzerocoin::zerocoinDenomList) {
-            long nDenomAdded = count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
-            pindex->mapZerocoinSupply.at(denom) += nDenomAdded;
+    if (pindex->nHeight >= Params().Zerocoin_StartHeight()) {
+        if (nFlags & ZEROCOIN_REINDEX_MINTED) {
+            std::list<CZerocoinMint> listMints;
+            BlockToZerocoinMintList(block, listMints, true);
+            for (auto& mint : listMints)
+                data.listDenomsMinted.emplace_back(mint.GetDenomination());
         }
 
-        //Remove spends from zCRTS supply
-        for (auto denom : listDenomsSpent)
-            pindex->mapZerocoinSupply.at(denom)--;
-
-        //Rewrite money supply
-        assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
+        if (nFlags & ZEROCOIN_REINDEX_SPENT)
+            data.listDenomsSpent = ZerocoinSpendListFromBlock(block, true);
 
-        if (pindex->nHeight < chainActive.Height())
-            pindex = chainActive.Next(pindex);
-        else
-            break;
+        if (nFlags & ZEROCOIN_REINDEX_ACCUMULATORS) {
+            // the block is accumulated by the checkpoint 20 blocks after its ten block period,
+            // and again by the recalculation from the last good checkpoint
+            int nHeightCheckpoint = pindex->nHeight - pindex->nHeight % 10 + 20;
+            if (nHeightCheckpoint < Params().Zerocoin_Block_RecalculateAccumulators())
+                data.fHavePubcoins = BlockToPubcoinList(block, data.listPubcoins, false);
+            if (nHeightCheckpoint >= Params().Zerocoin_Block_RecalculateAccumulators() || pindex->nHeight >= Params().Zerocoin_Block_LastGoodCheckpoint() - 10)
+                data.fHavePubcoinsFiltered = BlockToPubcoinList(block, data.listPubcoinsFiltered, true);
+        }
     }
-}
 
-bool RecalculateZCRTSSupply(int nHeightStart)
-{
-    if (nHeightStart > chainActive.Height())
-        return false;
-
-    CBlockIndex* pindex = chainActive[nHeightStart];
-    CAmount nSupplyPrev = pindex->pprev->nMoneySupply;
-    if (nHeightStart == Params().Zerocoin_StartHeight())
-        nSupplyPrev = CAmount(5449796547496199);
-
-    while (true) {
-        if (pindex->nHeight % 1000 == 0)
-            LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
-
-        CBlock block;
-        assert(ReadBlockFromDisk(block, pindex));
-
-        CAmount nValueIn = 0;
-        CAmount nValueOut = 0;
-        for (const CTransaction tx : block.vtx) {
+    if ((nFlags & ZEROCOIN_REINDEX_SUPPLY) && pindex->nHeight >= nSupplyHeightStart) {
+        for (const CTransaction& tx : block.vtx) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 if (tx.IsCoinBase())
                     break;
 
                 if (tx.vin[i].scriptSig.IsZerocoinSpend()) {
-                    nValueIn += tx.vin[i].nSequence * COIN;
+                    data.nValueIn += tx.vin[i].nSequence * COIN;
                     continue;
                 }
 
-                COutPoint prevout = tx.vin[i].prevout;
+                const COutPoint& prevout = tx.vin[i].prevout;
                 CTransaction txPrev;
                 uint256 hashBlock;
-                assert(GetTransaction(prevout.hash, txPrev, hashBlock, true));
-                nValueIn += txPrev.vout[prevout.n].nValue;
+                if (fTxIndex && ReadTransactionFromIndex(prevout.hash, txPrev, hashBlock))
+                    data.nValueIn += txPrev.vout[prevout.n].nValue;
+                else
+                    data.vPrevoutsLeft.push_back(prevout);
             }
 
             for (unsigned int i = 0; i < tx.vout.size(); i++) {
                 if (i == 0 && tx.IsCoinStake())
                     continue;
 
-                nValueOut += tx.vout[i].nValue;
+                data.nValueOut += tx.vout[i].nValue;
             }
         }
+    }
 
-        // Rewrite money supply
-        pindex->nMoneySupply = nSupplyPrev + nValueOut - nValueIn;
-        nSupplyPrev = pindex->nMoneySupply;
+    return true;
+}
 
-        // Add fraudulent funds to the supply and remove any recovered funds.
-        if (pindex->nHeight == Params().Zerocoin_Block_RecalculateAccumulators()) {
-            PopulateInvalidOutPointMap();
-            LogPrintf("%s : Original money supply=%s\n", __func__, FormatMoney(pindex->nMoneySupply));
+/**
+ * Blocks of a zerocoin reindex, read and extracted by a group of threads and handed out in
+ * chain order. The threads stay at most MAX_ZEROCOIN_REINDEX_READ_AHEAD blocks ahead.
+ */
+class CZerocoinReindexQueue
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable condRead;
+    boost::condition_variable condReady;
+    boost::thread_group threadGroup;
+
+    const std::vector<CBlockIndex*>& vBlocks;
+    const unsigned int nFlags;
+    const int nSupplyHeightStart;
+
+    std::map<size_t, CZerocoinReindexBlock> mapReady;
+    size_t nNextRead;
+    size_t nNextOrdered;
+    bool fStop;
+
+    void Thread()
+    {
+        RenameThread("caritas-zcreindex");
+        while (true) {
+            size_t nPos;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (!fStop && nNextRead < vBlocks.size() && nNextRead >= nNextOrdered + MAX_ZEROCOIN_REINDEX_READ_AHEAD)
+                    condRead.wait(lock);
+                if (fStop || nNextRead == vBlocks.size())
+                    return;
+                nPos = nNextRead++;
+            }
+
+            CZerocoinReindexBlock data;
+            data.pindex = vBlocks[nPos];
+            try {
+                data.fOk = ExtractZerocoinReindexBlock(data, nFlags, nSupplyHeightStart);
+            } catch (std::exception& e) {
+                LogPrintf("%s : block %d - %s\n", __func__, data.pindex->nHeight, e.what());
+            }
 
-            pindex->nMoneySupply += nFilteredThroughBittrex;
-            LogPrintf("%s : Adding bittrex filtered funds to supply + %s : supply=%s\n", __func__, FormatMoney(nFilteredThroughBittrex), FormatMoney(pindex->nMoneySupply));
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                mapReady[nPos] = std::move(data);
+            }
+            condReady.notify_one();
+        }
+    }
 
-            CAmount nLocked = GetInvalidUTXOValue();
-            pindex->nMoneySupply -= nLocked;
-            LogPrintf("%s : Removing locked from supply - %s : supply=%s\n", __func__, FormatMoney(nLocked), FormatMoney(pindex->nMoneySupply));
+public:
+    CZerocoinReindexQueue(const std::vector<CBlockIndex*>& vBlocksIn, unsigned int nFlagsIn, int nSupplyHeightStartIn, int nThreads)
+        : vBlocks(vBlocksIn), nFlags(nFlagsIn), nSupplyHeightStart(nSupplyHeightStartIn), nNextRead(0), nNextOrdered(0), fStop(false)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CZerocoinReindexQueue::Thread, this));
+    }
+
+    ~CZerocoinReindexQueue()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
         }
+        condRead.notify_all();
+        threadGroup.join_all();
+    }
+
+    //! Wait for the next block in chain order, returns false after the last one
+    bool Next(CZerocoinReindexBlock& data)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (nNextOrdered == vBlocks.size())
+            return false;
+        std::map<size_t, CZerocoinReindexBlock>::iterator it;
+        while ((it = mapReady.find(nNextOrdered)) == mapReady.end())
+            condReady.wait(lock);
+        data = std::move(it->second);
+        mapReady.erase(it);
+        nNextOrdered++;
+        condRead.notify_all();
+        return true;
+    }
+};
 
-        assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
+bool ReindexZerocoin(unsigned int nFlags, int nSupplyHeightStart, list<uint256>& listMissingCheckpoints, string& strError)
+{
+    int nZerocoinStart = Params().Zerocoin_StartHeight();
+    int nHeightEnd = chainActive.Height();
 
-        if (pindex->nHeight < chainActive.Height())
-            pindex = chainActive.Next(pindex);
+    std::set<uint256> setMissingCheckpoints(listMissingCheckpoints.begin(), listMissingCheckpoints.end());
+    if (setMissingCheckpoints.empty())
+        nFlags &= ~ZEROCOIN_REINDEX_ACCUMULATORS;
+
+    int nHeightStart = nHeightEnd + 1;
+    if (nFlags & (ZEROCOIN_REINDEX_MINTED | ZEROCOIN_REINDEX_SPENT | ZEROCOIN_REINDEX_ACCUMULATORS))
+        nHeightStart = nZerocoinStart;
+    if (nFlags & ZEROCOIN_REINDEX_SUPPLY) {
+        if (nSupplyHeightStart < 1 || nSupplyHeightStart > nHeightEnd)
+            nFlags &= ~ZEROCOIN_REINDEX_SUPPLY;
         else
-            break;
+            nHeightStart = std::min(nHeightStart, nSupplyHeightStart);
     }
-    return true;
-}
+    if (nHeightStart > nHeightEnd)
+        return true;
 
-bool ReindexAccumulators(list<uint256>& listMissingCheckpoints, string& strError)
-{
-    // CaritasCoin: recalculate Accumulator Checkpoints that failed to database properly
-    if (!listMissingCheckpoints.empty() && chainActive.Height() >= Params().Zerocoin_StartHeight()) {
-        //uiInterface.InitMessage(_("Calculating missing accumulators..."));
-        LogPrintf("%s : finding missing checkpoints\n", __func__);
+    CAmount nSupplyPrev = 0;
+    if (nFlags & ZEROCOIN_REINDEX_SUPPLY) {
+        nSupplyPrev = chainActive[nSupplyHeightStart]->pprev->nMoneySupply;
+        if (nSupplyHeightStart == nZerocoinStart)
+            nSupplyPrev = CAmount(5449796547496199);
 
-        //search the chain to see when zerocoin started
-        int nZerocoinStart = Params().Zerocoin_StartHeight();
+        // the read-ahead threads filter on the invalid outpoints, fill them in before they start
+        if (nHeightEnd >= Params().Zerocoin_Block_RecalculateAccumulators())
+            PopulateInvalidOutPointMap();
+    }
 
-        // find each checkpoint that is missing
-        CBlockIndex* pindex = chainActive[nZerocoinStart];
-        while (!listMissingCheckpoints.empty()) {
-            if (ShutdownRequested())
-                return false;
+    std::vector<CBlockIndex*> vBlocks;
+    vBlocks.reserve(nHeightEnd - nHeightStart + 1);
+    for (int nHeight = nHeightStart; nHeight <= nHeightEnd; nHeight++)
+        vBlocks.push_back(chainActive[nHeight]);
+
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_ZEROCOIN_REINDEX_THREADS));
+    LogPrintf("%s : reindexing blocks %d to %d with %d read-ahead threads\n", __func__, nHeightStart, nHeightEnd, nThreads);
+
+    CZerocoinReindexQueue queue(vBlocks, nFlags, nSupplyHeightStart, nThreads);
+    CBlockPubcoinCache pubcoinCache;
+    CZerocoinReindexBlock data;
+    int nReportDone = -1;
+    int nBlocksDone = 0;
+    while (queue.Next(data)) {
+        if (ShutdownRequested())
+            return false;
+
+        CBlockIndex* pindex = data.pindex;
+        if (!data.fOk) {
+            strError = strprintf(_("Failed to read block %d for the zerocoin reindex"), pindex->nHeight);
+            return error("%s : %s", __func__, strError);
+        }
+
+        int nDone = ++nBlocksDone * 100 / (int)vBlocks.size();
+        if (nDone > nReportDone) {
+            nReportDone = nDone;
+            uiInterface.InitMessage(strprintf(_("Reindexing zerocoin data... %d%%"), nReportDone));
+        }
+        if (pindex->nHeight % 1000 == 0)
+            LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
+
+        bool fWriteIndex = false;
+        if (pindex->nHeight >= nZerocoinStart) {
+            //overwrite possibly wrong vMintsInBlock data
+            if (nFlags & ZEROCOIN_REINDEX_MINTED)
+                pindex->vMintDenominationsInBlock.assign(data.listDenomsMinted.begin(), data.listDenomsMinted.end());
+
+            if (nFlags & ZEROCOIN_REINDEX_SPENT) {
+                //Reset the supply to previous block
+                pindex->mapZerocoinSupply = pindex->pprev->mapZerocoinSupply;
 
-            // find checkpoints by iterating through the blockchain beginning with the first zerocoin block
-            if (pindex->nAccumulatorCheckpoint != pindex->pprev->nAccumulatorCheckpoint) {
-                //double dPercent = (pindex->nHeight - nZerocoinStart) / (double) (chainActive.Height() - nZerocoinStart);
-                //uiInterface.ShowProgress(_("Calculating missing accumulators..."), (int) (dPercent * 100));
-                if (find(listMissingCheckpoints.begin(), listMissingCheckpoints.end(), pindex->nAccumulatorCheckpoint) != listMissingCheckpoints.end()) {
+                //Add mints to zCRTS supply
+                for (auto denom : libzerocoin::zerocoinDenomList) {
+                    long nDenomAdded = count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
+                    pindex->mapZerocoinSupply.at(denom) += nDenomAdded;
+                }
+
+                //Remove spends from zCRTS supply
+                for (auto denom : data.listDenomsSpent)
+                    pindex->mapZerocoinSupply.at(denom)--;
+
+                fWriteIndex = true;
+            }
+
+            if (nFlags & ZEROCOIN_REINDEX_ACCUMULATORS) {
+                if (data.fHavePubcoins)
+                    pubcoinCache.Add(pindex, false, data.listPubcoins);
+                if (data.fHavePubcoinsFiltered)
+                    pubcoinCache.Add(pindex, true, data.listPubcoinsFiltered);
+                pubcoinCache.Prune(pindex->nHeight - 20);
+
+                // CaritasCoin: recalculate Accumulator Checkpoints that failed to database properly
+                if (pindex->nAccumulatorCheckpoint != pindex->pprev->nAccumulatorCheckpoint && setMissingCheckpoints.count(pindex->nAccumulatorCheckpoint)) {
                     uint256 nCheckpointCalculated = 0;
-                    if (!CalculateAccumulatorCheckpoint(pindex->nHeight, nCheckpointCalculated)) {
+                    if (!CalculateAccumulatorCheckpoint(pindex->nHeight, nCheckpointCalculated, &pubcoinCache)) {
                         // GetCheckpoint could have terminated due to a shutdown request. Check this here.
                         if (ShutdownRequested())
-                            break;
+                            return false;
                         strError = _("Failed to calculate accumulator checkpoint");
-                        return false;
+                        return error("%s : %s at height %d", __func__, strError, pindex->nHeight);
                     }
 
                     //check that the calculated checkpoint is what is in the index.
@@ -3244,18 +3567,73 @@ bool ReindexAccumulators(list<uint256>& listMissingCheckpoints, string& strError
                         return false;
                     }
 
-                    auto it = find(listMissingCheckpoints.begin(), listMissingCheckpoints.end(), pindex->nAccumulatorCheckpoint);
-                    listMissingCheckpoints.erase(it);
+                    setMissingCheckpoints.erase(pindex->nAccumulatorCheckpoint);
+
+                    // nothing else to do once the last missing checkpoint is found
+                    if (setMissingCheckpoints.empty() && nFlags == ZEROCOIN_REINDEX_ACCUMULATORS)
+                        break;
                 }
             }
+        }
 
-            // if we have iterated to the end of the blockchain, then checkpoints should be in sync
-            if (pindex->nHeight + 1 <= chainActive.Height())
-                pindex = chainActive.Next(pindex);
-            else
-                break;
+        if ((nFlags & ZEROCOIN_REINDEX_SUPPLY) && pindex->nHeight >= nSupplyHeightStart) {
+            CAmount nValueIn = data.nValueIn;
+            for (const COutPoint& prevout : data.vPrevoutsLeft) {
+                CTransaction txPrev;
+                uint256 hashBlock;
+                if (!GetTransaction(prevout.hash, txPrev, hashBlock, true)) {
+                    strError = strprintf(_("Failed to find the inputs of block %d for the zerocoin reindex"), pindex->nHeight);
+                    return error("%s : %s", __func__, strError);
+                }
+                nValueIn += txPrev.vout[prevout.n].nValue;
+            }
+
+            // Rewrite money supply
+            pindex->nMoneySupply = nSupplyPrev + data.nValueOut - nValueIn;
+            nSupplyPrev = pindex->nMoneySupply;
+
+            // Add fraudulent funds to the supply and remove any recovered funds.
+            if (pindex->nHeight == Params().Zerocoin_Block_RecalculateAccumulators()) {
+                LogPrintf("%s : Original money supply=%s\n", __func__, FormatMoney(pindex->nMoneySupply));
+
+                pindex->nMoneySupply += nFilteredThroughBittrex;
+                LogPrintf("%s : Adding bittrex filtered funds to supply + %s : supply=%s\n", __func__, FormatMoney(nFilteredThroughBittrex), FormatMoney(pindex->nMoneySupply));
+
+                CAmount nLocked = GetInvalidUTXOValue();
+                pindex->nMoneySupply -= nLocked;
+                LogPrintf("%s : Removing locked from supply - %s : supply=%s\n", __func__, FormatMoney(nLocked), FormatMoney(pindex->nMoneySupply));
+            }
+
+            fWriteIndex = true;
+        }
+
+        if (fWriteIndex && !pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex))) {
+            strError = _("Failed to write to the block index database");
+            return error("%s : %s at height %d", __func__, strError, pindex->nHeight);
         }
     }
+
+    listMissingCheckpoints.remove_if([&setMissingCheckpoints](const uint256& nCheckpoint) { return !setMissingCheckpoints.count(nCheckpoint); });
+    return true;
+}
+
+template <typename T>
+static void AddBlockChecks(CCheckQueueControl<CBlockCheck>& control, std::vector<T>& vChecks)
+{
+    std::vector<CBlockCheck> vBlockChecks;
+    vBlockChecks.reserve(vChecks.size());
+    for (T& check : vChecks)
+        vBlockChecks.emplace_back(check);
+    control.Add(vBlockChecks);
+}
+
+/** Queue the proof checks of the zerocoin spends of tx on the block check queue, or verify them right away without script check threads */
+static bool QueueZerocoinSpendChecks(const CTransaction& tx, CValidationState& state, bool fJustCheck, CCheckQueueControl<CBlockCheck>& control)
+{
+    std::vector<CZerocoinSpendCheck> vZerocoinChecks;
+    if (!CheckZerocoinSpendProofs(tx, state, fJustCheck, nScriptCheckThreads ? &vZerocoinChecks : NULL))
+        return false;
+    AddBlockChecks(control, vZerocoinChecks);
     return true;
 }
 
@@ -3312,10 +3690,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                              (pindex->nHeight == 91880 && pindex->GetBlockHash() == uint256("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")));
     if (fEnforceBIP30) {
         BOOST_FOREACH (const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
-                    REJECT_INVALID, "bad-txns-BIP30");
+            for (unsigned int o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                    return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
+                        REJECT_INVALID, "bad-txns-BIP30");
+            }
         }
     }
 
@@ -3332,7 +3711,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    // Zerocoin spend proofs are not checked by CheckBlock(), they are verified here on the same queue as the script checks.
+    // Do not require proof verification if this is initial sync and a block over 24 hours old
+    bool fZerocoinSpendChecks = block.GetBlockTime() > Params().Zerocoin_StartTime() && !IsInitialBlockDownload() &&
+                                (GetTime() - chainActive.Tip()->GetBlockTime() < (60 * 60 * 24));
+    CCheckQueueControl<CBlockCheck> control((fScriptChecks || fZerocoinSpendChecks) && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -3398,6 +3781,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 if (!zerocoinDB->WriteCoinSpend(spend.getCoinSerialNumber(), tx.GetHash()))
                     return error("failed to record coin serial to database");
             }
+
+            if (fZerocoinSpendChecks && !QueueZerocoinSpendChecks(tx, state, fJustCheck, control))
+                return error("ConnectBlock() : invalid zerocoin spend in tx %s", tx.GetHash().GetHex());
         } else if (!tx.IsCoinBase()) {
             if (!view.HaveInputs(tx))
                 return state.DoS(100, error("ConnectBlock() : inputs missing/spent"),
@@ -3431,7 +3817,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             std::vector<CScriptCheck> vChecks;
             if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
-            control.Add(vChecks);
+            AddBlockChecks(control, vChecks);
         }
         nValueOut += tx.GetValueOut();
 
@@ -3447,13 +3833,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     std::list<CZerocoinMint> listMints;
     bool fFilterInvalid = pindex->nHeight >= Params().Zerocoin_Block_RecalculateAccumulators();
-    BlockToZerocoinMintList(block, listMints, fFilterInvalid);
+    bool fMintList = BlockToZerocoinMintList(block, listMints, fFilterInvalid);
     std::list<libzerocoin::CoinDenomination> listSpends = ZerocoinSpendListFromBlock(block, fFilterInvalid);
 
     if (pindex->nHeight == Params().Zerocoin_Block_RecalculateAccumulators() + 1) {
-        RecalculateZCRTSMinted();
-        RecalculateZCRTSSpent();
-        RecalculateZCRTSSupply(Params().Zerocoin_StartHeight());
+        list<uint256> listNoCheckpoints;
+        string strError;
+        if (!ReindexZerocoin(ZEROCOIN_REINDEX_MINTED | ZEROCOIN_REINDEX_SPENT | ZEROCOIN_REINDEX_SUPPLY, Params().Zerocoin_StartHeight(), listNoCheckpoints, strError))
+            return error("ConnectBlock() : failed to recalculate the zerocoin supply: %s", strError);
     }
 
     // Initialize zerocoin supply to the supply from previous block
@@ -3530,8 +3917,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 LogPrintf("%s : Checkpoint not found for block %d, recalculating accumulators\n", __func__, pindex->nHeight);
                 CBlockIndex* pindexCheckpoint = chainActive[Params().Zerocoin_Block_LastGoodCheckpoint()];
                 list<uint256> listCheckpoints;
+                set<uint256> setCheckpoints;
                 while (pindexCheckpoint->nHeight <= nStop) {
-                    if (!count(listCheckpoints.begin(), listCheckpoints.end(), pindexCheckpoint->nAccumulatorCheckpoint))
+                    if (setCheckpoints.insert(pindexCheckpoint->nAccumulatorCheckpoint).second)
                         listCheckpoints.emplace_back(pindexCheckpoint->nAccumulatorCheckpoint);
 
                     pindexCheckpoint = chainActive.Next(pindexCheckpoint);
@@ -3540,7 +3928,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 }
 
                 string strError;
-                if (!ReindexAccumulators(listCheckpoints, strError) || !CalculateAccumulatorCheckpoint(pindex->nHeight, nCheckpointCalculated))
+                if (!ReindexZerocoin(ZEROCOIN_REINDEX_ACCUMULATORS, 0, listCheckpoints, strError) || !CalculateAccumulatorCheckpoint(pindex->nHeight, nCheckpointCalculated))
                     return state.DoS(100, error("ConnectBlock() : failed to recalculate accumulator checkpoint"));
             } else {
                 return state.DoS(100, error("ConnectBlock() : failed to calculate accumulator checkpoint"));
@@ -3557,7 +3945,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
 
     if (!control.Wait())
-        return state.DoS(100, false);
+        return state.DoS(100, error("ConnectBlock() : script or zerocoin spend check failed"));
+
     int64_t nTime2 = GetTimeMicros();
     nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs - 1), nTimeVerify * 0.000001);
@@ -3627,6 +4016,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (pindex->nHeight >= Params().Zerocoin_Block_FirstFraudulent() && pindex->nHeight <= Params().Zerocoin_Block_RecalculateAccumulators() + 1)
         AddInvalidSpendsToMap(block);
 
+    //journal the mints of this block so that the accumulator checkpoints do not need to read it back from disk
+    if (fMintList && pindex->nHeight > Params().Zerocoin_Block_RecalculateAccumulators()) {
+        if (!WriteMintJournal(pindex, listMints))
+            return state.Abort("Failed to write mint journal");
+        if (!fVerifyingBlocks)
+            PrecomputeAccumulatorCheckpoint(pindex);
+    }
+
     return true;
 }
 
@@ -3647,14 +4044,14 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
     static int64_t nLastWrite = 0;
     try {
         if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) ||
             (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
-            // Typical CCoins structures on disk are around 100 bytes in size.
+            // Typical Coin structures on disk are around 48 bytes in size.
             // Pushing a new one to the database can cause it to be written
             // twice (once in the log, and once in the tables). This is already
             // an overestimation, as most will delete an existing entry or
             // overwrite one. Still, use a conservative safety factor of 2.
-            if (!CheckDiskSpace(100 * 2 * 2 * pcoinsTip->GetCacheSize()))
+            if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // First make sure all block and undo data is flushed to disk.
             FlushBlockFile();
@@ -3711,10 +4108,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-        Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+        Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -4036,9 +4433,11 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
     const CBlockIndex* pindexFork = chainActive.FindFork(pindexMostWork);
 
     // Disconnect active blocks which are no longer in the best chain.
+    bool fBlocksDisconnected = false;
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
         if (!DisconnectTip(state))
             return false;
+        fBlocksDisconnected = true;
     }
 
     // Build list of new blocks to connect.
@@ -4084,6 +4483,10 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
         }
     }
 
+    // Resurrected transactions may have pushed the pool beyond its limit
+    if (fBlocksDisconnected)
+        mempool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+
     // Callbacks/notifications for a new best chain.
     if (fInvalidFound)
         CheckForkWarningConditionsOnNewFork(vpindexToConnect.back());
@@ -4141,6 +4544,7 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock, bool fAlreadyChe
             }
             // Notify external listeners about the new tip.
             uiInterface.NotifyBlockTip(hashNewTip);
+            g_signals.UpdatedBlockTip(pindexNewTip);
         }
     } while (pindexMostWork != chainActive.Tip());
     CheckBlockIndex();
@@ -4222,6 +4626,47 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex* pindex)
     return true;
 }
 
+/** Compute the proof-of-stake fields of a block index entry that depend on its ancestors */
+void static ComputeBlockIndexStake(CBlockIndex* pindexNew)
+{
+    uint256 hash = pindexNew->GetBlockHash();
+
+    // ppcoin: compute stake entropy bit for stake modifier
+    if (!pindexNew->SetStakeEntropyBit(pindexNew->GetStakeEntropyBit()))
+        LogPrintf("AddToBlockIndex() : SetStakeEntropyBit() failed \n");
+
+    // ppcoin: record proof-of-stake hash value
+    if (pindexNew->IsProofOfStake()) {
+        if (!mapProofOfStake.count(hash))
+            LogPrintf("AddToBlockIndex() : hashProofOfStake not found in map \n");
+        pindexNew->hashProofOfStake = mapProofOfStake[hash];
+    }
+
+    // ppcoin: compute stake modifier
+    uint64_t nStakeModifier = 0;
+    bool fGeneratedStakeModifier = false;
+    if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
+        LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
+    pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+    pindexNew->nStakeModifierChecksum = GetStakeModifierChecksum(pindexNew);
+    if (!CheckStakeModifierCheckpoints(pindexNew->nHeight, pindexNew->nStakeModifierChecksum))
+        LogPrintf("AddToBlockIndex() : Rejected by stake modifier checkpoint height=%d, modifier=%s \n", pindexNew->nHeight, boost::lexical_cast<std::string>(nStakeModifier));
+}
+
+/** Fill in the proof-of-stake fields of an entry that was added from the block's header alone */
+void static SetBlockIndexStake(CBlockIndex* pindex, const CBlock& block)
+{
+    if (block.IsProofOfStake()) {
+        pindex->SetProofOfStake();
+        pindex->prevoutStake = block.vtx[1].vin[0].prevout;
+        pindex->nStakeTime = block.nTime;
+        setStakeSeen.insert(make_pair(pindex->prevoutStake, pindex->nStakeTime));
+    }
+    if (pindex->pprev)
+        ComputeBlockIndexStake(pindex);
+    setDirtyBlockIndex.insert(pindex);
+}
+
 CBlockIndex* AddToBlockIndex(const CBlock& block)
 {
     // Check for duplicate
@@ -4253,29 +4698,17 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         //update previous block pointer
         pindexNew->pprev->pnext = pindexNew;
 
+        // A header received without its block: every block after the last proof-of-work one is proof-of-stake,
+        // the remaining stake fields are set by AcceptBlock once the block arrives
+        bool fHeaderOnly = block.vtx.empty();
+        if (fHeaderOnly && pindexNew->nHeight > Params().LAST_POW_BLOCK())
+            pindexNew->SetProofOfStake();
+
         // ppcoin: compute chain trust score
         pindexNew->bnChainTrust = (pindexNew->pprev ? pindexNew->pprev->bnChainTrust : 0) + pindexNew->GetBlockTrust();
 
-        // ppcoin: compute stake entropy bit for stake modifier
-        if (!pindexNew->SetStakeEntropyBit(pindexNew->GetStakeEntropyBit()))
-            LogPrintf("AddToBlockIndex() : SetStakeEntropyBit() failed \n");
-
-        // ppcoin: record proof-of-stake hash value
-        if (pindexNew->IsProofOfStake()) {
-            if (!mapProofOfStake.count(hash))
-                LogPrintf("AddToBlockIndex() : hashProofOfStake not found in map \n");
-            pindexNew->hashProofOfStake = mapProofOfStake[hash];
-        }
-
-        // ppcoin: compute stake modifier
-        uint64_t nStakeModifier = 0;
-        bool fGeneratedStakeModifier = false;
-        if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
-            LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
-        pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
-        pindexNew->nStakeModifierChecksum = GetStakeModifierChecksum(pindexNew);
-        if (!CheckStakeModifierCheckpoints(pindexNew->nHeight, pindexNew->nStakeModifierChecksum))
-            LogPrintf("AddToBlockIndex() : Rejected by stake modifier checkpoint height=%d, modifier=%s \n", pindexNew->nHeight, boost::lexical_cast<std::string>(nStakeModifier));
+        if (!fHeaderOnly)
+            ComputeBlockIndexStake(pindexNew);
     }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
@@ -4563,7 +4996,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     bool fZerocoinActive = block.GetBlockTime() > Params().Zerocoin_StartTime();
     vector<CBigNum> vBlockSerials;
     for (const CTransaction& tx : block.vtx) {
-        if (!CheckTransaction(tx, fZerocoinActive, chainActive.Height() + 1 >= Params().Zerocoin_Block_EnforceSerialRange(), state))
+        // zerocoin spend proofs are verified in parallel by ConnectBlock()
+        if (!CheckTransaction(tx, fZerocoinActive, chainActive.Height() + 1 >= Params().Zerocoin_Block_EnforceSerialRange(), state, false))
             return error("CheckBlock() : CheckTransaction failed");
 
         // double check that there are no double spent zCRTS spends in this block
@@ -4593,14 +5027,12 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     return true;
 }
 
-bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
+/** Check that the block's nBits is the difficulty required after pindexPrev */
+bool static CheckBlockBits(const CBlockHeader& block, bool fProofOfWork, CBlockIndex* const pindexPrev)
 {
-    if (pindexPrev == NULL)
-        return error("%s : null pindexPrev for block %s", __func__, block.GetHash().ToString().c_str());
-
     unsigned int nBitsRequired = GetNextWorkRequired(pindexPrev, &block);
 
-    if (block.IsProofOfWork() && (pindexPrev->nHeight + 1 <= 68589)) {
+    if (fProofOfWork && (pindexPrev->nHeight + 1 <= 68589)) {
         double n1 = ConvertBitsToDouble(block.nBits);
         double n2 = ConvertBitsToDouble(nBitsRequired);
 
@@ -4613,6 +5045,17 @@ bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
     if (block.nBits != nBitsRequired)
         return error("%s : incorrect proof of work at %d", __func__, pindexPrev->nHeight + 1);
 
+    return true;
+}
+
+bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
+{
+    if (pindexPrev == NULL)
+        return error("%s : null pindexPrev for block %s", __func__, block.GetHash().ToString().c_str());
+
+    if (!CheckBlockBits(block, block.IsProofOfWork(), pindexPrev))
+        return false;
+
     if (block.IsProofOfStake()) {
         uint256 hashProofOfStake;
         uint256 hash = block.GetHash();
@@ -4628,6 +5071,41 @@ bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
     return true;
 }
 
+/**
+ * Cheap checks of a header received without its block. The stake kernel needs the coinstake and the chain up to
+ * the parent, so it is checked once the block itself is connected; until then a header has to carry the required
+ * difficulty, a timestamp within the allowed drift and, up to the last proof-of-work block, valid proof of work.
+ */
+bool static CheckHeaderWork(const CBlockHeader& block, CValidationState& state)
+{
+    AssertLockHeld(cs_main);
+
+    uint256 hash = block.GetHash();
+    if (hash == Params().HashGenesisBlock() || mapBlockIndex.count(hash))
+        return true;
+
+    // A missing parent is reported by AcceptBlockHeader
+    BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+    if (mi == mapBlockIndex.end())
+        return true;
+    CBlockIndex* pindexPrev = mi->second;
+    bool fProofOfWork = pindexPrev->nHeight + 1 <= Params().LAST_POW_BLOCK();
+
+    if (block.GetBlockTime() > GetAdjustedTime() + (fProofOfWork ? 7200 : 180))
+        return state.Invalid(error("%s : block timestamp too far in the future", __func__),
+            REJECT_INVALID, "time-too-new");
+
+    if (fProofOfWork && !CheckProofOfWork(hash, block.nBits))
+        return state.DoS(50, error("%s : proof of work failed", __func__),
+            REJECT_INVALID, "high-hash");
+
+    if (!CheckBlockBits(block, fProofOfWork, pindexPrev))
+        return state.DoS(100, error("%s : incorrect difficulty for block %s", __func__, hash.ToString()),
+            REJECT_INVALID, "bad-diffbits");
+
+    return true;
+}
+
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex* const pindexPrev)
 {
     uint256 hash = block.GetHash();
@@ -4813,6 +5291,9 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
     if (block.GetHash() != Params().HashGenesisBlock() && !CheckWork(block, pindexPrev))
         return false;
 
+    BlockMap::iterator miSelf = mapBlockIndex.find(block.GetHash());
+    bool fHeaderOnly = miSelf != mapBlockIndex.end() && !(miSelf->second->nStatus & BLOCK_HAVE_DATA);
+
     if (!AcceptBlockHeader(block, state, &pindex))
         return false;
 
@@ -4880,6 +5361,10 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         }
     }
 
+    // The entry was added by headers-first sync, its stake fields need the block
+    if (fHeaderOnly)
+        SetBlockIndexStake(pindex, block);
+
     // Write block to history file
     try {
         unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
@@ -5389,7 +5874,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -5790,8 +6275,12 @@ bool static AlreadyHave(const CInv& inv)
     case MSG_TX: {
         bool txInMap = false;
         txInMap = mempool.exists(inv.hash);
+        // Only outputs 0 and 1 of transactions already loaded in the coin cache are
+        // checked. This is a best effort to skip transactions that were recently
+        // included in a block without hitting the database.
         return txInMap || mapOrphanTransactions.count(inv.hash) ||
-               pcoinsTip->HaveCoins(inv.hash);
+               pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) ||
+               pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
     }
     case MSG_DSTX:
         return mapObfuscationBroadcastTxes.count(inv.hash);
@@ -5804,44 +6293,50 @@ bool static AlreadyHave(const CInv& inv)
         return mapTxLockVote.count(inv.hash);
     case MSG_SPORK:
         return mapSporks.count(inv.hash);
-    case MSG_CORALNODE_WINNER:
-        if (coralnodePayments.mapCoralnodePayeeVotes.count(inv.hash)) {
+    case MSG_CORALNODE_WINNER: {
+        // The maps are filled by the message workers, which may take cs_main under the
+        // lock of their subsystem. Asking for an item again beats waiting for that lock.
+        bool fSeen;
+        {
+            TRY_LOCK(cs_mapCoralnodePayeeVotes, lockVotes);
+            fSeen = lockVotes && coralnodePayments.mapCoralnodePayeeVotes.count(inv.hash);
+        }
+        if (fSeen) {
             coralnodeSync.AddedCoralnodeWinner(inv.hash);
             return true;
         }
         return false;
+    }
     case MSG_BUDGET_VOTE:
-        if (budget.mapSeenCoralnodeBudgetVotes.count(inv.hash)) {
-            coralnodeSync.AddedBudgetItem(inv.hash);
-            return true;
-        }
-        return false;
     case MSG_BUDGET_PROPOSAL:
-        if (budget.mapSeenCoralnodeBudgetProposals.count(inv.hash)) {
-            coralnodeSync.AddedBudgetItem(inv.hash);
-            return true;
-        }
-        return false;
     case MSG_BUDGET_FINALIZED_VOTE:
-        if (budget.mapSeenFinalizedBudgetVotes.count(inv.hash)) {
-            coralnodeSync.AddedBudgetItem(inv.hash);
-            return true;
+    case MSG_BUDGET_FINALIZED: {
+        bool fSeen = false;
+        TRY_LOCK(cs_budget, lockBudget);
+        if (lockBudget) {
+            if (inv.type == MSG_BUDGET_VOTE)
+                fSeen = budget.mapSeenCoralnodeBudgetVotes.count(inv.hash);
+            else if (inv.type == MSG_BUDGET_PROPOSAL)
+                fSeen = budget.mapSeenCoralnodeBudgetProposals.count(inv.hash);
+            else if (inv.type == MSG_BUDGET_FINALIZED_VOTE)
+                fSeen = budget.mapSeenFinalizedBudgetVotes.count(inv.hash);
+            else
+                fSeen = budget.mapSeenFinalizedBudgets.count(inv.hash);
         }
-        return false;
-    case MSG_BUDGET_FINALIZED:
-        if (budget.mapSeenFinalizedBudgets.count(inv.hash)) {
+        if (fSeen) {
             coralnodeSync.AddedBudgetItem(inv.hash);
             return true;
         }
         return false;
+    }
     case MSG_CORALNODE_ANNOUNCE:
-        if (mnodeman.mapSeenCoralnodeBroadcast.count(inv.hash)) {
+        if (mnodeman.HaveSeenBroadcast(inv.hash)) {
             coralnodeSync.AddedCoralnodeList(inv.hash);
             return true;
         }
         return false;
     case MSG_CORALNODE_PING:
-        return mnodeman.mapSeenCoralnodePing.count(inv.hash);
+        return mnodeman.HaveSeenPing(inv.hash);
 
     case MSG_MN_SPORK:
         return mapMNSporks.count(inv.hash);
@@ -5912,7 +6407,7 @@ void static ProcessGetData(CNode* pfrom)
                             // however we MUST always provide at least what the remote peer needs
                             typedef std::pair<unsigned int, uint256> PairType;
                             BOOST_FOREACH (PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                                if (!pfrom->filterInventoryKnown.contains(CInv(MSG_TX, pair.second).GetKey()))
                                     pfrom->PushMessage("tx", block.vtx[pair.first]);
                         }
                         // else
@@ -5935,20 +6430,17 @@ void static ProcessGetData(CNode* pfrom)
                 bool pushed = false;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CTransactionRef>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                        pfrom->PushMessage(inv.GetCommand(), *mi->second);
                         pushed = true;
                     }
                 }
 
                 if (!pushed && inv.type == MSG_TX) {
-                    CTransaction tx;
-                    if (mempool.lookup(inv.hash, tx)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << tx;
-                        pfrom->PushMessage("tx", ss);
+                    CTransactionRef ptx = mempool.get(inv.hash);
+                    if (ptx) {
+                        pfrom->PushMessage("tx", *ptx);
                         pushed = true;
                     }
                 }
@@ -5979,8 +6471,15 @@ void static ProcessGetData(CNode* pfrom)
                         pushed = true;
                     }
                 }
+                // The coralnode, payment and budget maps are filled by the message workers, which take
+                // cs_main under the lock of their subsystem. While a worker holds it, the rest of the
+                // requests is served on the next round.
+                bool fRetry = false;
                 if (!pushed && inv.type == MSG_CORALNODE_WINNER) {
-                    if (coralnodePayments.mapCoralnodePayeeVotes.count(inv.hash)) {
+                    TRY_LOCK(cs_mapCoralnodePayeeVotes, lockVotes);
+                    if (!lockVotes) {
+                        fRetry = true;
+                    } else if (coralnodePayments.mapCoralnodePayeeVotes.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << coralnodePayments.mapCoralnodePayeeVotes[inv.hash];
@@ -5989,7 +6488,10 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_BUDGET_VOTE) {
-                    if (budget.mapSeenCoralnodeBudgetVotes.count(inv.hash)) {
+                    TRY_LOCK(cs_budget, lockBudget);
+                    if (!lockBudget) {
+                        fRetry = true;
+                    } else if (budget.mapSeenCoralnodeBudgetVotes.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << budget.mapSeenCoralnodeBudgetVotes[inv.hash];
@@ -5999,7 +6501,10 @@ void static ProcessGetData(CNode* pfrom)
                 }
 
                 if (!pushed && inv.type == MSG_BUDGET_PROPOSAL) {
-                    if (budget.mapSeenCoralnodeBudgetProposals.count(inv.hash)) {
+                    TRY_LOCK(cs_budget, lockBudget);
+                    if (!lockBudget) {
+                        fRetry = true;
+                    } else if (budget.mapSeenCoralnodeBudgetProposals.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << budget.mapSeenCoralnodeBudgetProposals[inv.hash];
@@ -6009,7 +6514,10 @@ void static ProcessGetData(CNode* pfrom)
                 }
 
                 if (!pushed && inv.type == MSG_BUDGET_FINALIZED_VOTE) {
-                    if (budget.mapSeenFinalizedBudgetVotes.count(inv.hash)) {
+                    TRY_LOCK(cs_budget, lockBudget);
+                    if (!lockBudget) {
+                        fRetry = true;
+                    } else if (budget.mapSeenFinalizedBudgetVotes.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << budget.mapSeenFinalizedBudgetVotes[inv.hash];
@@ -6019,7 +6527,10 @@ void static ProcessGetData(CNode* pfrom)
                 }
 
                 if (!pushed && inv.type == MSG_BUDGET_FINALIZED) {
-                    if (budget.mapSeenFinalizedBudgets.count(inv.hash)) {
+                    TRY_LOCK(cs_budget, lockBudget);
+                    if (!lockBudget) {
+                        fRetry = true;
+                    } else if (budget.mapSeenFinalizedBudgets.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << budget.mapSeenFinalizedBudgets[inv.hash];
@@ -6029,25 +6540,34 @@ void static ProcessGetData(CNode* pfrom)
                 }
 
                 if (!pushed && inv.type == MSG_CORALNODE_ANNOUNCE) {
-                    if (mnodeman.mapSeenCoralnodeBroadcast.count(inv.hash)) {
+                    CCoralnodeBroadcast fnb;
+                    if (!mnodeman.GetSeenBroadcast(inv.hash, fnb, pushed)) {
+                        fRetry = true;
+                    } else if (pushed) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mnodeman.mapSeenCoralnodeBroadcast[inv.hash];
+                        ss << fnb;
                         pfrom->PushMessage("fnb", ss);
-                        pushed = true;
                     }
                 }
 
                 if (!pushed && inv.type == MSG_CORALNODE_PING) {
-                    if (mnodeman.mapSeenCoralnodePing.count(inv.hash)) {
+                    CCoralnodePing fnp;
+                    if (!mnodeman.GetSeenPing(inv.hash, fnp, pushed)) {
+                        fRetry = true;
+                    } else if (pushed) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mnodeman.mapSeenCoralnodePing[inv.hash];
+                        ss << fnp;
                         pfrom->PushMessage("fnp", ss);
-                        pushed = true;
                     }
                 }
 
+                if (fRetry) {
+                    it--;
+                    break;
+                }
+
                 if (!pushed && inv.type == MSG_DSTX) {
                     if (mapObfuscationBroadcastTxes.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
@@ -6116,6 +6636,121 @@ void static ProcessGetData(CNode* pfrom)
 }
 
 bool fRequestedSporksIDB = false;
+/**
+ * Keep a block whose parent is known but not yet downloaded, so it can be processed once the parent is.
+ * Only blocks we requested from the peer are kept, after the context-free block checks.
+ * Returns false if the block should be processed right away.
+ */
+bool static AddPendingBlock(const CBlock& block, NodeId nodeid)
+{
+    uint256 hash = block.GetHash();
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+        if (mi == mapBlockIndex.end() || (mi->second->nStatus & BLOCK_HAVE_DATA))
+            return false;
+
+        map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+        if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid) {
+            LogPrint("net", "%s : block %s ahead of its parent was not requested from peer=%d, ignoring it\n", __func__, hash.ToString(), nodeid);
+            return true;
+        }
+    }
+
+    CValidationState state;
+    bool fChecked = CheckBlock(block, state);
+
+    LOCK(cs_main);
+    MarkBlockAsReceived(hash);
+    if (!fChecked) {
+        int nDoS;
+        if (state.IsInvalid(nDoS) && nDoS > 0)
+            Misbehaving(nodeid, nDoS);
+        LogPrint("net", "%s : block %s ahead of its parent failed CheckBlock: %s\n", __func__, hash.ToString(), state.GetRejectReason());
+        return true;
+    }
+
+    // the parent may have been connected while the block was being checked
+    BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+    if (mi->second->nStatus & BLOCK_HAVE_DATA)
+        return false;
+    if (mapPendingBlocks.count(hash))
+        return true;
+
+    CNodeState* nodestate = State(nodeid);
+    unsigned int nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    if (!nodestate || nPendingBlocksSize + nSize > MAX_PENDING_BLOCKS_SIZE || nodestate->nPendingBlocksSize + nSize > MAX_PENDING_BLOCKS_SIZE_PER_PEER) {
+        // It is requested again once the download window has moved
+        LogPrint("net", "%s : no room for block %s ahead of its parent, dropping it\n", __func__, hash.ToString());
+        return true;
+    }
+
+    PendingBlock& pending = mapPendingBlocks[hash];
+    pending.block = block;
+    pending.nodeid = nodeid;
+    pending.nSize = nSize;
+    pending.nTime = GetTime();
+    mapPendingBlocksByPrev.insert(make_pair(block.hashPrevBlock, hash));
+    nPendingBlocksSize += nSize;
+    nodestate->nPendingBlocksSize += nSize;
+    LogPrint("net", "%s : block %s arrived ahead of its parent, %u pending\n", __func__, hash.ToString(), mapPendingBlocks.size());
+    return true;
+}
+
+/** Process the pending blocks that descend from hashParent, in order */
+void static ProcessPendingBlocks(const uint256& hashParent)
+{
+    std::deque<uint256> queue(1, hashParent);
+    while (!queue.empty()) {
+        uint256 hashPrev = queue.front();
+        queue.pop_front();
+
+        std::vector<PendingBlock> vChildren;
+        bool fParentAccepted;
+        {
+            LOCK(cs_main);
+            std::pair<multimap<uint256, uint256>::iterator, multimap<uint256, uint256>::iterator> range = mapPendingBlocksByPrev.equal_range(hashPrev);
+            if (range.first == range.second)
+                continue;
+            for (multimap<uint256, uint256>::iterator it = range.first; it != range.second; ++it) {
+                map<uint256, PendingBlock>::iterator itPending = mapPendingBlocks.find(it->second);
+                vChildren.push_back(itPending->second);
+                CNodeState* state = State(itPending->second.nodeid);
+                if (state)
+                    state->nPendingBlocksSize -= itPending->second.nSize;
+                nPendingBlocksSize -= itPending->second.nSize;
+                mapPendingBlocks.erase(itPending);
+            }
+            mapPendingBlocksByPrev.erase(range.first, range.second);
+
+            BlockMap::iterator mi = mapBlockIndex.find(hashPrev);
+            fParentAccepted = mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA) && !(mi->second->nStatus & BLOCK_FAILED_MASK);
+        }
+
+        BOOST_FOREACH (PendingBlock& pending, vChildren) {
+            uint256 hash = pending.block.GetHash();
+            queue.push_back(hash);
+            if (!fParentAccepted) {
+                // Dropped along with its own descendants; they are downloaded again if still wanted
+                LogPrint("net", "%s : parent of block %s was not accepted, dropping it\n", __func__, hash.ToString());
+                continue;
+            }
+
+            {
+                LOCK(cs_main);
+                mapBlockSource[hash] = pending.nodeid;
+            }
+            CValidationState state;
+            ProcessNewBlock(state, NULL, &pending.block);
+            int nDoS;
+            if (state.IsInvalid(nDoS) && nDoS > 0) {
+                LOCK(cs_main);
+                Misbehaving(pending.nodeid, nDoS);
+            }
+        }
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     RandAddSeedPerfmon();
@@ -6293,7 +6928,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 {
                     LOCK(cs_vNodes);
                     // Use deterministic randomness to send to the same nodes for 24 hours
-                    // at a time so the setAddrKnowns of the chosen nodes prevent repeats
+                    // at a time so the addrKnowns of the chosen nodes prevent repeats
                     static uint256 hashSalt;
                     if (hashSalt == 0)
                         hashSalt = GetRandHash();
@@ -6354,10 +6989,21 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
-                if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
-                    LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash) && !mapPendingBlocks.count(inv.hash)) {
+                    if (State(pfrom->GetId())->fHeadersFirst) {
+                        // First request the headers preceding the announced block, the download logic in
+                        // SendMessages then fetches the blocks. Near the tip, also ask for the block right away.
+                        pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
+                        if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().TargetSpacing() * 20) {
+                            vToFetch.push_back(inv);
+                            MarkBlockAsInFlight(pfrom->GetId(), inv.hash);
+                        }
+                        LogPrint("net", "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    } else {
+                        // Add this to the list of blocks to request
+                        vToFetch.push_back(inv);
+                        LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    }
                 }
             }
 
@@ -6394,7 +7040,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == "getblocks" || strCommand == "getheaders") {
+    else if (strCommand == "getblocks") {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
@@ -6426,16 +7072,15 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == "headers" && Params().HeadersFirstSyncingActive()) {
+    else if (strCommand == "getheaders") {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
 
         LOCK(cs_main);
 
-        if (IsInitialBlockDownload())
-            return true;
-
+        // Served during initial download as well: the headers of our active chain are all connected, and
+        // a syncing peer picks the chain with the most work among the ones it is offered.
         CBlockIndex* pindex = NULL;
         if (locator.IsNull()) {
             // If locator is null, return the hashStop block
@@ -6528,7 +7173,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         if (!tx.IsZerocoinSpend() && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs, false, ignoreFees)) {
             mempool.check(pcoinsTip);
-            RelayTransaction(tx);
+            RelayTransaction(mempool.get(inv.hash));
             vWorkQueue.push_back(inv.hash);
 
             LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s : accepted %s (poolsz %u)\n",
@@ -6559,7 +7204,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                         continue;
                     if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2)) {
                         LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
+                        RelayTransaction(mempool.get(orphanHash));
                         vWorkQueue.push_back(orphanHash);
                         vEraseQueue.push_back(orphanHash);
                     } else if (!fMissingInputs2) {
@@ -6584,7 +7229,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         } else if (tx.IsZerocoinSpend() && AcceptToMemoryPool(mempool, state, tx, true, &fMissingZerocoinInputs, false, ignoreFees)) {
             //Presstab: ZCoin has a bunch of code commented out here. Is this something that should have more going on?
             //Also there is nothing that handles fMissingZerocoinInputs. Does there need to be?
-            RelayTransaction(tx);
+            RelayTransaction(mempool.get(inv.hash));
             LogPrint("mempool", "AcceptToMemoryPool: Zerocoinspend peer=%d %s : accepted %s (poolsz %u)\n",
                 pfrom->id, pfrom->cleanSubVer,
                 tx.GetHash().ToString(),
@@ -6601,8 +7246,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             // Always relay transactions received from whitelisted peers, even
             // if they are already in the mempool (allowing the node to function
             // as a gateway for nodes hidden behind it).
-
-            RelayTransaction(tx);
+            CTransactionRef ptx = mempool.get(inv.hash);
+            RelayTransaction(ptx ? ptx : MakeTransactionRef(tx));
         }
 
         if (strCommand == "dstx") {
@@ -6641,6 +7286,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         LOCK(cs_main);
 
+        State(pfrom->GetId())->fHeadersFirst = true;
+
         if (nCount == 0) {
             // Nothing interesting. Stop asking this peers for more headers.
             return true;
@@ -6653,10 +7300,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 return error("non-continuous headers sequence");
             }
 
-            /*TODO: this has a CBlock cast on it so that it will compile. There should be a solution for this
-             * before headers are reimplemented on mainnet
-             */
-            if (!AcceptBlockHeader((CBlock)header, state, &pindexLast)) {
+            // The CBlock built from the header has no transactions, AddToBlockIndex leaves the stake fields
+            // of such an entry to AcceptBlock
+            if (!CheckHeaderWork(header, state) || !AcceptBlockHeader(CBlock(header), state, &pindexLast)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -6674,7 +7320,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
-            LogPrintf("more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
+            LogPrint("net", "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->id, pfrom->nStartingHeight);
             pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexLast), uint256(0));
         }
 
@@ -6689,22 +7335,43 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CInv inv(MSG_BLOCK, hashBlock);
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
 
+        bool fHeadersFirst;
+        {
+            LOCK(cs_main);
+            fHeadersFirst = State(pfrom->GetId())->fHeadersFirst;
+        }
+
         //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
         if (!mapBlockIndex.count(block.hashPrevBlock)) {
-            if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
+            if (fHeadersFirst) {
+                // the headers connecting it are fetched first, the block is requested again after them
+                LOCK(cs_main);
+                MarkBlockAsReceived(hashBlock);
+                pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), hashBlock);
+            } else if (pfrom->setBlockRequested.count(hashBlock)) {
                 //we already asked for this block, so lets work backwards and ask for the previous block
                 pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
-                pfrom->vBlockRequested.push_back(block.hashPrevBlock);
+                pfrom->setBlockRequested.insert(block.hashPrevBlock);
             } else {
                 //ask to sync to this block
                 pfrom->PushMessage("getblocks", chainActive.GetLocator(), hashBlock);
-                pfrom->vBlockRequested.push_back(hashBlock);
+                pfrom->setBlockRequested.insert(hashBlock);
             }
+        } else if (AddPendingBlock(block, pfrom->GetId())) {
+            // downloaded ahead of its parent, it is processed once the parent is
+            pfrom->AddInventoryKnown(inv);
         } else {
             pfrom->AddInventoryKnown(inv);
 
+            bool fHaveData;
+            {
+                LOCK(cs_main);
+                BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+                fHaveData = mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA);
+            }
+
             CValidationState state;
-            if (!mapBlockIndex.count(block.GetHash())) {
+            if (!fHaveData) {
                 ProcessNewBlock(state, pfrom, &block);
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
@@ -6720,6 +7387,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             } else {
                 LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
             }
+
+            // blocks that were downloaded ahead of this one can follow it now
+            ProcessPendingBlocks(hashBlock);
         }
     }
 
@@ -6938,6 +7608,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
     } else {
         //probably one the extensions
+        CMessageWorker* pworker = GetMessageWorker(strCommand);
+        if (pworker) {
+            pworker->Push(pfrom, strCommand, vRecv);
+            return true;
+        }
+
         obfuScationPool.ProcessMessageObfuscation(pfrom, strCommand, vRecv);
         mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
         budget.ProcessMessage(pfrom, strCommand, vRecv);
@@ -7019,6 +7695,12 @@ bool ProcessMessages(CNode* pfrom)
         if (!msg.complete())
             break;
 
+        // wait while the worker of the message still has a lot queued for this peer
+        CMessageWorker* pworker = GetMessageWorker(msg.hdr.GetCommand());
+        pfrom->fProcessQueueFull = pworker && pworker->QueuedSize(pfrom->GetId()) >= ReceiveFloodSize();
+        if (pfrom->fProcessQueueFull)
+            break;
+
         // at this point, any failure means we can delete the current message
         it++;
 
@@ -7053,6 +7735,7 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nTimeStart = GetTimeMicros();
         try {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
             boost::this_thread::interruption_point();
@@ -7078,6 +7761,10 @@ bool ProcessMessages(CNode* pfrom)
         if (!fRet)
             LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
 
+        // the workers record the time of the messages they process
+        if (!pworker)
+            pfrom->RecordCommandTime(strCommand, GetTimeMicros() - nTimeStart);
+
         break;
     }
 
@@ -7134,9 +7821,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         if (!IsInitialBlockDownload() && (GetTime() - nLastRebroadcast > 24 * 60 * 60)) {
             LOCK(cs_vNodes);
             BOOST_FOREACH (CNode* pnode, vNodes) {
-                // Periodically clear setAddrKnown to allow refresh broadcasts
+                // Periodically clear addrKnown to allow refresh broadcasts
                 if (nLastRebroadcast)
-                    pnode->setAddrKnown.clear();
+                    pnode->addrKnown.reset();
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -7153,7 +7840,8 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH (const CAddress& addr, pto->vAddrToSend) {
                 // returns true if wasn't already contained in the set
-                if (pto->setAddrKnown.insert(addr).second) {
+                if (!pto->addrKnown.contains(addr.GetKey())) {
+                    pto->addrKnown.insert(addr.GetKey());
                     vAddr.push_back(addr);
                     // receiver rejects addr messages larger than 1000
                     if (vAddr.size() >= 1000) {
@@ -7167,6 +7855,18 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                 pto->PushMessage("addr", vAddr);
         }
 
+        // Misbehavior reported without cs_main
+        int nMisbehaviorPending = 0;
+        {
+            LOCK(cs_mapMisbehaviorPending);
+            std::map<NodeId, int>::iterator it = mapMisbehaviorPending.find(pto->GetId());
+            if (it != mapMisbehaviorPending.end()) {
+                nMisbehaviorPending = it->second;
+                mapMisbehaviorPending.erase(it);
+            }
+        }
+        Misbehaving(pto->GetId(), nMisbehaviorPending);
+
         CNodeState& state = *State(pto->GetId());
         if (state.fShouldBan) {
             if (pto->fWhitelisted)
@@ -7195,10 +7895,14 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             if (nSyncStarted == 0 || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
                 state.fSyncStarted = true;
                 nSyncStarted++;
-                //CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
-                //LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                //pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
-                pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
+                if (Params().HeadersFirstSyncingActive()) {
+                    // Peers that predate headers-first sync answer getheaders like getblocks, with block invs
+                    CBlockIndex* pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+                    LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
+                    pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
+                } else {
+                    pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
+                }
             }
         }
 
@@ -7218,9 +7922,25 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             LOCK(pto->cs_inventory);
             vInv.reserve(pto->vInventoryToSend.size());
             vInvWait.reserve(pto->vInventoryToSend.size());
+
+            // Each class of inventory waits for its timer, so what was relayed in the meantime
+            // is announced together in as few inv messages as possible
+            int64_t nNowInv = GetTimeMicros();
+            bool fClassDue[INV_RELAY_MAX];
+            for (int i = 0; i < INV_RELAY_MAX; i++)
+                fClassDue[i] = pto->nNextInvSend[i] <= nNowInv;
+            bool fClassSent[INV_RELAY_MAX] = {};
+
             BOOST_FOREACH (const CInv& inv, pto->vInventoryToSend) {
-                if (pto->setInventoryKnown.count(inv))
+                std::vector<unsigned char> vKey = inv.GetKey();
+                if (pto->filterInventoryKnown.contains(vKey))
+                    continue;
+
+                InvRelayClass invClass = GetInvRelayClass(inv);
+                if (!fClassDue[invClass]) {
+                    vInvWait.push_back(inv);
                     continue;
+                }
 
                 // trickle out tx inv to protect privacy
                 if (inv.type == MSG_TX && !fSendTrickle) {
@@ -7238,20 +7958,27 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second) {
-                    vInv.push_back(inv);
-                    if (vInv.size() >= 1000) {
-                        pto->PushMessage("inv", vInv);
-                        vInv.clear();
-                    }
+                pto->filterInventoryKnown.insert(vKey);
+                fClassSent[invClass] = true;
+                vInv.push_back(inv);
+                if (vInv.size() >= 1000) {
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
                 }
             }
             pto->vInventoryToSend = vInvWait;
+
+            for (int i = 0; i < INV_RELAY_MAX; i++) {
+                if (fClassSent[i])
+                    pto->nNextInvSend[i] = nNowInv + nInvRelayInterval[i];
+            }
         }
         if (!vInv.empty())
             pto->PushMessage("inv", vInv);
 
+        // Drop the blocks that waited too long for their parent
+        ExpirePendingBlocks(GetTime());
+
         // Detect whether we're stalling
         int64_t nNow = GetTimeMicros();
         if (!pto->fDisconnect && state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
@@ -7375,6 +8102,144 @@ std::string CBlockFileInfo::ToString() const
 }
 
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/** Transactions revalidated per cs_main lock when loading the mempool, the message handler gets its turn in between */
+static const unsigned int MEMPOOL_LOAD_BATCH_SIZE = 50;
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMicros();
+    int64_t count = 0;
+    int64_t skipped = 0;
+    int64_t failed = 0;
+    int64_t nNow = GetTime();
+
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != MEMPOOL_DUMP_VERSION)
+            return false;
+        uint64_t num;
+        file >> num;
+        while (num) {
+            // Read a batch, then revalidate it under a single lock
+            std::vector<CTransaction> vTx;
+            std::vector<int64_t> vTime;
+            std::vector<std::pair<double, CAmount> > vDelta;
+            while (num && vTx.size() < MEMPOOL_LOAD_BATCH_SIZE) {
+                CTransaction tx;
+                int64_t nTime;
+                double dPriorityDelta;
+                CAmount nFeeDelta;
+                file >> tx;
+                file >> nTime;
+                file >> dPriorityDelta;
+                file >> nFeeDelta;
+                vTx.push_back(tx);
+                vTime.push_back(nTime);
+                vDelta.push_back(std::make_pair(dPriorityDelta, nFeeDelta));
+                --num;
+            }
+
+            {
+                LOCK(cs_main);
+                for (unsigned int i = 0; i < vTx.size(); i++) {
+                    const uint256& hash = vTx[i].GetHash();
+                    if (vDelta[i].first || vDelta[i].second)
+                        mempool.PrioritiseTransaction(hash, hash.ToString(), vDelta[i].first, vDelta[i].second);
+                    if (vTime[i] + nExpiryTimeout <= nNow || mempool.exists(hash)) {
+                        ++skipped;
+                        continue;
+                    }
+                    CValidationState state;
+                    if (AcceptToMemoryPoolWithTime(mempool, state, vTx[i], true, NULL, vTime[i]))
+                        ++count;
+                    else
+                        ++failed;
+                }
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); it++)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired or already there, in %.2fs\n",
+        count, failed, skipped, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<std::pair<CTransactionRef, int64_t> > vInfo;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        vInfo.reserve(mempool.mapTx.size());
+        for (CTxMemPool::indexed_transaction_set::const_iterator it = mempool.mapTx.begin(); it != mempool.mapTx.end(); it++)
+            vInfo.push_back(std::make_pair(it->GetSharedTx(), it->GetTime()));
+    }
+
+    int64_t nMid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "wb");
+        if (!filestr)
+            return false;
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = MEMPOOL_DUMP_VERSION;
+        file << version;
+
+        file << (uint64_t)vInfo.size();
+        for (unsigned int i = 0; i < vInfo.size(); i++) {
+            const CTransaction& tx = *vInfo[i].first;
+            // the deltas of the transactions in the pool go with them, the rest is written after
+            std::pair<double, CAmount> delta(0.0, 0);
+            std::map<uint256, std::pair<double, CAmount> >::iterator itDelta = mapDeltas.find(tx.GetHash());
+            if (itDelta != mapDeltas.end()) {
+                delta = itDelta->second;
+                mapDeltas.erase(itDelta);
+            }
+            file << tx;
+            file << vInfo[i].second;
+            file << delta.first;
+            file << delta.second;
+        }
+
+        file << mapDeltas;
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
+        int64_t nLast = GetTimeMicros();
+        LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (nMid - nStart) * 0.000001, (nLast - nMid) * 0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+
 class CMainCleanup
 {
 public:
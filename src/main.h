@@ -52,6 +52,7 @@ class CSporkDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
+class CZerocoinSpendCheck;
 class CValidationInterface;
 class CValidationState;
 
@@ -68,6 +69,20 @@ static const bool DEFAULT_ALERTS = true;
 /** The maximum size for transactions we're willing to relay/mine */
 static const unsigned int MAX_STANDARD_TX_SIZE = 100000;
 static const unsigned int MAX_ZEROCOIN_TX_SIZE = 150000;
+/** Default for -limitancestorcount, max number of in-mempool ancestors of a transaction */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of a transaction and all of its in-mempool ancestors, room for a zerocoin spend */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = MAX_ZEROCOIN_TX_SIZE / 1000 + 1;
+/** Default for -limitdescendantcount, max number of in-mempool descendants of a transaction */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of a transaction and all of its in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = MAX_ZEROCOIN_TX_SIZE / 1000 + 1;
+/** Default for -maxmempool, maximum megabytes of the mempool */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time of mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
 /** The maximum allowed number of signature check operations in a block (network rule) */
 static const unsigned int MAX_BLOCK_SIGOPS_CURRENT = MAX_BLOCK_SIZE_CURRENT / 50;
 static const unsigned int MAX_BLOCK_SIGOPS_LEGACY = MAX_BLOCK_SIZE_LEGACY / 50;
@@ -104,6 +119,13 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Maximum total size of the blocks kept in memory because they arrived before their parent. Blocks are
+ *  connected in order, as the proof-of-stake kernel check needs the chain up to the block's parent. */
+static const unsigned int MAX_PENDING_BLOCKS_SIZE = 64 * 1000 * 1000;
+/** Maximum total size of the blocks ahead of their parent kept for a single peer. */
+static const unsigned int MAX_PENDING_BLOCKS_SIZE_PER_PEER = 16 * 1000 * 1000;
+/** Time (in seconds) a block ahead of its parent is kept waiting for the parent before it is dropped. */
+static const unsigned int PENDING_BLOCK_TIMEOUT = 10 * 60;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
 /** Maximum length of reject messages. */
@@ -143,7 +165,7 @@ extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern bool fVerifyingBlocks;
@@ -181,6 +203,8 @@ void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL);
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
 /** Unregister a network node */
 void UnregisterNodeSignals(CNodeSignals& nodeSignals);
+/** Start the threads processing the coralnode, budget, payment, SwiftTX and obfuscation messages */
+void StartMessageWorkers(boost::thread_group& threadGroup);
 
 /**
  * Process an incoming block. This only returns after the best known valid
@@ -234,6 +258,8 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(std::string strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransaction& tx, uint256& hashBlock, bool fAllowSlow = false);
+/** Retrieve a confirmed transaction through the transaction index (-txindex), does not need cs_main */
+bool ReadTransactionFromIndex(const uint256& hash, CTransaction& tx, uint256& hashBlock);
 /** Find the best known block, and make it the tip of the block chain */
 
 bool DisconnectBlocksAndReprocess(int blocks);
@@ -254,15 +280,22 @@ CBlockIndex* InsertBlockIndex(uint256 hash);
 bool AbortNode(const std::string& msg, const std::string& userMessage = "");
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
-/** Increase a node's misbehavior score. */
+/** Increase a node's misbehavior score, deferred to the next SendMessages when cs_main is held elsewhere. */
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Dump the mempool to disk. */
+bool DumpMempool();
+/** Load the mempool from disk, revalidating the transactions in batches. */
+bool LoadMempool();
 
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false);
 
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee = false, bool ignoreFees = false);
+
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
 bool AcceptableFundamentalTxn(CTxMemPool& pool, CValidationState& state, const CTransaction& tx);
@@ -358,9 +391,15 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
 
 /** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state);
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, bool fRejectBadUTXO, CValidationState& state, bool fVerifyZerocoinProofs = true);
 bool CheckZerocoinMint(const uint256& txHash, const CTxOut& txout, CValidationState& state, bool fCheckOnly = false);
 bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidationState& state);
+/**
+ * Verify the zero-knowledge proofs of every zerocoin spend input of tx against the accumulator
+ * checkpoint it references. If pvChecks is not NULL, the proofs are pushed onto it instead of
+ * being verified inline. Unless fJustCheck is false, the spend cache entries are left in place.
+ */
+bool CheckZerocoinSpendProofs(const CTransaction& tx, CValidationState& state, bool fJustCheck, std::vector<CZerocoinSpendCheck>* pvChecks = NULL);
 libzerocoin::CoinSpend TxInToZerocoinSpend(const CTxIn& txin);
 bool TxOutToPublicCoin(const CTxOut txout, libzerocoin::PublicCoin& pubCoin, CValidationState& state);
 bool BlockToPubcoinList(const CBlock& block, list<libzerocoin::PublicCoin>& listPubcoins, bool fFilterInvalid);
@@ -377,10 +416,21 @@ bool IsTransactionInChain(uint256 txId, int& nHeightTx);
 bool IsBlockHashInChain(const uint256& hashBlock);
 void PopulateInvalidOutPointMap();
 bool ValidOutPoint(const COutPoint out, int nHeight);
-void RecalculateZCRTSSpent();
-void RecalculateZCRTSMinted();
-bool RecalculateZCRTSSupply(int nHeightStart);
-bool ReindexAccumulators(list<uint256>& listMissingCheckpoints, string& strError);
+
+/** Parts of the chain state recalculated by ReindexZerocoin() */
+enum ZerocoinReindexFlags {
+    ZEROCOIN_REINDEX_MINTED = (1U << 0),       //! zerocoin mint denominations of each block
+    ZEROCOIN_REINDEX_SPENT = (1U << 1),        //! zerocoin supply of each block
+    ZEROCOIN_REINDEX_SUPPLY = (1U << 2),       //! money supply from nSupplyHeightStart on
+    ZEROCOIN_REINDEX_ACCUMULATORS = (1U << 3), //! the accumulator checkpoints in listMissingCheckpoints
+};
+
+/**
+ * Recalculate the zerocoin state of the active chain in one pass. Blocks are read and their mints,
+ * spends and values extracted by read-ahead threads, then applied in chain order on the calling
+ * thread. Checkpoints that were recalculated are removed from listMissingCheckpoints.
+ */
+bool ReindexZerocoin(unsigned int nFlags, int nSupplyHeightStart, list<uint256>& listMissingCheckpoints, string& strError);
 
 
 /**
@@ -434,8 +484,8 @@ private:
 
 public:
     CScriptCheck() : ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) : scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-                                                                                                                                ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) : scriptPubKey(outIn.scriptPubKey),
+                                                                                                                             ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
 
     bool operator()();
 
@@ -452,6 +502,60 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the proof verification of one zerocoin spend input
+ * Note that this stores references to the spending transaction
+ */
+class CZerocoinSpendCheck
+{
+private:
+    const CTransaction* ptxTo;
+    unsigned int nIn;
+    CBigNum bnAccumulatorValue;
+    bool fJustCheck;
+
+public:
+    CZerocoinSpendCheck() : ptxTo(0), nIn(0), bnAccumulatorValue(0), fJustCheck(true) {}
+    CZerocoinSpendCheck(const CTransaction& txToIn, unsigned int nInIn, const CBigNum& bnAccumulatorValueIn, bool fJustCheckIn) :
+        ptxTo(&txToIn), nIn(nInIn), bnAccumulatorValue(bnAccumulatorValueIn), fJustCheck(fJustCheckIn) {}
+
+    bool operator()();
+
+    void swap(CZerocoinSpendCheck& check)
+    {
+        std::swap(ptxTo, check.ptxTo);
+        std::swap(nIn, check.nIn);
+        std::swap(bnAccumulatorValue, check.bnAccumulatorValue);
+        std::swap(fJustCheck, check.fJustCheck);
+    }
+};
+
+/**
+ * Closure run by the block validation check queue: either a script check or the proof
+ * verification of a zerocoin spend input, so that both share the -par worker threads
+ */
+class CBlockCheck
+{
+private:
+    CScriptCheck scriptCheck;
+    CZerocoinSpendCheck zerocoinSpendCheck;
+    bool fZerocoinSpend;
+
+public:
+    CBlockCheck() : fZerocoinSpend(false) {}
+    explicit CBlockCheck(CScriptCheck& check) : fZerocoinSpend(false) { scriptCheck.swap(check); }
+    explicit CBlockCheck(CZerocoinSpendCheck& check) : fZerocoinSpend(true) { zerocoinSpendCheck.swap(check); }
+
+    bool operator()() { return fZerocoinSpend ? zerocoinSpendCheck() : scriptCheck(); }
+
+    void swap(CBlockCheck& check)
+    {
+        scriptCheck.swap(check.scriptCheck);
+        zerocoinSpendCheck.swap(check.zerocoinSpendCheck);
+        std::swap(fZerocoinSpend, check.fZerocoinSpend);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
@@ -487,7 +591,7 @@ bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex
 
 /** Store block on disk. If dbp is provided, the file is known to already reside on disk */
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** pindex, CDiskBlockPos* dbp = NULL, bool fAlreadyCheckedBlock = false);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex = NULL);
+bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex = NULL);
 
 
 class CBlockFileInfo
@@ -247,8 +247,11 @@ void CMasternode::Check()
         return;
     }
 
-    //once spent, stop doing the checks
-    if(activeState == MASTERNODE_VIN_SPENT) return;
+    bool fCollateralSpent = false;
+    bool fCollateralWatched = !unitTest && m_nodeman.collateralWatch.GetStatus(vin.prevout, fCollateralSpent);
+
+    //once spent, stop doing the checks, unless the watch saw the spend disconnected or dropped from the mempool
+    if(activeState == MASTERNODE_VIN_SPENT && !(fCollateralWatched && !fCollateralSpent)) return;
 
 
     if(!UpdatedWithin(MASTERNODE_REMOVAL_SECONDS)){
@@ -261,7 +264,13 @@ void CMasternode::Check()
         return;
     }
 
-    if(!unitTest){
+    if(fCollateralWatched){
+        // spends of the collateral are pushed to the watch by validation
+        if(fCollateralSpent){
+            activeState = MASTERNODE_VIN_SPENT;
+            return;
+        }
+    } else if(!unitTest){
         CValidationState state;
         CMutableTransaction tx = CMutableTransaction();
         CTxOut vout = CTxOut(19999.99 * COIN, obfuScationPool.collateralPubKey);
@@ -277,6 +286,9 @@ void CMasternode::Check()
                 return;
             }
         }
+
+        // from now on the watch knows about spends of a listed collateral
+        m_nodeman.collateralWatch.SetVerified(vin.prevout);
     }
 
     activeState = MASTERNODE_ENABLED; // OK
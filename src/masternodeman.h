@@ -16,6 +16,7 @@
 #include "util.h"
 #include "script/script.h"
 #include "base58.h"
+#include "collateralwatch.h"
 #include "main.h"
 #include "masternode.h"
 
@@ -67,10 +68,16 @@ private:
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
 
+    /// Watch the collateral of exactly the listed Masternodes
+    void ResetCollateralWatch();
+
 public:
     // keep track of dsq count to prevent masternodes from gaming darksend queue
     int64_t nDsqCount;
 
+    // spends of the collateral of the listed masternodes
+    CCollateralWatch collateralWatch;
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -88,6 +95,9 @@ public:
                 READWRITE(mWeAskedForMasternodeList);
                 READWRITE(mWeAskedForMasternodeListEntry);
                 READWRITE(nDsqCount);
+
+                if (ser_action.ForRead())
+                    ResetCollateralWatch();
         }
     }
 
@@ -0,0 +1,108 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "messageworker.h"
+
+#include "main.h"
+#include "util.h"
+#include "utiltime.h"
+
+CMessageWorker::CMessageWorker(const std::string& strNameIn, Handler handlerIn) : strName(strNameIn),
+                                                                                  handler(handlerIn)
+{
+}
+
+void CMessageWorker::Push(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv)
+{
+    {
+        LOCK(cs_vNodes);
+        pfrom->AddRef();
+    }
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    PeerQueue& queue = mapQueues[pfrom->GetId()];
+    // a peer with queued messages already has its turn
+    if (queue.vMessages.empty())
+        vTurns.push_back(pfrom->GetId());
+    queue.vMessages.push_back(QueuedMessage(pfrom, strCommand));
+    QueuedMessage& msg = queue.vMessages.back();
+    msg.vRecv.swap(vRecv);
+    msg.nSize = msg.vRecv.size();
+    queue.nSize += msg.nSize;
+    cond.notify_one();
+}
+
+size_t CMessageWorker::QueuedSize(NodeId nodeid) const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    std::map<NodeId, PeerQueue>::const_iterator it = mapQueues.find(nodeid);
+    return it == mapQueues.end() ? 0 : it->second.nSize;
+}
+
+void CMessageWorker::Process(QueuedMessage& msg)
+{
+    // the connection was dropped while the message waited
+    if (msg.pnode->fDisconnect)
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    try {
+        handler(msg.pnode, msg.strCommand, msg.vRecv);
+    } catch (std::ios_base::failure& e) {
+        msg.pnode->PushMessage("reject", msg.strCommand, REJECT_MALFORMED, std::string("error parsing message"));
+        if (strstr(e.what(), "end of data")) {
+            // Allow exceptions from under-length message on vRecv
+            LogPrintf("CMessageWorker(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", SanitizeString(msg.strCommand), msg.nSize, e.what());
+        } else if (strstr(e.what(), "size too large")) {
+            // Allow exceptions from over-long size
+            LogPrintf("CMessageWorker(%s, %u bytes): Exception '%s' caught\n", SanitizeString(msg.strCommand), msg.nSize, e.what());
+        } else {
+            PrintExceptionContinue(&e, "CMessageWorker::Process()");
+        }
+    } catch (boost::thread_interrupted) {
+        throw;
+    } catch (std::exception& e) {
+        PrintExceptionContinue(&e, "CMessageWorker::Process()");
+    } catch (...) {
+        PrintExceptionContinue(NULL, "CMessageWorker::Process()");
+    }
+    msg.pnode->RecordCommandTime(msg.strCommand, GetTimeMicros() - nTimeStart);
+}
+
+void CMessageWorker::Run()
+{
+    while (true) {
+        NodeId nodeid;
+        QueuedMessage* pmsg;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (vTurns.empty())
+                cond.wait(lock);
+            nodeid = vTurns.front();
+            vTurns.pop_front();
+            // Push only appends to the queue, the front message stays in place while it is processed
+            pmsg = &mapQueues[nodeid].vMessages.front();
+        }
+
+        Process(*pmsg);
+        CNode* pnode = pmsg->pnode;
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            PeerQueue& queue = mapQueues[nodeid];
+            queue.nSize -= queue.vMessages.front().nSize;
+            queue.vMessages.pop_front();
+            if (queue.vMessages.empty())
+                mapQueues.erase(nodeid);
+            else
+                vTurns.push_back(nodeid);
+        }
+
+        {
+            LOCK(cs_vNodes);
+            pnode->Release();
+        }
+        boost::this_thread::interruption_point();
+    }
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef CARITASCOIN_MESSAGEWORKER_H
+#define CARITASCOIN_MESSAGEWORKER_H
+
+#include "net.h"
+#include "streams.h"
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Processes the messages of one subsystem (coralnode list, payments, budget or obfuscation)
+ * on a thread of its own, so they neither wait for nor hold up the block and transaction
+ * messages processed by the message handler thread. SwiftTX messages stay on the message
+ * handler thread, which reads the SwiftTX maps in AlreadyHave, ProcessGetData and ATMP.
+ *
+ * Every peer has a queue of its own and the peers take turns, one message at a time: the
+ * messages of a peer are processed in the order they arrived, and a flooding peer cannot
+ * hold back the others. The message handler stops reading the messages of a peer while
+ * its queue holds more than ReceiveFloodSize() bytes.
+ */
+class CMessageWorker
+{
+public:
+    typedef boost::function<void(CNode*, std::string&, CDataStream&)> Handler;
+
+    CMessageWorker(const std::string& strNameIn, Handler handlerIn);
+
+    const std::string& GetName() const { return strName; }
+
+    /** Queue a message of pfrom, the node is referenced until the message was processed. The data is moved out of vRecv. */
+    void Push(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv);
+
+    /** Bytes of the messages queued for a peer */
+    size_t QueuedSize(NodeId nodeid) const;
+
+    /** Process the queued messages until the thread is interrupted */
+    void Run();
+
+private:
+    // Disallow copies
+    CMessageWorker(const CMessageWorker&);
+    CMessageWorker& operator=(const CMessageWorker&);
+
+    struct QueuedMessage {
+        CNode* pnode;
+        std::string strCommand;
+        CDataStream vRecv;
+        size_t nSize; // vRecv is consumed while the message is processed
+
+        QueuedMessage(CNode* pnodeIn, const std::string& strCommandIn) : pnode(pnodeIn),
+                                                                           strCommand(strCommandIn),
+                                                                           vRecv(SER_NETWORK, PROTOCOL_VERSION, CDataStream::allocator_type(false)),
+                                                                           nSize(0)
+        {
+        }
+    };
+
+    struct PeerQueue {
+        std::deque<QueuedMessage> vMessages;
+        size_t nSize;
+
+        PeerQueue() : nSize(0) {}
+    };
+
+    std::string strName;
+    Handler handler;
+
+    mutable boost::mutex mutex;
+    boost::condition_variable cond;
+    std::map<NodeId, PeerQueue> mapQueues;
+    /** Peers with queued messages in the order of their turns, without the one being processed */
+    std::deque<NodeId> vTurns;
+
+    void Process(QueuedMessage& msg);
+};
+
+#endif // CARITASCOIN_MESSAGEWORKER_H
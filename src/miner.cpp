@@ -29,8 +29,12 @@
 
 #include "masternodeman.h"
 
+#include <limits>
+
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index_container.hpp>
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 using namespace std;
 
@@ -39,54 +43,487 @@ using namespace std;
 // CaritasCoinMiner
 //
 
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+int64_t nLastCoinStakeSearchInterval = 0;
+
+namespace
+{
 //
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// The mempool keeps the fee rate of every transaction together with its
+// in-mempool ancestors. Blocks are filled with the best such packages first;
+// once part of a package is in the block, the rest of it is re-scored without
+// that part in mapModifiedTx.
 //
-class COrphan
+struct CTxMemPoolModifiedEntry {
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry) : iter(entry),
+                                                        nSizeWithAncestors(entry->GetSizeWithAncestors()),
+                                                        nModFeesWithAncestors(entry->GetModFeesWithAncestors())
+    {
+    }
+};
+
+/** Sort by the package fee rate, or the transaction's own fee rate when that is lower, as CompareTxMemPoolEntryByAncestorFee */
+class CompareModifiedEntry
 {
 public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+    bool operator()(const CTxMemPoolModifiedEntry& a, const CTxMemPoolModifiedEntry& b) const
+    {
+        double aFees = a.nModFeesWithAncestors;
+        double aSize = a.nSizeWithAncestors;
+        double bFees = b.nModFeesWithAncestors;
+        double bSize = b.nSizeWithAncestors;
+        if ((double)a.iter->GetModifiedFee() * aSize < aFees * a.iter->GetTxSize()) {
+            aFees = a.iter->GetModifiedFee();
+            aSize = a.iter->GetTxSize();
+        }
+        if ((double)b.iter->GetModifiedFee() * bSize < bFees * b.iter->GetTxSize()) {
+            bFees = b.iter->GetModifiedFee();
+            bSize = b.iter->GetTxSize();
+        }
+        double f1 = aFees * bSize;
+        double f2 = aSize * bFees;
+        if (f1 == f2)
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        return f1 > f2;
+    }
+};
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator()(const CTxMemPoolModifiedEntry& entry) const
     {
+        return entry.iter;
     }
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
-int64_t nLastCoinStakeSearchInterval = 0;
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CTxMemPool::CompareIteratorByHash>,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry> > >
+    indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion {
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator()(CTxMemPoolModifiedEntry& e)
+    {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+    }
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
-{
-    bool byFee;
+    CTxMemPool::txiter iter;
+};
+
+// Sort the transactions of a package so that parents come before their children
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+// Priority of a transaction, for the high-priority area at the start of the block
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+
+struct TxCoinAgePriorityCompare {
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b) const
+    {
+        if (a.first == b.first)
+            return CompareTxMemPoolEntryByAncestorFee()(*b.second, *a.second); // Reverse order to make sort less than
+        return a.first < b.first;
+    }
+};
 
+/** Fills a block template with mempool transactions; requires LOCK2(cs_main, mempool.cs) */
+class CBlockAssembler
+{
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
+    CBlockAssembler(CBlockTemplate* pblocktemplateIn, int nHeightIn, unsigned int nBlockMaxSizeIn, unsigned int nBlockMinSizeIn, unsigned int nBlockPrioritySizeIn)
+        : pblocktemplate(pblocktemplateIn), pblock(&pblocktemplateIn->block), view(pcoinsTip), nHeight(nHeightIn),
+          nBlockMaxSize(nBlockMaxSizeIn), nBlockMinSize(nBlockMinSizeIn), nBlockPrioritySize(nBlockPrioritySizeIn),
+          nBlockSize(1000), nBlockTx(0), nBlockSigOps(100), nFees(0)
+    {
+        fPrintPriority = GetBoolArg("-printpriority", false);
+    }
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    /** Add the highest priority transactions up to the priority size, then the best packages by fee rate */
+    void AddTransactions()
     {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+        AddPriorityTxs();
+        AddPackageTxs();
+    }
+
+    uint64_t GetBlockSize() const { return nBlockSize; }
+    uint64_t GetBlockTx() const { return nBlockTx; }
+    CAmount GetFees() const { return nFees; }
+
+private:
+    CBlockTemplate* pblocktemplate;
+    CBlock* pblock;
+    CCoinsViewCache view;
+    int nHeight;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockMinSize;
+    unsigned int nBlockPrioritySize;
+    bool fPrintPriority;
+
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+    CTxMemPool::setEntries inBlock;
+    std::vector<CBigNum> vBlockSerials;
+
+    /** Whether a transaction may go into this block at all */
+    bool IsEligible(const CTransaction& tx) const
+    {
+        if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+            return false;
+        if (GetAdjustedTime() > GetSporkValue(SPORK_18_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins())
+            return false;
+        return true;
+    }
+
+    /**
+     * Add the transactions of a package, parents first, if all of them fit and
+     * connect to the block. Their scripts were verified when they entered the
+     * pool; TestBlockValidity verifies the finished block once more.
+     */
+    bool AddPackage(const std::vector<CTxMemPool::txiter>& vPackage)
+    {
+        CCoinsViewCache viewPackage(&view);
+        std::vector<CBigNum> vPackageSerials;
+        std::vector<CAmount> vTxFees;
+        std::vector<unsigned int> vTxSigOps;
+        uint64_t nPackageSize = 0;
+        unsigned int nPackageSigOps = 0;
+
+        for (const CTxMemPool::txiter& it : vPackage) {
+            const CTransaction& tx = it->GetTx();
+            if (!IsEligible(tx))
+                return false;
+
+            // Size limits
+            nPackageSize += it->GetTxSize();
+            if (nBlockSize + nPackageSize >= nBlockMaxSize)
+                return false;
+
+            if (!viewPackage.HaveInputs(tx))
+                return false;
+
+            //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
+            if (!tx.IsZerocoinSpend()) {
+                for (const CTxIn& txin : tx.vin) {
+                    if (mapInvalidOutPoints.count(txin.prevout)) {
+                        LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
+                        return false;
+                    }
+                }
+            }
+
+            // double check that there are no double spent zCRTS spends in this block or tx
+            if (tx.IsZerocoinSpend()) {
+                int nHeightTx = 0;
+                if (IsTransactionInChain(tx.GetHash(), nHeightTx))
+                    return false;
+
+                for (const CTxIn& txIn : tx.vin) {
+                    if (txIn.scriptSig.IsZerocoinSpend()) {
+                        libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
+                        if (!spend.HasValidSerial(Params().Zerocoin_Params()))
+                            return false;
+                        //This zCRTS serial has already been included in the block, do not add this tx.
+                        if (count(vBlockSerials.begin(), vBlockSerials.end(), spend.getCoinSerialNumber()) ||
+                            count(vPackageSerials.begin(), vPackageSerials.end(), spend.getCoinSerialNumber()))
+                            return false;
+                        vPackageSerials.emplace_back(spend.getCoinSerialNumber());
+                    }
+                }
+            }
+
+            // Legacy limits on sigOps:
+            unsigned int nTxSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, viewPackage);
+            nPackageSigOps += nTxSigOps;
+            if (nBlockSigOps + nPackageSigOps >= MAX_BLOCK_SIGOPS_CURRENT)
+                return false;
+
+            CAmount nTxFees = viewPackage.GetValueIn(tx) - tx.GetValueOut();
+            if (nTxFees > CORALNODE_AMOUNT)
+                nTxFees = nTxFees - CORALNODE_AMOUNT;
+
+            CValidationState state;
+            CTxUndo txundo;
+            UpdateCoins(tx, state, viewPackage, txundo, nHeight);
+            vTxFees.push_back(nTxFees);
+            vTxSigOps.push_back(nTxSigOps);
+        }
+
+        viewPackage.Flush();
+        for (unsigned int i = 0; i < vPackage.size(); i++)
+            AddToBlock(vPackage[i], vTxFees[i], vTxSigOps[i]);
+        vBlockSerials.insert(vBlockSerials.end(), vPackageSerials.begin(), vPackageSerials.end());
+        return true;
+    }
+
+    void AddToBlock(CTxMemPool::txiter iter, CAmount nTxFees, unsigned int nTxSigOps)
+    {
+        pblock->vtx.push_back(iter->GetTx());
+        pblocktemplate->vTxFees.push_back(nTxFees);
+        pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+        nBlockSize += iter->GetTxSize();
+        ++nBlockTx;
+        nBlockSigOps += nTxSigOps;
+        nFees += nTxFees;
+        inBlock.insert(iter);
+
+        if (fPrintPriority) {
+            double dPriority = iter->GetPriority(nHeight);
+            CAmount dummy;
+            mempool.ApplyDeltas(iter->GetTx().GetHash(), dPriority, dummy);
+            LogPrintf("priority %.1f fee %s txid %s\n",
+                dPriority, CFeeRate(iter->GetModifiedFee(), iter->GetTxSize()).ToString(), iter->GetTx().GetHash().ToString());
+        }
+    }
+
+    /** Whether the transaction has in-mempool parents that are not in the block yet */
+    bool IsStillDependent(CTxMemPool::txiter iter) const
+    {
+        for (const CTxMemPool::txiter& parent : mempool.GetMemPoolParents(iter)) {
+            if (!inBlock.count(parent))
+                return true;
+        }
+        return false;
+    }
+
+    void AddPriorityTxs()
+    {
+        // How much of the block should be dedicated to high-priority transactions,
+        // included regardless of the fees they pay
+        if (nBlockPrioritySize == 0)
+            return;
+
+        std::vector<TxCoinAgePriority> vecPriority;
+        TxCoinAgePriorityCompare pricomparer;
+        std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+
+        vecPriority.reserve(mempool.mapTx.size());
+        for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi) {
+            double dPriority = mi->GetPriority(nHeight);
+            CAmount dummy;
+            mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+            vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+        }
+        std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+        while (!vecPriority.empty()) {
+            CTxMemPool::txiter iter = vecPriority.front().second;
+            double dPriority = vecPriority.front().first;
+            std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+            vecPriority.pop_back();
+
+            // Past the priority size or out of high-priority transactions, the rest goes by fee rate
+            if (nBlockSize + iter->GetTxSize() >= nBlockPrioritySize || !AllowFree(dPriority))
+                break;
+
+            // Has to wait for its parents
+            if (IsStillDependent(iter)) {
+                waitPriMap.insert(std::make_pair(iter, dPriority));
+                continue;
+            }
+
+            if (!AddPackage(std::vector<CTxMemPool::txiter>(1, iter)))
+                continue;
+
+            // Transactions that waited for this one can go in now
+            for (const CTxMemPool::txiter& child : mempool.GetMemPoolChildren(iter)) {
+                std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator wpiter = waitPriMap.find(child);
+                if (wpiter != waitPriMap.end()) {
+                    vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                    std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                    waitPriMap.erase(wpiter);
+                }
+            }
+        }
+    }
+
+    /** Re-score the in-mempool descendants of the transactions just added without them */
+    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx)
+    {
+        for (const CTxMemPool::txiter& it : alreadyAdded) {
+            CTxMemPool::setEntries descendants;
+            mempool.CalculateDescendants(it, descendants);
+            for (const CTxMemPool::txiter& desc : descendants) {
+                if (alreadyAdded.count(desc))
+                    continue;
+                modtxiter mit = mapModifiedTx.find(desc);
+                if (mit == mapModifiedTx.end()) {
+                    CTxMemPoolModifiedEntry modEntry(desc);
+                    modEntry.nSizeWithAncestors -= it->GetTxSize();
+                    modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                    mapModifiedTx.insert(modEntry);
+                } else {
+                    mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+                }
+            }
+        }
+    }
+
+    void AddPackageTxs()
+    {
+        // Descendants of transactions in the block, scored without those
+        indexed_modified_transaction_set mapModifiedTx;
+        // Transactions whose package did not fit or connect
+        CTxMemPool::setEntries failedTx;
+
+        UpdatePackagesForAdded(inBlock, mapModifiedTx);
+
+        CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+
+        while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty()) {
+            // Entries of mapTx that are in the block, scored differently in mapModifiedTx or
+            // known to fail are skipped
+            if (mi != mempool.mapTx.get<ancestor_score>().end()) {
+                CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+                if (inBlock.count(it) || mapModifiedTx.count(it) || failedTx.count(it)) {
+                    ++mi;
+                    continue;
+                }
+            }
+
+            // Take the better of the next entry of mapTx and the best of mapModifiedTx
+            CTxMemPool::txiter iter;
+            bool fUsingModified = false;
+            modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
+            if (mi == mempool.mapTx.get<ancestor_score>().end()) {
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                iter = mempool.mapTx.project<0>(mi);
+                if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                    CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                    iter = modit->iter;
+                    fUsingModified = true;
+                } else {
+                    ++mi;
+                }
+            }
+            assert(!inBlock.count(iter));
+
+            uint64_t nPackageSize = fUsingModified ? modit->nSizeWithAncestors : iter->GetSizeWithAncestors();
+            CAmount nPackageFees = fUsingModified ? modit->nModFeesWithAncestors : iter->GetModFeesWithAncestors();
+
+            // Skip free transactions if we're past the minimum block size, zerocoin spends excepted
+            bool fSkip = nPackageFees < ::minRelayTxFee.GetFee(nPackageSize) && nBlockSize + nPackageSize >= nBlockMinSize && !iter->GetTx().IsZerocoinSpend();
+            if (!fSkip && nBlockSize + nPackageSize >= nBlockMaxSize)
+                fSkip = true;
+
+            std::vector<CTxMemPool::txiter> vPackage;
+            if (!fSkip) {
+                CTxMemPool::setEntries setAncestors;
+                mempool.CalculateMemPoolAncestors(*iter, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+                for (const CTxMemPool::txiter& ancestor : setAncestors) {
+                    if (!inBlock.count(ancestor))
+                        vPackage.push_back(ancestor);
+                }
+                vPackage.push_back(iter);
+                std::sort(vPackage.begin(), vPackage.end(), CompareTxIterByAncestorCount());
+                fSkip = !AddPackage(vPackage);
+            }
+
+            if (fSkip) {
+                if (fUsingModified)
+                    mapModifiedTx.get<ancestor_score>().erase(modit);
+                failedTx.insert(iter);
+                continue;
+            }
+
+            CTxMemPool::setEntries setAdded;
+            for (const CTxMemPool::txiter& it : vPackage) {
+                mapModifiedTx.erase(it);
+                setAdded.insert(it);
+            }
+            UpdatePackagesForAdded(setAdded, mapModifiedTx);
         }
     }
 };
 
+/**
+ * Find the first transaction that keeps a block template from connecting, by checking the inputs,
+ * scripts and zerocoin spends of the transactions one at a time in block order. Requires cs_main.
+ */
+bool FindInvalidTransaction(const CBlock& block, int nHeight, CTransaction& txInvalid)
+{
+    CCoinsViewCache view(pcoinsTip);
+    std::set<CBigNum> setSerials;
+    for (const CTransaction& tx : block.vtx) {
+        if (tx.IsCoinBase() || tx.IsCoinStake())
+            continue;
+
+        CValidationState state;
+        bool fValid = true;
+        if (tx.IsZerocoinSpend()) {
+            fValid = CheckZerocoinSpendProofs(tx, state, true);
+            for (const CTxIn& txin : tx.vin) {
+                if (!fValid || !txin.scriptSig.IsZerocoinSpend())
+                    continue;
+                CBigNum bnSerial = TxInToZerocoinSpend(txin).getCoinSerialNumber();
+                int nHeightTx = 0;
+                fValid = !IsSerialInBlockchain(bnSerial, nHeightTx) && setSerials.insert(bnSerial).second;
+            }
+        } else {
+            fValid = view.HaveInputs(tx) && CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true);
+        }
+
+        if (!fValid) {
+            txInvalid = tx;
+            return true;
+        }
+
+        CTxUndo txundo;
+        UpdateCoins(tx, state, view, txundo, nHeight);
+    }
+    return false;
+}
+}
+
+void RemoveInvalidTemplateTransactions(const CBlock& block, int nHeight, CTxMemPool& pool)
+{
+    std::list<CTransaction> removed;
+    CTransaction txInvalid;
+    if (FindInvalidTransaction(block, nHeight, txInvalid)) {
+        LogPrintf("CreateNewBlock() : removing invalid transaction %s from the mempool\n", txInvalid.GetHash().ToString());
+        pool.remove(txInvalid, removed, true);
+        return;
+    }
+
+    // The template failed a check no single transaction fails on its own (sigops, size, payee...).
+    // Keeping its transactions would build the same template again.
+    LogPrintf("CreateNewBlock() : no invalid transaction found, removing the %u template transactions from the mempool\n", block.vtx.size());
+    for (const CTransaction& tx : block.vtx) {
+        if (!tx.IsCoinBase() && !tx.IsCoinStake())
+            pool.remove(tx, removed, true);
+    }
+}
+
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
@@ -191,224 +628,12 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 
         CBlockIndex* pindexPrev = chainActive.Tip();
         const int nHeight = pindexPrev->nHeight + 1;
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)){
-                continue;
-            }
-            if(GetAdjustedTime() > GetSporkValue(SPORK_18_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins()){
-                continue;
-            }
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            for (const CTxIn& txin : tx.vin) {
-                //zerocoinspend has special vin
-                if (tx.IsZerocoinSpend()) {
-                    nTotalIn = tx.GetZerocoinSpent();
-                    break;
-                }
-
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
 
-                //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
-                if (mapInvalidOutPoints.count(txin.prevout)) {
-                    LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
-                    fMissingInputs = true;
-                    break;
-                }
-
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        vector<CBigNum> vBlockSerials;
-        vector<CBigNum> vTxSerials;
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (!tx.IsZerocoinSpend() && fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            // double check that there are no double spent zCRTS spends in this block or tx
-            if (tx.IsZerocoinSpend()) {
-                int nHeightTx = 0;
-                if (IsTransactionInChain(tx.GetHash(), nHeightTx))
-                    continue;
-
-                bool fDoubleSerial = false;
-                for (const CTxIn txIn : tx.vin) {
-                    if (txIn.scriptSig.IsZerocoinSpend()) {
-                        libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
-                        if (!spend.HasValidSerial(Params().Zerocoin_Params()))
-                            fDoubleSerial = true;
-                        if (count(vBlockSerials.begin(), vBlockSerials.end(), spend.getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (count(vTxSerials.begin(), vTxSerials.end(), spend.getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (fDoubleSerial)
-                            break;
-                        vTxSerials.emplace_back(spend.getCoinSerialNumber());
-                    }
-                }
-                //This zCRTS serial has already been included in the block, do not add this tx.
-                if (fDoubleSerial)
-                    continue;
-            }
-
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
-
-            if(nTxFees > CORALNODE_AMOUNT)
-                nTxFees = nTxFees - CORALNODE_AMOUNT;
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
-
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            for (const CBigNum bnSerial : vTxSerials)
-                vBlockSerials.emplace_back(bnSerial);
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                BOOST_FOREACH (COrphan* porphan, mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        CBlockAssembler assembler(pblocktemplate.get(), nHeight, nBlockMaxSize, nBlockMinSize, nBlockPrioritySize);
+        assembler.AddTransactions();
+        nFees = assembler.GetFees();
+        uint64_t nBlockSize = assembler.GetBlockSize();
+        uint64_t nBlockTx = assembler.GetBlockTx();
 
         if (!fProofOfStake) {
             //Coralnode and general budget payments
@@ -447,7 +672,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         CValidationState state;
         if (!TestBlockValidity(state, *pblock, pindexPrev, false, false)) {
             LogPrintf("CreateNewBlock() : TestBlockValidity failed\n");
-            mempool.clear();
+            RemoveInvalidTemplateTransactions(*pblock, nHeight, mempool);
             return NULL;
         }
     }
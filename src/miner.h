@@ -13,6 +13,7 @@ class CBlockHeader;
 class CBlockIndex;
 class CReserveKey;
 class CScript;
+class CTxMemPool;
 class CWallet;
 
 struct CBlockTemplate;
@@ -22,6 +23,12 @@ void GenerateBitcoins(bool fGenerate, CWallet* pwallet, int nThreads);
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake);
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfStake);
+/**
+ * Remove from the mempool what made TestBlockValidity reject a block template: the first transaction
+ * that fails the input, script or zerocoin spend checks and its descendants or, when none does, all
+ * transactions of the template. Requires cs_main.
+ */
+void RemoveInvalidTemplateTransactions(const CBlock& block, int nHeight, CTxMemPool& pool);
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 /** Check mined block */
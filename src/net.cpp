@@ -36,6 +36,10 @@
 #include <miniupnpc/upnperrors.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -91,7 +95,7 @@ bool fAddressesInitialized = false;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CTransactionRef> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -109,6 +113,9 @@ NodeId nLastNodeId = 0;
 CCriticalSection cs_nLastNodeId;
 
 static CSemaphore* semOutbound = NULL;
+/** epoll instance watching the listening sockets and the socket of every node, -1 when select() is used */
+static int hEpoll = -1;
+static void WatchNodeSocket(CNode* pnode);
 boost::condition_variable messageHandlerCondition;
 
 // Signals for message handling
@@ -351,9 +358,67 @@ void AddressCurrentlyConnected(const CService& addr)
 
 uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
+uint64_t CNode::nTotalRecvCalls = 0;
+uint64_t CNode::nTotalSendCalls = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
 
+namespace
+{
+/** Socket calls counted per minute of the clock, to report their rate */
+struct CCallRate {
+    int64_t nMinute;     // start of the minute being counted
+    uint64_t nCalls;     // calls during that minute
+    uint64_t nCallsLast; // calls during the minute before
+
+    CCallRate() : nMinute(0), nCalls(0), nCallsLast(0) {}
+
+    void Roll(int64_t nNow)
+    {
+        int64_t nThisMinute = nNow - nNow % 60;
+        if (nThisMinute == nMinute)
+            return;
+        nCallsLast = nThisMinute == nMinute + 60 ? nCalls : 0;
+        nMinute = nThisMinute;
+        nCalls = 0;
+    }
+
+    void Record(int64_t nNow)
+    {
+        Roll(nNow);
+        nCalls++;
+    }
+
+    double Get(int64_t nNow)
+    {
+        Roll(nNow);
+        return nCallsLast / 60.0;
+    }
+};
+
+// guarded by CNode::cs_totalBytesRecv and CNode::cs_totalBytesSent
+CCallRate recvCallRate;
+CCallRate sendCallRate;
+}
+
+int64_t nInvRelayInterval[INV_RELAY_MAX] = {0, DEFAULT_TX_INV_INTERVAL * 1000, DEFAULT_CORALNODE_INV_INTERVAL * 1000};
+
+InvRelayClass GetInvRelayClass(const CInv& inv)
+{
+    switch (inv.type) {
+    case MSG_BLOCK:
+    case MSG_FILTERED_BLOCK:
+        return INV_RELAY_BLOCK;
+    case MSG_TX:
+    case MSG_TXLOCK_REQUEST:
+    case MSG_TXLOCK_VOTE:
+    case MSG_DSTX:
+        return INV_RELAY_TX;
+    default:
+        return INV_RELAY_CORALNODE;
+    }
+}
+
 CNode* FindNode(const CNetAddr& ip)
 {
     LOCK(cs_vNodes);
@@ -425,7 +490,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
     bool proxyConnectionFailed = false;
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed)) {
-        if (!IsSelectableSocket(hSocket)) {
+        if (hEpoll == -1 && !IsSelectableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -441,6 +506,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
             LOCK(cs_vNodes);
             vNodes.push_back(pnode);
         }
+        WatchNodeSocket(pnode);
 
         pnode->nTimeConnected = GetTime();
         if (obfuScationMaster) pnode->fObfuScationMaster = true;
@@ -713,6 +779,11 @@ void CNode::copyStats(CNodeStats& stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    {
+        LOCK(cs_mapCommandStats);
+        stats.mapCommandStats = mapCommandStats;
+    }
 }
 #undef X
 
@@ -807,20 +878,47 @@ void SocketSendData(CNode* pnode)
     std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
+        assert(it->size() > pnode->nSendOffset);
+#ifdef WIN32
         const CSerializeData& data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        size_t nQueued = data.size() - pnode->nSendOffset;
+        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], nQueued, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        // Gather the queued messages so small ones go out with a single call
+        struct iovec iov[MAX_SEND_IOV];
+        int nIov = 0;
+        size_t nQueued = 0;
+        for (std::deque<CSerializeData>::iterator itIov = it; itIov != pnode->vSendMsg.end() && nIov < MAX_SEND_IOV; ++itIov, ++nIov) {
+            size_t nOffset = nIov == 0 ? pnode->nSendOffset : 0;
+            iov[nIov].iov_base = &(*itIov)[nOffset];
+            iov[nIov].iov_len = itIov->size() - nOffset;
+            nQueued += iov[nIov].iov_len;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nIov;
+        ssize_t nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            // Skip the messages that were sent completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRemaining = it->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= it->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nQueued) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -846,71 +944,341 @@ void SocketSendData(CNode* pnode)
 
 static list<CNode*> vNodesDisconnected;
 
-void ThreadSocketHandler()
+#ifdef USE_EPOLL
+/** Maximum number of socket events fetched by one epoll_wait call */
+static const int MAX_SOCKET_EVENTS = 256;
+
+/** Nodes with socket events ThreadSocketHandler has not fully handled yet, and those events. Only used by that thread. */
+static map<CNode*, uint32_t> mapNodeEvents;
+
+/** Set up the epoll instance and watch the listening sockets, or leave the socket loop on select() */
+static void InitSocketEvents()
 {
-    unsigned int nPrevNodeCount = 0;
-    while (true) {
-        //
-        // Disconnect nodes
-        //
-        {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH (CNode* pnode, vNodesCopy) {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    hEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (hEpoll == -1) {
+        LogPrintf("epoll_create1 failed: %s, using select()\n", NetworkErrorString(errno));
+        return;
+    }
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+    BOOST_FOREACH (ListenSocket& hListenSocket, vhListenSocket) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = &hListenSocket;
+        if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0) {
+            LogPrintf("epoll_ctl failed for a listening socket: %s, using select()\n", NetworkErrorString(errno));
+            close(hEpoll);
+            hEpoll = -1;
+            return;
+        }
+    }
+}
+#endif
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+/** Watch the socket of a node that was just added to vNodes */
+static void WatchNodeSocket(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (hEpoll == -1)
+        return;
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+    // Edge-triggered: an event is reported once when the socket becomes readable or writable,
+    // ThreadSocketHandler keeps track of it until the socket would block.
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->id, NetworkErrorString(errno));
+        pnode->CloseSocketDisconnect();
+    }
+#endif
+}
+
+/** Close the sockets of the nodes to disconnect, and delete disconnected nodes no other thread uses anymore */
+static void DisconnectNodes()
+{
+    {
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
+
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
+
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
-        {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend) {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv) {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH (CNode* pnode, vNodesDisconnectedCopy) {
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend) {
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv) {
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
-                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+#ifdef USE_EPOLL
+                    mapNodeEvents.erase(pnode);
+#endif
+                    delete pnode;
                 }
             }
         }
-        size_t vNodesSize;
+    }
+}
+
+static void NotifyNodeCount(unsigned int& nPrevNodeCount)
+{
+    size_t vNodesSize;
+    {
+        LOCK(cs_vNodes);
+        vNodesSize = vNodes.size();
+    }
+    if(vNodesSize != nPrevNodeCount) {
+        nPrevNodeCount = vNodesSize;
+        uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+static void AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+    } else if (hEpoll == -1 && !IsSelectableSocket(hSocket)) {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (CNode::IsBanned(addr) && !whitelisted) {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+
         {
             LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
+            vNodes.push_back(pnode);
+        }
+        WatchNodeSocket(pnode);
+    }
+}
+
+/** Receive from a node's socket, returns false once the socket would block or was closed. Requires cs_vRecvMsg. */
+static bool SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0) {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return pnode->hSocket != INVALID_SOCKET;
+    } else if (nBytes == 0) {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    } else if (nBytes < 0) {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        } else if (nErr != WSAEWOULDBLOCK) {
+            // interrupted, try again
+            return true;
+        }
+    }
+    return false;
+}
+
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+/**
+ * The socket loop on epoll. Only nodes with pending socket events are visited, the node list itself is
+ * only swept once a second for disconnection and inactivity. The same flow control as with select()
+ * applies: a node's send queue is drained before receiving more from it, and nothing is received while
+ * its receive buffer is full; such events stay pending until they can be handled.
+ */
+static void ThreadSocketHandlerEpoll()
+{
+    unsigned int nPrevNodeCount = 0;
+    int64_t nLastSweep = 0;
+    bool fProgress = false;
+    struct epoll_event events[MAX_SOCKET_EVENTS];
+
+    while (true) {
+        int64_t nNow = GetTime();
+        if (nNow != nLastSweep) {
+            nLastSweep = nNow;
+            DisconnectNodes();
+            NotifyNodeCount(nPrevNodeCount);
+
+            vector<CNode*> vNodesCopy;
+            {
+                LOCK(cs_vNodes);
+                vNodesCopy = vNodes;
+            }
+            BOOST_FOREACH (CNode* pnode, vNodesCopy)
+                InactivityCheck(pnode);
         }
-        if(vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+
+        // Only poll if the last pass left data to read
+        int nEvents = epoll_wait(hEpoll, events, MAX_SOCKET_EVENTS, fProgress ? 0 : 50);
+        boost::this_thread::interruption_point();
+
+        if (nEvents < 0) {
+            if (errno != EINTR) {
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+                MilliSleep(50);
+            }
+            nEvents = 0;
         }
 
+        for (int i = 0; i < nEvents; i++) {
+            const ListenSocket* pListenSocket = NULL;
+            BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket)
+                if (events[i].data.ptr == &hListenSocket)
+                    pListenSocket = &hListenSocket;
+
+            if (pListenSocket)
+                AcceptConnection(*pListenSocket);
+            else
+                mapNodeEvents[(CNode*)events[i].data.ptr] |= events[i].events;
+        }
+
+        //
+        // Service the sockets with pending events
+        //
+        fProgress = false;
+        map<CNode*, uint32_t>::iterator it = mapNodeEvents.begin();
+        while (it != mapNodeEvents.end()) {
+            CNode* pnode = it->first;
+            uint32_t& nPending = it->second;
+
+            if (pnode->hSocket != INVALID_SOCKET && (nPending & EPOLLOUT)) {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend) {
+                    if (!pnode->vSendMsg.empty())
+                        SocketSendData(pnode);
+                    // a send that would block gets another event once the socket is writable
+                    nPending &= ~EPOLLOUT;
+                }
+            }
+
+            if (pnode->hSocket != INVALID_SOCKET && (nPending & ~EPOLLOUT)) {
+                bool fSendPending = false;
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend && !pnode->vSendMsg.empty())
+                        fSendPending = true;
+                }
+                if (!fSendPending) {
+                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize())) {
+                        if (SocketRecvData(pnode))
+                            fProgress = true;
+                        else
+                            nPending &= EPOLLOUT;
+                    }
+                }
+            }
+
+            if (pnode->hSocket == INVALID_SOCKET || nPending == 0)
+                mapNodeEvents.erase(it++);
+            else
+                it++;
+        }
+    }
+}
+#endif
+
+void ThreadSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (hEpoll != -1) {
+        ThreadSocketHandlerEpoll();
+        return;
+    }
+#endif
+
+    unsigned int nPrevNodeCount = 0;
+    while (true) {
+        //
+        // Disconnect nodes
+        //
+        DisconnectNodes();
+        NotifyNodeCount(nPrevNodeCount);
+
         //
         // Find which sockets have data to receive
         //
@@ -993,49 +1361,8 @@ void ThreadSocketHandler()
         // Accept new connections
         //
         BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
-
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
-
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH (CNode* pnode, vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
-
-                if (hSocket == INVALID_SOCKET) {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                } else if (!IsSelectableSocket(hSocket)) {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (CNode::IsBanned(addr) && !whitelisted) {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
-
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
-            }
+            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+                AcceptConnection(hListenSocket);
         }
 
         //
@@ -1058,33 +1385,8 @@ void ThreadSocketHandler()
                 continue;
             if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        } else if (nBytes == 0) {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        } else if (nBytes < 0) {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+                if (lockRecv)
+                    SocketRecvData(pnode);
             }
 
             //
@@ -1101,22 +1403,7 @@ void ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -1537,7 +1824,7 @@ void ThreadMessageHandler()
                     if (!g_signals.ProcessMessages(pnode))
                         pnode->CloseSocketDisconnect();
 
-                    if (pnode->nSendSize < SendBufferSize()) {
+                    if (pnode->nSendSize < SendBufferSize() && !pnode->fProcessQueueFull) {
                         if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete())) {
                             fSleep = false;
                         }
@@ -1549,8 +1836,15 @@ void ThreadMessageHandler()
             // Send messages
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
+                if (lockSend) {
+                    // Queue what SendMessages produces and write it with as few send calls as possible
+                    bool fQueueEmpty = pnode->vSendMsg.empty();
+                    pnode->fSendBatch = true;
                     g_signals.SendMessages(pnode, pnode == pnodeTrickle || pnode->fWhitelisted);
+                    pnode->fSendBatch = false;
+                    if (fQueueEmpty && !pnode->vSendMsg.empty())
+                        SocketSendData(pnode);
+                }
             }
             boost::this_thread::interruption_point();
         }
@@ -1763,6 +2057,11 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Map ports with UPnP
     MapPort(GetBoolArg("-upnp", DEFAULT_UPNP));
 
+#ifdef USE_EPOLL
+    // Watch the sockets with epoll, before any node is connected
+    InitSocketEvents();
+#endif
+
     // Send and receive from sockets, accept connections
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "net", &ThreadSocketHandler));
 
@@ -1779,8 +2078,13 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
 
     // ppcoin:mint proof-of-stake blocks in the background
-    if (GetBoolArg("-staking", true))
+    if (GetBoolArg("-staking", true)) {
         threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "stakemint", &ThreadStakeMinter));
+
+        // The minter thread takes part in the kernel search as well
+        for (int i = 0; i < nStakeThreads - 1; i++)
+            threadGroup.create_thread(&ThreadStakeSearch);
+    }
 }
 
 bool StopNode()
@@ -1822,6 +2126,12 @@ public:
             delete pnode;
         vNodes.clear();
         vNodesDisconnected.clear();
+#ifdef USE_EPOLL
+        mapNodeEvents.clear();
+        if (hEpoll != -1)
+            close(hEpoll);
+        hEpoll = -1;
+#endif
         vhListenSocket.clear();
         delete semOutbound;
         semOutbound = NULL;
@@ -1845,14 +2155,12 @@ void CExplicitNetCleanup::callCleanup()
 
 void RelayTransaction(const CTransaction& tx)
 {
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss.reserve(10000);
-    ss << tx;
-    RelayTransaction(tx, ss);
+    RelayTransaction(MakeTransactionRef(tx));
 }
 
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
+void RelayTransaction(const CTransactionRef& ptx)
 {
+    const CTransaction& tx = *ptx;
     CInv inv(MSG_TX, tx.GetHash());
     {
         LOCK(cs_mapRelay);
@@ -1862,8 +2170,8 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
             vRelayExpiration.pop_front();
         }
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        // Keep the transaction itself, shared with the mempool when it came from there
+        mapRelay.insert(std::make_pair(inv, ptx));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
     LOCK(cs_vNodes);
@@ -1907,12 +2215,16 @@ void CNode::RecordBytesRecv(uint64_t bytes)
 {
     LOCK(cs_totalBytesRecv);
     nTotalBytesRecv += bytes;
+    nTotalRecvCalls++;
+    recvCallRate.Record(GetTime());
 }
 
 void CNode::RecordBytesSent(uint64_t bytes)
 {
     LOCK(cs_totalBytesSent);
     nTotalBytesSent += bytes;
+    nTotalSendCalls++;
+    sendCallRate.Record(GetTime());
 }
 
 uint64_t CNode::GetTotalBytesRecv()
@@ -1927,6 +2239,30 @@ uint64_t CNode::GetTotalBytesSent()
     return nTotalBytesSent;
 }
 
+uint64_t CNode::GetTotalRecvCalls()
+{
+    LOCK(cs_totalBytesRecv);
+    return nTotalRecvCalls;
+}
+
+uint64_t CNode::GetTotalSendCalls()
+{
+    LOCK(cs_totalBytesSent);
+    return nTotalSendCalls;
+}
+
+double CNode::GetRecvCallRate()
+{
+    LOCK(cs_totalBytesRecv);
+    return recvCallRate.Get(GetTime());
+}
+
+double CNode::GetSendCallRate()
+{
+    LOCK(cs_totalBytesSent);
+    return sendCallRate.Get(GetTime());
+}
+
 void CNode::Fuzz(int nChance)
 {
     if (!fSuccessfullyConnected) return; // Don't fuzz initial handshake
@@ -2058,7 +2394,9 @@ bool CAddrDB::Read(CAddrMan& addr)
 unsigned int ReceiveFloodSize() { return 1000 * GetArg("-maxreceivebuffer", 5 * 1000); }
 unsigned int SendBufferSize() { return 1000 * GetArg("-maxsendbuffer", 1 * 1000); }
 
-CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
+CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION),
+                                                                                            addrKnown(5000, 0.001),
+                                                                                            filterInventoryKnown(5000, 0.000001)
 {
     nServices = 0;
     hSocket = hSocketIn;
@@ -2080,14 +2418,17 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fProcessQueueFull = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    fSendBatch = false;
+    for (int i = 0; i < INV_RELAY_MAX; i++)
+        nNextInvSend[i] = 0;
     hashContinue = 0;
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
-    setInventoryKnown.max_size(SendBufferSize() / 1000);
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
     nPingUsecStart = 0;
@@ -2202,8 +2543,8 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     ssSend.GetAndClear(*it);
     nSendSize += (*it).size();
 
-    // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    // If write queue empty, attempt "optimistic write", unless more messages follow in the same batch
+    if (it == vSendMsg.begin() && !fSendBatch)
         SocketSendData(this);
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
@@ -13,8 +13,8 @@
 #include "compat.h"
 #include "hash.h"
 #include "limitedmap.h"
-#include "mruset.h"
 #include "netbase.h"
+#include "primitives/transaction.h"
 #include "protocol.h"
 #include "random.h"
 #include "streams.h"
@@ -63,6 +63,22 @@ static const bool DEFAULT_UPNP = false;
 #endif
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
+/** The maximum number of queued messages handed to the kernel by one send call */
+static const int MAX_SEND_IOV = 64;
+/** -txinvinterval default, in milliseconds */
+static const int64_t DEFAULT_TX_INV_INTERVAL = 0;
+/** -cninvinterval default, in milliseconds */
+static const int64_t DEFAULT_CORALNODE_INV_INTERVAL = 1000;
+
+/** Classes of inventory announced to a peer on timers of their own */
+enum InvRelayClass {
+    INV_RELAY_BLOCK,     // always announced at once
+    INV_RELAY_TX,        // transactions, SwiftTX locks and obfuscation transactions
+    INV_RELAY_CORALNODE, // coralnode, budget and spork data
+    INV_RELAY_MAX
+};
+
+InvRelayClass GetInvRelayClass(const CInv& inv);
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
@@ -131,10 +147,12 @@ extern uint64_t nLocalServices;
 extern uint64_t nLocalHostNonce;
 extern CAddrMan addrman;
 extern int nMaxConnections;
+/** Time between the inventory announcements of a class to a peer, in microseconds */
+extern int64_t nInvRelayInterval[INV_RELAY_MAX];
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CTransactionRef> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -153,6 +171,18 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+/** Messages of one command processed for a peer and the time spent on them */
+struct CCommandStats {
+    uint64_t nCount;
+    int64_t nTimeUsec;
+
+    CCommandStats() : nCount(0), nTimeUsec(0) {}
+};
+typedef std::map<std::string, CCommandStats> mapCommandStats_t;
+
+/** Commands counted separately per peer, the others are summed up under "other" */
+static const unsigned int MAX_COMMAND_STATS = 64;
+
 class CNodeStats
 {
 public:
@@ -173,6 +203,7 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    mapCommandStats_t mapCommandStats;
 };
 
 
@@ -190,7 +221,9 @@ public:
 
     int64_t nTime; // time (in microseconds) of message receipt.
 
-    CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn)
+    // received data is public, it is not wiped when the buffers are freed
+    CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn, CDataStream::allocator_type(false)),
+                                               vRecv(nTypeIn, nVersionIn, CDataStream::allocator_type(false))
     {
         hdrbuf.resize(24);
         in_data = false;
@@ -292,12 +325,18 @@ public:
     uint64_t nSendBytes;
     std::deque<CSerializeData> vSendMsg;
     CCriticalSection cs_vSend;
+    // set while SendMessages queues messages, which are then sent together; requires LOCK(cs_vSend)
+    bool fSendBatch;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
     uint64_t nRecvBytes;
     int nRecvVersion;
+    // set while the next message waits for room in a full subsystem queue, requires LOCK(cs_vRecvMsg)
+    bool fProcessQueueFull;
+    mapCommandStats_t mapCommandStats;
+    CCriticalSection cs_mapCommandStats;
 
     int64_t nLastSend;
     int64_t nLastRecv;
@@ -359,16 +398,18 @@ public:
 
     // flood relay
     std::vector<CAddress> vAddrToSend;
-    mruset<CAddress> setAddrKnown;
+    CRollingBloomFilter addrKnown;
     bool fGetAddr;
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    CRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
     CCriticalSection cs_inventory;
+    // time the inventory of each class is announced next, in microseconds; requires LOCK(cs_inventory)
+    int64_t nNextInvSend[INV_RELAY_MAX];
     std::multimap<int64_t, CInv> mapAskFor;
-    std::vector<uint256> vBlockRequested;
+    std::set<uint256> setBlockRequested;
 
     // Ping time measurement:
     // The pong reply we're expecting, or 0 if no pong expected.
@@ -389,6 +430,8 @@ private:
     static CCriticalSection cs_totalBytesSent;
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
+    static uint64_t nTotalRecvCalls;
+    static uint64_t nTotalSendCalls;
 
     CNode(const CNode&);
     void operator=(const CNode&);
@@ -436,10 +479,20 @@ public:
         nRefCount--;
     }
 
+    void RecordCommandTime(const std::string& strCommand, int64_t nTimeUsec)
+    {
+        LOCK(cs_mapCommandStats);
+        mapCommandStats_t::iterator it = mapCommandStats.find(strCommand);
+        if (it == mapCommandStats.end())
+            it = mapCommandStats.insert(std::make_pair(mapCommandStats.size() < MAX_COMMAND_STATS ? strCommand : "other", CCommandStats())).first;
+        it->second.nCount++;
+        it->second.nTimeUsec += nTimeUsec;
+    }
+
 
     void AddAddressKnown(const CAddress& addr)
     {
-        setAddrKnown.insert(addr);
+        addrKnown.insert(addr.GetKey());
     }
 
     void PushAddress(const CAddress& addr)
@@ -447,7 +500,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
-        if (addr.IsValid() && !setAddrKnown.count(addr)) {
+        if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
             } else {
@@ -461,7 +514,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.GetKey());
         }
     }
 
@@ -469,7 +522,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
+            if (!filterInventoryKnown.contains(inv.GetKey()))
                 vInventoryToSend.push_back(inv);
         }
     }
@@ -723,12 +776,17 @@ public:
     static bool IsWhitelistedRange(const CNetAddr& ip);
     static void AddWhitelistedRange(const CSubNet& subnet);
 
-    // Network stats
+    // Network stats, every record is one socket call
     static void RecordBytesRecv(uint64_t bytes);
     static void RecordBytesSent(uint64_t bytes);
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
+    static uint64_t GetTotalRecvCalls();
+    static uint64_t GetTotalSendCalls();
+    /** Socket calls per second over the last complete minute */
+    static double GetRecvCallRate();
+    static double GetSendCallRate();
 };
 
 class CExplicitNetCleanup
@@ -737,9 +795,8 @@ public:
     static void callCleanup();
 };
 
-class CTransaction;
 void RelayTransaction(const CTransaction& tx);
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
+void RelayTransaction(const CTransactionRef& ptx);
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll = false);
 void RelayInv(CInv& inv);
 
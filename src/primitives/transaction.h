@@ -13,6 +13,7 @@
 #include "uint256.h"
 
 #include <list>
+#include <memory>
 
 class CTransaction;
 
@@ -311,6 +312,13 @@ public:
     bool GetCoinAge(uint64_t& nCoinAge) const;  // ppcoin: get transaction coin age
 };
 
+/**
+ * A transaction shared by the mempool and the relay memory instead of being copied into
+ * each of them. The transaction must not be modified once it is shared.
+ */
+typedef std::shared_ptr<const CTransaction> CTransactionRef;
+static inline CTransactionRef MakeTransactionRef(const CTransaction& tx) { return std::make_shared<const CTransaction>(tx); }
+
 /** A mutable version of CTransaction. */
 struct CMutableTransaction
 {
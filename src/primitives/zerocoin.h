@@ -10,6 +10,8 @@
 #include "libzerocoin/Denominations.h"
 #include "serialize.h"
 
+uint256 GetPubCoinHash(const CBigNum& bnValue);
+
 class CZerocoinMint
 {
 private:
@@ -172,6 +174,99 @@ public:
     };
 };
 
+/** The zerocoin mints a block adds to the accumulators, recorded when the block is connected */
+class CMintJournalEntry
+{
+private:
+    uint256 hashBlock;
+    std::vector<std::pair<libzerocoin::CoinDenomination, CBigNum> > vMints;
+
+public:
+    CMintJournalEntry()
+    {
+        SetNull();
+    }
+
+    CMintJournalEntry(const uint256& hashBlock)
+    {
+        SetNull();
+        this->hashBlock = hashBlock;
+    }
+
+    void SetNull()
+    {
+        hashBlock = 0;
+        vMints.clear();
+    }
+
+    uint256 GetBlockHash() const { return hashBlock; }
+    const std::vector<std::pair<libzerocoin::CoinDenomination, CBigNum> >& GetMints() const { return vMints; }
+    void AddMint(libzerocoin::CoinDenomination denom, const CBigNum& bnValue) { vMints.emplace_back(std::make_pair(denom, bnValue)); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(vMints);
+    };
+};
+
+/** The accumulator witness of one of our zerocoin mints, kept up to date as new checkpoints are generated */
+class CZerocoinWitness
+{
+public:
+    CBigNum bnPubcoin;
+    libzerocoin::CoinDenomination denom;
+    int nHeightMint;
+    int nHeightAccStart; //! first block whose mints are added to the witness
+    int nHeightAccEnd; //! mints of the blocks below this height have been added
+    uint256 hashAccEnd; //! hash of block nHeightAccEnd - 1, used to detect reorgs
+    CBigNum bnWitness;
+    int nMintsAdded;
+
+    CZerocoinWitness()
+    {
+        SetNull();
+    }
+
+    CZerocoinWitness(const CBigNum& bnPubcoin, libzerocoin::CoinDenomination denom)
+    {
+        SetNull();
+        this->bnPubcoin = bnPubcoin;
+        this->denom = denom;
+    }
+
+    void SetNull()
+    {
+        bnPubcoin = 0;
+        denom = libzerocoin::ZQ_ERROR;
+        nHeightMint = 0;
+        nHeightAccStart = 0;
+        nHeightAccEnd = 0;
+        hashAccEnd = 0;
+        bnWitness = 0;
+        nMintsAdded = 0;
+    }
+
+    bool IsNull() const { return nHeightAccEnd == 0; }
+    uint256 GetHash() const { return GetPubCoinHash(bnPubcoin); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(bnPubcoin);
+        READWRITE(denom);
+        READWRITE(nHeightMint);
+        READWRITE(nHeightAccStart);
+        READWRITE(nHeightAccEnd);
+        READWRITE(hashAccEnd);
+        READWRITE(bnWitness);
+        READWRITE(nMintsAdded);
+    };
+};
+
 class CZerocoinSpendReceipt
 {
 private:
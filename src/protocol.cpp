@@ -161,3 +161,11 @@ std::string CInv::ToString() const
 {
     return strprintf("%s %s", GetCommand(), hash.ToString());
 }
+
+std::vector<unsigned char> CInv::GetKey() const
+{
+    std::vector<unsigned char> vKey(hash.begin(), hash.end());
+    for (int i = 0; i < 4; i++)
+        vKey.push_back((unsigned char)(type >> (8 * i)));
+    return vKey;
+}
@@ -148,6 +148,8 @@ public:
     bool IsCoralNodeType() const;
     const char* GetCommand() const;
     std::string ToString() const;
+    //! Hash and type, as a transaction is announced with the same hash as its SwiftTX lock request
+    std::vector<unsigned char> GetKey() const;
 
     // TODO: make private (improves encapsulation)
 public:
@@ -579,6 +579,10 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
             "  \"enoughcoins\": true|false,        (boolean) if available coins are greater than reserve balance\n"
             "  \"fnsync\": true|false,             (boolean) if coralnode data is synced\n"
             "  \"staking status\": true|false,     (boolean) if the wallet is staking or not\n"
+            "  \"stakethreads\": n,                (numeric) the number of threads searching for stake kernels\n"
+            "  \"lastsearchinputs\": n,            (numeric) the number of stake inputs scanned in the last search round\n"
+            "  \"lastsearchhashes\": n,            (numeric) the number of kernel hashes in the last search round\n"
+            "  \"hashespersec\": n,                (numeric) the kernel hash rate of the last search round\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getstakingstatus", "") + HelpExampleRpc("getstakingstatus", ""));
@@ -600,6 +604,12 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
         nStaking = true;
     obj.push_back(Pair("staking status", nStaking));
 
+    CStakeSearchStats stats = GetStakeSearchStats();
+    obj.push_back(Pair("stakethreads", nStakeThreads));
+    obj.push_back(Pair("lastsearchinputs", (uint64_t)stats.nInputs));
+    obj.push_back(Pair("lastsearchhashes", stats.nHashes));
+    obj.push_back(Pair("hashespersec", stats.nTimeMicros > 0 ? (uint64_t)(stats.nHashes * 1000000 / stats.nTimeMicros) : 0));
+
     return obj;
 }
 #endif // ENABLE_WALLET
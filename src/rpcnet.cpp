@@ -104,7 +104,15 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"commands\": {             (json object) The messages received from the peer and processed, by command\n"
+            "      \"command\": {\n"
+            "        \"count\": n,           (numeric) The number of messages processed\n"
+            "        \"time\": n            (numeric) The time spent processing them in seconds\n"
+            "      },\n"
+            "      ...\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -152,6 +160,14 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             obj.push_back(Pair("inflight", heights));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        UniValue commands(UniValue::VOBJ);
+        BOOST_FOREACH (const PAIRTYPE(std::string, CCommandStats)& item, stats.mapCommandStats) {
+            UniValue command(UniValue::VOBJ);
+            command.push_back(Pair("count", item.second.nCount));
+            command.push_back(Pair("time", ((double)item.second.nTimeUsec) / 1e6));
+            commands.push_back(Pair(item.first, command));
+        }
+        obj.push_back(Pair("commands", commands));
 
         ret.push_back(obj);
     }
@@ -339,6 +355,12 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
             "{\n"
             "  \"totalbytesrecv\": n,   (numeric) Total bytes received\n"
             "  \"totalbytessent\": n,   (numeric) Total bytes sent\n"
+            "  \"totalrecvcalls\": n,   (numeric) Socket receive calls that returned data\n"
+            "  \"totalsendcalls\": n,   (numeric) Socket send calls that sent data\n"
+            "  \"bytesperrecvcall\": x.x, (numeric) Average bytes received per call\n"
+            "  \"bytespersendcall\": x.x, (numeric) Average bytes sent per call\n"
+            "  \"recvcallspersec\": x.x,  (numeric) Receive calls per second during the last complete minute\n"
+            "  \"sendcallspersec\": x.x,  (numeric) Send calls per second during the last complete minute\n"
             "  \"timemillis\": t        (numeric) Total cpu time\n"
             "}\n"
             "\nExamples:\n" +
@@ -347,6 +369,14 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     UniValue obj(UniValue::VOBJ);
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
+    uint64_t nRecvCalls = CNode::GetTotalRecvCalls();
+    uint64_t nSendCalls = CNode::GetTotalSendCalls();
+    obj.push_back(Pair("totalrecvcalls", nRecvCalls));
+    obj.push_back(Pair("totalsendcalls", nSendCalls));
+    obj.push_back(Pair("bytesperrecvcall", nRecvCalls ? (double)CNode::GetTotalBytesRecv() / nRecvCalls : 0.0));
+    obj.push_back(Pair("bytespersendcall", nSendCalls ? (double)CNode::GetTotalBytesSent() / nSendCalls : 0.0));
+    obj.push_back(Pair("recvcallspersec", CNode::GetRecvCallRate()));
+    obj.push_back(Pair("sendcallspersec", CNode::GetSendCallRate()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
     return obj;
 }
@@ -294,6 +294,7 @@ static const CRPCCommand vRPCCommands[] =
         {"blockchain", "gettxoutsetinfo", &gettxoutsetinfo, true, false, false},
         {"blockchain", "invalidateblock", &invalidateblock, true, true, false},
         {"blockchain", "reconsiderblock", &reconsiderblock, true, true, false},
+        {"blockchain", "savemempool", &savemempool, true, true, false},
         {"blockchain", "verifychain", &verifychain, true, false, false},
 
         /* Mining */
@@ -426,6 +427,7 @@ static const CRPCCommand vRPCCommands[] =
         {"zerocoin", "importzerocoins", &importzerocoins, false, false, true},
         {"zerocoin", "exportzerocoins", &exportzerocoins, false, false, true},
         {"zerocoin", "reconsiderzerocoins", &reconsiderzerocoins, false, false, true},
+        {"zerocoin", "listzerocoinwitnesses", &listzerocoinwitnesses, false, false, true},
         {"zerocoin", "getspentzerocoinamount", &getspentzerocoinamount, false, false, false}
 
 #endif // ENABLE_WALLET
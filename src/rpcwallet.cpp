@@ -8,6 +8,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "accumulators.h"
 #include "amount.h"
 #include "base58.h"
 #include "core_io.h"
@@ -2587,7 +2588,7 @@ UniValue resetmintzerocoin(const UniValue& params, bool fHelp)
     // update the meta data of mints that were marked for updating
     UniValue arrUpdated(UniValue::VARR);
     for (CZerocoinMint mint : vMintsToUpdate) {
-        walletdb.WriteZerocoinMint(mint);
+        pwalletMain->WriteZerocoinMint(walletdb, mint);
         arrUpdated.push_back(mint.GetValue().GetHex());
     }
 
@@ -2595,7 +2596,7 @@ UniValue resetmintzerocoin(const UniValue& params, bool fHelp)
     UniValue arrDeleted(UniValue::VARR);
     for (CZerocoinMint mint : vMintsMissing) {
         arrDeleted.push_back(mint.GetValue().GetHex());
-        walletdb.ArchiveMintOrphan(mint);
+        pwalletMain->ArchiveMintOrphan(walletdb, mint);
     }
 
     UniValue obj(UniValue::VOBJ);
@@ -2636,7 +2637,7 @@ UniValue resetspentzerocoin(const UniValue& params, bool fHelp)
         for (CZerocoinMint mint : listMints) {
             if (mint.GetSerialNumber() == spend.GetSerial()) {
                 mint.SetUsed(false);
-                walletdb.WriteZerocoinMint(mint);
+                pwalletMain->WriteZerocoinMint(walletdb, mint);
                 walletdb.EraseZerocoinSpendSerialEntry(spend.GetSerial());
                 RemoveSerialFromDB(spend.GetSerial());
                 UniValue obj(UniValue::VOBJ);
@@ -2790,7 +2791,7 @@ UniValue importzerocoins(const UniValue& params, bool fHelp)
         CZerocoinMint mint(denom, bnValue, bnRandom, bnSerial, fUsed);
         mint.SetTxHash(txid);
         mint.SetHeight(nHeight);
-        walletdb.WriteZerocoinMint(mint);
+        pwalletMain->WriteZerocoinMint(walletdb, mint);
         count++;
         nValue += libzerocoin::ZerocoinDenominationToAmount(denom);
     }
@@ -2841,3 +2842,61 @@ UniValue reconsiderzerocoins(const UniValue& params, bool fHelp)
 
     return arrRet;
 }
+
+UniValue listzerocoinwitnesses(const UniValue& params, bool fHelp)
+{
+    if(fHelp || !params.empty())
+        throw runtime_error(
+            "listzerocoinwitnesses\n"
+                "\nList the cached accumulator witness of each unused zCRTS mint and how far it is behind the chain.\n"
+
+                "\nResult\n"
+                "[                                 (array of json objects)\n"
+                "  {\n"
+                "    \"pubcoin\" : \"pubcoin\",    (string) The mint's public identifier\n"
+                "    \"denomination\" : \"denom\", (numeric) the mint's zerocoin denomination\n"
+                "    \"height\" : n,               (numeric) The height the mint was added to the blockchain\n"
+                "    \"witnessheight\" : n,        (numeric) The height the witness is accumulated up to, -1 if there is no cached witness\n"
+                "    \"blocksbehind\" : n,         (numeric) The blocks a spend would still have to add to the witness\n"
+                "    \"mintsadded\" : n,           (numeric) The mints added to the witness\n"
+                "    \"current\" : true|false,     (boolean) If the witness is on the active chain\n"
+                "  }\n"
+                "  ,...\n"
+                "]\n"
+
+                "\nExamples\n" +
+            HelpExampleCli("listzerocoinwitnesses", "") + HelpExampleRpc("listzerocoinwitnesses", ""));
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    int nChainHeight = chainActive.Height();
+    int nHeightStop = nChainHeight - (nChainHeight % 10) - 20;
+
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    list<CZerocoinMint> listMints = walletdb.ListMintedCoins(true, false, false);
+
+    UniValue arrRet(UniValue::VARR);
+    for (const CZerocoinMint& mint : listMints) {
+        CZerocoinWitness zerocoinWitness;
+        uint256 hashPubcoin = GetPubCoinHash(mint.GetValue());
+        if (pwalletMain->mapZerocoinWitness.count(hashPubcoin))
+            zerocoinWitness = pwalletMain->mapZerocoinWitness.at(hashPubcoin);
+
+        UniValue objMint(UniValue::VOBJ);
+        objMint.push_back(Pair("pubcoin", mint.GetValue().GetHex()));
+        objMint.push_back(Pair("denomination", FormatMoney(mint.GetDenominationAsAmount())));
+        objMint.push_back(Pair("height", mint.GetHeight()));
+        if (zerocoinWitness.IsNull()) {
+            objMint.push_back(Pair("witnessheight", -1));
+            objMint.push_back(Pair("blocksbehind", max(0, nHeightStop - mint.GetHeight())));
+        } else {
+            objMint.push_back(Pair("witnessheight", zerocoinWitness.nHeightAccEnd));
+            objMint.push_back(Pair("blocksbehind", max(0, nHeightStop - zerocoinWitness.nHeightAccEnd)));
+        }
+        objMint.push_back(Pair("mintsadded", zerocoinWitness.nMintsAdded));
+        objMint.push_back(Pair("current", IsZerocoinWitnessCurrent(zerocoinWitness)));
+        arrRet.push_back(objMint);
+    }
+
+    return arrRet;
+}
@@ -55,6 +55,11 @@ public:
         Init(nTypeIn, nVersionIn);
     }
 
+    CDataStream(int nTypeIn, int nVersionIn, const allocator_type& alloc) : vch(alloc)
+    {
+        Init(nTypeIn, nVersionIn);
+    }
+
     CDataStream(const_iterator pbegin, const_iterator pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
     {
         Init(nTypeIn, nVersionIn);
@@ -126,6 +131,13 @@ public:
         vch.clear();
         nReadPos = 0;
     }
+    void swap(CDataStream& other)
+    {
+        vch.swap(other.vch);
+        std::swap(nReadPos, other.nReadPos);
+        std::swap(nType, other.nType);
+        std::swap(nVersion, other.nVersion);
+    }
     iterator insert(iterator it, const char& x = char()) { return vch.insert(it, x); }
     void insert(iterator it, size_type n, const char& x) { vch.insert(it, n, x); }
 
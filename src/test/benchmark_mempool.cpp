@@ -0,0 +1,99 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "main.h"
+#include "miner.h"
+#include "random.h"
+#include "script/script.h"
+#include "tinyformat.h"
+#include "txmempool.h"
+#include "utiltime.h"
+#include "wallet.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+extern CWallet* pwalletMain;
+
+namespace
+{
+/** Fill the mempool with nTxs transactions, about a third of them spending an earlier one. Returns the funding txids. */
+std::vector<uint256> FillMempool(int nTxs)
+{
+    std::vector<uint256> vFunding;
+    std::vector<CTransaction> vTxs;
+    std::vector<int> vDepth;
+    std::vector<bool> vSpent;
+    LOCK(cs_main);
+    for (int i = 0; i < nTxs; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        int nDepth = 1;
+        CAmount nValueIn = 10 * COIN;
+        int nParent = vTxs.empty() ? -1 : insecure_rand() % vTxs.size();
+        if (insecure_rand() % 10 < 3 && nParent >= 0 && vDepth[nParent] < 9 && !vSpent[nParent]) {
+            // spend an earlier transaction, keeping its chain short of the ancestor limit
+            tx.vin[0].prevout = COutPoint(vTxs[nParent].GetHash(), 0);
+            nValueIn = vTxs[nParent].vout[0].nValue;
+            nDepth = vDepth[nParent] + 1;
+            vSpent[nParent] = true;
+        } else {
+            uint256 hashFunding = GetRandHash();
+            pcoinsTip->AddCoin(COutPoint(hashFunding, 0), Coin(CTxOut(nValueIn, CScript() << OP_TRUE), 0, false, false, 1), false);
+            vFunding.push_back(hashFunding);
+            tx.vin[0].prevout = COutPoint(hashFunding, 0);
+        }
+        CAmount nFee = 1000 + (insecure_rand() % 100) * 1000;
+        tx.vout[0].nValue = nValueIn - nFee;
+        vTxs.push_back(tx);
+        vDepth.push_back(nDepth);
+        vSpent.push_back(false);
+        mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, GetTime(), 0.0, 0));
+    }
+    return vFunding;
+}
+
+void ClearFunding(const std::vector<uint256>& vFunding)
+{
+    LOCK(cs_main);
+    for (unsigned int i = 0; i < vFunding.size(); i++) {
+        pcoinsTip->SpendCoin(COutPoint(vFunding[i], 0));
+    }
+}
+}
+
+BOOST_AUTO_TEST_SUITE(benchmark_mempool)
+
+BOOST_AUTO_TEST_CASE(benchmark_block_assembly)
+{
+    // Time filling the mempool and assembling a block template from it. The coins spent are
+    // made up, the template is not required to validate.
+    seed_insecure_rand(true);
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    const int nSizes[] = {10000, 50000};
+    for (unsigned int i = 0; i < sizeof(nSizes) / sizeof(nSizes[0]); i++) {
+        mempool.clear();
+        int64_t nStart = GetTimeMicros();
+        std::vector<uint256> vFunding = FillMempool(nSizes[i]);
+        int64_t nTimeFill = GetTimeMicros() - nStart;
+        BOOST_CHECK_EQUAL(mempool.size(), nSizes[i]);
+
+        nStart = GetTimeMicros();
+        CBlockTemplate* pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false);
+        int64_t nTimeAssemble = GetTimeMicros() - nStart;
+        delete pblocktemplate;
+
+        BOOST_TEST_MESSAGE(strprintf("%d mempool transactions: filled in %.3fs, block of %u transactions assembled in %.3fs",
+            nSizes[i], nTimeFill / 1e6, nLastBlockTx, nTimeAssemble / 1e6));
+
+        mempool.clear();
+        ClearFunding(vFunding);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
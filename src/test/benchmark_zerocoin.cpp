@@ -25,6 +25,7 @@
 #include "libzerocoin/Coin.h"
 #include "libzerocoin/CoinSpend.h"
 #include "libzerocoin/Accumulator.h"
+#include "libzerocoin/GroupExponentiation.h"
 
 using namespace std;
 using namespace libzerocoin;
@@ -369,6 +370,51 @@ Testb_MintAndSpend()
 	return false;
 }
 
+bool
+Testb_GroupExponentiation()
+{
+	const uint32_t nRounds = 200;
+	const IntegerGroupParams* groups[] = { &gg_Params->coinCommitmentGroup, &gg_Params->serialNumberSoKCommitmentGroup };
+	const char* names[] = { "COIN COMMITMENT GROUP", "SOK COMMITMENT GROUP" };
+
+	try {
+		for (uint32_t n = 0; n < 2; n++) {
+			const IntegerGroupParams& group = *groups[n];
+			vector<CBigNum> vA, vB, vBefore, vAfter;
+			for (uint32_t i = 0; i < nRounds; i++) {
+				vA.push_back(CBigNum::randBignum(group.groupOrder));
+				vB.push_back(CBigNum::randBignum(group.groupOrder));
+			}
+
+			// Build the tables before timing
+			const GroupExponentiation& groupExp = getGroupExponentiation(group);
+			groupExp.pow_gh(vA[0], vB[0]);
+
+			timer.start();
+			for (uint32_t i = 0; i < nRounds; i++)
+				vBefore.push_back(group.g.pow_mod(vA[i], group.modulus).mul_mod(group.h.pow_mod(vB[i], group.modulus), group.modulus));
+			timer.stop();
+			int nBefore = timer.duration();
+
+			timer.start();
+			for (uint32_t i = 0; i < nRounds; i++)
+				vAfter.push_back(groupExp.pow_gh(vA[i], vB[i]));
+			timer.stop();
+			int nAfter = timer.duration();
+
+			if (vBefore != vAfter)
+				return false;
+
+			cout << "	" << names[n] << " g^a*h^b (" << nRounds << " rounds):\n\t\tpow_mod: " << nBefore << " ms\n\t\tfixed-base: " << nAfter << " ms" << endl;
+		}
+	} catch (runtime_error &e) {
+		cout << e.what() << endl;
+		return false;
+	}
+
+	return true;
+}
+
 void
 Testb_RunAllTests()
 {
@@ -388,6 +434,7 @@ Testb_RunAllTests()
 	gLogTestResult("coins can be minted", Testb_MintCoin);
 	gLogTestResult("the accumulator works", Testb_Accumulator);
 	gLogTestResult("a minted coin can be spent", Testb_MintAndSpend);
+	gLogTestResult("fixed-base exponentiation matches pow_mod", Testb_GroupExponentiation);
 
 	// Summarize test results
 	if (ggSuccessfulTests < ggNumTests) {
@@ -0,0 +1,121 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cachefile.h"
+#include "random.h"
+#include "serialize.h"
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+struct TestCacheDB {
+    enum ReadResult {
+        Ok,
+        FileError,
+        HashReadError,
+        IncorrectHash,
+        IncorrectMagicMessage,
+        IncorrectMagicNumber,
+        IncorrectFormat
+    };
+};
+
+struct TestCache {
+    std::vector<unsigned char> vchData;
+    std::map<uint256, int> mapEntries;
+
+    void Clear()
+    {
+        vchData.clear();
+        mapEntries.clear();
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(vchData);
+        READWRITE(mapEntries);
+    }
+};
+
+TestCache MakeTestCache()
+{
+    // larger than a chunk, so the data spans several
+    TestCache cache;
+    cache.vchData.resize(CACHEFILE_CHUNK_SIZE * 2 + 1000);
+    GetRandBytes(&cache.vchData[0], cache.vchData.size());
+    for (int i = 0; i < 1000; i++)
+        cache.mapEntries[GetRandHash()] = i;
+    return cache;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(cachefile_tests)
+
+BOOST_AUTO_TEST_CASE(cachefile_roundtrip)
+{
+    boost::filesystem::path path = GetDataDir() / "cachefile_test.dat";
+    TestCache cache = MakeTestCache();
+    BOOST_CHECK(WriteCacheFile(path, "TestCache", cache));
+    BOOST_CHECK(!boost::filesystem::exists(path.string() + ".new"));
+
+    TestCache cacheRead;
+    BOOST_CHECK_EQUAL(ReadCacheFile<TestCacheDB>(path, "TestCache", cacheRead), TestCacheDB::Ok);
+    BOOST_CHECK(cacheRead.vchData == cache.vchData);
+    BOOST_CHECK(cacheRead.mapEntries == cache.mapEntries);
+
+    BOOST_CHECK_EQUAL(ReadCacheFile<TestCacheDB>(path, "OtherCache", cacheRead), TestCacheDB::IncorrectMagicMessage);
+    BOOST_CHECK_EQUAL(ReadCacheFile<TestCacheDB>(GetDataDir() / "missing.dat", "TestCache", cacheRead), TestCacheDB::FileError);
+
+    // flip a byte in the second chunk
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    BOOST_REQUIRE(file);
+    fseek(file, CACHEFILE_CHUNK_SIZE + 1000, SEEK_SET);
+    int c = fgetc(file);
+    fseek(file, CACHEFILE_CHUNK_SIZE + 1000, SEEK_SET);
+    fputc(c ^ 0xff, file);
+    fclose(file);
+
+    BOOST_CHECK_EQUAL(ReadCacheFile<TestCacheDB>(path, "TestCache", cacheRead), TestCacheDB::IncorrectHash);
+    BOOST_CHECK(cacheRead.vchData.empty());
+
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(cachefile_legacy)
+{
+    // the format written before the chunked one
+    boost::filesystem::path path = GetDataDir() / "cachefile_legacy.dat";
+    TestCache cache = MakeTestCache();
+
+    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
+    ssObj << std::string("TestCache");
+    ssObj << FLATDATA(Params().MessageStart());
+    ssObj << cache;
+    uint256 hash = Hash(ssObj.begin(), ssObj.end());
+    ssObj << hash;
+
+    CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!fileout.IsNull());
+    fileout << ssObj;
+    fileout.fclose();
+
+    TestCache cacheRead;
+    BOOST_CHECK_EQUAL(ReadCacheFile<TestCacheDB>(path, "TestCache", cacheRead), TestCacheDB::Ok);
+    BOOST_CHECK(cacheRead.vchData == cache.vchData);
+    BOOST_CHECK(cacheRead.mapEntries == cache.mapEntries);
+
+    // and is converted when written again
+    BOOST_CHECK(WriteCacheFile(path, "TestCache", cacheRead));
+    TestCache cacheConverted;
+    BOOST_CHECK_EQUAL(ReadCacheFile<TestCacheDB>(path, "TestCache", cacheConverted), TestCacheDB::Ok);
+    BOOST_CHECK(cacheConverted.mapEntries == cache.mapEntries);
+
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
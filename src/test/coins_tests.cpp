@@ -4,6 +4,7 @@
 
 #include "coins.h"
 #include "random.h"
+#include "txdb.h"
 #include "uint256.h"
 
 #include <vector>
@@ -16,27 +17,27 @@ namespace
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
-            // Randomly return false in case of an empty entry.
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
+            // Randomly return false in case of a spent entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
+    bool HaveCoin(const COutPoint& outpoint) const
     {
-        CCoins coins;
-        return GetCoins(txid, coins);
+        Coin coin;
+        return GetCoin(outpoint, coin) && !coin.IsSpent();
     }
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
@@ -44,10 +45,12 @@ public:
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
-            map_[it->first] = it->second.coins;
-            if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
-                // Randomly delete empty entries on write.
-                map_.erase(it->first);
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
+                    // Randomly delete spent entries on write.
+                    map_.erase(it->first);
+                }
             }
             mapCoins.erase(it++);
         }
@@ -58,6 +61,71 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += it->second.coin.DynamicMemoryUsage();
+        }
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
+
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true, true) {}
+
+    //! Store a transaction the way versions before per-output records did
+    void WriteLegacyCoins(const uint256& txid, const CCoins& coins)
+    {
+        BOOST_CHECK(db.Write(std::make_pair('c', txid), coins));
+    }
+
+    bool HaveLegacyCoins(const uint256& txid) const
+    {
+        return db.Exists(std::make_pair('c', txid));
+    }
+};
+
+CCoins RandomLegacyCoins(int nHeight)
+{
+    CCoins coins;
+    coins.fCoinBase = insecure_rand() % 4 == 0;
+    coins.fCoinStake = !coins.fCoinBase && insecure_rand() % 2 == 0;
+    coins.nVersion = 1;
+    coins.nHeight = nHeight;
+    coins.vout.resize(1 + insecure_rand() % 4);
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        coins.vout[i].nValue = insecure_rand();
+        coins.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    // a spent output in the middle, trailing spent outputs are never stored
+    if (coins.vout.size() > 2)
+        coins.vout[1].SetNull();
+    return coins;
+}
+
+//! Whether db holds exactly the unspent outputs of coins, each with the metadata of its transaction
+bool HaveUpgradedCoins(const CCoinsViewDB& db, const uint256& txid, const CCoins& coins)
+{
+    for (unsigned int n = 0; n < coins.vout.size() + 1; n++) {
+        Coin coin;
+        bool fUnspent = n < coins.vout.size() && !coins.vout[n].IsNull();
+        if (db.GetCoin(COutPoint(txid, n), coin) != fUnspent || db.HaveCoin(COutPoint(txid, n)) != fUnspent)
+            return false;
+        if (fUnspent && coin != Coin(coins.vout[n], coins.nHeight, coins.fCoinBase, coins.fCoinStake, coins.nVersion))
+            return false;
+    }
+    return true;
+}
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -67,8 +135,8 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
-// txids picked from a limited list of random 256-bit hashes. Occasionally, a
+// It will randomly create/update/delete Coin entries to a tip of caches, with
+// outpoints picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
 // During the process, booleans are kept to make sure that the randomized
@@ -85,16 +153,16 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool missed_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
-    txids.resize(NUM_SIMULATION_ITERATIONS / 8);
+    txids.resize(NUM_SIMULATION_ITERATIONS / 16);
     for (unsigned int i = 0; i < txids.size(); i++) {
         txids[i] = GetRandHash();
     }
@@ -102,39 +170,41 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     for (unsigned int i = 0; i < NUM_SIMULATION_ITERATIONS; i++) {
         // Do a random modification.
         {
-            uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
+            COutPoint outpoint(txids[insecure_rand() % txids.size()], insecure_rand() % 2); // outpoint we're going to modify in this iteration.
+            Coin& coin = result[outpoint];
+            BOOST_CHECK(coin == stack.back()->AccessCoin(outpoint));
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                if (coin.IsSpent()) {
                     added_an_entry = true;
                 } else {
                     updated_an_entry = true;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                Coin newcoin(CTxOut(insecure_rand(), CScript()), 1, false, false, insecure_rand());
+                stack.back()->AddCoin(outpoint, newcoin, !coin.IsSpent() || insecure_rand() % 2 == 0);
+                coin = newcoin;
             } else {
-                coins.Clear();
-                entry->Clear();
+                BOOST_CHECK(stack.back()->SpendCoin(outpoint));
+                coin.Clear();
                 removed_an_entry = true;
             }
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    found_an_entry = true;
                 }
             }
+            for (unsigned int j = 0; j < stack.size(); j++) {
+                stack[j]->SelfTest();
+            }
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -151,7 +221,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -175,4 +245,116 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+BOOST_AUTO_TEST_CASE(coins_db_per_output_test)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    uint256 hashBlock = GetRandHash();
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(4);
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        tx.vout[i].nValue = 1000 * (i + 1);
+        tx.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    tx.vout[2].scriptPubKey = CScript() << OP_RETURN;
+    uint256 txid = tx.GetHash();
+
+    // create the outputs in the database, the unspendable one is left out
+    {
+        CCoinsViewCacheTest cache(&db);
+        AddCoins(cache, tx, 100);
+        cache.SelfTest();
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), memusage::DynamicUsage(CCoinsMap()));
+    }
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        Coin coin;
+        BOOST_CHECK_EQUAL(db.HaveCoin(COutPoint(txid, i)), i != 2);
+        BOOST_CHECK_EQUAL(db.GetCoin(COutPoint(txid, i), coin), i != 2);
+        if (i != 2)
+            BOOST_CHECK(coin == Coin(tx, i, 100));
+    }
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txid, tx.vout.size())));
+    BOOST_CHECK(!db.HaveCoin(COutPoint(GetRandHash(), 0)));
+
+    // spending an output only erases its own record
+    {
+        CCoinsViewCacheTest cache(&db);
+        Coin coin;
+        BOOST_CHECK(cache.SpendCoin(COutPoint(txid, 3), &coin));
+        BOOST_CHECK(coin == Coin(tx, 3, 100));
+        BOOST_CHECK(!cache.HaveCoin(COutPoint(txid, 3)));
+        cache.SelfTest();
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txid, 3)));
+    BOOST_CHECK(db.HaveCoin(COutPoint(txid, 0)));
+    BOOST_CHECK(db.HaveCoin(COutPoint(txid, 1)));
+
+    // changes that are not flushed never reach the database
+    {
+        CCoinsViewCacheTest cache(&db);
+        BOOST_CHECK(cache.SpendCoin(COutPoint(txid, 0)));
+        BOOST_CHECK(cache.SpendCoin(COutPoint(txid, 1)));
+    }
+    BOOST_CHECK(db.HaveCoin(COutPoint(txid, 0)));
+    {
+        CCoinsViewCacheTest cache(&db);
+        BOOST_CHECK(cache.SpendCoin(COutPoint(txid, 0)));
+        BOOST_CHECK(cache.SpendCoin(COutPoint(txid, 1)));
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txid, 0)));
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txid, 1)));
+    BOOST_CHECK(AccessByTxid(CCoinsViewCache(&db), txid).IsSpent());
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_upgrade_test)
+{
+    CCoinsViewDBTest db;
+    // nothing to convert
+    BOOST_CHECK(db.Upgrade());
+
+    // More transactions than fit in one upgrade batch
+    std::vector<std::pair<uint256, CCoins> > vLegacy;
+    for (unsigned int i = 0; i < 13000; i++)
+        vLegacy.push_back(std::make_pair(GetRandHash(), RandomLegacyCoins(1 + i)));
+
+    // Every upgrade batch converts its transactions and erases their legacy records
+    // atomically, so an interrupted upgrade leaves part of the database converted and
+    // the rest in the old format. Build that state by converting the first part.
+    const unsigned int nInterrupted = 2000;
+    for (unsigned int i = 0; i < nInterrupted; i++)
+        db.WriteLegacyCoins(vLegacy[i].first, vLegacy[i].second);
+    BOOST_CHECK(db.Upgrade());
+    for (unsigned int i = nInterrupted; i < vLegacy.size(); i++)
+        db.WriteLegacyCoins(vLegacy[i].first, vLegacy[i].second);
+    BOOST_CHECK(!db.HaveLegacyCoins(vLegacy[0].first));
+    BOOST_CHECK(HaveUpgradedCoins(db, vLegacy[0].first, vLegacy[0].second));
+    BOOST_CHECK(db.HaveLegacyCoins(vLegacy.back().first));
+    BOOST_CHECK(!db.HaveCoin(COutPoint(vLegacy.back().first, 0)));
+
+    // The next start resumes with the remaining transactions
+    BOOST_CHECK(db.Upgrade());
+    unsigned int nUpgraded = 0;
+    unsigned int nLegacy = 0;
+    for (unsigned int i = 0; i < vLegacy.size(); i++) {
+        if (HaveUpgradedCoins(db, vLegacy[i].first, vLegacy[i].second))
+            nUpgraded++;
+        if (db.HaveLegacyCoins(vLegacy[i].first))
+            nLegacy++;
+    }
+    BOOST_CHECK_EQUAL(nUpgraded, vLegacy.size());
+    BOOST_CHECK_EQUAL(nLegacy, 0U);
+
+    // and a cache on top of the converted database sees the outputs
+    CCoinsViewCache cache(&db);
+    const CCoins& coins = vLegacy.back().second;
+    BOOST_CHECK(AccessByTxid(cache, vLegacy.back().first) == Coin(coins.vout[0], coins.nHeight, coins.fCoinBase, coins.fCoinStake, coins.nVersion));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
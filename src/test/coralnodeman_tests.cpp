@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coralnodeman.h"
+#include "key.h"
+#include "random.h"
+#include "script/standard.h"
+#include "utiltime.h"
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(coralnodeman_tests)
+
+static const int NUM_CORALNODES = 5000;
+static const int NUM_LOOKUPS = 1000;
+
+static CCoralnode MakeCoralnode()
+{
+    CKey keyCollateral, keyCoralnode;
+    keyCollateral.MakeNewKey(true);
+    keyCoralnode.MakeNewKey(true);
+
+    CCoralnode mn;
+    mn.vin = CTxIn(GetRandHash(), GetRand(10));
+    mn.pubKeyCollateralAddress = keyCollateral.GetPubKey();
+    mn.pubKeyCoralnode = keyCoralnode.GetPubKey();
+    return mn;
+}
+
+BOOST_AUTO_TEST_CASE(coralnodeman_index_lookup)
+{
+    CCoralnodeMan man;
+    std::vector<CCoralnode> vList;
+    for (int i = 0; i < NUM_CORALNODES; i++) {
+        vList.push_back(MakeCoralnode());
+        BOOST_CHECK(man.Add(vList.back()));
+    }
+    BOOST_CHECK_EQUAL(man.size(), NUM_CORALNODES);
+
+    // a duplicate collateral is rejected
+    BOOST_CHECK(!man.Add(vList[0]));
+
+    int64_t nIndexed = 0, nScanned = 0;
+    for (int i = 0; i < NUM_LOOKUPS; i++) {
+        const CCoralnode& mn = vList[GetRand(NUM_CORALNODES)];
+        CScript payee = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
+
+        int64_t nStart = GetTimeMicros();
+        CCoralnode* pmnVin = man.Find(mn.vin);
+        CCoralnode* pmnPayee = man.Find(payee);
+        CCoralnode* pmnPubKey = man.Find(mn.pubKeyCoralnode);
+        nIndexed += GetTimeMicros() - nStart;
+
+        // what the lookups did before the indexes
+        nStart = GetTimeMicros();
+        const CCoralnode* pmnScan = NULL;
+        BOOST_FOREACH (const CCoralnode& mn2, vList) {
+            if (mn2.vin.prevout == mn.vin.prevout && GetScriptForDestination(mn2.pubKeyCollateralAddress.GetID()) == payee && mn2.pubKeyCoralnode == mn.pubKeyCoralnode) {
+                pmnScan = &mn2;
+                break;
+            }
+        }
+        nScanned += GetTimeMicros() - nStart;
+
+        BOOST_REQUIRE(pmnVin != NULL && pmnScan != NULL);
+        BOOST_CHECK(pmnVin == pmnPayee && pmnVin == pmnPubKey);
+        BOOST_CHECK(pmnVin->vin == pmnScan->vin);
+    }
+    BOOST_TEST_MESSAGE(strprintf("%d coralnodes, %d lookups: indexed %dus, linear scan %dus", NUM_CORALNODES, NUM_LOOKUPS, nIndexed, nScanned));
+
+    // unknown keys are not found
+    CCoralnode mnUnknown = MakeCoralnode();
+    BOOST_CHECK(man.Find(mnUnknown.vin) == NULL);
+    BOOST_CHECK(man.Find(mnUnknown.pubKeyCoralnode) == NULL);
+    BOOST_CHECK(man.Find(GetScriptForDestination(mnUnknown.pubKeyCollateralAddress.GetID())) == NULL);
+
+    // the indexes follow removals that shift the remaining entries
+    man.Remove(vList[0].vin);
+    BOOST_CHECK(man.Find(vList[0].vin) == NULL);
+    BOOST_CHECK(man.Find(vList[0].pubKeyCoralnode) == NULL);
+    for (int i = 1; i < NUM_CORALNODES; i += NUM_CORALNODES / 10) {
+        CCoralnode* pmn = man.Find(vList[i].pubKeyCoralnode);
+        BOOST_REQUIRE(pmn != NULL);
+        BOOST_CHECK(pmn->vin == vList[i].vin);
+    }
+
+    man.Clear();
+    BOOST_CHECK(man.Find(vList[1].vin) == NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,30 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "kernel.h"
+#include "random.h"
+
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(kernel_tests)
+
+BOOST_AUTO_TEST_CASE(stake_kernel_matches_stakehash)
+{
+    for (int i = 0; i < 100; i++) {
+        uint64_t nStakeModifier = GetRand(std::numeric_limits<uint64_t>::max());
+        unsigned int nTimeBlockFrom = GetRand(std::numeric_limits<int32_t>::max());
+        COutPoint prevout(GetRandHash(), GetRand(1000));
+
+        CDataStream ss(SER_GETHASH, 0);
+        ss << nStakeModifier;
+
+        CStakeKernel kernel(nStakeModifier, nTimeBlockFrom, prevout);
+        for (unsigned int nTimeTx = nTimeBlockFrom; nTimeTx < nTimeBlockFrom + 10; nTimeTx++)
+            BOOST_CHECK(kernel.GetHash(nTimeTx) == stakeHash(nTimeTx, ss, prevout.n, prevout.hash, nTimeBlockFrom));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -442,6 +442,57 @@ Test_MintAndSpend()
 	return false;
 }
 
+bool
+Test_SerialSoKBinding()
+{
+	try {
+		// This test assumes a list of coins were generated in Test_MintCoin()
+		if (gCoins[0] == NULL || gCoins[1] == NULL)
+		{
+			// No coins: mint some.
+			Test_MintCoin();
+			if (gCoins[0] == NULL || gCoins[1] == NULL) {
+				return false;
+			}
+		}
+
+		Accumulator acc(&g_Params->accumulatorParams,CoinDenomination::ZQ_ONE);
+		AccumulatorWitness wAcc0(g_Params, acc, gCoins[0]->getPublicCoin());
+		AccumulatorWitness wAcc1(g_Params, acc, gCoins[1]->getPublicCoin());
+
+		for (uint32_t i = 0; i < TESTS_COINS_TO_ACCUMULATE; i++) {
+			acc += gCoins[i]->getPublicCoin();
+			wAcc0 += gCoins[i]->getPublicCoin();
+			wAcc1 += gCoins[i]->getPublicCoin();
+		}
+
+		CoinSpend spend0(g_Params, *gCoins[0], acc, 0, wAcc0, 0);
+		CoinSpend spend1(g_Params, *gCoins[1], acc, 0, wAcc1, 1);
+
+		if (!spend0.Verify(acc) || !spend1.Verify(acc))
+			return false;
+
+		// Change the transaction hash of the first spend. Only its serial number
+		// proof covers that hash, so the other proofs still pass and the spend fails.
+		CDataStream ss0(SER_NETWORK, PROTOCOL_VERSION);
+		CDataStream ss1(SER_NETWORK, PROTOCOL_VERSION);
+		ss0 << spend0;
+		ss1 << spend1;
+		size_t nPos = 0;
+		while (nPos < ss0.size() && ss0[nPos] == ss1[nPos])
+			nPos++;
+		ss0[nPos] ^= 1;
+		CoinSpend badSpend(g_Params, ss0);
+
+		return spend1.Verify(acc) && !badSpend.Verify(acc);
+	} catch (runtime_error &e) {
+		cout << e.what() << endl;
+		return false;
+	}
+
+	return false;
+}
+
 void
 Test_RunAllTests()
 {
@@ -463,6 +514,7 @@ Test_RunAllTests()
 	LogTestResult("the accumulator works", Test_Accumulator);
 	LogTestResult("the commitment equality PoK works", Test_EqualityPoK);
 	LogTestResult("a minted coin can be spent", Test_MintAndSpend);
+	LogTestResult("a serial number proof is bound to its transaction hash", Test_SerialSoKBinding);
 
 	cout << endl << "Average coin size is " << gCoinSize << " bytes." << endl;
 	cout << "Serial number size is " << gSerialNumberSize << " bytes." << endl;
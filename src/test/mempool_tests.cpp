@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "main.h"
+#include "miner.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -99,4 +100,239 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolPackageStateTest)
+{
+    // Test the ancestor and descendant state kept for each entry
+
+    // Parent with two children, the first of which has a child of its own
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    CMutableTransaction txChild[2];
+    for (int i = 0; i < 2; i++) {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout.hash = txParent.GetHash();
+        txChild[i].vin[0].prevout.n = i;
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 11000LL;
+    }
+    CMutableTransaction txGrandChild;
+    txGrandChild.vin.resize(1);
+    txGrandChild.vin[0].scriptSig = CScript() << OP_11;
+    txGrandChild.vin[0].prevout.hash = txChild[0].GetHash();
+    txGrandChild.vin[0].prevout.n = 0;
+    txGrandChild.vout.resize(1);
+    txGrandChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txGrandChild.vout[0].nValue = 10000LL;
+
+    CTxMemPool testPool(CFeeRate(0));
+    CTxMemPoolEntry entryParent(txParent, 1000, 0, 0.0, 1);
+    CTxMemPoolEntry entryChild0(txChild[0], 10000, 0, 0.0, 1);
+    CTxMemPoolEntry entryChild1(txChild[1], 0, 0, 0.0, 1);
+    CTxMemPoolEntry entryGrandChild(txGrandChild, 2000, 0, 0.0, 1);
+    testPool.addUnchecked(txParent.GetHash(), entryParent);
+    testPool.addUnchecked(txChild[0].GetHash(), entryChild0);
+    testPool.addUnchecked(txChild[1].GetHash(), entryChild1);
+    testPool.addUnchecked(txGrandChild.GetHash(), entryGrandChild);
+
+    CTxMemPool::txiter itParent = testPool.mapTx.find(txParent.GetHash());
+    CTxMemPool::txiter itChild0 = testPool.mapTx.find(txChild[0].GetHash());
+    CTxMemPool::txiter itChild1 = testPool.mapTx.find(txChild[1].GetHash());
+    CTxMemPool::txiter itGrandChild = testPool.mapTx.find(txGrandChild.GetHash());
+
+    BOOST_CHECK_EQUAL(itParent->GetCountWithDescendants(), 4);
+    BOOST_CHECK_EQUAL(itParent->GetSizeWithDescendants(), entryParent.GetTxSize() + entryChild0.GetTxSize() + entryChild1.GetTxSize() + entryGrandChild.GetTxSize());
+    BOOST_CHECK_EQUAL(itParent->GetModFeesWithDescendants(), 13000);
+    BOOST_CHECK_EQUAL(itChild0->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(itGrandChild->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(itGrandChild->GetSizeWithAncestors(), entryParent.GetTxSize() + entryChild0.GetTxSize() + entryGrandChild.GetTxSize());
+    BOOST_CHECK_EQUAL(itGrandChild->GetModFeesWithAncestors(), 13000);
+    BOOST_CHECK_EQUAL(itChild1->GetModFeesWithAncestors(), 1000);
+
+    // The well paying child and its parent are the best package to mine
+    BOOST_CHECK(testPool.mapTx.get<ancestor_score>().begin()->GetTx().GetHash() == txChild[0].GetHash());
+
+    // Prioritisation counts towards the packages
+    testPool.PrioritiseTransaction(txChild[1].GetHash(), txChild[1].GetHash().ToString(), 0.0, 5000);
+    BOOST_CHECK_EQUAL(itChild1->GetModifiedFee(), 5000);
+    BOOST_CHECK_EQUAL(itChild1->GetModFeesWithAncestors(), 6000);
+    BOOST_CHECK_EQUAL(itParent->GetModFeesWithDescendants(), 18000);
+
+    // Mining the first child leaves the grandchild without ancestors
+    std::list<CTransaction> removed;
+    testPool.remove(txChild[0], removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(itParent->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(itParent->GetModFeesWithDescendants(), 6000);
+    BOOST_CHECK_EQUAL(itGrandChild->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(itGrandChild->GetModFeesWithAncestors(), 2000);
+
+    // Disconnecting that block brings it back, above the grandchild already in the pool
+    testPool.addUnchecked(txChild[0].GetHash(), entryChild0);
+    itChild0 = testPool.mapTx.find(txChild[0].GetHash());
+    BOOST_CHECK_EQUAL(itParent->GetCountWithDescendants(), 4);
+    BOOST_CHECK_EQUAL(itParent->GetModFeesWithDescendants(), 18000);
+    BOOST_CHECK_EQUAL(itChild0->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(itGrandChild->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(itGrandChild->GetModFeesWithAncestors(), 13000);
+
+    // Removing the parent with its descendants empties the pool
+    removed.clear();
+    testPool.remove(txParent, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 4);
+    BOOST_CHECK_EQUAL(testPool.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    // Test trimming, expiry and the rolling minimum fee
+    CTxMemPool pool(CFeeRate(1000));
+
+    CMutableTransaction tx[4];
+    for (int i = 0; i < 4; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    // the last one spends the one before
+    tx[3].vin[0].prevout = COutPoint(tx[2].GetHash(), 0);
+
+    CTxMemPoolEntry entry1(tx[0], 10000, 100, 0.0, 1);
+    CTxMemPoolEntry entry2(tx[1], 5000, 200, 0.0, 1);
+    pool.addUnchecked(tx[0].GetHash(), entry1);
+    pool.addUnchecked(tx[1].GetHash(), entry2);
+
+    // Nothing to trim
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK(pool.exists(tx[0].GetHash()));
+    BOOST_CHECK(pool.exists(tx[1].GetHash()));
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+
+    // The worse paying transaction goes first and raises the minimum fee above its own
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(pool.exists(tx[0].GetHash()));
+    BOOST_CHECK(!pool.exists(tx[1].GetHash()));
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(CFeeRate(5000, entry2.GetTxSize()).GetFeePerK() + 1000));
+
+    // A child paying for its parent keeps it in the pool
+    pool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], 0, 300, 0.0, 1));
+    pool.addUnchecked(tx[3].GetHash(), CTxMemPoolEntry(tx[3], 30000, 400, 0.0, 1));
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx[0].GetHash()));
+    BOOST_CHECK(pool.exists(tx[2].GetHash()));
+    BOOST_CHECK(pool.exists(tx[3].GetHash()));
+    CAmount nMinFeePerK = CFeeRate(10000, entry1.GetTxSize()).GetFeePerK() + 1000;
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(nMinFeePerK));
+
+    // Expiry takes the descendants along
+    BOOST_CHECK_EQUAL(pool.Expire(350), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+
+    // The minimum fee only decays once a block came in, by half each half-life
+    SetMockTime(42);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(nMinFeePerK));
+    std::vector<CTransaction> vtx;
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts);
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(nMinFeePerK / 2));
+    // down to half the relay fee it drops to zero
+    SetMockTime(42 + 10 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitZerocoinSpendTest)
+{
+    // Zerocoin spends pay no fee, trimming must not evict them before paying transactions
+    CTxMemPool pool(CFeeRate(1000));
+
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].scriptSig = CScript() << OP_ZEROCOINSPEND;
+    txSpend.vout.resize(1);
+    txSpend.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txSpend.vout[0].nValue = 10 * COIN;
+    BOOST_CHECK(CTransaction(txSpend).IsZerocoinSpend());
+
+    CMutableTransaction txPaying;
+    txPaying.vin.resize(1);
+    txPaying.vin[0].prevout = COutPoint(uint256(1), 0);
+    txPaying.vin[0].scriptSig = CScript() << OP_11;
+    txPaying.vout.resize(1);
+    txPaying.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txPaying.vout[0].nValue = 10 * COIN;
+
+    pool.addUnchecked(txSpend.GetHash(), CTxMemPoolEntry(txSpend, 0, 200, 0.0, 1));
+    pool.addUnchecked(txPaying.GetHash(), CTxMemPoolEntry(txPaying, 10000, 100, 0.0, 1));
+
+    // The paying transaction goes first, the zerocoin spend stays
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(pool.exists(txSpend.GetHash()));
+    BOOST_CHECK(!pool.exists(txPaying.GetHash()));
+
+    // A pool of zerocoin spends only can still be trimmed
+    pool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolRemoveInvalidTemplateTest)
+{
+    // Test what CreateNewBlock removes when TestBlockValidity rejects its template
+    LOCK(cs_main);
+    CTxMemPool pool(CFeeRate(0));
+
+    CMutableTransaction txCoinbase;
+    txCoinbase.vin.resize(1);
+    txCoinbase.vin[0].prevout.SetNull();
+    txCoinbase.vout.resize(1);
+
+    // Transactions without inputs pass the input and script checks against the tip
+    CMutableTransaction txValid[2];
+    for (int i = 0; i < 2; i++) {
+        txValid[i].vout.resize(1);
+        txValid[i].vout[0].scriptPubKey = CScript() << i << OP_EQUAL;
+        txValid[i].vout[0].nValue = 0;
+        pool.addUnchecked(txValid[i].GetHash(), CTxMemPoolEntry(txValid[i], 0, 100, 0.0, 1));
+    }
+    // One spending a coin the tip does not have fails them
+    CMutableTransaction txMissing;
+    txMissing.vin.resize(1);
+    txMissing.vin[0].prevout = COutPoint(uint256(1), 0);
+    txMissing.vin[0].scriptSig = CScript() << OP_11;
+    txMissing.vout.resize(1);
+    txMissing.vout[0].nValue = 0;
+    pool.addUnchecked(txMissing.GetHash(), CTxMemPoolEntry(txMissing, 0, 100, 0.0, 1));
+
+    int nHeight = chainActive.Height() + 1;
+
+    // Only the failing transaction is removed
+    CBlock block;
+    block.vtx.push_back(txCoinbase);
+    block.vtx.push_back(txValid[0]);
+    block.vtx.push_back(txMissing);
+    RemoveInvalidTemplateTransactions(block, nHeight, pool);
+    BOOST_CHECK(!pool.exists(txMissing.GetHash()));
+    BOOST_CHECK(pool.exists(txValid[0].GetHash()));
+    BOOST_CHECK(pool.exists(txValid[1].GetHash()));
+
+    // Without a failing transaction the template's transactions are removed, so the next template differs
+    block.vtx.resize(2);
+    RemoveInvalidTemplateTransactions(block, nHeight, pool);
+    BOOST_CHECK(!pool.exists(txValid[0].GetHash()));
+    BOOST_CHECK(pool.exists(txValid[1].GetHash()));
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
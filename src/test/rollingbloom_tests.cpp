@@ -0,0 +1,126 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bloom.h"
+#include "mruset.h"
+#include "protocol.h"
+#include "random.h"
+#include "tinyformat.h"
+#include "uint256.h"
+#include "utiltime.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+std::vector<unsigned char> RandomKey()
+{
+    std::vector<unsigned char> vKey(32);
+    for (unsigned int i = 0; i < vKey.size(); i++)
+        vKey[i] = insecure_rand() & 0xff;
+    return vKey;
+}
+
+CInv RandomInv()
+{
+    uint256 hash;
+    for (unsigned int i = 0; i < hash.size(); i++)
+        *(hash.begin() + i) = insecure_rand() & 0xff;
+    return CInv(MSG_TX, hash);
+}
+}
+
+BOOST_AUTO_TEST_SUITE(rollingbloom_tests)
+
+BOOST_AUTO_TEST_CASE(rolling_bloom_recent)
+{
+    seed_insecure_rand(true);
+
+    // the last nElements insertions are always found
+    CRollingBloomFilter rb(100, 0.01);
+    std::vector<std::vector<unsigned char> > vKeys;
+    for (int i = 0; i < 1000; i++) {
+        vKeys.push_back(RandomKey());
+        rb.insert(vKeys.back());
+        for (int j = std::max(0, i - 99); j <= i; j++)
+            BOOST_CHECK(rb.contains(vKeys[j]));
+    }
+
+    // and the oldest ones are forgotten, but for false positives
+    int nOldFound = 0;
+    for (int i = 0; i < 500; i++)
+        nOldFound += rb.contains(vKeys[i]);
+    BOOST_CHECK(nOldFound < 25);
+
+    rb.reset();
+    int nFound = 0;
+    for (int i = 0; i < 1000; i++)
+        nFound += rb.contains(vKeys[i]);
+    BOOST_CHECK(nFound < 50);
+}
+
+BOOST_AUTO_TEST_CASE(rolling_bloom_fp_rate)
+{
+    seed_insecure_rand(true);
+
+    // filled to its maximum of 1.5 * nElements, the false positive rate stays within bounds
+    CRollingBloomFilter rb(1000, 0.001);
+    for (int i = 0; i < 1500; i++)
+        rb.insert(RandomKey());
+    int nFalsePositives = 0;
+    for (int i = 0; i < 100000; i++)
+        nFalsePositives += rb.contains(RandomKey());
+    BOOST_CHECK(nFalsePositives <= 200);
+
+    // inventory keys of the same hash and a different type differ
+    CRollingBloomFilter rbInv(100, 0.000001);
+    CInv inv = RandomInv();
+    rbInv.insert(inv.GetKey());
+    BOOST_CHECK(rbInv.contains(inv.GetKey()));
+    BOOST_CHECK(!rbInv.contains(CInv(MSG_TXLOCK_REQUEST, inv.hash).GetKey()));
+}
+
+BOOST_AUTO_TEST_CASE(rolling_bloom_vs_mruset_benchmark)
+{
+    // The known-inventory check of a peer as done before (mruset<CInv> of SendBufferSize()/1000
+    // entries) and now: one insert and two lookups per relayed inv
+    seed_insecure_rand(true);
+    const int nInvs = 200000;
+    std::vector<CInv> vInvs;
+    for (int i = 0; i < nInvs; i++)
+        vInvs.push_back(RandomInv());
+
+    int64_t nStart = GetTimeMicros();
+    mruset<CInv> setKnown(1000);
+    for (int i = 0; i < nInvs; i++) {
+        if (!setKnown.count(vInvs[i]))
+            setKnown.insert(vInvs[i]);
+        setKnown.count(vInvs[i / 2]);
+    }
+    int64_t nTimeMruset = GetTimeMicros() - nStart;
+    // a set node holds the element and 4 words, the queue a second copy of it
+    size_t nMemMruset = setKnown.size() * (2 * sizeof(CInv) + 4 * sizeof(void*));
+
+    nStart = GetTimeMicros();
+    CRollingBloomFilter filterKnown(5000, 0.000001);
+    for (int i = 0; i < nInvs; i++) {
+        std::vector<unsigned char> vKey = vInvs[i].GetKey();
+        if (!filterKnown.contains(vKey))
+            filterKnown.insert(vKey);
+        filterKnown.contains(vInvs[i / 2].GetKey());
+    }
+    int64_t nTimeFilter = GetTimeMicros() - nStart;
+
+    BOOST_TEST_MESSAGE(strprintf("mruset<CInv>(1000):                  %d invs in %.3fs, ~%u bytes",
+        nInvs, nTimeMruset / 1e6, nMemMruset));
+    BOOST_TEST_MESSAGE(strprintf("CRollingBloomFilter(5000, 0.000001):  %d invs in %.3fs, %u bytes",
+        nInvs, nTimeFilter / 1e6, filterKnown.DynamicMemoryUsage()));
+
+    // five times the entries in less memory
+    BOOST_CHECK(filterKnown.DynamicMemoryUsage() < nMemMruset);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
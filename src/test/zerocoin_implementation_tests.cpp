@@ -5,9 +5,12 @@
 #include "libzerocoin/Denominations.h"
 #include "amount.h"
 #include "chainparams.h"
+#include "checkqueue.h"
 #include "main.h"
 #include "txdb.h"
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 #include <iostream>
 #include <accumulators.h>
 
@@ -263,6 +266,111 @@ BOOST_AUTO_TEST_CASE(checkzerocoinspend_test)
     BOOST_CHECK_MESSAGE(strError == "Transaction spend more than was redeemed in zerocoins", str);
 }
 
+BOOST_AUTO_TEST_CASE(parallel_zerocoinspend_check_test)
+{
+    cout << "Running parallel_zerocoinspend_check_test...\n";
+
+    CBigNum bnpubcoin;
+    BOOST_CHECK_MESSAGE(bnpubcoin.SetHexBool(rawTxpub1), "Failed to set CBigNum from hex string");
+    PublicCoin pubCoin(Params().Zerocoin_Params(), bnpubcoin, CoinDenomination::ZQ_ONE);
+
+    //accumulate every mint of the test set
+    Accumulator accumulator(Params().Zerocoin_Params(), CoinDenomination::ZQ_ONE);
+    AccumulatorWitness witness(Params().Zerocoin_Params(), accumulator, pubCoin);
+    CValidationState state;
+    for (pair<string, string> raw : vecRawMints) {
+        CTransaction tx;
+        BOOST_CHECK_MESSAGE(DecodeHexTx(tx, raw.first), "Failed to deserialize hex transaction");
+        for (const CTxOut out : tx.vout) {
+            if (!out.scriptPubKey.empty() && out.scriptPubKey.IsZerocoinMint()) {
+                PublicCoin publicCoin(Params().Zerocoin_Params());
+                BOOST_CHECK_MESSAGE(TxOutToPublicCoin(out, publicCoin, state), "Failed to convert CTxOut to PublicCoin");
+                accumulator += publicCoin;
+                witness += publicCoin;
+            }
+        }
+    }
+
+    PrivateCoin privateCoin(Params().Zerocoin_Params(), pubCoin.getDenomination());
+    privateCoin.setPublicCoin(pubCoin);
+    privateCoin.setRandomness(CBigNum(rawTxRand1));
+    privateCoin.setSerialNumber(CBigNum(rawTxSerial1));
+
+    //the spend checks look the accumulator up by its checksum
+    bool fZerocoinDB = zerocoinDB != NULL;
+    if (!fZerocoinDB)
+        zerocoinDB = new CZerocoinDB(0, true);
+    uint32_t nChecksum = GetChecksum(accumulator.getValue());
+    BOOST_CHECK(zerocoinDB->WriteAccumulatorValue(nChecksum, accumulator.getValue()));
+    //a checksum that resolves to an accumulator without the coin
+    Accumulator accumulatorEmpty(Params().Zerocoin_Params(), CoinDenomination::ZQ_ONE);
+    uint32_t nChecksumEmpty = GetChecksum(accumulatorEmpty.getValue());
+    BOOST_CHECK(zerocoinDB->WriteAccumulatorValue(nChecksumEmpty, accumulatorEmpty.getValue()));
+
+    CMutableTransaction txSpend;
+    CMutableTransaction txSpendBad;
+    for (uint32_t nSpendChecksum : {nChecksum, nChecksumEmpty}) {
+        CoinSpend coinSpend(Params().Zerocoin_Params(), privateCoin, accumulator, nSpendChecksum, witness, 0);
+
+        CDataStream serializedCoinSpend(SER_NETWORK, PROTOCOL_VERSION);
+        serializedCoinSpend << coinSpend;
+        std::vector<unsigned char> data(serializedCoinSpend.begin(), serializedCoinSpend.end());
+
+        CMutableTransaction& tx = nSpendChecksum == nChecksum ? txSpend : txSpendBad;
+        CTxIn txin;
+        txin.nSequence = 1;
+        txin.scriptSig = CScript() << OP_ZEROCOINSPEND << data.size();
+        txin.scriptSig.insert(txin.scriptSig.end(), data.begin(), data.end());
+        txin.prevout.SetNull();
+        tx.vin.push_back(txin);
+        tx.vout.push_back(CTxOut(1 * COIN, CScript()));
+    }
+
+    //a block worth of spends, checked inline as with -par=1 and as CBlockChecks on a check queue
+    //served by worker threads, the way ConnectBlock() queues them
+    const int nSpends = 24;
+    std::vector<CTransaction> vtx(nSpends, CTransaction(txSpend));
+
+    CCheckQueue<CBlockCheck> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 2; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CBlockCheck>::Thread, boost::ref(queue)));
+
+    //one spend checked against the wrong accumulator must fail the block either way
+    for (int nBad : {-1, nSpends / 2}) {
+        if (nBad >= 0)
+            vtx[nBad] = CTransaction(txSpendBad);
+
+        bool fInlineOk = true;
+        for (const CTransaction& tx : vtx) {
+            CValidationState stateTx;
+            fInlineOk = CheckZerocoinSpendProofs(tx, stateTx, true) && fInlineOk;
+        }
+
+        CCheckQueueControl<CBlockCheck> control(&queue);
+        for (const CTransaction& tx : vtx) {
+            CValidationState stateTx;
+            std::vector<CZerocoinSpendCheck> vChecks;
+            BOOST_CHECK(CheckZerocoinSpendProofs(tx, stateTx, true, &vChecks));
+            std::vector<CBlockCheck> vBlockChecks;
+            for (CZerocoinSpendCheck& check : vChecks)
+                vBlockChecks.emplace_back(check);
+            control.Add(vBlockChecks);
+        }
+        bool fQueueOk = control.Wait();
+
+        BOOST_CHECK_MESSAGE(fInlineOk == (nBad < 0), "inline zerocoin spend checks returned " << fInlineOk << " with bad spend " << nBad);
+        BOOST_CHECK_MESSAGE(fQueueOk == (nBad < 0), "queued zerocoin spend checks returned " << fQueueOk << " with bad spend " << nBad);
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+
+    if (!fZerocoinDB) {
+        delete zerocoinDB;
+        zerocoinDB = NULL;
+    }
+}
 
 BOOST_AUTO_TEST_CASE(setup_exceptions_test)
 {
@@ -8,10 +8,13 @@
 
 #include "txdb.h"
 
+#include "init.h"
 #include "main.h"
 #include "pow.h"
 #include "uint256.h"
 #include "accumulators.h"
+#include "ui_interface.h"
+#include "util.h"
 
 #include <stdint.h>
 
@@ -20,12 +23,29 @@
 using namespace std;
 using namespace libzerocoin;
 
-void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
+static const char DB_COINS = 'c';
+static const char DB_COIN = 'C';
+
+namespace
 {
-    if (coins.IsPruned())
-        batch.Erase(make_pair('c', hash));
-    else
-        batch.Write(make_pair('c', hash), coins);
+/** Key of a single unspent output in the coin database: 'C' + txid + VARINT(n) */
+struct CoinEntry {
+    uint256* hash;
+    uint32_t* n;
+    char key;
+
+    CoinEntry(const uint256* hashIn, const uint32_t* nIn) : hash(const_cast<uint256*>(hashIn)), n(const_cast<uint32_t*>(nIn)), key(DB_COIN) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(key);
+        READWRITE(*hash);
+        READWRITE(VARINT(*n));
+    }
+};
 }
 
 void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
@@ -37,14 +57,14 @@ CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(Get
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
+bool CCoinsViewDB::GetCoin(const COutPoint& outpoint, Coin& coin) const
 {
-    return db.Read(make_pair('c', txid), coins);
+    return db.Read(CoinEntry(&outpoint.hash, &outpoint.n), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256& txid) const
+bool CCoinsViewDB::HaveCoin(const COutPoint& outpoint) const
 {
-    return db.Exists(make_pair('c', txid));
+    return db.Exists(CoinEntry(&outpoint.hash, &outpoint.n));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
@@ -62,7 +82,11 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            CoinEntry entry(&it->first.hash, &it->first.n);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
+            else
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
@@ -72,10 +96,72 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
+bool CCoinsViewDB::Upgrade()
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::string(1, DB_COINS));
+    if (!pcursor->Valid() || pcursor->key()[0] != DB_COINS)
+        return true;
+
+    // Every batch moves whole transactions and erases their old records, so an
+    // interrupted upgrade continues where it stopped on the next start.
+    LogPrintf("Upgrading the coin database to one record per unspent output...\n");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    size_t nTransactions = 0;
+    size_t nOutputs = 0;
+    size_t nBatchSize = 0;
+    int nReportDone = 0;
+    CLevelDBBatch batch;
+    for (; pcursor->Valid() && pcursor->key()[0] == DB_COINS; pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            break;
+        uint256 txid;
+        CCoins coins;
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType >> txid;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> coins;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+
+        for (uint32_t n = 0; n < coins.vout.size(); n++) {
+            if (!coins.vout[n].IsNull()) {
+                batch.Write(CoinEntry(&txid, &n), Coin(coins.vout[n], coins.nHeight, coins.fCoinBase, coins.fCoinStake, coins.nVersion));
+                nOutputs++;
+            }
+        }
+        batch.Erase(make_pair(DB_COINS, txid));
+        nTransactions++;
+        if (++nBatchSize >= 10000) {
+            if (!db.WriteBatch(batch))
+                return error("%s : failed to write upgraded coins", __func__);
+            batch = CLevelDBBatch();
+            nBatchSize = 0;
+            // txids are uniformly distributed, their first serialized byte tells how far we got
+            int nDone = (unsigned char)pcursor->key()[1] * 100 / 256;
+            if (nDone > nReportDone) {
+                nReportDone = nDone;
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), nReportDone);
+                LogPrintf("[%d%%]...", nReportDone);
+            }
+        }
+    }
+    bool fOk = db.WriteBatch(batch);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("\n%s %u transactions, %u unspent outputs\n", ShutdownRequested() ? "Interrupted upgrade after" : "Upgraded", nTransactions, nOutputs);
+    return fOk;
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
 {
 }
@@ -131,6 +217,8 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
+    uint256 txhashPrev;
+    bool fFirst = true;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -138,35 +226,41 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
             CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == 'c') {
+            if (chType == DB_COIN) {
+                uint256 txhash;
+                uint32_t n = 0;
+                ssKey >> txhash >> VARINT(n);
                 leveldb::Slice slValue = pcursor->value();
                 CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i = 0; i < coins.vout.size(); i++) {
-                    const CTxOut& out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i + 1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+                Coin coin;
+                ssValue >> coin;
+                // outputs of a transaction are consecutive and ordered by index
+                if (!fFirst && txhash != txhashPrev) {
+                    ss << VARINT(0);
+                }
+                if (fFirst || txhash != txhashPrev) {
+                    ss << txhash;
+                    ss << VARINT(coin.nVersion);
+                    ss << (coin.fCoinBase ? 'c' : 'n');
+                    ss << VARINT(coin.nHeight);
+                    stats.nTransactions++;
+                    stats.nSerializedSize += 32;
+                    txhashPrev = txhash;
+                    fFirst = false;
                 }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+                stats.nTransactionOutputs++;
+                ss << VARINT(n + 1);
+                ss << coin.out;
+                nTotalAmount += coin.out.nValue;
+                stats.nSerializedSize += slValue.size();
             }
             pcursor->Next();
         } catch (std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
+    if (!fFirst)
+        ss << VARINT(0);
     stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
     stats.hashSerialized = ss.GetHash();
     stats.nTotalAmount = nTotalAmount;
@@ -367,3 +461,18 @@ bool CZerocoinDB::EraseAccumulatorValue(const uint32_t& nChecksum)
     LogPrint("zero", "%s : checksum:%d\n", __func__, nChecksum);
     return Erase(make_pair('a', nChecksum));
 }
+
+bool CZerocoinDB::WriteMintJournal(int nHeight, const CMintJournalEntry& entry)
+{
+    return Write(make_pair('j', nHeight), entry);
+}
+
+bool CZerocoinDB::ReadMintJournal(int nHeight, CMintJournalEntry& entry)
+{
+    return Read(make_pair('j', nHeight), entry);
+}
+
+bool CZerocoinDB::EraseMintJournal(int nHeight)
+{
+    return Erase(make_pair('j', nHeight));
+}
@@ -18,7 +18,6 @@
 #include <utility>
 #include <vector>
 
-class CCoins;
 class uint256;
 
 //! -dbcache default (MiB)
@@ -37,11 +36,13 @@ protected:
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+    //! Convert the per-transaction records of older versions to per-output ones
+    bool Upgrade();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -90,6 +91,9 @@ public:
     bool WriteAccumulatorValue(const uint32_t& nChecksum, const CBigNum& bnValue);
     bool ReadAccumulatorValue(const uint32_t& nChecksum, CBigNum& bnValue);
     bool EraseAccumulatorValue(const uint32_t& nChecksum);
+    bool WriteMintJournal(int nHeight, const CMintJournalEntry& entry);
+    bool ReadMintJournal(int nHeight, CMintJournalEntry& entry);
+    bool EraseMintJournal(int nHeight);
 };
 
 #endif // BITCOIN_TXDB_H
@@ -9,26 +9,48 @@
 #include "txmempool.h"
 
 #include "clientversion.h"
+#include "core_memusage.h"
 #include "main.h"
 #include "streams.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "version.h"
 
+#include <limits>
+#include <math.h>
+
 #include <boost/circular_buffer.hpp>
 
 using namespace std;
 
-CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nTime(0), dPriority(0.0)
+CTxMemPoolEntry::CTxMemPoolEntry() : tx(MakeTransactionRef(CTransaction())), nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), nFeeDelta(0), fZerocoinSpend(false)
 {
     nHeight = MEMPOOL_HEIGHT;
+
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = 0;
+    nModFeesWithDescendants = 0;
+
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = 0;
+    nModFeesWithAncestors = 0;
 }
 
-CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(MakeTransactionRef(_tx)), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight), nFeeDelta(0)
 {
-    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    nTxSize = ::GetSerializeSize(*tx, SER_NETWORK, PROTOCOL_VERSION);
+    fZerocoinSpend = tx->IsZerocoinSpend();
+
+    nModSize = tx->CalculateModifiedSize(nTxSize);
+    nUsageSize = RecursiveDynamicUsage(tx);
+
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = nTxSize;
+    nModFeesWithDescendants = nFee;
 
-    nModSize = tx.CalculateModifiedSize(nTxSize);
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -39,12 +61,37 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
 double
 CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 {
-    CAmount nValueIn = tx.GetValueOut() + nFee;
+    CAmount nValueIn = tx->GetValueOut() + nFee;
     double deltaPriority = ((double)(currentHeight - nHeight) * nValueIn) / nModSize;
     double dResult = dPriority + deltaPriority;
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithDescendants += modifySize;
+    assert(int64_t(nSizeWithDescendants) > 0);
+    nModFeesWithDescendants += modifyFee;
+    nCountWithDescendants += modifyCount;
+    assert(int64_t(nCountWithDescendants) > 0);
+}
+
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithAncestors += modifySize;
+    assert(int64_t(nSizeWithAncestors) > 0);
+    nModFeesWithAncestors += modifyFee;
+    nCountWithAncestors += modifyCount;
+    assert(int64_t(nCountWithAncestors) > 0);
+}
+
+void CTxMemPoolEntry::UpdateFeeDelta(CAmount nNewFeeDelta)
+{
+    nModFeesWithDescendants += nNewFeeDelta - nFeeDelta;
+    nModFeesWithAncestors += nNewFeeDelta - nFeeDelta;
+    nFeeDelta = nNewFeeDelta;
+}
+
 /**
  * Keep track of fee/priority for transactions confirmed within N blocks
  */
@@ -358,7 +405,13 @@ public:
 
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) : nTransactionsUpdated(0),
-                                                       minRelayFee(_minRelayFee)
+                                                       minRelayFee(_minRelayFee),
+                                                       totalTxSize(0),
+                                                       cachedInnerUsage(0),
+                                                       lastRollingFeeUpdate(GetTime()),
+                                                       blockSinceLastRollingFeeBump(false),
+                                                       rollingMinimumFeeRate(0),
+                                                       fLoaded(false)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -378,17 +431,10 @@ CTxMemPool::~CTxMemPool()
     delete minerPolicyEstimator;
 }
 
-void CTxMemPool::pruneSpent(const uint256& hashTx, CCoins& coins)
+bool CTxMemPool::isSpent(const COutPoint& outpoint)
 {
     LOCK(cs);
-
-    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
-
-    // iterate over all COutPoints in mapNextTx whose hash equals the provided hashTx
-    while (it != mapNextTx.end() && it->first.hash == hashTx) {
-        coins.Spend(it->first.n); // and remove those outputs from coins
-        it++;
-    }
+    return mapNextTx.count(outpoint);
 }
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const
@@ -404,34 +450,296 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 }
 
 
+const CTxMemPool::setEntries& CTxMemPool::GetMemPoolParents(txiter entry) const
+{
+    assert(entry != mapTx.end());
+    txlinksMap::const_iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    return it->second.parents;
+}
+
+const CTxMemPool::setEntries& CTxMemPool::GetMemPoolChildren(txiter entry) const
+{
+    assert(entry != mapTx.end());
+    txlinksMap::const_iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    return it->second.children;
+}
+
+void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
+{
+    setEntries& parents = mapLinks[entry].parents;
+    if (add && parents.insert(parent).second)
+        cachedInnerUsage += memusage::IncrementalDynamicUsage(parents);
+    else if (!add && parents.erase(parent))
+        cachedInnerUsage -= memusage::IncrementalDynamicUsage(parents);
+}
+
+void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+{
+    setEntries& children = mapLinks[entry].children;
+    if (add && children.insert(child).second)
+        cachedInnerUsage += memusage::IncrementalDynamicUsage(children);
+    else if (!add && children.erase(child))
+        cachedInnerUsage -= memusage::IncrementalDynamicUsage(children);
+}
+
+bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents) const
+{
+    setEntries parentHashes;
+    const CTransaction& tx = entry.GetTx();
+
+    if (fSearchForParents) {
+        // The links only exist for entries in the pool, find the parents through the inputs
+        if (!tx.IsZerocoinSpend()) {
+            for (unsigned int i = 0; i < tx.vin.size(); i++) {
+                txiter piter = mapTx.find(tx.vin[i].prevout.hash);
+                if (piter != mapTx.end()) {
+                    parentHashes.insert(piter);
+                    if (parentHashes.size() + 1 > limitAncestorCount) {
+                        errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
+                        return false;
+                    }
+                }
+            }
+        }
+    } else {
+        txiter it = mapTx.iterator_to(entry);
+        parentHashes = GetMemPoolParents(it);
+    }
+
+    size_t totalSizeWithAncestors = entry.GetTxSize();
+
+    while (!parentHashes.empty()) {
+        txiter stageit = *parentHashes.begin();
+
+        setAncestors.insert(stageit);
+        parentHashes.erase(stageit);
+        totalSizeWithAncestors += stageit->GetTxSize();
+
+        if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", stageit->GetTx().GetHash().ToString(), limitDescendantSize);
+            return false;
+        } else if (stageit->GetCountWithDescendants() + 1 > limitDescendantCount) {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", stageit->GetTx().GetHash().ToString(), limitDescendantCount);
+            return false;
+        } else if (totalSizeWithAncestors > limitAncestorSize) {
+            errString = strprintf("exceeds ancestor size limit [limit: %u]", limitAncestorSize);
+            return false;
+        }
+
+        BOOST_FOREACH (const txiter& phash, GetMemPoolParents(stageit)) {
+            if (setAncestors.count(phash) == 0)
+                parentHashes.insert(phash);
+            if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
+                errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void CTxMemPool::CalculateDescendants(txiter entryit, setEntries& setDescendants) const
+{
+    setEntries stage;
+    if (setDescendants.count(entryit) == 0)
+        stage.insert(entryit);
+
+    while (!stage.empty()) {
+        txiter it = *stage.begin();
+        setDescendants.insert(it);
+        stage.erase(it);
+
+        BOOST_FOREACH (const txiter& childiter, GetMemPoolChildren(it)) {
+            if (!setDescendants.count(childiter))
+                stage.insert(childiter);
+        }
+    }
+}
+
+void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, const setEntries& setAncestors)
+{
+    // a copy, the links of the entry may go away with it
+    setEntries parentIters = GetMemPoolParents(it);
+    BOOST_FOREACH (txiter piter, parentIters)
+        UpdateChild(piter, it, add);
+
+    const int64_t updateCount = (add ? 1 : -1);
+    const int64_t updateSize = updateCount * it->GetTxSize();
+    const CAmount updateFee = updateCount * it->GetModifiedFee();
+    BOOST_FOREACH (txiter ancestorIt, setAncestors)
+        mapTx.modify(ancestorIt, update_descendant_state(updateSize, updateFee, updateCount));
+}
+
+void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries& setAncestors)
+{
+    int64_t updateCount = setAncestors.size();
+    int64_t updateSize = 0;
+    CAmount updateFee = 0;
+    BOOST_FOREACH (txiter ancestorIt, setAncestors) {
+        updateSize += ancestorIt->GetTxSize();
+        updateFee += ancestorIt->GetModifiedFee();
+    }
+    mapTx.modify(it, update_ancestor_state(updateSize, updateFee, updateCount));
+}
+
+void CTxMemPool::RecalculatePackageState(txiter it)
+{
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+
+    setEntries setAncestors;
+    CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+    int64_t nSize = it->GetTxSize();
+    CAmount nModFees = it->GetModifiedFee();
+    BOOST_FOREACH (txiter ancestorIt, setAncestors) {
+        nSize += ancestorIt->GetTxSize();
+        nModFees += ancestorIt->GetModifiedFee();
+    }
+    mapTx.modify(it, update_ancestor_state(nSize - it->GetSizeWithAncestors(), nModFees - it->GetModFeesWithAncestors(),
+                         (int64_t)setAncestors.size() + 1 - it->GetCountWithAncestors()));
+
+    setEntries setDescendants;
+    CalculateDescendants(it, setDescendants);
+    nSize = 0;
+    nModFees = 0;
+    BOOST_FOREACH (txiter descendantIt, setDescendants) {
+        nSize += descendantIt->GetTxSize();
+        nModFees += descendantIt->GetModifiedFee();
+    }
+    mapTx.modify(it, update_descendant_state(nSize - it->GetSizeWithDescendants(), nModFees - it->GetModFeesWithDescendants(),
+                         (int64_t)setDescendants.size() - it->GetCountWithDescendants()));
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
+{
+    LOCK(cs);
+    setEntries setAncestors;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+    return addUnchecked(hash, entry, setAncestors);
+}
+
+bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry, setEntries& setAncestors)
 {
     // Add to memory pool without checking anything.
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     LOCK(cs);
-    {
-        mapTx[hash] = entry;
-        const CTransaction& tx = mapTx[hash].GetTx();
-        if(!tx.IsZerocoinSpend()) {
-            for (unsigned int i = 0; i < tx.vin.size(); i++)
-                mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
+    txiter newit = mapTx.insert(entry).first;
+    mapLinks.insert(make_pair(newit, TxLinks()));
+
+    // Apply a prioritisation made before the transaction arrived
+    std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
+    if (pos != mapDeltas.end() && pos->second.second)
+        mapTx.modify(newit, update_fee_delta(pos->second.second));
+
+    const CTransaction& tx = newit->GetTx();
+    if (!tx.IsZerocoinSpend()) {
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
+            txiter piter = mapTx.find(tx.vin[i].prevout.hash);
+            if (piter != mapTx.end())
+                UpdateParent(newit, piter, true);
         }
-        nTransactionsUpdated++;
-        totalTxSize += entry.GetTxSize();
     }
+    UpdateAncestorsOf(true, newit, setAncestors);
+    UpdateEntryForAncestors(newit, setAncestors);
+
+    // Transactions spending this one are in the pool already when it comes back from a
+    // disconnected block. The entries related to it then gained ancestors or descendants
+    // in an order the incremental updates above do not cover, so recompute them.
+    setEntries setChildren;
+    std::map<COutPoint, CInPoint>::iterator itNext = mapNextTx.lower_bound(COutPoint(hash, 0));
+    while (itNext != mapNextTx.end() && itNext->first.hash == hash) {
+        txiter childit = mapTx.find(itNext->second.ptx->GetHash());
+        assert(childit != mapTx.end());
+        setChildren.insert(childit);
+        itNext++;
+    }
+    if (!setChildren.empty()) {
+        BOOST_FOREACH (txiter childit, setChildren) {
+            UpdateChild(newit, childit, true);
+            UpdateParent(childit, newit, true);
+        }
+        setEntries setAffected = setAncestors;
+        CalculateDescendants(newit, setAffected);
+        BOOST_FOREACH (txiter it, setAffected)
+            RecalculatePackageState(it);
+    }
+
+    nTransactionsUpdated++;
+    totalTxSize += entry.GetTxSize();
+    cachedInnerUsage += entry.DynamicMemoryUsage();
     return true;
 }
 
+void CTxMemPool::UpdateForRemoveFromMempool(const setEntries& entriesToRemove)
+{
+    // The package state is computed with the links still in place
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    BOOST_FOREACH (txiter removeIt, entriesToRemove) {
+        const int64_t nSize = removeIt->GetTxSize();
+        const CAmount nModFee = removeIt->GetModifiedFee();
+
+        setEntries setAncestors;
+        std::string dummy;
+        CalculateMemPoolAncestors(*removeIt, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        BOOST_FOREACH (txiter ancestorIt, setAncestors)
+            mapTx.modify(ancestorIt, update_descendant_state(-nSize, -nModFee, -1));
+
+        setEntries setDescendants;
+        CalculateDescendants(removeIt, setDescendants);
+        setDescendants.erase(removeIt);
+        BOOST_FOREACH (txiter descendantIt, setDescendants)
+            mapTx.modify(descendantIt, update_ancestor_state(-nSize, -nModFee, -1));
+    }
+
+    BOOST_FOREACH (txiter removeIt, entriesToRemove) {
+        setEntries setChildren = GetMemPoolChildren(removeIt);
+        BOOST_FOREACH (txiter childIt, setChildren)
+            UpdateParent(childIt, removeIt, false);
+        setEntries setParents = GetMemPoolParents(removeIt);
+        BOOST_FOREACH (txiter parentIt, setParents)
+            UpdateChild(parentIt, removeIt, false);
+    }
+}
+
+void CTxMemPool::removeUnchecked(txiter it)
+{
+    BOOST_FOREACH (const CTxIn& txin, it->GetTx().vin)
+        mapNextTx.erase(txin.prevout);
+
+    totalTxSize -= it->GetTxSize();
+    cachedInnerUsage -= it->DynamicMemoryUsage();
+    txlinksMap::iterator linksit = mapLinks.find(it);
+    cachedInnerUsage -= memusage::DynamicUsage(linksit->second.parents) + memusage::DynamicUsage(linksit->second.children);
+    mapLinks.erase(linksit);
+    mapTx.erase(it);
+    nTransactionsUpdated++;
+}
+
+void CTxMemPool::RemoveStaged(const setEntries& stage)
+{
+    AssertLockHeld(cs);
+    UpdateForRemoveFromMempool(stage);
+    BOOST_FOREACH (txiter it, stage)
+        removeUnchecked(it);
+}
 
 void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& removed, bool fRecursive)
 {
     // Remove transaction from memory pool
     {
         LOCK(cs);
-        std::deque<uint256> txToRemove;
-        txToRemove.push_back(origTx.GetHash());
-        if (fRecursive && !mapTx.count(origTx.GetHash())) {
+        setEntries txToRemove;
+        txiter origit = mapTx.find(origTx.GetHash());
+        if (origit != mapTx.end()) {
+            txToRemove.insert(origit);
+        } else if (fRecursive) {
             // If recursively removing but origTx isn't in the mempool
             // be sure to remove any children that are in the pool. This can
             // happen during chain re-orgs if origTx isn't re-accepted into
@@ -440,31 +748,21 @@ void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& rem
                 std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
                 if (it == mapNextTx.end())
                     continue;
-                txToRemove.push_back(it->second.ptx->GetHash());
+                txiter nextit = mapTx.find(it->second.ptx->GetHash());
+                assert(nextit != mapTx.end());
+                txToRemove.insert(nextit);
             }
         }
-        while (!txToRemove.empty()) {
-            uint256 hash = txToRemove.front();
-            txToRemove.pop_front();
-            if (!mapTx.count(hash))
-                continue;
-            const CTransaction& tx = mapTx[hash].GetTx();
-            if (fRecursive) {
-                for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
-                    if (it == mapNextTx.end())
-                        continue;
-                    txToRemove.push_back(it->second.ptx->GetHash());
-                }
-            }
-            BOOST_FOREACH (const CTxIn& txin, tx.vin)
-                mapNextTx.erase(txin.prevout);
-
-            removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
-            mapTx.erase(hash);
-            nTransactionsUpdated++;
+        setEntries setAllRemoves;
+        if (fRecursive) {
+            BOOST_FOREACH (txiter it, txToRemove)
+                CalculateDescendants(it, setAllRemoves);
+        } else {
+            setAllRemoves.swap(txToRemove);
         }
+        BOOST_FOREACH (txiter it, setAllRemoves)
+            removed.push_back(it->GetTx());
+        RemoveStaged(setAllRemoves);
     }
 }
 
@@ -473,15 +771,15 @@ void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned in
     // Remove transactions spending a coinbase which are now immature
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->second.GetTx();
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        const CTransaction& tx = it->GetTx();
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
+            indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
             if (it2 != mapTx.end())
                 continue;
-            const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
-            if (fSanityCheck) assert(coins);
-            if (!coins || ((coins->IsCoinBase() || coins->IsCoinStake()) && nMemPoolHeight - coins->nHeight < (unsigned)Params().COINBASE_MATURITY())) {
+            const Coin& coin = pcoins->AccessCoin(txin.prevout);
+            if (fSanityCheck) assert(!coin.IsSpent());
+            if (coin.IsSpent() || ((coin.IsCoinBase() || coin.IsCoinStake()) && nMemPoolHeight - coin.nHeight < (unsigned)Params().COINBASE_MATURITY())) {
                 transactionsToRemove.push_back(tx);
                 break;
             }
@@ -517,9 +815,9 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
     LOCK(cs);
     std::vector<CTxMemPoolEntry> entries;
     BOOST_FOREACH (const CTransaction& tx, vtx) {
-        uint256 hash = tx.GetHash();
-        if (mapTx.count(hash))
-            entries.push_back(mapTx[hash]);
+        indexed_transaction_set::const_iterator i = mapTx.find(tx.GetHash());
+        if (i != mapTx.end())
+            entries.push_back(*i);
     }
     minerPolicyEstimator->seenBlock(entries, nBlockHeight, minRelayFee);
     BOOST_FOREACH (const CTransaction& tx, vtx) {
@@ -528,15 +826,22 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
         removeConflicts(tx, conflicts);
         ClearPrioritisation(tx.GetHash());
     }
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = true;
 }
 
 
 void CTxMemPool::clear()
 {
     LOCK(cs);
+    mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
     totalTxSize = 0;
+    cachedInnerUsage = 0;
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = false;
+    rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
 }
 
@@ -548,26 +853,32 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
     LogPrint("mempool", "Checking mempool with %u transactions and %u inputs\n", (unsigned int)mapTx.size(), (unsigned int)mapNextTx.size());
 
     uint64_t checkTotal = 0;
+    uint64_t innerUsage = 0;
 
     CCoinsViewCache mempoolDuplicate(const_cast<CCoinsViewCache*>(pcoins));
 
     LOCK(cs);
     list<const CTxMemPoolEntry*> waitingOnDependants;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         unsigned int i = 0;
-        checkTotal += it->second.GetTxSize();
-        const CTransaction& tx = it->second.GetTx();
+        checkTotal += it->GetTxSize();
+        const CTransaction& tx = it->GetTx();
+        txlinksMap::const_iterator linksiter = mapLinks.find(it);
+        assert(linksiter != mapLinks.end());
+        const TxLinks& links = linksiter->second;
+        innerUsage += it->DynamicMemoryUsage() + memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
         bool fDependsWait = false;
+        setEntries setParentCheck;
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
+            indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
             if (it2 != mapTx.end()) {
-                const CTransaction& tx2 = it2->second.GetTx();
+                const CTransaction& tx2 = it2->GetTx();
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
                 fDependsWait = true;
+                setParentCheck.insert(it2);
             } else {
-                const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
-                assert(coins && coins->IsAvailable(txin.prevout.n));
+                assert(pcoins->AccessCoin(txin.prevout).IsAvailable());
             }
             // Check whether its inputs are marked in mapNextTx.
             std::map<COutPoint, CInPoint>::const_iterator it3 = mapNextTx.find(txin.prevout);
@@ -576,8 +887,46 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
             assert(it3->second.n == i);
             i++;
         }
+        assert(setParentCheck == links.parents);
+
+        // Check the ancestor state against the ancestors found through the inputs
+        setEntries setAncestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+        uint64_t nSizeCheck = it->GetTxSize();
+        CAmount nFeesCheck = it->GetModifiedFee();
+        BOOST_FOREACH (txiter ancestorIt, setAncestors) {
+            nSizeCheck += ancestorIt->GetTxSize();
+            nFeesCheck += ancestorIt->GetModifiedFee();
+        }
+        assert(it->GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(it->GetSizeWithAncestors() == nSizeCheck);
+        assert(it->GetModFeesWithAncestors() == nFeesCheck);
+
+        // Check the children against mapNextTx, and the descendant state against the children
+        setEntries setChildrenCheck;
+        std::map<COutPoint, CInPoint>::const_iterator iter = mapNextTx.lower_bound(COutPoint(it->GetTx().GetHash(), 0));
+        for (; iter != mapNextTx.end() && iter->first.hash == it->GetTx().GetHash(); ++iter) {
+            txiter childit = mapTx.find(iter->second.ptx->GetHash());
+            assert(childit != mapTx.end());
+            setChildrenCheck.insert(childit);
+        }
+        assert(setChildrenCheck == links.children);
+        setEntries setDescendants;
+        CalculateDescendants(it, setDescendants);
+        nSizeCheck = 0;
+        nFeesCheck = 0;
+        BOOST_FOREACH (txiter descendantIt, setDescendants) {
+            nSizeCheck += descendantIt->GetTxSize();
+            nFeesCheck += descendantIt->GetModifiedFee();
+        }
+        assert(it->GetCountWithDescendants() == setDescendants.size());
+        assert(it->GetSizeWithDescendants() == nSizeCheck);
+        assert(it->GetModFeesWithDescendants() == nFeesCheck);
+
         if (fDependsWait)
-            waitingOnDependants.push_back(&it->second);
+            waitingOnDependants.push_back(&(*it));
         else {
             CValidationState state;
             CTxUndo undo;
@@ -603,15 +952,17 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
     }
     for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
         uint256 hash = it->second.ptx->GetHash();
-        map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(hash);
-        const CTransaction& tx = it2->second.GetTx();
+        indexed_transaction_set::const_iterator it2 = mapTx.find(hash);
         assert(it2 != mapTx.end());
+        const CTransaction& tx = it2->GetTx();
         assert(&tx == it->second.ptx);
         assert(tx.vin.size() > it->second.n);
         assert(it->first == it->second.ptx->vin[it->second.n].prevout);
     }
 
     assert(totalTxSize == checkTotal);
+    assert(innerUsage == cachedInnerUsage);
+    assert(mapLinks.size() == mapTx.size());
 }
 
 void CTxMemPool::queryHashes(vector<uint256>& vtxid)
@@ -620,19 +971,28 @@ void CTxMemPool::queryHashes(vector<uint256>& vtxid)
 
     LOCK(cs);
     vtxid.reserve(mapTx.size());
-    for (map<uint256, CTxMemPoolEntry>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
-        vtxid.push_back((*mi).first);
+    for (indexed_transaction_set::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+        vtxid.push_back(mi->GetTx().GetHash());
 }
 
 bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
 {
     LOCK(cs);
-    map<uint256, CTxMemPoolEntry>::const_iterator i = mapTx.find(hash);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
     if (i == mapTx.end()) return false;
-    result = i->second.GetTx();
+    result = i->GetTx();
     return true;
 }
 
+CTransactionRef CTxMemPool::get(const uint256& hash) const
+{
+    LOCK(cs);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
+    if (i == mapTx.end())
+        return CTransactionRef();
+    return i->GetSharedTx();
+}
+
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
 {
     LOCK(cs);
@@ -682,6 +1042,22 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount>& deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end() && nFeeDelta) {
+            mapTx.modify(it, update_fee_delta(deltas.second));
+            // The packages the transaction belongs to pay the difference as well
+            uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+            std::string dummy;
+            setEntries setAncestors;
+            CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+            BOOST_FOREACH (txiter ancestorIt, setAncestors)
+                mapTx.modify(ancestorIt, update_descendant_state(0, nFeeDelta, 0));
+            setEntries setDescendants;
+            CalculateDescendants(it, setDescendants);
+            setDescendants.erase(it);
+            BOOST_FOREACH (txiter descendantIt, setDescendants)
+                mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0));
+        }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -704,22 +1080,124 @@ void CTxMemPool::ClearPrioritisation(const uint256 hash)
 }
 
 
+size_t CTxMemPool::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    // Every entry is a node of the four ordered indices of mapTx
+    return memusage::MultiIndexNodeUsage<CTxMemPoolEntry>(4) * mapTx.size() + memusage::DynamicUsage(mapNextTx) +
+           memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + cachedInnerUsage;
+}
+
+bool CTxMemPool::IsLoaded() const
+{
+    LOCK(cs);
+    return fLoaded;
+}
+
+void CTxMemPool::SetIsLoaded(bool loaded)
+{
+    LOCK(cs);
+    fLoaded = loaded;
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const
+{
+    LOCK(cs);
+    // The fee stays until a block was found after the last time it was raised
+    if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
+        return CFeeRate(rollingMinimumFeeRate);
+
+    int64_t time = GetTime();
+    if (time > lastRollingFeeUpdate + 10) {
+        // Decay faster the emptier the pool is
+        double halflife = ROLLING_FEE_HALFLIFE;
+        if (DynamicMemoryUsage() < sizelimit / 4)
+            halflife /= 4;
+        else if (DynamicMemoryUsage() < sizelimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (time - lastRollingFeeUpdate) / halflife);
+        lastRollingFeeUpdate = time;
+
+        if (rollingMinimumFeeRate < minRelayFee.GetFeePerK() / 2) {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate(rollingMinimumFeeRate), minRelayFee);
+}
+
+void CTxMemPool::trackPackageRemoved(const CFeeRate& rate)
+{
+    AssertLockHeld(cs);
+    if (rate.GetFeePerK() > rollingMinimumFeeRate) {
+        rollingMinimumFeeRate = rate.GetFeePerK();
+        blockSinceLastRollingFeeBump = false;
+    }
+}
+
+void CTxMemPool::TrimToSize(size_t sizelimit)
+{
+    LOCK(cs);
+
+    unsigned int nTxnRemoved = 0;
+    CFeeRate maxFeeRateRemoved(0);
+    while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
+        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+
+        // A transaction must pay more than the package evicted, by at least the relay fee,
+        // to get in until the next block. Otherwise it could take the place of what was just
+        // removed for the same fee.
+        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
+        removed = CFeeRate(removed.GetFeePerK() + minRelayFee.GetFeePerK());
+        trackPackageRemoved(removed);
+        maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+
+        setEntries stage;
+        CalculateDescendants(mapTx.project<0>(it), stage);
+        nTxnRemoved += stage.size();
+        RemoveStaged(stage);
+    }
+
+    if (maxFeeRateRemoved > CFeeRate(0))
+        LogPrint("mempool", "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
+}
+
+int CTxMemPool::Expire(int64_t time)
+{
+    LOCK(cs);
+    indexed_transaction_set::index<entry_time>::type::iterator it = mapTx.get<entry_time>().begin();
+    setEntries toremove;
+    while (it != mapTx.get<entry_time>().end() && it->GetTime() < time) {
+        toremove.insert(mapTx.project<0>(it));
+        it++;
+    }
+    setEntries stage;
+    BOOST_FOREACH (txiter removeit, toremove)
+        CalculateDescendants(removeit, stage);
+    RemoveStaged(stage);
+    return stage.size();
+}
+
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView* baseIn, CTxMemPool& mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) {}
 
-bool CCoinsViewMemPool::GetCoins(const uint256& txid, CCoins& coins) const
+bool CCoinsViewMemPool::GetCoin(const COutPoint& outpoint, Coin& coin) const
 {
     // If an entry in the mempool exists, always return that one, as it's guaranteed to never
-    // conflict with the underlying cache, and it cannot have pruned entries (as it contains full)
-    // transactions. First checking the underlying cache risks returning a pruned entry instead.
-    CTransaction tx;
-    if (mempool.lookup(txid, tx)) {
-        coins = CCoins(tx, MEMPOOL_HEIGHT);
+    // conflict with the underlying cache, and it cannot have spent entries (as it contains full)
+    // transactions. First checking the underlying cache risks returning a spent entry instead.
+    CTransactionRef ptx = mempool.get(outpoint.hash);
+    if (ptx) {
+        if (outpoint.n >= ptx->vout.size() || ptx->vout[outpoint.n].scriptPubKey.IsUnspendable())
+            return false;
+        coin = Coin(*ptx, outpoint.n, MEMPOOL_HEIGHT);
         return true;
     }
-    return (base->GetCoins(txid, coins) && !coins.IsPruned());
+    return (base->GetCoin(outpoint, coin) && !coin.IsSpent());
 }
 
-bool CCoinsViewMemPool::HaveCoins(const uint256& txid) const
+bool CCoinsViewMemPool::HaveCoin(const COutPoint& outpoint) const
 {
-    return mempool.exists(txid) || base->HaveCoins(txid);
+    Coin coin;
+    return GetCoin(outpoint, coin);
 }
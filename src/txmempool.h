@@ -10,12 +10,17 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index_container.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -31,34 +36,200 @@ inline bool AllowFree(double dPriority)
 }
 
 
-/** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
+/** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
 /**
  * CTxMemPool stores these:
+ *
+ * Besides the transaction itself, every entry keeps the size, modified fee
+ * (fee plus prioritisation delta) and count of the transaction together with
+ * all of its in-mempool ancestors, and likewise with all of its descendants.
+ * CTxMemPool keeps these up to date as transactions come and go, so that a
+ * block can be assembled from the best packages without walking the pool.
  */
 class CTxMemPoolEntry
 {
 private:
-    CTransaction tx;
+    CTransactionRef tx;
     CAmount nFee;         //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize;       //! ... and avoid recomputing tx size
     size_t nModSize;      //! ... and modified size for priority
+    size_t nUsageSize;    //! ... and total memory usage
     int64_t nTime;        //! Local time when entering the mempool
     double dPriority;     //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    CAmount nFeeDelta;    //! Prioritisation of the transaction, see CTxMemPool::PrioritiseTransaction
+    bool fZerocoinSpend;  //! Cached, the descendant score compares it for every entry
+
+    // The transaction and all of its in-mempool descendants
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+
+    // The transaction and all of its in-mempool ancestors
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
     CTxMemPoolEntry();
     CTxMemPoolEntry(const CTxMemPoolEntry& other);
 
-    const CTransaction& GetTx() const { return this->tx; }
+    const CTransaction& GetTx() const { return *this->tx; }
+    CTransactionRef GetSharedTx() const { return this->tx; }
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
+    bool IsZerocoinSpend() const { return fZerocoinSpend; }
+
+    // Adjust the package state when a descendant or ancestor comes or goes
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    // Set the prioritisation and adjust the package fees for it
+    void UpdateFeeDelta(CAmount nNewFeeDelta);
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+};
+
+// Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index
+struct update_descendant_state {
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) : modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount) {}
+
+    void operator()(CTxMemPoolEntry& e) { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_ancestor_state {
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) : modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount) {}
+
+    void operator()(CTxMemPoolEntry& e) { e.UpdateAncestorState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_fee_delta {
+    update_fee_delta(CAmount _nFeeDelta) : nFeeDelta(_nFeeDelta) {}
+
+    void operator()(CTxMemPoolEntry& e) { e.UpdateFeeDelta(nFeeDelta); }
+
+private:
+    CAmount nFeeDelta;
+};
+
+/** Extracts the transaction hash of a CTxMemPoolEntry, the key of mapTx */
+struct mempoolentry_txid {
+    typedef uint256 result_type;
+    result_type operator()(const CTxMemPoolEntry& entry) const
+    {
+        return entry.GetTx().GetHash();
+    }
+};
+
+/**
+ * Sort an entry by the better of its own fee rate and that of the package of
+ * it and its descendants, the worst to evict first.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        // Zerocoin spends pay no fee and are exempt from the minimum fee, so they rank above
+        // any fee rate; otherwise a full pool would evict them first and reject new ones
+        if (a.IsZerocoinSpend() != b.IsZerocoinSpend())
+            return b.IsZerocoinSpend();
+
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aModFee = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+        double bModFee = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b)
+        double f1 = aModFee * bSize;
+        double f2 = aSize * bModFee;
+        if (f1 == f2)
+            return a.GetTime() >= b.GetTime();
+        return f1 < f2;
+    }
+
+    // Whether the package of the entry and its descendants pays a better fee rate than the entry alone
+    static bool UseDescendantScore(const CTxMemPoolEntry& a)
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+/**
+ * Sort an entry by the fee rate of the package of it and its ancestors, or by its
+ * own fee rate when that is lower; the best to mine first.
+ */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double aFees = a.GetModFeesWithAncestors();
+        double aSize = a.GetSizeWithAncestors();
+        double bFees = b.GetModFeesWithAncestors();
+        double bSize = b.GetSizeWithAncestors();
+        // use the entry's own fee rate when it is the worse one
+        if ((double)a.GetModifiedFee() * aSize < aFees * a.GetTxSize()) {
+            aFees = a.GetModifiedFee();
+            aSize = a.GetTxSize();
+        }
+        if ((double)b.GetModifiedFee() * bSize < bFees * b.GetTxSize()) {
+            bFees = b.GetModifiedFee();
+            bSize = b.GetTxSize();
+        }
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b)
+        double f1 = aFees * bSize;
+        double f2 = aSize * bFees;
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 > f2;
+    }
+};
+
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        return a.GetTime() < b.GetTime();
+    }
+};
+
+// Multi_index tag names
+struct descendant_score {
+};
+struct entry_time {
+};
+struct ancestor_score {
 };
 
 class CMinerPolicyEstimator;
@@ -103,13 +274,81 @@ private:
 
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+
+    // The fee rate a transaction must pay once the pool was trimmed, decaying back to zero
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
+
+    bool fLoaded; //! Whether the transactions saved on shutdown were loaded back
+
+    void trackPackageRemoved(const CFeeRate& rate);
 
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
+    typedef boost::multi_index_container<
+        CTxMemPoolEntry,
+        boost::multi_index::indexed_by<
+            // sorted by txid
+            boost::multi_index::ordered_unique<mempoolentry_txid>,
+            // sorted by fee rate with descendants
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByDescendantScore>,
+            // sorted by entry time, the oldest to expire first
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<entry_time>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByEntryTime>,
+            // sorted by fee rate with ancestors, the order to mine in
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFee> > >
+        indexed_transaction_set;
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
+    indexed_transaction_set mapTx;
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+
+    struct CompareIteratorByHash {
+        bool operator()(const txiter& a, const txiter& b) const
+        {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
+private:
+    /** The in-mempool parents and children of an entry */
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    txlinksMap mapLinks;
+
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+    /** Add an entry to the descendant state of each of its ancestors, and link it to its parents */
+    void UpdateAncestorsOf(bool add, txiter it, const setEntries& setAncestors);
+    /** Set the ancestor state of an entry from its ancestors */
+    void UpdateEntryForAncestors(txiter it, const setEntries& setAncestors);
+    /** Recompute the package state of an entry from scratch, after it gained ancestors or descendants out of order */
+    void RecalculatePackageState(txiter it);
+    /** Take the entries about to be removed out of the package state of everything that stays */
+    void UpdateForRemoveFromMempool(const setEntries& entriesToRemove);
+    /** Erase an entry, its links and its spends; the package state must have been updated before */
+    void removeUnchecked(txiter entry);
+
+public:
+
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
 
@@ -123,13 +362,33 @@ public:
     void setSanityCheck(bool _fSanityCheck) { fSanityCheck = _fSanityCheck; }
 
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry);
+    /** As above, with the in-mempool ancestors of the entry already computed by CalculateMemPoolAncestors */
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry, setEntries& setAncestors);
     void remove(const CTransaction& tx, std::list<CTransaction>& removed, bool fRecursive = false);
+    /** Remove a set of entries whose in-mempool descendants are either in the set as well or stay with their package state updated */
+    void RemoveStaged(const setEntries& stage);
     void removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight);
     void removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed);
     void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight, std::list<CTransaction>& conflicts);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
-    void pruneSpent(const uint256& hash, CCoins& coins);
+    /** Whether a transaction in the pool spends outpoint */
+    bool isSpent(const COutPoint& outpoint);
+
+    const setEntries& GetMemPoolParents(txiter entry) const;
+    const setEntries& GetMemPoolChildren(txiter entry) const;
+
+    /**
+     * Collect the in-mempool ancestors of entry into setAncestors. When fSearchForParents is
+     * set, the parents are looked up through the inputs of the transaction, which works for an
+     * entry not in the pool yet; otherwise the entry must be in mapTx and its links are used.
+     * Fails with errString when the package of entry and its ancestors, or that of any
+     * ancestor and its descendants including entry, exceeds the given limits.
+     */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents = true) const;
+
+    /** Add entryit and all of its in-mempool descendants not in setDescendants yet to setDescendants */
+    void CalculateDescendants(txiter entryit, setEntries& setDescendants) const;
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
 
@@ -138,6 +397,21 @@ public:
     void ApplyDeltas(const uint256 hash, double& dPriorityDelta, CAmount& nFeeDelta);
     void ClearPrioritisation(const uint256 hash);
 
+    /**
+     * The minimum fee rate to get into the pool, which may itself not be good enough
+     * to get in. Zero unless the pool had to be trimmed to sizelimit lately.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /**
+     * Remove transactions from the pool, lowest descendant fee rate first, until its dynamic
+     * memory usage is at most sizelimit. Raises the minimum fee rate to get into the pool.
+     */
+    void TrimToSize(size_t sizelimit);
+
+    /** Remove the transactions that entered the pool before time, and their descendants. Returns the number removed. */
+    int Expire(int64_t time);
+
     unsigned long size()
     {
         LOCK(cs);
@@ -149,6 +423,12 @@ public:
         return totalTxSize;
     }
 
+    size_t DynamicMemoryUsage() const;
+
+    /** Whether the pool was loaded from disk, only then is it saved on shutdown */
+    bool IsLoaded() const;
+    void SetIsLoaded(bool loaded);
+
     bool exists(uint256 hash)
     {
         LOCK(cs);
@@ -156,6 +436,8 @@ public:
     }
 
     bool lookup(uint256 hash, CTransaction& result) const;
+    /** The transaction as held by the pool, to be shared rather than copied; NULL if it is not in the pool */
+    CTransactionRef get(const uint256& hash) const;
 
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
@@ -179,8 +461,8 @@ protected:
 
 public:
     CCoinsViewMemPool(CCoinsView* baseIn, CTxMemPool& mempoolIn);
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
 };
 
 #endif // BITCOIN_TXMEMPOOL_H
@@ -12,18 +12,19 @@
 
 /** Undo information for a CTxIn
  *
- *  Contains the prevout's CTxOut being spent, and if this was the
- *  last output of the affected transaction, its metadata as well
- *  (coinbase or not, height, transaction version)
+ *  Contains the prevout's CTxOut being spent and the metadata of its
+ *  transaction (coinbase or not, height, transaction version). Undo data
+ *  written by older versions only has the metadata when the output was the
+ *  last unspent one of its transaction, nHeight is 0 otherwise.
  */
 class CTxInUndo
 {
 public:
     CTxOut txout;   // the txout data before being spent
-    bool fCoinBase; // if the outpoint was the last unspent: whether it belonged to a coinbase
+    bool fCoinBase; // whether the outpoint belonged to a coinbase
     bool fCoinStake;
-    unsigned int nHeight; // if the outpoint was the last unspent: its height
-    int nVersion;         // if the outpoint was the last unspent: its version
+    unsigned int nHeight; // height of the transaction of the outpoint
+    int nVersion;         // version of the transaction of the outpoint
 
     CTxInUndo() : txout(), fCoinBase(false), fCoinStake(false), nHeight(0), nVersion(0) {}
     CTxInUndo(const CTxOut& txoutIn, bool fCoinBaseIn = false, bool fCoinStakeIn = false, unsigned int nHeightIn = 0, int nVersionIn = 0) : txout(txoutIn), fCoinBase(fCoinBaseIn), fCoinStake(fCoinStakeIn), nHeight(nHeightIn), nVersion(nVersionIn) {}
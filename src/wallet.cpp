@@ -12,6 +12,7 @@
 #include "accumulators.h"
 #include "base58.h"
 #include "checkpoints.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "coralnode-budget.h"
 #include "kernel.h"
@@ -47,6 +48,7 @@ bool bSpendZeroConfChange = true;
 bool bdisableSystemnotifications = false; // Those bubbles can be annoying and slow down the UI when you get lots of trx
 bool fSendFreeTransactions = false;
 bool fPayAtLeastCustomFee = true;
+int nStakeThreads = DEFAULT_STAKE_THREADS;
 
 /**
  * Fees smaller than this (in uCaritasCoin) are considered zero fee (for transaction creation)
@@ -730,6 +732,9 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 {
     LOCK2(cs_main, cs_wallet);
+    if (tx.IsZerocoinSpend())
+        NotifyZerocoinSpends(tx);
+
     if (!AddToWalletIfInvolvingMe(tx, pblock, true))
         return; // Not one of ours
 
@@ -742,6 +747,183 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     }
 }
 
+void CWallet::UpdateMintSerialIndex(const CZerocoinMint& mint)
+{
+    LOCK(cs_mintserials);
+    if (mint.IsUsed())
+        mapMintSerials.erase(GetPubCoinHash(mint.GetSerialNumber()));
+    else
+        mapMintSerials[GetPubCoinHash(mint.GetSerialNumber())] = mint.GetSerialNumber();
+}
+
+void CWallet::EraseMintSerialIndex(const CZerocoinMint& mint)
+{
+    LOCK(cs_mintserials);
+    mapMintSerials.erase(GetPubCoinHash(mint.GetSerialNumber()));
+}
+
+bool CWallet::IsMyMintSerial(const CBigNum& bnSerial) const
+{
+    LOCK(cs_mintserials);
+    return mapMintSerials.count(GetPubCoinHash(bnSerial)) != 0;
+}
+
+bool CWallet::WriteZerocoinMint(CWalletDB& walletdb, const CZerocoinMint& mint)
+{
+    if (!walletdb.WriteZerocoinMint(mint))
+        return false;
+
+    UpdateMintSerialIndex(mint);
+    return true;
+}
+
+bool CWallet::EraseZerocoinMint(CWalletDB& walletdb, const CZerocoinMint& mint)
+{
+    EraseMintSerialIndex(mint);
+    return walletdb.EraseZerocoinMint(mint);
+}
+
+bool CWallet::ArchiveMintOrphan(CWalletDB& walletdb, const CZerocoinMint& mint)
+{
+    if (!walletdb.ArchiveMintOrphan(mint))
+        return false;
+
+    EraseMintSerialIndex(mint);
+    return true;
+}
+
+bool CWallet::UnarchiveZerocoin(CWalletDB& walletdb, const CZerocoinMint& mint)
+{
+    if (!walletdb.UnarchiveZerocoin(mint))
+        return false;
+
+    UpdateMintSerialIndex(mint);
+    return true;
+}
+
+/**
+ * Queue a GUI notification for each of our unused zerocoin mints spent by a transaction entering the
+ * mempool or a block. Only the index lookup happens here, under cs_main; the notifications themselves
+ * are sent by FlushZerocoinSpendNotifications() from the scheduler thread.
+ */
+void CWallet::NotifyZerocoinSpends(const CTransaction& tx)
+{
+    for (const CTxIn& txin : tx.vin) {
+        if (!txin.scriptSig.IsZerocoinSpend())
+            continue;
+
+        CBigNum bnSerial;
+        try {
+            bnSerial = TxInToZerocoinSpend(txin).getCoinSerialNumber();
+        } catch (std::exception& e) {
+            continue;
+        }
+
+        if (IsMyMintSerial(bnSerial)) {
+            LogPrintf("%s: %s detected spent zerocoin mint in transaction %s \n", __func__, bnSerial.GetHex(), tx.GetHash().GetHex());
+            LOCK(cs_mintserials);
+            vMintSerialsSpent.push_back(bnSerial);
+        }
+    }
+}
+
+void CWallet::FlushZerocoinSpendNotifications()
+{
+    std::vector<CBigNum> vSerials;
+    {
+        LOCK(cs_mintserials);
+        vSerials.swap(vMintSerialsSpent);
+    }
+
+    for (const CBigNum& bnSerial : vSerials)
+        NotifyZerocoinChanged(this, bnSerial.GetHex(), "Used", CT_UPDATED);
+}
+
+void CWallet::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    //witnesses only need to move forward when a new accumulator checkpoint is generated, which may be
+    //several blocks at once when the tip jumps. They are updated by UpdateZerocoinWitnessCheckpoint()
+    //on the scheduler thread, not on the thread connecting the blocks
+    if (!fFileBacked || pindex->nHeight < Params().Zerocoin_StartHeight())
+        return;
+    nWitnessCheckpointTarget = pindex->nHeight - (pindex->nHeight % 10) - 20;
+}
+
+void CWallet::UpdateZerocoinWitnessCheckpoint()
+{
+    int nHeightCheckpoint = nWitnessCheckpointTarget;
+    if (!nHeightCheckpoint || nHeightCheckpoint == nWitnessCheckpointHeight)
+        return;
+
+    //a checkpoint the chain moved back from is retried with the next target
+    if (UpdateZerocoinWitnesses(nHeightCheckpoint))
+        nWitnessCheckpointHeight = nHeightCheckpoint;
+}
+
+//! Witnesses built from scratch per update, each of them accumulates every later mint of its denomination
+static const int MAX_NEW_ZEROCOIN_WITNESSES = 10;
+
+/**
+ * Bring the cached accumulator witnesses of our unused mints up to the checkpoint at nHeightStop,
+ * so that creating a spend only has to add the mints of the blocks since the last update.
+ * The wallet database is scanned without cs_main, which is then only held while a single witness is updated.
+ * Returns false if the active chain no longer reaches nHeightStop. A witness that fails to update is
+ * logged and retried at the next checkpoint.
+ */
+bool CWallet::UpdateZerocoinWitnesses(int nHeightStop)
+{
+    CWalletDB walletdb(strWalletFile);
+    std::list<CZerocoinMint> listMints = walletdb.ListMintedCoins(true, false, false);
+    std::set<uint256> setUnused;
+    int nNewWitnesses = 0;
+    for (const CZerocoinMint& mint : listMints) {
+        uint256 hashPubcoin = GetPubCoinHash(mint.GetValue());
+        setUnused.insert(hashPubcoin);
+        if (!mint.GetHeight() || mint.GetHeight() >= nHeightStop)
+            continue;
+
+        LOCK2(cs_main, cs_wallet);
+        if (nHeightStop > chainActive.Height() + 1)
+            return false;
+
+        CZerocoinWitness zerocoinWitness;
+        if (mapZerocoinWitness.count(hashPubcoin))
+            zerocoinWitness = mapZerocoinWitness.at(hashPubcoin);
+        if (zerocoinWitness.nHeightAccEnd == nHeightStop && IsZerocoinWitnessCurrent(zerocoinWitness))
+            continue;
+
+        std::string strError;
+        if (!IsZerocoinWitnessCurrent(zerocoinWitness) || zerocoinWitness.nHeightAccEnd > nHeightStop) {
+            if (nNewWitnesses++ >= MAX_NEW_ZEROCOIN_WITNESSES)
+                continue;
+            zerocoinWitness = CZerocoinWitness(mint.GetValue(), mint.GetDenomination());
+            if (!InitZerocoinWitness(zerocoinWitness, strError))
+                continue;
+        }
+
+        if (!UpdateZerocoinWitness(zerocoinWitness, nHeightStop, strError)) {
+            LogPrintf("%s : failed to update witness for %s: %s\n", __func__, mint.GetValue().GetHex().substr(0, 16), strError);
+            continue;
+        }
+
+        mapZerocoinWitness[hashPubcoin] = zerocoinWitness;
+        walletdb.WriteZerocoinWitness(zerocoinWitness);
+    }
+
+    //forget the witnesses of mints that have been spent
+    LOCK(cs_wallet);
+    for (auto it = mapZerocoinWitness.begin(); it != mapZerocoinWitness.end();) {
+        if (setUnused.count(it->first)) {
+            ++it;
+            continue;
+        }
+        walletdb.EraseZerocoinWitness(it->second);
+        mapZerocoinWitness.erase(it++);
+    }
+    LogPrint("zero", "%s : %d witnesses at height %d\n", __func__, mapZerocoinWitness.size(), nHeightStop);
+    return true;
+}
+
 void CWallet::EraseFromWallet(const uint256& hash)
 {
     if (!fFileBacked)
@@ -2879,6 +3061,53 @@ bool CWallet::CreateTransaction(CScript scriptPubKey, const CAmount& nValue, CWa
     }
 }
 
+static CCheckQueue<CStakeKernelSearch> stakesearchqueue(16);
+
+static CCriticalSection cs_stakeSearchStats;
+static CStakeSearchStats stakeSearchStats = {0, 0, 0};
+
+void ThreadStakeSearch()
+{
+    RenameThread("caritas-stakesearch");
+    stakesearchqueue.Thread();
+}
+
+CStakeSearchStats GetStakeSearchStats()
+{
+    LOCK(cs_stakeSearchStats);
+    return stakeSearchStats;
+}
+
+bool CStakeKernelSearch::operator()()
+{
+    //another input already produced a kernel
+    if (pround->fFound)
+        return true;
+
+    unsigned int nTimeTx = pround->nTimeTx;
+    uint256 hashProofOfStake = 0;
+    uint64_t nHashes = 0;
+    bool fHit = SearchStakeKernel(kernel, bnTarget, nTimeTx, pround->nHashDrift, pround->nHeightStart, hashProofOfStake, nHashes, &pround->fFound);
+    pround->nHashes += nHashes;
+    pround->nInputs++;
+    if (!fHit)
+        return true;
+
+    //Double check that this will pass time requirements
+    if (nTimeTx <= pround->nMinTime) {
+        LogPrintf("CreateCoinStake() : kernel found, but it is too far in the past \n");
+        return true;
+    }
+
+    LOCK(pround->cs);
+    if (!pround->fFound) {
+        pround->kernelCoin = coin;
+        pround->nKernelTime = nTimeTx;
+        pround->fFound = true;
+    }
+    return true;
+}
+
 // ppcoin: create coin stake transaction
 bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction& txNew, unsigned int& nTxNewTime)
 {
@@ -2927,6 +3156,15 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     if (GetAdjustedTime() <= chainActive.Tip()->nTime)
         MilliSleep(10000);
 
+    CStakeSearchRound round;
+    round.nTimeTx = GetAdjustedTime();
+    round.nHashDrift = nHashDrift;
+    round.nHeightStart = chainActive.Height();
+    round.nMinTime = chainActive.Tip()->GetMedianTimePast();
+    int64_t nTimeSearchStart = GetTimeMicros();
+
+    //set up the kernel of each stake input, everything but the time is fixed during the search
+    std::vector<CStakeKernelSearch> vSearches;
     BOOST_FOREACH (PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setStakeCoins) {
         //make sure that enough time has elapsed between
         CBlockIndex* pindex = NULL;
@@ -2939,75 +3177,99 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             continue;
         }
 
-        // Read block header
-        CBlockHeader block = pindex->GetBlockHeader();
+        unsigned int nTimeBlockFrom = pindex->GetBlockTime();
+        if (nTimeBlockFrom + nStakeMinAge > round.nTimeTx) // Min age requirement
+            continue;
+
+        uint64_t nStakeModifier = 0;
+        int nStakeModifierHeight = 0;
+        int64_t nStakeModifierTime = 0;
+        if (!GetKernelStakeModifier(pindex->GetBlockHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false)) {
+            LogPrintf("CreateCoinStake() : failed to get kernel stake modifier \n");
+            continue;
+        }
 
-        bool fKernelFound = false;
-        uint256 hashProofOfStake = 0;
         COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-        nTxNewTime = GetAdjustedTime();
+        vSearches.push_back(CStakeKernelSearch(round, pcoin, CStakeKernel(nStakeModifier, nTimeBlockFrom, prevoutStake),
+                                               GetStakeKernelTarget(nBits, pcoin.first->vout[pcoin.second].nValue)));
+    }
 
-        //iterates each utxo inside of CheckStakeKernelHash()
-        if (CheckStakeKernelHash(nBits, block, *pcoin.first, prevoutStake, nTxNewTime, nHashDrift, false, hashProofOfStake, true)) {
-            //Double check that this will pass time requirements
-            if (nTxNewTime <= chainActive.Tip()->GetMedianTimePast()) {
-                LogPrintf("CreateCoinStake() : kernel found, but it is too far in the past \n");
-                continue;
-            }
+    //search the kernels on the -stakethreads pool, the first kernel found calls off the rest of the search
+    {
+        CCheckQueueControl<CStakeKernelSearch> control(nStakeThreads > 1 ? &stakesearchqueue : NULL);
+        if (nStakeThreads > 1) {
+            control.Add(vSearches);
+        } else {
+            BOOST_FOREACH (CStakeKernelSearch& search, vSearches)
+                search();
+        }
+    }
 
-            // Found a kernel
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : kernel found\n");
-
-            vector<valtype> vSolutions;
-            txnouttype whichType;
-            CScript scriptPubKeyOut;
-            scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
-            if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
-                LogPrintf("CreateCoinStake : failed to parse kernel\n");
-                break;
-            }
+    if (!vSearches.empty()) {
+        mapHashedBlocks.clear();
+        mapHashedBlocks[chainActive.Tip()->nHeight] = GetTime(); //store a time stamp of when we last hashed on this block
+    }
+
+    {
+        LOCK(cs_stakeSearchStats);
+        stakeSearchStats.nInputs = round.nInputs;
+        stakeSearchStats.nHashes = round.nHashes;
+        stakeSearchStats.nTimeMicros = GetTimeMicros() - nTimeSearchStart;
+    }
+
+    if (round.fFound) {
+        const CWalletTx* pwtxKernel = round.kernelCoin.first;
+        unsigned int nOutKernel = round.kernelCoin.second;
+        nTxNewTime = round.nKernelTime;
+
+        // Found a kernel
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : kernel found\n");
+
+        vector<valtype> vSolutions;
+        txnouttype whichType;
+        CScript scriptPubKeyOut;
+        scriptPubKeyKernel = pwtxKernel->vout[nOutKernel].scriptPubKey;
+        if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
+            LogPrintf("CreateCoinStake : failed to parse kernel\n");
+            return false;
+        }
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
+        if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
             if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
-            if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
+                LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
+            return false; // only support pay to public key and pay to address
+        }
+        if (whichType == TX_PUBKEYHASH) // pay to address type
+        {
+            //convert to pay to public key type
+            CKey key;
+            if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
                 if (fDebug && GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
-                break; // only support pay to public key and pay to address
+                    LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+                return false; // unable to find corresponding public key
             }
-            if (whichType == TX_PUBKEYHASH) // pay to address type
-            {
-                //convert to pay to public key type
-                CKey key;
-                if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
-                    if (fDebug && GetBoolArg("-printcoinstake", false))
-                        LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                    break; // unable to find corresponding public key
-                }
 
-                scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
-            } else
-                scriptPubKeyOut = scriptPubKeyKernel;
+            scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
+        } else
+            scriptPubKeyOut = scriptPubKeyKernel;
 
-            txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-            nCredit += pcoin.first->vout[pcoin.second].nValue;
-            vwtxPrev.push_back(pcoin.first);
-            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+        txNew.vin.push_back(CTxIn(pwtxKernel->GetHash(), nOutKernel));
+        nCredit += pwtxKernel->vout[nOutKernel].nValue;
+        vwtxPrev.push_back(pwtxKernel);
+        txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
 
-            //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
-            const CBlockIndex* pIndex0 = chainActive.Tip();
-            uint64_t nTotalSize = pcoin.first->vout[pcoin.second].nValue + GetBlockValue(pIndex0->nHeight);
+        //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
+        const CBlockIndex* pIndex0 = chainActive.Tip();
+        uint64_t nTotalSize = pwtxKernel->vout[nOutKernel].nValue + GetBlockValue(pIndex0->nHeight);
 
-            //presstab HyperStake - if MultiSend is set to send in coinstake we will add our outputs here (values asigned further down)
-            if (nTotalSize / 2 > nStakeSplitThreshold * COIN)
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
+        //presstab HyperStake - if MultiSend is set to send in coinstake we will add our outputs here (values asigned further down)
+        if (nTotalSize / 2 > nStakeSplitThreshold * COIN)
+            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
 
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
-            fKernelFound = true;
-            break;
-        }
-        if (fKernelFound)
-            break; // if kernel is found stop searching
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
     }
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
         return false;
@@ -4529,7 +4791,27 @@ bool CWallet::MintToTxIn(CZerocoinMint zerocoinSelected, int nSecurityLevel, con
     libzerocoin::AccumulatorWitness witness(Params().Zerocoin_Params(), accumulator, pubCoinSelected);
     string strFailReason = "";
     int nMintsAdded = 0;
-    if (!GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason)) {
+    uint256 hashPubcoin = GetPubCoinHash(pubCoinSelected.getValue());
+    CZerocoinWitness zerocoinWitness;
+    {
+        LOCK(cs_wallet);
+        if (mapZerocoinWitness.count(hashPubcoin))
+            zerocoinWitness = mapZerocoinWitness.at(hashPubcoin);
+    }
+    uint256 hashAccEndCached = zerocoinWitness.hashAccEnd;
+    bool fWitness = GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason, &zerocoinWitness);
+
+    //keep the witness the spend moved forward, unless the witness updater got further meanwhile
+    if (fFileBacked && !zerocoinWitness.IsNull() && zerocoinWitness.hashAccEnd != hashAccEndCached) {
+        LOCK(cs_wallet);
+        std::map<uint256, CZerocoinWitness>::const_iterator it = mapZerocoinWitness.find(hashPubcoin);
+        if (it == mapZerocoinWitness.end() || !IsZerocoinWitnessCurrent(it->second) || it->second.nHeightAccEnd < zerocoinWitness.nHeightAccEnd) {
+            mapZerocoinWitness[hashPubcoin] = zerocoinWitness;
+            CWalletDB(strWalletFile).WriteZerocoinWitness(zerocoinWitness);
+        }
+    }
+
+    if (!fWitness) {
         receipt.SetStatus(_("Try to spend with a higher security level to include more coins"), ZVIT_FAILED_ACCUMULATOR_INITIALIZATION);
         LogPrintf("%s : %s \n", __func__, receipt.GetStatusMessage());
         return false;
@@ -4584,7 +4866,8 @@ bool CWallet::MintToTxIn(CZerocoinMint zerocoinSelected, int nSecurityLevel, con
             if (spend.getCoinSerialNumber() == item) {
                 //Tried to spend an already spent zCRTS
                 zerocoinSelected.SetUsed(true);
-                if (!CWalletDB(strWalletFile).WriteZerocoinMint(zerocoinSelected))
+                CWalletDB walletdb(strWalletFile);
+                if (!WriteZerocoinMint(walletdb, zerocoinSelected))
                     LogPrintf("%s failed to write zerocoinmint\n", __func__);
 
                 pwalletMain->NotifyZerocoinChanged(pwalletMain, zerocoinSelected.GetValue().GetHex(), "Used", CT_UPDATED);
@@ -4663,7 +4946,7 @@ bool CWallet::CreateZerocoinSpendTransaction(CAmount nValue, int nSecurityLevel,
             receipt.SetStatus(_("Trying to spend an already spent serial #, try again."), nStatus);
 
             mint.SetUsed(true);
-            walletdb.WriteZerocoinMint(mint);
+            WriteZerocoinMint(walletdb, mint);
 
             return false;
         }
@@ -4682,7 +4965,7 @@ bool CWallet::CreateZerocoinSpendTransaction(CAmount nValue, int nSecurityLevel,
 
         // archive this mint as an orphan
         if (fArchive) {
-            walletdb.ArchiveMintOrphan(mint);
+            ArchiveMintOrphan(walletdb, mint);
             nArchived++;
         }
     }
@@ -4818,13 +5101,13 @@ string CWallet::ResetMintZerocoin(bool fExtendedSearch)
     // Update the meta data of mints that were marked for updating
     for (CZerocoinMint mint : vMintsToUpdate) {
         updates++;
-        walletdb.WriteZerocoinMint(mint);
+        WriteZerocoinMint(walletdb, mint);
     }
 
     // Delete any mints that were unable to be located on the blockchain
     for (CZerocoinMint mint : vMintsMissing) {
         deletions++;
-        walletdb.ArchiveMintOrphan(mint);
+        ArchiveMintOrphan(walletdb, mint);
     }
 
     string strResult = _("ResetMintZerocoin finished: ") + to_string(updates) + _(" mints updated, ") + to_string(deletions) + _(" mints deleted\n");
@@ -4859,7 +5142,7 @@ string CWallet::ResetSpentZerocoin()
                 removed++;
                 mint.SetUsed(false);
                 RemoveSerialFromDB(spend.GetSerial());
-                walletdb.WriteZerocoinMint(mint);
+                WriteZerocoinMint(walletdb, mint);
                 walletdb.EraseZerocoinSpendSerialEntry(spend.GetSerial());
                 continue;
             }
@@ -4893,7 +5176,7 @@ void CWallet::ReconsiderZerocoins(std::list<CZerocoinMint>& listMintsRestored)
 
         mint.SetTxHash(txHash);
         mint.SetHeight(mapBlockIndex.at(hashBlock)->nHeight);
-        if (!walletdb.UnarchiveZerocoin(mint)) {
+        if (!UnarchiveZerocoin(walletdb, mint)) {
             LogPrintf("%s : failed to unarchive mint %s\n", __func__, mint.GetValue().GetHex());
         }
         listMintsRestored.emplace_back(mint);
@@ -4985,7 +5268,7 @@ string CWallet::MintZerocoin(CAmount nValue, CWalletTx& wtxNew, vector<CZerocoin
         CWalletDB walletdb(pwalletMain->strWalletFile);
         for (CZerocoinMint mint : vMints) {
             mint.SetTxHash(wtxNew.GetHash());
-            walletdb.WriteZerocoinMint(mint);
+            WriteZerocoinMint(walletdb, mint);
             pwalletMain->NotifyZerocoinChanged(pwalletMain, mint.GetValue().GetHex(), "Used", CT_UPDATED);
         }
     }
@@ -5024,7 +5307,7 @@ bool CWallet::SpendZerocoin(CAmount nAmount, int nSecurityLevel, CWalletTx& wtxN
         //reset all mints
         for (CZerocoinMint mint : vMintsSelected) {
             mint.SetUsed(false); // having error, so set to false, to be able to use again
-            walletdb.WriteZerocoinMint(mint);
+            WriteZerocoinMint(walletdb, mint);
             pwalletMain->NotifyZerocoinChanged(pwalletMain, mint.GetValue().GetHex(), "New", CT_UPDATED);
         }
 
@@ -5040,7 +5323,7 @@ bool CWallet::SpendZerocoin(CAmount nAmount, int nSecurityLevel, CWalletTx& wtxN
 
         // erase new mints
         for (auto& mint : vNewMints) {
-            if (!walletdb.EraseZerocoinMint(mint)) {
+            if (!EraseZerocoinMint(walletdb, mint)) {
                 receipt.SetStatus("Error: Unable to cannot delete zerocoin mint in wallet", ZVIT_ERASE_NEW_MINTS_FAILED);
             }
         }
@@ -5051,7 +5334,7 @@ bool CWallet::SpendZerocoin(CAmount nAmount, int nSecurityLevel, CWalletTx& wtxN
 
     for (CZerocoinMint mint : vMintsSelected) {
         mint.SetUsed(true);
-        if (!walletdb.WriteZerocoinMint(mint)) {
+        if (!WriteZerocoinMint(walletdb, mint)) {
             receipt.SetStatus("Failed to write mint to db", nStatus);
             return false;
         }
@@ -5071,7 +5354,7 @@ bool CWallet::SpendZerocoin(CAmount nAmount, int nSecurityLevel, CWalletTx& wtxN
     // write new Mints to db
     for (CZerocoinMint mint : vNewMints) {
         mint.SetTxHash(wtxNew.GetHash());
-        walletdb.WriteZerocoinMint(mint);
+        WriteZerocoinMint(walletdb, mint);
     }
 
     receipt.SetStatus("Spend Successful", ZVIT_SPEND_OKAY); // When we reach this point spending zCRTS was successful
@@ -26,6 +26,7 @@
 #include "walletdb.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -44,6 +45,7 @@ extern bool bSpendZeroConfChange;
 extern bool bdisableSystemnotifications;
 extern bool fSendFreeTransactions;
 extern bool fPayAtLeastCustomFee;
+extern int nStakeThreads;
 
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
@@ -55,6 +57,10 @@ static const CAmount DEFAULT_TRANSACTION_MAXFEE = 1 * COIN;
 static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWarning;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
+//! -stakethreads default (number of kernel search threads, 0 = auto)
+static const int DEFAULT_STAKE_THREADS = 1;
+//! Maximum number of kernel search threads
+static const int MAX_STAKE_THREADS = 16;
 
 // Zerocoin denomination which creates exactly one of each denominations:
 // 6666 = 1*5000 + 1*1000 + 1*500 + 1*100 + 1*50 + 1*10 + 1*5 + 1
@@ -116,6 +122,65 @@ struct CompactTallyItem {
     }
 };
 
+/** Shared state of the kernel search of one CreateCoinStake round */
+struct CStakeSearchRound {
+    unsigned int nTimeTx;
+    unsigned int nHashDrift;
+    int nHeightStart;
+    int64_t nMinTime; //!< kernels at or before the median time past are not accepted
+
+    std::atomic<bool> fFound;
+    std::atomic<unsigned int> nInputs;
+    std::atomic<uint64_t> nHashes;
+
+    //! The kernel found, guarded by cs
+    CCriticalSection cs;
+    std::pair<const CWalletTx*, unsigned int> kernelCoin;
+    unsigned int nKernelTime;
+
+    CStakeSearchRound() : nTimeTx(0), nHashDrift(0), nHeightStart(0), nMinTime(0), fFound(false), nInputs(0), nHashes(0), kernelCoin(NULL, 0), nKernelTime(0) {}
+};
+
+/**
+ * Closure representing the kernel search of one stake input, run on the -stakethreads pool
+ * Note that this stores a reference to the search round
+ */
+class CStakeKernelSearch
+{
+private:
+    CStakeSearchRound* pround;
+    std::pair<const CWalletTx*, unsigned int> coin;
+    CStakeKernel kernel;
+    uint256 bnTarget;
+
+public:
+    CStakeKernelSearch() : pround(NULL), coin(NULL, 0) {}
+    CStakeKernelSearch(CStakeSearchRound& roundIn, const std::pair<const CWalletTx*, unsigned int>& coinIn, const CStakeKernel& kernelIn, const uint256& bnTargetIn) :
+        pround(&roundIn), coin(coinIn), kernel(kernelIn), bnTarget(bnTargetIn) {}
+
+    bool operator()();
+
+    void swap(CStakeKernelSearch& check)
+    {
+        std::swap(pround, check.pround);
+        std::swap(coin, check.coin);
+        std::swap(kernel, check.kernel);
+        std::swap(bnTarget, check.bnTarget);
+    }
+};
+
+/** Kernel search statistics of the last CreateCoinStake round */
+struct CStakeSearchStats {
+    unsigned int nInputs;
+    uint64_t nHashes;
+    int64_t nTimeMicros;
+};
+
+CStakeSearchStats GetStakeSearchStats();
+
+/** Run an instance of the kernel search thread */
+void ThreadStakeSearch();
+
 /** A key pool entry */
 class CKeyPool
 {
@@ -187,6 +252,18 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Serial numbers of our unused zerocoin mints, keyed by the hash of the serial.
+     * Kept in sync with the wallet database by WriteZerocoinMint()/EraseZerocoinMint()
+     * so that spends seen on the network can be matched without scanning the database.
+     */
+    boost::unordered_map<uint256, CBigNum, BlockHasher> mapMintSerials;
+    //! Serials of our mints seen spent, waiting for FlushZerocoinSpendNotifications()
+    std::vector<CBigNum> vMintSerialsSpent;
+    mutable CCriticalSection cs_mintserials;
+
+    void NotifyZerocoinSpends(const CTransaction& tx);
+
 public:
     bool MintableCoins();
     bool SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, CAmount nTargetAmount) const;
@@ -208,6 +285,16 @@ public:
     std::string ResetMintZerocoin(bool fExtendedSearch);
     std::string ResetSpentZerocoin();
     void ReconsiderZerocoins(std::list<CZerocoinMint>& listMintsRestored);
+    void UpdateMintSerialIndex(const CZerocoinMint& mint);
+    void EraseMintSerialIndex(const CZerocoinMint& mint);
+    bool IsMyMintSerial(const CBigNum& bnSerial) const;
+    bool WriteZerocoinMint(CWalletDB& walletdb, const CZerocoinMint& mint);
+    bool EraseZerocoinMint(CWalletDB& walletdb, const CZerocoinMint& mint);
+    bool ArchiveMintOrphan(CWalletDB& walletdb, const CZerocoinMint& mint);
+    bool UnarchiveZerocoin(CWalletDB& walletdb, const CZerocoinMint& mint);
+    void FlushZerocoinSpendNotifications();
+    bool UpdateZerocoinWitnesses(int nHeightStop);
+    void UpdateZerocoinWitnessCheckpoint();
     void ZVitBackupWallet();
 
     /** Zerocin entry changed.
@@ -302,6 +389,8 @@ public:
         strMultiSendChangeAddress = "";
         nLastMultiSendHeight = 0;
         vDisabledAddresses.clear();
+        nWitnessCheckpointHeight = 0;
+        nWitnessCheckpointTarget = 0;
 
         //Auto Combine Dust
         fCombineDust = false;
@@ -346,6 +435,13 @@ public:
 
     std::map<CTxDestination, CAddressBookData> mapAddressBook;
 
+    //! accumulator witnesses of our unused zerocoin mints, keyed by the hash of the pubcoin
+    std::map<uint256, CZerocoinWitness> mapZerocoinWitness;
+    //! checkpoint height the witnesses were last brought up to by UpdateZerocoinWitnessCheckpoint()
+    std::atomic<int> nWitnessCheckpointHeight;
+    //! checkpoint height of the current tip, set by UpdatedBlockTip()
+    std::atomic<int> nWitnessCheckpointTarget;
+
     CPubKey vchDefaultKey;
 
     std::set<COutPoint> setLockedCoins;
@@ -442,6 +538,7 @@ public:
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet = false);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void UpdatedBlockTip(const CBlockIndex* pindex);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256& hash);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
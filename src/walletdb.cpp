@@ -653,6 +653,18 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
             ssValue >> pSettings;
             pwallet->fCombineDust = pSettings.first;
             pwallet->nAutoCombineThreshold = pSettings.second;
+        } else if (strType == "zerocoin") {
+            uint256 hash;
+            ssKey >> hash;
+            CZerocoinMint mint;
+            ssValue >> mint;
+            pwallet->UpdateMintSerialIndex(mint);
+        } else if (strType == "zcwitness") {
+            uint256 hash;
+            ssKey >> hash;
+            CZerocoinWitness zerocoinWitness;
+            ssValue >> zerocoinWitness;
+            pwallet->mapZerocoinWitness[hash] = zerocoinWitness;
         } else if (strType == "destdata") {
             std::string strAddress, strKey, strValue;
             ssKey >> strAddress;
@@ -1062,6 +1074,18 @@ bool CWalletDB::WriteZerocoinMint(const CZerocoinMint& zerocoinMint)
     return Write(make_pair(string("zerocoin"), hash), zerocoinMint, true);
 }
 
+bool CWalletDB::WriteZerocoinWitness(const CZerocoinWitness& zerocoinWitness)
+{
+    nWalletDBUpdated++;
+    return Write(make_pair(string("zcwitness"), zerocoinWitness.GetHash()), zerocoinWitness);
+}
+
+bool CWalletDB::EraseZerocoinWitness(const CZerocoinWitness& zerocoinWitness)
+{
+    nWalletDBUpdated++;
+    return Erase(make_pair(string("zcwitness"), zerocoinWitness.GetHash()));
+}
+
 bool CWalletDB::ReadZerocoinMint(const CBigNum &bnPubCoinValue, CZerocoinMint& zerocoinMint)
 {
     CDataStream ss(SER_GETHASH, 0);
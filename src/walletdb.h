@@ -165,6 +165,8 @@ public:
     bool WriteZerocoinSpendSerialEntry(const CZerocoinSpend& zerocoinSpend);
     bool EraseZerocoinSpendSerialEntry(const CBigNum& serialEntry);
     bool ReadZerocoinSpendSerialEntry(const CBigNum& bnSerial);
+    bool WriteZerocoinWitness(const CZerocoinWitness& zerocoinWitness);
+    bool EraseZerocoinWitness(const CZerocoinWitness& zerocoinWitness);
 
 private:
     CWalletDB(const CWalletDB&);
@@ -0,0 +1,120 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zerocoinspendcache.h"
+
+#include "hash.h"
+#include "random.h"
+#include "uint256.h"
+#include "util.h"
+#include "version.h"
+
+#include <boost/thread.hpp>
+
+namespace {
+
+/**
+ * Valid zerocoin spend cache, to avoid running the accumulator and serial number
+ * proofs twice for every zerocoin spend (once when accepted into memory pool, and
+ * again when accepted into the block chain)
+ */
+class CZerocoinSpendCache
+{
+private:
+    //! Entries are salted hashes of (CoinSpend hash, accumulator checksum)
+    std::set<uint256> setValid;
+    uint256 nonce;
+    //! Lookups from mempool acceptance and from block checks are counted apart
+    uint64_t nMempoolHits;
+    uint64_t nMempoolMisses;
+    uint64_t nBlockHits;
+    uint64_t nBlockMisses;
+    boost::shared_mutex cs_spendcache;
+
+public:
+    CZerocoinSpendCache() : nMempoolHits(0), nMempoolMisses(0), nBlockHits(0), nBlockMisses(0)
+    {
+        nonce = GetRandHash();
+    }
+
+    uint256 GetEntry(const libzerocoin::CoinSpend& spend) const
+    {
+        CHashWriter ssSpend(SER_GETHASH, PROTOCOL_VERSION);
+        ssSpend << spend;
+
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << nonce << ssSpend.GetHash() << spend.getAccumulatorChecksum();
+        return ss.GetHash();
+    }
+
+    bool Get(const uint256& entry, bool fMempool, bool fErase)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_spendcache);
+
+        std::set<uint256>::iterator mi = setValid.find(entry);
+        if (mi == setValid.end()) {
+            fMempool ? nMempoolMisses++ : nBlockMisses++;
+            return false;
+        }
+
+        fMempool ? nMempoolHits++ : nBlockHits++;
+        if (fErase)
+            setValid.erase(mi);
+        return true;
+    }
+
+    void Set(const uint256& entry)
+    {
+        int64_t nMaxCacheSize = GetArg("-maxzcspendcachesize", DEFAULT_MAX_ZCSPEND_CACHE_SIZE);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_spendcache);
+
+        while (static_cast<int64_t>(setValid.size()) >= nMaxCacheSize) {
+            // Evict a random entry, entries are salted so their order can not be predicted
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+
+        setValid.insert(entry);
+    }
+
+    CZerocoinSpendCacheStats GetStats()
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_spendcache);
+
+        CZerocoinSpendCacheStats stats;
+        stats.nSize = setValid.size();
+        stats.nMempoolHits = nMempoolHits;
+        stats.nMempoolMisses = nMempoolMisses;
+        stats.nBlockHits = nBlockHits;
+        stats.nBlockMisses = nBlockMisses;
+        return stats;
+    }
+};
+
+CZerocoinSpendCache spendCache;
+
+}
+
+bool VerifyCoinSpendCached(const libzerocoin::CoinSpend& spend, const libzerocoin::Accumulator& accumulator, bool fStore, bool fErase)
+{
+    uint256 entry = spendCache.GetEntry(spend);
+    if (spendCache.Get(entry, fStore, fErase))
+        return true;
+
+    if (!spend.Verify(accumulator))
+        return false;
+
+    if (fStore)
+        spendCache.Set(entry);
+    return true;
+}
+
+CZerocoinSpendCacheStats GetZerocoinSpendCacheStats()
+{
+    return spendCache.GetStats();
+}
@@ -0,0 +1,35 @@
+// Copyright (c) 2018 The CaritasCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef CARITASCOIN_ZEROCOINSPENDCACHE_H
+#define CARITASCOIN_ZEROCOINSPENDCACHE_H
+
+#include "libzerocoin/Accumulator.h"
+#include "libzerocoin/CoinSpend.h"
+
+#include <stdint.h>
+
+/** Default for -maxzcspendcachesize, the number of verified zerocoin spends remembered */
+static const unsigned int DEFAULT_MAX_ZCSPEND_CACHE_SIZE = 5000;
+
+struct CZerocoinSpendCacheStats {
+    uint64_t nSize;
+    uint64_t nMempoolHits;
+    uint64_t nMempoolMisses;
+    uint64_t nBlockHits;
+    uint64_t nBlockMisses;
+};
+
+/**
+ * Verify a CoinSpend against an accumulator, skipping the proof if the same spend was
+ * already verified against the same accumulator checksum. Successful verifications are
+ * remembered if fStore is true (mempool acceptance). Block checks do not store, and a cache
+ * hit consumes the entry if fErase is true, since a spend that was connected cannot be
+ * verified again.
+ */
+bool VerifyCoinSpendCached(const libzerocoin::CoinSpend& spend, const libzerocoin::Accumulator& accumulator, bool fStore, bool fErase = false);
+
+CZerocoinSpendCacheStats GetZerocoinSpendCacheStats();
+
+#endif //CARITASCOIN_ZEROCOINSPENDCACHE_H